@@ -0,0 +1,45 @@
+/****************************************************************************
+AutoTune header file
+ ****************************************************************************/
+
+#ifndef AutoTune_H
+#define AutoTune_H
+
+#include "ES_Types.h"
+#include "FixedPID.h"
+
+// Samples in a step response, the first AUTOTUNE_PRESTEP of them before the step
+#define AUTOTUNE_SAMPLES 64
+#define AUTOTUNE_PRESTEP 8
+
+// A motor's speed response to duty, fitted as first order plus dead time
+typedef struct {
+	float gain;						// steady RPM per percent duty
+	float timeConstant;		// seconds
+	float deadTime;				// seconds
+} PlantModel;
+
+// A step test: we hold the low duty, log a few samples, step to the high duty
+// and log the motor's speed as it settles. Each sample averages a few control
+// periods, so a short log covers the whole response
+typedef struct {
+	uint8_t lowDuty;												// percent
+	uint8_t highDuty;
+	uint8_t periodsPerSample;
+	uint8_t periods;												// periods summed into the sample we are on
+	int64_t sum;														// Q16 RPM
+	volatile bool logging;
+	volatile uint8_t logged;
+	q16_t log[AUTOTUNE_SAMPLES];						// Q16 RPM
+} AutoTuneStep;
+
+// Public Function Prototypes
+void AutoTune_Start(AutoTuneStep *step, uint8_t lowDuty, uint8_t highDuty, uint8_t periodsPerSample);
+void AutoTune_StartLogging(AutoTuneStep *step);
+uint8_t AutoTune_Duty(const AutoTuneStep *step);
+void AutoTune_Sample(AutoTuneStep *step, q16_t rpm);
+bool AutoTune_Done(const AutoTuneStep *step);
+bool AutoTune_Fit(const AutoTuneStep *step, float controlPeriod, PlantModel *plant);
+void AutoTune_PIGains(const PlantModel *plant, float closedLoopRatio, float controlPeriod, float *kp, float *ki);
+
+#endif
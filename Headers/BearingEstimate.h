@@ -0,0 +1,28 @@
+/****************************************************************************
+BearingEstimate header file
+ ****************************************************************************/
+
+#ifndef BearingEstimate_H
+#define BearingEstimate_H
+
+#include "ES_Types.h"
+
+// Most pulse angles we keep for one beacon. Beyond this we keep every other one
+#define BEARING_MAX_SAMPLES 32
+
+// The pulse angles seen for one beacon. The caller owns the storage
+typedef struct {
+	float first;								// the first angle (degrees), which the offsets are from
+	float offsets[BEARING_MAX_SAMPLES];	// degrees from first, in [-180, 180)
+	uint8_t count;							// offsets stored
+	uint8_t stride;							// we store every stride'th angle
+	uint8_t skipped;						// angles since the last one we stored
+	uint16_t total;							// all angles added
+} BearingSamples;
+
+// Public Function Prototypes
+void Bearing_Reset(BearingSamples *samples);
+void Bearing_Add(BearingSamples *samples, float angle);
+bool Bearing_Estimate(const BearingSamples *samples, float *angle, float *quality);
+
+#endif
@@ -0,0 +1,50 @@
+/****************************************************************************
+CollisionDetect header file
+ ****************************************************************************/
+
+#ifndef CollisionDetect_H
+#define CollisionDetect_H
+
+#include "ES_Types.h"
+#include "FixedPID.h"
+
+// Measured speeds we keep, to tell whether a wheel is speeding up
+#define COLLISION_LOOKBACK 8
+
+// A first-order model of a drive motor, and how far short of it we may fall
+// before calling it a collision. Build it with COLLISION_MODEL so the
+// conversions fold to constants
+typedef struct {
+	q16_t decay;					// share of the gap to the steady RPM the model closes each period
+	q16_t keep;						// share of the model RPM we must measure (1 - margin)
+	q16_t offset;					// less this many RPM, for noise at low speed
+	q16_t rise;						// RPM a wheel must gain over COLLISION_LOOKBACK periods to be speeding up
+	uint8_t minDuty;			// only judge while driving at least this hard
+	uint8_t periods;			// periods in a row short of the model (and not speeding up) for a collision
+} CollisionModel;
+
+// timeConstantMs in milliseconds, periodUs in microseconds, margin as a
+// fraction of the model RPM, offsetRPM and riseRPM in RPM, duty in percent and
+// count in control periods
+#define COLLISION_MODEL(timeConstantMs, periodUs, margin, offsetRPM, riseRPM, duty, count) { \
+	.decay = FLOAT_TO_Q16((periodUs) / ((timeConstantMs) * 1000.0f + (periodUs))), \
+	.keep = FLOAT_TO_Q16(1.0f - (margin)), \
+	.offset = FLOAT_TO_Q16(offsetRPM), \
+	.rise = FLOAT_TO_Q16(riseRPM), \
+	.minDuty = (duty), \
+	.periods = (count) }
+
+// The state of one motor's detector
+typedef struct {
+	q16_t modelRPM;				// RPM the model expects, positive in the driven direction
+	q16_t history[COLLISION_LOOKBACK];	// RPM we measured over the last periods
+	uint8_t next;					// where the next goes, over the oldest
+	bool forward;					// the direction we are driving
+	uint8_t count;				// periods in a row we've fallen short
+} CollisionState;
+
+// Public Function Prototypes
+void CollisionDetect_Reset(CollisionState *state);
+bool CollisionDetect_Update(CollisionState *state, const CollisionModel *model, uint8_t duty, q16_t steadyRPM, bool forward, q16_t measuredRPM);
+
+#endif
@@ -38,6 +38,51 @@ Definitions header file for any definitiosn taht should be included throughout e
 //*******************************************************************************************
 #define TESTING_MODE true
 
+//*******************************************************************************************
+//--------------------------------- CONTROL LAWS --------------------------------------
+//*******************************************************************************************
+// Run the drive and cannon control interrupts on the fixed-point PID kernel (FixedPID.c)
+// Set to false to fall back to the original float control laws
+#define FIXED_POINT_CONTROL true
+
+// Measure drive and flywheel speed over a ring of recent encoder edges
+// (VelocityEstimate.c), which reads down to zero by itself when the edges stop.
+// Set to false to use the period between the last two edges, as before
+#define VELOCITY_ESTIMATOR true
+
+// Start the drive and flywheel loops from the duty a calibrated map says holds
+// the target (FeedForward.c), so their integrals only trim it. Set to false to
+// leave it all to the PID loops, as before
+#define FEED_FORWARD true
+
+// Let the drive and flywheel loops identify their motors from a step test and
+// work out their own gains (AutoTune.c), kept in EEPROM (ParamStore.c) and read
+// back at init. Set to false to always use the gains in the source
+#define AUTOTUNE true
+
+// Run encoder tick moves (drives and rotates) on an acceleration- and jerk-limited
+// motion profile (MotionProfile.c). Set to false to step straight to
+// DEFAULT_DRIVE_RPM and coast to a stop at the target, as before
+#define PROFILED_MOVES true
+
+// Drive to each destination along an arc, steered from our pose as we go, instead of
+// rotating to face it, stopping, then driving straight (needs PROFILED_MOVES)
+#define PATH_FOLLOWING true
+
+// Report a collision as soon as a drive wheel falls well short of the speed a
+// model of its motor expects for the duty we give it (CollisionDetect.c), rather
+// than only once it has gone STALL_TIME_MS without an edge (needs VELOCITY_ESTIMATOR,
+// so that a stopped wheel's speed falls away)
+#define MODEL_COLLISIONS true
+
+//*******************************************************************************************
+//--------------------------------- POSITIONING --------------------------------------
+//*******************************************************************************************
+// Keep the periscope running while we drive, using each beacon angle with our odometry
+// pose when we saw it. Set to false to stop the periscope and forget our position on
+// every move, as before
+#define LOCALIZE_WHILE_DRIVING true
+
 
 //*******************************************************************************************
 //--------------------------------- PIN DEFINITIONS --------------------------------------
@@ -270,6 +315,17 @@ Definitions header file for any definitiosn taht should be included throughout e
 
 #define PERISCOPE_PWM_DUTY 50
 
+// The periscope speed loop holds PERISCOPE_TARGET_RPM. PERISCOPE_PWM_DUTY gave us
+// about PERISCOPE_NOMINAL_RPM open loop, which the beacon pulse thresholds were
+// tuned at
+#define PERISCOPE_NOMINAL_RPM 60
+#define PERISCOPE_TARGET_RPM 90
+
+// When we know where the beacons should be, the periscope sweeps between them
+// at this speed (about the most full duty gives us), and passes them at
+// PERISCOPE_TARGET_RPM
+#define PERISCOPE_SWEEP_RPM 120
+
 //These Values have been tested and appear to be good
 #define PERISCOPE_LATCH_DUTY 9
 #define PERISCOPE_UNLATCH_DUTY 5
@@ -422,6 +478,25 @@ static uint8_t PS_Frequency_Codes[] = {
 #define NULL_STATION 10
 	
 #define DEFAULT_DRIVE_RPM 100.0f
+
+// Limits for profiled moves, in wheel RPM, RPM/s and RPM/s^2. We creep at
+// PROFILE_MIN_RPM on the way in rather than stall short. The position loop
+// holds us to what the wheels can stop from at PROFILE_STOP_ACCELERATION, and
+// closes the last few ticks at PROFILE_POSITION_GAIN RPM per tick to go
+#define PROFILE_MAX_RPM 130.0f
+#define PROFILE_MIN_RPM 20.0f
+#define PROFILE_ACCELERATION 600.0f
+#define PROFILE_JERK 20000.0f
+#define PROFILE_STOP_ACCELERATION 400.0f
+#define PROFILE_POSITION_GAIN 12.0f
+
+// Drive motor model: steady wheel RPM per percent duty (the default duty maps,
+// and collision detection without FEED_FORWARD), and the time constant of the
+// step response. First estimates, recalibrate them from a logged step if the
+// drive changes
+#define DRIVE_RPM_PER_DUTY 1.7f
+#define DRIVE_TIME_CONSTANT_MS 80.0f
+
 #define NOT_IN_QUEUE 0x30
 
 #define PRI_DISTANCE_MULTIPLIER 1
@@ -432,6 +507,21 @@ static uint8_t PS_Frequency_Codes[] = {
 
 #define HALL_SENSOR_OFFSET_IN_TICKS 40
 
+// Hall sensor geometry, in inches. Lateral positions are measured from the
+// centerline (left negative), and the forward distance is
+// HALL_SENSOR_OFFSET_IN_TICKS converted to inches
+#define HALL_SENSOR_OUTER_LATERAL 2.0f
+#define HALL_SENSOR_INNER_LATERAL 0.75f
+#define HALL_SENSOR_FORWARD_DISTANCE 1.5f
+
+// We do not correct station offsets smaller than this (inches)
+#define STATION_CENTERED_TOLERANCE 0.4f
+// The largest offset the sensors can resolve (inches). Past halfway between
+// an inner and an outer sensor only the outer one sees the station, however
+// far off it is. Must stay under HALL_SENSOR_FORWARD_DISTANCE so a pivot can
+// cover it
+#define MAX_RESOLVED_STATION_OFFSET ((HALL_SENSOR_INNER_LATERAL + HALL_SENSOR_OUTER_LATERAL) / 2)
+
 #define PROXIMITY_TO_OUR_STATION_THRESHOLD 7.0f
 
 #define BACK_UP_TICKS 175
@@ -0,0 +1,24 @@
+/****************************************************************************
+DriveMove header file
+ ****************************************************************************/
+
+#ifndef DriveMove_H
+#define DriveMove_H
+
+#include "ES_Types.h"
+#include "FixedPID.h"
+
+// Whether the wheels have settled on a move's target: the control periods
+// since either wheel last ticked
+typedef struct {
+	uint32_t lastTickSum;
+	uint8_t stillPeriods;
+} SettleState;
+
+// Public Function Prototypes
+q16_t DriveMove_SyncCorrection(uint32_t leadTicks, uint32_t followTicks, q16_t followRatio, q16_t gain, q16_t maxCorrection);
+uint32_t DriveMove_TicksToGo(uint32_t tickSum, uint32_t targetSum, q16_t followRatio);
+void DriveMove_ResetSettle(SettleState *settle);
+bool DriveMove_Settled(SettleState *settle, uint32_t tickSum, uint32_t targetSum, uint32_t tolerance, uint8_t periods);
+
+#endif
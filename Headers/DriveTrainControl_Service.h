@@ -17,6 +17,10 @@ void setTargetDriveSpeed(float newRPMTarget_left, float newRPMTarget_right);
 void setDriveToAlignToBucket(void);
 void clearDriveAligningToBucket(void);
 void setTargetEncoderTicks(uint32_t leftTicks, uint32_t rightTicks, bool negativeLeft, bool negativeRight);
+void setTargetPath(uint32_t ticksToGo, float leftScale, float rightScale);
+bool QueueRotation(uint32_t ticks, bool clockwise);
+bool QueueDrive(uint32_t ticks, bool forward);
+bool QueueArc(uint32_t leftTicks, uint32_t rightTicks, bool forward);
 
 void DriveEncoder_Left_InterruptResponse(void);
 void DriveEncoder_Right_InterruptResponse(void);
@@ -26,7 +30,9 @@ uint32_t GetLeftEncoderTicks(void);
 uint32_t GetRightEncoderTicks(void);
 void ResetEncoderTicks(void);
 bool IsMoving(void);
+bool IsFollowingPath(void);
 void SetBackingUp(bool val);
+bool CenterOnStation(float lateralOffset);
 
 #endif 
 
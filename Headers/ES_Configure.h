@@ -278,6 +278,8 @@ typedef enum {  ES_NO_EVENT = 0,
 									
 								ES_START_CANNON,			//commands the cannon to start spinning at the speed that has been set
 								ES_STOP_CANNON,				//commands 
+								ES_CALIBRATE_CANNON,	//sweeps the flywheel's duty to calibrate its feed-forward
+								ES_AUTOTUNE_CANNON,		//step tests the flywheel to work out its gains
 								
 								//The Following Are Events solely for testing purposes
 								ES_DRIVE_FULL_SPEED,
@@ -285,18 +287,25 @@ typedef enum {  ES_NO_EVENT = 0,
 								ES_REVERSE_FULL_SPEED,
 								ES_REVERSE_HALF_SPEED,
 								ES_STOP_DRIVE,
+								ES_CALIBRATE_DRIVE,
+								ES_AUTOTUNE_DRIVE,
 								ES_ROTATE_45,
 								ES_ROTATE_90,
 
 								
 								ES_FACE_TARGET,
 								ES_DRIVE_TO_TARGET,
+								ES_FOLLOW_PATH,
+								ES_PATH_UPDATE,
 								
 								ES_CALCULATE_POSITION,
+								ES_BEACON_BEARING,		//param is the beacon index
+								ES_RELOCALIZE,
 								ES_ARRIVED,
 								
 								ES_START_PERISCOPE,
 								ES_STOP_PERISCOPE,
+								ES_PERISCOPE_STOPPED,
 								
 								ES_MANUAL_START,
 								ES_ATTACK_COMPLETE,
@@ -348,7 +357,7 @@ typedef enum {  ES_NO_EVENT = 0,
 
 /****************************************************************************/
 // This is the list of event checking functions 
-#define EVENT_CHECK_LIST Check4Keystroke
+#define EVENT_CHECK_LIST Check4Keystroke, Check4BeaconPulses, Check4PeriscopeStopped
 
 /****************************************************************************/
 // These are the definitions for the post functions to be executed when the
@@ -358,8 +367,9 @@ typedef enum {  ES_NO_EVENT = 0,
 // priority in servicing them
 #define TIMER_UNUSED ((pPostFunc)0)
 #define TIMER0_RESP_FUNC PostDriveTrainControlService
-		#define MOTOR_STOPPED_L	0
-		#define MOTOR_STOPPED_T 350
+		#define DRIVE_CALIBRATION_TIMER 0
+		#define DRIVE_CALIBRATION_SETTLE_T 500
+		#define DRIVE_CALIBRATION_MEASURE_T 200
 #define TIMER1_RESP_FUNC PostMasterSM
 		#define MEASURING_TIMEOUT_TIMER	1
 		#define MEASURING_TIMEOUT_T 500
@@ -378,17 +388,20 @@ typedef enum {  ES_NO_EVENT = 0,
 #define TIMER6_RESP_FUNC PostMasterSM
 		#define HALL_EFFECT_TIMEOUT_TIMER 6
 		#define HALL_EFFECT_TIMEOUT_T 200
-#define TIMER7_RESP_FUNC PostDriveTrainControlService
-		#define MOTOR_STOPPED_R 7
+#define TIMER7_RESP_FUNC PostCannonControlService
+		#define CANNON_CALIBRATION_TIMER 7
+		#define CANNON_CALIBRATION_SETTLE_T 1500
+		#define CANNON_CALIBRATION_MEASURE_T 300
 #define TIMER8_RESP_FUNC PostMasterSM
 		#define HOPPER_LOAD_TIMER 8
 		#define HOPPER_LOAD_T 1000
 #define TIMER9_RESP_FUNC PostMasterSM
 		#define CAPTURE_TIMEOUT_TIMER	9
 		#define CAPTURE_TIMEOUT_T 1000
-#define TIMER10_RESP_FUNC PostCannonControlService
-		#define CANNON_STOPPED_TIMER 10
-		#define CANNON_STOPPED_T 200
+#define TIMER10_RESP_FUNC PostDriveTrainControlService
+		#define DRIVE_AUTOTUNE_TIMER 10
+		#define DRIVE_AUTOTUNE_SETTLE_T 500
+		#define DRIVE_AUTOTUNE_LOG_T 600
 #define TIMER11_RESP_FUNC PostPeriscopeControlService
 		#define START_PERISCOPE_TIMER 11
 		#define START_PERISCOPE_T 100
@@ -397,9 +410,10 @@ typedef enum {  ES_NO_EVENT = 0,
 		#define REV_T 1000
 		#define ATTACK_PHASE_T 5000  // Note: the attack phase triggers after this timeout + 2 * GAME_TIMER_T
 		#define NEXT_SHOT_T   5000 // 80000
-#define TIMER13_RESP_FUNC PostPeriscopeControlService
-		#define PERISCOPE_STOPPED_TIMER 13
-		#define PERISCOPE_STOPPED_T 250
+#define TIMER13_RESP_FUNC PostCannonControlService
+		#define CANNON_AUTOTUNE_TIMER 13
+		#define CANNON_AUTOTUNE_SETTLE_T 2000
+		#define CANNON_AUTOTUNE_LOG_T 2700
 #define TIMER14_RESP_FUNC PostMasterSM
 		#define ATTACK_COMPLETE_TIMER 14
 		#define ATTACK_COMPLETE_T 1500
@@ -0,0 +1,24 @@
+/****************************************************************************
+EdgeWatch header file
+ ****************************************************************************/
+
+#ifndef EdgeWatch_H
+#define EdgeWatch_H
+
+#include "ES_Types.h"
+
+// Only the encoder interrupt writes lastEdge outside of a critical section
+typedef struct {
+	volatile uint32_t lastEdge;	// capture time of the last edge, or of the last start
+	uint32_t reportedEdge;			// lastEdge when we last reported a stop
+	bool reported;
+} EdgeWatch;
+
+// Public Function Prototypes
+void EdgeWatch_Init(EdgeWatch *watch);
+void EdgeWatch_Start(EdgeWatch *watch, uint32_t now);
+void EdgeWatch_Edge(EdgeWatch *watch, uint32_t time);
+uint32_t EdgeWatch_LastEdge(const EdgeWatch *watch);
+bool EdgeWatch_Stopped(EdgeWatch *watch, uint32_t lastEdge, uint32_t now, uint32_t stoppedTicks);
+
+#endif
@@ -17,6 +17,8 @@
 // prototypes for event checkers
 
 bool Check4Keystroke(void);
+bool Check4BeaconPulses(void);
+bool Check4PeriscopeStopped(void);
 
 
 #endif /* EventCheckers_H */
@@ -0,0 +1,55 @@
+/****************************************************************************
+FeedForward header file
+ ****************************************************************************/
+
+#ifndef FeedForward_H
+#define FeedForward_H
+
+#include "ES_Types.h"
+#include "FixedPID.h"
+
+// Most points in a duty map (and in a calibration sweep)
+#define FEEDFORWARD_MAX_POINTS 12
+
+// One point of a motor's duty map: the steady speed a duty gives it
+typedef struct {
+	uint8_t duty;					// percent
+	uint16_t rpm;
+} FeedForwardPoint;
+
+// A motor's duty map, for the duty that should hold a given speed. The points
+// are kept in order of speed with the slope on to the next one, so a lookup
+// is a short search and one multiply
+typedef struct {
+	q16_t rpm[FEEDFORWARD_MAX_POINTS];
+	q16_t duty[FEEDFORWARD_MAX_POINTS];
+	q16_t slope[FEEDFORWARD_MAX_POINTS];	// duty per RPM from each point to the next (the last carries on)
+	q16_t rpmSlope[FEEDFORWARD_MAX_POINTS];	// and RPM per duty, to look up the speed a duty holds
+	uint8_t numPoints;
+	q16_t trim;														// scales the map to the battery and load we have now
+	qgain_t trimRate;											// trim per period per unit of integral
+} FeedForwardMap;
+
+// A calibration sweep: we hold each duty in turn until the motor settles,
+// then average its speed
+typedef struct {
+	FeedForwardPoint points[FEEDFORWARD_MAX_POINTS];
+	uint8_t numPoints;
+	uint8_t step;													// the point we are on
+	volatile bool measuring;							// settled, so the control interrupt sums speeds
+	volatile uint64_t sum;								// Q16 RPM
+	volatile uint32_t samples;
+} FeedForwardSweep;
+
+// Public Function Prototypes
+void FeedForward_Init(FeedForwardMap *map, const FeedForwardPoint *points, uint8_t numPoints, qgain_t trimRate);
+q16_t FeedForward_Duty(const FeedForwardMap *map, q16_t rpm);
+q16_t FeedForward_RPM(const FeedForwardMap *map, q16_t duty);
+void FeedForward_Trim(FeedForwardMap *map, q16_t integral);
+void FeedForward_StartSweep(FeedForwardSweep *sweep, uint8_t maxDuty, uint8_t numPoints);
+uint8_t FeedForward_SweepDuty(const FeedForwardSweep *sweep);
+void FeedForward_SweepSample(FeedForwardSweep *sweep, q16_t rpm);
+bool FeedForward_SweepNext(FeedForwardSweep *sweep);
+void FeedForward_PrintSweep(const FeedForwardSweep *sweep);
+
+#endif
@@ -0,0 +1,70 @@
+/****************************************************************************
+FixedPID header file
+ ****************************************************************************/
+
+#ifndef FixedPID_H
+#define FixedPID_H
+
+#include "ES_Types.h"
+
+// Signals (speeds, errors, duty cycles) are carried in Q16 (16 fractional bits)
+typedef int32_t q16_t;
+
+// Gains are carried in Q24, so that the very small cannon gains keep their precision
+typedef int32_t qgain_t;
+
+#define Q16_SHIFT 16
+#define QGAIN_SHIFT 24
+
+// A proportional gain that scales with |error| is in duty per RPM squared, far
+// too small for Q24 (the cannon's 1e-7 would round to 2, a 19% error), so it
+// is carried in Q40 instead
+#define QSCALED_SHIFT 40
+
+// Conversions (these fold to constants when given constants)
+#define FLOAT_TO_Q16(x) ((q16_t) (((x) * 65536.0f) + (((x) >= 0) ? 0.5f : -0.5f)))
+#define FLOAT_TO_QGAIN(x) ((qgain_t) (((x) * 16777216.0f) + (((x) >= 0) ? 0.5f : -0.5f)))
+#define FLOAT_TO_QSCALED(x) ((qgain_t) (((x) * 1099511627776.0f) + (((x) >= 0) ? 0.5f : -0.5f)))
+#define INT_TO_Q16(x) ((q16_t) ((x) * (1L << Q16_SHIFT)))
+#define Q16_TO_INT(x) ((int32_t) ((x) >> Q16_SHIFT))
+#define Q16_TO_FLOAT(x) (((float) (x)) / 65536.0f)
+
+// Arithmetic helpers
+#define Q16_ABS(x) (((x) < 0) ? -(x) : (x))
+#define Q16_MUL(a, b) ((q16_t) (((int64_t) (a) * (b)) >> Q16_SHIFT))
+#define QGAIN_MUL(g, x) ((q16_t) (((int64_t) (g) * (x)) >> QGAIN_SHIFT))
+
+// A single set of PID gains
+typedef struct {
+	qgain_t p;
+	qgain_t i;
+	qgain_t d;
+	bool pScalesWithError; // if set, p (in Q40, see FLOAT_TO_QSCALED) is multiplied by |error|
+} PIDGains;
+
+// Gain schedule: startup gains while far below target, then below/above gains
+typedef struct {
+	const PIDGains *startup;
+	const PIDGains *below;
+	const PIDGains *above;
+	q16_t startupFraction; // use startup gains while error > startupFraction * target
+} PIDSchedule;
+
+// The state of a single control loop
+typedef struct {
+	q16_t integral;
+	q16_t lastError;
+	q16_t integralMin;
+	q16_t integralMax;
+	q16_t outputMin;
+	q16_t outputMax;
+} PIDState;
+
+// Public Function Prototypes
+void FixedPID_Init(PIDState *pid, q16_t integralMin, q16_t integralMax, q16_t outputMin, q16_t outputMax);
+void FixedPID_Reset(PIDState *pid);
+const PIDGains *FixedPID_ScheduleGains(const PIDSchedule *schedule, q16_t error, q16_t target);
+q16_t FixedPID_Update(PIDState *pid, const PIDGains *gains, q16_t error);
+q16_t FixedPID_Ratio(uint32_t numerator, uint32_t denominator, uint8_t headroom);
+
+#endif
@@ -0,0 +1,24 @@
+/****************************************************************************
+Geometry header file
+ ****************************************************************************/
+
+#ifndef Geometry_H
+#define Geometry_H
+
+#include "ES_Types.h"
+
+#define GEO_PI 3.14159265f
+#define GEO_HALF_PI 1.57079633f
+#define GEO_TWO_PI 6.28318531f
+#define GEO_DEGREES_PER_RADIAN 57.29577951f
+#define GEO_RADIANS_PER_DEGREE 0.01745329251f
+
+// Public Function Prototypes
+void Geo_SinCos(float angle, float *sinOut, float *cosOut);
+float Geo_Sin(float angle);
+float Geo_Cos(float angle);
+float Geo_Atan2(float y, float x);
+float Geo_WrapDegrees(float angle);
+float Geo_WrapRadians(float angle);
+
+#endif
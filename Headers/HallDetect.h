@@ -0,0 +1,37 @@
+/****************************************************************************
+HallDetect header file
+ ****************************************************************************/
+
+#ifndef HallDetect_H
+#define HallDetect_H
+
+#include "ES_Types.h"
+#include "PeriodBins.h"
+
+#define HALL_DETECT_SENSORS 4
+#define HALL_DETECT_FREQUENCIES 16
+
+// Each sensor keeps its own period history and histogram of matched frequencies
+typedef struct {
+	uint32_t lastCapture;
+	uint8_t lastFrequency;												// frequency index of the previous matched period
+	uint8_t histogram[HALL_DETECT_FREQUENCIES];
+} HallSensor;
+
+// The sensors over one station, and how sure they must be before we report it
+typedef struct {
+	const PeriodBinTable *table;									// classifies periods into frequency indices
+	uint8_t threshold;														// confidence needed to report a station
+	uint8_t agreementBonus;												// added for each extra sensor that agrees
+	HallSensor sensors[HALL_DETECT_SENSORS];
+} HallDetector;
+
+// Public Function Prototypes
+void HallDetect_Init(HallDetector *detector, const PeriodBinTable *table, uint8_t threshold, uint8_t agreementBonus);
+void HallDetect_Reset(HallDetector *detector);
+uint8_t HallDetect_Period(HallDetector *detector, uint8_t sensor, uint32_t capture);
+bool HallDetect_Count(HallDetector *detector, uint8_t sensor, uint8_t frequencyIndex, uint8_t *sensorMask);
+uint8_t HallDetect_Confidence(const HallDetector *detector, uint8_t frequencyIndex, uint8_t *sensorMask);
+float HallDetect_StationOffset(const HallDetector *detector, uint8_t frequencyIndex, const float *lateralPositions, float maxOffset);
+
+#endif
@@ -10,12 +10,19 @@ HallEffect Header File
 // State definitions for use with the query function
 typedef enum { Measure_t, Requesting_t } HallEffectState_t ;
 
+// ES_PS_DETECTED carries the frequency index in its low byte and a mask of the
+// hall sensors that saw it (bit 0 = outer left ... bit 3 = outer right) in its high byte
+#define PS_DETECTED_PARAM(frequency, sensors) ((uint16_t) (((sensors) << 8) | (frequency)))
+#define PS_FREQUENCY_INDEX(param) ((uint8_t) ((param) & 0xff))
+#define PS_SENSOR_MASK(param) ((uint8_t) ((param) >> 8))
+
 
 // Public Function Prototypes
 
 ES_Event RunHallEffectSM( ES_Event CurrentEvent );
 void StartHallEffectSM ( ES_Event CurrentEvent );
 HallEffectState_t QueryHallEffectSM ( void );
+float GetStationOffset(void);
 
 //Interrupt Responses
 void HE_OuterLeft_InterruptResponse(void);
@@ -87,6 +87,18 @@ uint32_t captureInterrupt(
 	uint8_t priority,
 	uint32_t time_length);
 
+uint32_t currentTimerValue(
+	uint8_t timer_num, 
+	uint8_t timer_letter,
+	uint8_t priority,
+	uint32_t time_length);
+
+uint32_t captureAge(
+	uint8_t timer_num, 
+	uint8_t timer_letter,
+	uint8_t priority,
+	uint32_t time_length);
+
 float clamp(float X, int min, int max);
 
 uint8_t GetRequestCommand(uint8_t M, uint8_t R, uint8_t F);
@@ -0,0 +1,25 @@
+/****************************************************************************
+IsrTiming header file
+ ****************************************************************************/
+
+#ifndef IsrTiming_H
+#define IsrTiming_H
+
+#include "ES_Types.h"
+
+// The priority 0 capture interrupts we time. They can't preempt each other,
+// so each one's latency is how long the others held it off
+typedef enum {
+	ISR_PERISCOPE_ENCODER = 0,
+	ISR_CANNON_ENCODER,
+	ISR_PHOTOTRANSISTOR,
+	ISR_HALL_EFFECT,
+	NUM_TIMED_ISRS
+} TimedIsr;
+
+// Public Function Prototypes
+void IsrTiming_Record(TimedIsr isr, uint32_t latency, uint32_t duration);
+void IsrTiming_Get(TimedIsr isr, uint32_t *longestLatency, uint32_t *longestDuration);
+void IsrTiming_Reset(void);
+
+#endif
@@ -0,0 +1,49 @@
+/****************************************************************************
+MotionProfile header file
+ ****************************************************************************/
+
+#ifndef MotionProfile_H
+#define MotionProfile_H
+
+#include "ES_Types.h"
+#include "FixedPID.h"
+
+// The limits of a profile, in wheel RPM and control periods. Build them with
+// MOTION_LIMITS so the conversions fold to constants
+typedef struct {
+	q16_t maxVelocity;		// RPM
+	q16_t minVelocity;		// RPM we creep at on the way in, so the wheel never stalls short
+	q16_t maxAccel;				// RPM per period
+	q16_t maxJerk;				// RPM per period per period
+	q16_t brakeGain;			// RPM per period of braking it takes to stop in one tick from 1 RPM
+	q16_t leadGain;				// ticks per RPM per (RPM/period)^2 of acceleration the jerk limit has to swing through
+	q16_t stopGain;				// RPM^2 per tick to go: the position loop caps the setpoint at sqrt(stopGain * ticks)
+	q16_t positionGain;		// RPM per tick to go, for the last few ticks down to zero at the target
+} MotionLimits;
+
+// maxRPM and minRPM in RPM, accel and stopAccel (the deceleration the wheels
+// can really follow) in RPM/s, jerk in RPM/s^2, gain (the position gain) in
+// RPM per tick, periodUs in microseconds and ticksPerRev in encoder ticks per
+// wheel revolution
+#define MOTION_LIMITS(maxRPM, minRPM, accel, jerk, stopAccel, gain, periodUs, ticksPerRev) { \
+	.maxVelocity = FLOAT_TO_Q16(maxRPM), \
+	.minVelocity = FLOAT_TO_Q16(minRPM), \
+	.maxAccel = FLOAT_TO_Q16((accel) * ((periodUs) / 1000000.0f)), \
+	.maxJerk = FLOAT_TO_Q16((jerk) * ((periodUs) / 1000000.0f) * ((periodUs) / 1000000.0f)), \
+	.brakeGain = FLOAT_TO_Q16(((ticksPerRev) / 120.0f) * ((periodUs) / 1000000.0f)), \
+	.leadGain = FLOAT_TO_Q16((ticksPerRev) / (120.0f * (jerk) * (accel) * ((periodUs) / 1000000.0f) * ((periodUs) / 1000000.0f))), \
+	.stopGain = FLOAT_TO_Q16((120.0f * (stopAccel)) / (ticksPerRev)), \
+	.positionGain = FLOAT_TO_Q16(gain) }
+
+// The state of one profile
+typedef struct {
+	q16_t velocity;				// RPM
+	q16_t accel;					// RPM per period
+	bool braking;					// we have started braking for the target
+} MotionProfile;
+
+// Public Function Prototypes
+void MotionProfile_Reset(MotionProfile *profile);
+q16_t MotionProfile_Step(MotionProfile *profile, const MotionLimits *limits, uint32_t ticksToGo);
+
+#endif
@@ -0,0 +1,35 @@
+/****************************************************************************
+MotionQueue header file
+ ****************************************************************************/
+
+#ifndef MotionQueue_H
+#define MotionQueue_H
+
+#include "ES_Types.h"
+
+// Moves we can queue up behind the current one
+#define MOTION_QUEUE_SIZE 4
+
+// A rotate, drive or arc, as each wheel's ticks and direction
+typedef struct {
+	uint32_t leftTicks;
+	uint32_t rightTicks;
+	bool negativeLeft;
+	bool negativeRight;
+} MotionPrimitive;
+
+typedef struct {
+	MotionPrimitive moves[MOTION_QUEUE_SIZE];
+	uint8_t head;
+	uint8_t count;
+} MotionQueue;
+
+// Public Function Prototypes
+void MotionQueue_Clear(MotionQueue *queue);
+bool MotionQueue_Push(MotionQueue *queue, const MotionPrimitive *move);
+bool MotionQueue_Pop(MotionQueue *queue, MotionPrimitive *move);
+const MotionPrimitive *MotionQueue_Next(const MotionQueue *queue);
+bool MotionQueue_Continues(const MotionPrimitive *from, const MotionPrimitive *to);
+uint32_t MotionQueue_BlendTicks(const MotionQueue *queue, const MotionPrimitive *current);
+
+#endif
@@ -0,0 +1,31 @@
+/****************************************************************************
+Odometry header file
+ ****************************************************************************/
+
+#ifndef Odometry_H
+#define Odometry_H
+
+#include "ES_Types.h"
+#include "FixedPID.h"
+
+// Our raw pose at some instant, cheap enough to take in an interrupt. It is
+// only meaningful until odometry is next anchored
+typedef struct {
+	q16_t x;
+	q16_t y;
+	uint32_t heading;
+	uint16_t epoch;
+} OdometrySnapshot;
+
+// Public Function Prototypes
+void Odometry_Anchor(float x, float y, float thetaDegrees);
+void Odometry_Correct(float dx, float dy, float dThetaDegrees);
+bool Odometry_IsAnchored(void);
+void Odometry_LeftTick(bool forward);
+void Odometry_RightTick(bool forward);
+void Odometry_GetPose(float *x, float *y, float *thetaDegrees);
+uint32_t Odometry_Heading(void);
+void Odometry_Snapshot(OdometrySnapshot *snapshot);
+bool Odometry_SnapshotPose(const OdometrySnapshot *first, const OdometrySnapshot *last, float *x, float *y, float *thetaDegrees);
+
+#endif
@@ -0,0 +1,41 @@
+/****************************************************************************
+ParamStore header file
+ ****************************************************************************/
+
+#ifndef ParamStore_H
+#define ParamStore_H
+
+#include "ES_Types.h"
+#include "FeedForward.h"
+
+// The gain sets we keep, one per control loop
+typedef enum {
+	DRIVE_GAINS = 0,
+	CANNON_GAINS,
+	NUM_GAIN_SETS
+} GainSetID;
+
+// A loop's gains, in the form that loop's law uses them
+typedef struct {
+	float p;
+	float i;
+	float d;
+} GainSet;
+
+// The duty maps we keep, one per motor
+typedef enum {
+	DRIVE_LEFT_MAP = 0,
+	DRIVE_RIGHT_MAP,
+	CANNON_MAP,
+	NUM_DUTY_MAPS
+} DutyMapID;
+
+// Public Function Prototypes
+bool ParamStore_ReadGains(GainSetID id, GainSet *gains);
+bool ParamStore_WriteGains(GainSetID id, const GainSet *gains);
+void ParamStore_ForgetGains(GainSetID id);
+bool ParamStore_ReadMap(DutyMapID id, FeedForwardPoint *points, uint8_t *numPoints);
+bool ParamStore_WriteMap(DutyMapID id, const FeedForwardPoint *points, uint8_t numPoints);
+void ParamStore_ForgetMap(DutyMapID id);
+
+#endif
@@ -0,0 +1,34 @@
+/****************************************************************************
+PeriodBins header file
+ ****************************************************************************/
+
+#ifndef PeriodBins_H
+#define PeriodBins_H
+
+#include "ES_Types.h"
+
+#define TICKS_PER_US (TICKS_PER_MS / MICROSECONDS_DIVISOR)
+
+// Returned when a period matches none of the target periods
+#define PERIOD_BIN_NONE 0xff
+
+// Number of bins needed to cover periods [minUs, maxUs] with a +/- tolUs tolerance
+#define PERIOD_BIN_COUNT(minUs, maxUs, tolUs, shift) \
+	((((((maxUs) + (tolUs) + 1) - ((minUs) - (tolUs))) * TICKS_PER_US) >> (shift)) + 1)
+
+// A lookup from raw capture ticks to the index of the matching target period.
+// The caller owns the storage (we have no dynamic memory)
+typedef struct {
+	uint32_t base;				// ticks at the start of bin 0
+	uint8_t shift;				// log2 of the bin width in ticks
+	uint16_t numBins;
+	uint8_t *bins;				// candidate period index per bin, or PERIOD_BIN_NONE
+	uint32_t *lower;			// inclusive tick bounds for each period index
+	uint32_t *upper;
+} PeriodBinTable;
+
+// Public Function Prototypes
+void PeriodBins_Build(PeriodBinTable *table, const uint32_t *periods, uint8_t numPeriods, uint32_t tolerance);
+uint8_t PeriodBins_Classify(const PeriodBinTable *table, uint32_t ticks);
+
+#endif
@@ -6,6 +6,7 @@ PeriscopeControl_Service header file
 #define PeriscopeControl_H
 
 #include "ES_Types.h"
+#include "FixedPID.h"
 
 // Public Function Prototypes
 
@@ -14,13 +15,21 @@ bool PostPeriscopeControlService( ES_Event ThisEvent );
 ES_Event RunPeriscopeControlService( ES_Event ThisEvent );
 
 float GetPeriscopeAngle(void);
+float GetPeriscopeAngleAt(uint32_t age);
 void PeriscopeEncoder_InterruptResponse(void);
+void StartPeriscope(void);
+void StopPeriscope(void);
+q16_t GetPeriscopeRPM(void);
+q16_t GetBeaconSweepRPM(void);
+void ScanSectors(const float *centers, const float *halfWidths, uint8_t numSectors);
+void ScanFullRotation(void);
 void ResetPeriscopeEncoderTicks(void);
 void LatchPeriscope(void);
 void UnlatchPeriscope(void);
 void RequireZero(void);
 bool IsZeroed(void);
 void SetAttemptingToStop(bool val);
+bool CheckPeriscopeStopped(void);
 
 #endif 
 
@@ -8,6 +8,8 @@
 #define PhotoTransistor_H
 
 #include "ES_Types.h"
+#include "Odometry.h"
+#include "PulseRing.h"
 
 #define BEACON_INDEX_NW 0 
 #define BEACON_INDEX_NE 1
@@ -18,7 +20,10 @@
 typedef struct {
 	uint32_t period; 
 	float lastEncoderAngle; 
+	float quality;				// fraction of its pulses that agreed on lastEncoderAngle
 	uint32_t lastUpdateTime;
+	OdometrySnapshot firstSeen; // where we were for the first and last pulses
+	OdometrySnapshot lastSeen;
 	int priorBeacons[2];
 	int xShift;
 	int yShift;
@@ -29,6 +34,8 @@ bool InitPhotoTransistorService ( uint8_t Priority );
 bool PostPhotoTransistorService( ES_Event ThisEvent );
 ES_Event RunPhotoTransistorService( ES_Event ThisEvent );
 void PhotoTransistor_InterruptResponse(void);
+bool ProcessBeaconPulses(void);
+uint16_t GetDroppedBeaconPulses(void);
 
 uint32_t GetLastUpdateTime(uint8_t beaconIndex);
 void ResetUpdateTimes(void);
@@ -38,6 +45,13 @@ void ResetAligningToBucket(void);
 float GetBeaconAngle_A(uint8_t beaconIndex);
 float GetBeaconAngle_B(uint8_t beaconIndex);
 float GetBeaconAngle_C(uint8_t beaconIndex);
+float GetBeaconAngle(uint8_t beaconIndex);
+float GetBeaconQuality(uint8_t beaconIndex);
+bool GetBeaconPose(uint8_t beaconIndex, float *x, float *y, float *thetaDegrees);
+
+uint8_t GetFreshBeacons(void);
+uint8_t OldestFreshBeacon(void);
+void ExpireBeacon(uint8_t beaconIndex);
 
 void SetBeaconAngles(float A, float B, float C);
 
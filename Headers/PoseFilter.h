@@ -0,0 +1,19 @@
+/****************************************************************************
+PoseFilter header file
+ ****************************************************************************/
+
+#ifndef PoseFilter_H
+#define PoseFilter_H
+
+#include "ES_Types.h"
+
+// Public Function Prototypes
+void PoseFilter_Reset(float x, float y, float thetaDegrees);
+bool PoseFilter_IsInitialized(void);
+void PoseFilter_Predict(void);
+bool PoseFilter_UpdateBearing(float beaconX, float beaconY, float angleDegrees, float seenX, float seenY, float seenThetaDegrees);
+void PoseFilter_GetCovariance(float covariance[3][3]);
+float PoseFilter_PositionSigma(void);
+float PoseFilter_HeadingSigma(void);
+
+#endif
@@ -21,10 +21,15 @@ void SetTargetLocation(float x, float y);
 void SetMyLocation(float x, float y, float theta);
 bool IsAbsolutePosition(void);
 void ResetAbsolutePosition(void);
+bool IsPositionKnown(void);
+float GetPositionUncertainty(void);
+float GetHeadingUncertainty(void);
+void GetPoseCovariance(float covariance[3][3]);
 float DistanceToPoint(float TargetX, float TargetY);
 float DetermineDistanceToBucket(void);
 float ToAppropriateRange(float angle);
 void ExecuteBackup(void);
+void RecoverPosition(void);
 
 #endif 
 
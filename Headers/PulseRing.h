@@ -0,0 +1,40 @@
+/****************************************************************************
+PulseRing header file
+ ****************************************************************************/
+
+#ifndef PulseRing_H
+#define PulseRing_H
+
+#include "ES_Types.h"
+#include "Odometry.h"
+
+// Pulses the ring holds (must be a power of 2, and no more than 256). One slot
+// stays empty, so that a full ring can be told from an empty one
+#define PULSE_RING_SIZE 64
+#define PULSE_RING_MASK (PULSE_RING_SIZE - 1)
+
+// A pulse recorded by the capture interrupt, waiting to be processed
+typedef struct {
+	uint32_t capture;				// capture time
+	float angle;						// periscope angle (degrees) at the pulse
+	OdometrySnapshot seen;	// where we were at the pulse
+} BeaconPulse;
+
+// Only the interrupt moves head, and only the task moves tail, so neither
+// side needs a critical section
+typedef struct {
+	BeaconPulse pulses[PULSE_RING_SIZE];
+	volatile uint8_t head;
+	volatile uint8_t tail;
+	volatile uint16_t dropped;											// pulses lost to a full ring
+} PulseRing;
+
+// Public Function Prototypes
+void PulseRing_Init(PulseRing *ring);
+BeaconPulse *PulseRing_Claim(PulseRing *ring);
+void PulseRing_Publish(PulseRing *ring);
+const BeaconPulse *PulseRing_Oldest(const PulseRing *ring);
+void PulseRing_Release(PulseRing *ring);
+uint16_t PulseRing_Dropped(const PulseRing *ring);
+
+#endif
@@ -0,0 +1,27 @@
+/****************************************************************************
+Relocalizer header file
+ ****************************************************************************/
+
+#ifndef Relocalizer_H
+#define Relocalizer_H
+
+#include "ES_Types.h"
+
+// Where the relocalizer has got to after a bearing
+typedef enum {
+	RELOCALIZE_WORKING,		// more rounds to run for the last bearing
+	RELOCALIZE_SEARCHING,	// still narrowing down
+	RELOCALIZE_CONVERGED,	// one clear pose
+	RELOCALIZE_AMBIGUOUS	// too many bearings without one clear pose
+} RelocalizeResult;
+
+// Public Function Prototypes
+void Relocalizer_Start(void);
+void Relocalizer_Stop(void);
+bool Relocalizer_IsRunning(void);
+uint8_t Relocalizer_NumBearings(void);
+void Relocalizer_AddBearing(float beaconX, float beaconY, float angleDegrees, float seenX, float seenY, float seenThetaDegrees);
+RelocalizeResult Relocalizer_Step(void);
+void Relocalizer_GetEstimate(float *x, float *y, float *thetaDegrees);
+
+#endif
@@ -0,0 +1,25 @@
+/****************************************************************************
+Triangulate header file
+ ****************************************************************************/
+
+#ifndef Triangulate_H
+#define Triangulate_H
+
+#include "ES_Types.h"
+
+#define TRIANGULATE_BEACONS 4
+
+// How far we have moved (odometry, in the current robot frame) since we saw
+// a beacon
+typedef struct {
+	float forward;
+	float left;
+	float turned;																	// degrees
+} BeaconSighting;
+
+// Public Function Prototypes
+void Triangulate_Triple(float A, float B, float C, int xShift, int yShift, int thetaShift, float *x, float *y, float *theta);
+float Triangulate_Refine(uint8_t beacons, const float *angles, const BeaconSighting *sightings,
+	const float *beaconX, const float *beaconY, float *x, float *y, float *theta);
+
+#endif
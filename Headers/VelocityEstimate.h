@@ -0,0 +1,33 @@
+/****************************************************************************
+VelocityEstimate header file
+ ****************************************************************************/
+
+#ifndef VelocityEstimate_H
+#define VelocityEstimate_H
+
+#include "ES_Types.h"
+#include "FixedPID.h"
+
+// Number of recent encoder edges we remember (must be a power of 2)
+#define VELOCITY_RING_SIZE 8
+#define VELOCITY_RING_MASK (VELOCITY_RING_SIZE - 1)
+
+// Edge times from one encoder, and how to turn them into a speed. The
+// encoder interrupt records edges, the control loop estimates from them
+typedef struct {
+	volatile uint32_t times[VELOCITY_RING_SIZE];	// capture times of the most recent edges
+	volatile uint32_t numEdges;										// edges recorded since the last reset
+	uint32_t numerator;														// RPM = numerator / period in capture ticks
+	uint8_t headroom;															// see FixedPID_Ratio
+	uint8_t maxIntervals;													// most edge intervals we average over (up to VELOCITY_RING_SIZE - 2)
+	uint32_t window;															// longest span (capture ticks) we average over
+	uint32_t stale;																// no edge for this long (capture ticks) means stopped
+} VelocityEstimate;
+
+// Public Function Prototypes
+void VelocityEstimate_Init(VelocityEstimate *estimate, uint32_t numerator, uint8_t headroom, uint8_t maxIntervals, uint32_t window, uint32_t stale);
+void VelocityEstimate_Reset(VelocityEstimate *estimate);
+void VelocityEstimate_Edge(VelocityEstimate *estimate, uint32_t capture);
+q16_t VelocityEstimate_RPM(const VelocityEstimate *estimate, uint32_t now);
+
+#endif
@@ -0,0 +1,248 @@
+/****************************************************************************
+ Module
+   AutoTune.c
+
+ Description
+		Works out speed loop gains from a step test, in place of tuning them by
+		  hand. With the motor held at a low duty we step to a high one and log
+			its speed as it settles. Fitting that response as first order plus
+			dead time gives the motor's gain (RPM per duty), its time constant
+			and its delay, from the times it takes to cover 28.3% and 63.2% of
+			the change. From that model the SIMC (lambda) rules give PI gains
+			for a closed loop that settles with a chosen time constant and
+			doesn't overshoot. We hold no hardware here, so the same code tunes
+			a plant model on the host.
+****************************************************************************/
+
+#include <Math.h>
+#include "ES_Configure.h"
+#include "ES_Framework.h"
+#include "AutoTune.h"
+
+/*----------------------------- Module Defines ----------------------------*/
+// The fractions of the change at which we time the response
+#define FIRST_FRACTION 0.283f
+#define SECOND_FRACTION 0.632f
+
+// The final speed is the average of the last AUTOTUNE_SAMPLES / SETTLED_SHARE
+// samples, and the motor has settled if that differs from the samples before
+// it by less than 1 / SETTLED_SHARE of the change
+#define SETTLED_SHARE 8
+
+/*---------------------------- Module Functions ---------------------------*/
+static float averageSamples(const AutoTuneStep *step, uint8_t first, uint8_t count);
+static float crossingTime(const AutoTuneStep *step, float level, float controlPeriod);
+static float sampleTime(const AutoTuneStep *step, uint8_t sample, float controlPeriod);
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     AutoTune_Start
+
+ Parameters
+     step : the test to start
+		 lowDuty, highDuty : the duties to step between (percent)
+		 periodsPerSample : control periods averaged into each logged sample
+
+ Description
+     Holds the low duty. Call AutoTune_StartLogging once the motor has
+		   settled there
+****************************************************************************/
+void AutoTune_Start(AutoTuneStep *step, uint8_t lowDuty, uint8_t highDuty, uint8_t periodsPerSample)
+{
+	step->lowDuty = lowDuty;
+	step->highDuty = highDuty;
+	step->periodsPerSample = periodsPerSample;
+	step->periods = 0;
+	step->sum = 0;
+	step->logged = 0;
+	step->logging = false;
+}
+
+/****************************************************************************
+ Function
+     AutoTune_StartLogging
+
+ Description
+     Logs AUTOTUNE_PRESTEP samples at the low duty and then steps. Does
+		   nothing once the log is full
+****************************************************************************/
+void AutoTune_StartLogging(AutoTuneStep *step)
+{
+	step->logging = (step->logged < AUTOTUNE_SAMPLES);
+}
+
+/****************************************************************************
+ Function
+     AutoTune_Duty
+
+ Returns
+     the duty (percent) to drive the motor with, 0 once the log is full
+****************************************************************************/
+uint8_t AutoTune_Duty(const AutoTuneStep *step)
+{
+	if (step->logged >= AUTOTUNE_SAMPLES)
+	{
+		return 0;
+	}
+	return (step->logged < AUTOTUNE_PRESTEP) ? step->lowDuty : step->highDuty;
+}
+
+/****************************************************************************
+ Function
+     AutoTune_Sample
+
+ Description
+     Adds the motor's speed (Q16 RPM) to the log while we are logging.
+		   Call it from the control interrupt, before setting AutoTune_Duty
+****************************************************************************/
+void AutoTune_Sample(AutoTuneStep *step, q16_t rpm)
+{
+	if (!step->logging)
+	{
+		return;
+	}
+
+	step->sum += rpm;
+	step->periods++;
+	if (step->periods >= step->periodsPerSample)
+	{
+		step->log[step->logged] = (q16_t) (step->sum / step->periods);
+		step->sum = 0;
+		step->periods = 0;
+		step->logged++;
+		if (step->logged >= AUTOTUNE_SAMPLES)
+		{
+			step->logging = false;
+		}
+	}
+}
+
+/****************************************************************************
+ Function
+     AutoTune_Done
+
+ Returns
+     true once the log is full
+****************************************************************************/
+bool AutoTune_Done(const AutoTuneStep *step)
+{
+	return step->logged >= AUTOTUNE_SAMPLES;
+}
+
+/****************************************************************************
+ Function
+     AutoTune_Fit
+
+ Parameters
+     step : a finished test
+		 controlPeriod : seconds between the control interrupts that logged it
+		 plant : the fitted model
+
+ Returns
+     false (leaving plant alone) if the response doesn't fit: the motor
+		   didn't speed up, it hadn't settled by the end of the log (log it for
+			 longer), or it gives a model without a positive gain, time constant
+			 and dead time, which no real motor has and we can't tune from
+****************************************************************************/
+bool AutoTune_Fit(const AutoTuneStep *step, float controlPeriod, PlantModel *plant)
+{
+	uint8_t tail = AUTOTUNE_SAMPLES / SETTLED_SHARE;
+	float start = averageSamples(step, 0, AUTOTUNE_PRESTEP);
+	float end = averageSamples(step, AUTOTUNE_SAMPLES - tail, tail);
+	float before = averageSamples(step, AUTOTUNE_SAMPLES - 2 * tail, tail);
+	float change = end - start;
+	float first, second;
+	float gain, timeConstant, deadTime;
+
+	if (!AutoTune_Done(step) || (step->highDuty <= step->lowDuty) || (change <= 0))
+	{
+		return false;
+	}
+	if (fabsf(end - before) * SETTLED_SHARE > change)
+	{
+		return false;
+	}
+
+	first = crossingTime(step, start + FIRST_FRACTION * change, controlPeriod);
+	second = crossingTime(step, start + SECOND_FRACTION * change, controlPeriod);
+	if (second <= first)
+	{
+		return false;
+	}
+
+	gain = change / (step->highDuty - step->lowDuty);
+	timeConstant = 1.5f * (second - first);
+	deadTime = second - timeConstant;
+	if (!(gain > 0) || !(timeConstant > 0) || !(deadTime > 0))
+	{
+		return false;
+	}
+
+	plant->gain = gain;
+	plant->timeConstant = timeConstant;
+	plant->deadTime = deadTime;
+	return true;
+}
+
+/****************************************************************************
+ Function
+     AutoTune_PIGains
+
+ Parameters
+     plant : the motor's model
+		 closedLoopRatio : the closed loop time constant we want, as a share
+		   of the motor's own (smaller is faster and less robust). It is
+			 never less than the dead time
+		 controlPeriod : seconds between control updates
+		 kp : proportional gain (duty per RPM)
+		 ki : integral gain (duty per RPM, added each control period)
+****************************************************************************/
+void AutoTune_PIGains(const PlantModel *plant, float closedLoopRatio, float controlPeriod, float *kp, float *ki)
+{
+	float closedLoop = fmaxf(closedLoopRatio * plant->timeConstant, plant->deadTime);
+	float integralTime = fminf(plant->timeConstant, 4.0f * (closedLoop + plant->deadTime));
+
+	*kp = plant->timeConstant / (plant->gain * (closedLoop + plant->deadTime));
+	*ki = *kp * controlPeriod / integralTime;
+}
+
+// The average speed (RPM) of some logged samples
+static float averageSamples(const AutoTuneStep *step, uint8_t first, uint8_t count)
+{
+	int64_t sum = 0;
+	uint8_t i;
+
+	for (i = first; i < first + count; i++)
+	{
+		sum += step->log[i];
+	}
+	return Q16_TO_FLOAT(sum / count);
+}
+
+// Seconds after the step that the speed first reaches a level, between the
+// samples either side of it
+static float crossingTime(const AutoTuneStep *step, float level, float controlPeriod)
+{
+	uint8_t i;
+
+	for (i = AUTOTUNE_PRESTEP; i < AUTOTUNE_SAMPLES; i++)
+	{
+		float speed = Q16_TO_FLOAT(step->log[i]);
+		if (speed >= level)
+		{
+			float lastSpeed = Q16_TO_FLOAT(step->log[i - 1]);
+			float lastTime = fmaxf(sampleTime(step, i - 1, controlPeriod), 0.0f);
+			float time = sampleTime(step, i, controlPeriod);
+			return lastTime + (time - lastTime) * (level - lastSpeed) / (speed - lastSpeed);
+		}
+	}
+	return sampleTime(step, AUTOTUNE_SAMPLES - 1, controlPeriod);
+}
+
+// Seconds after the step at the middle of a sample's periods. The first
+// period after the step measures the speed one period in
+static float sampleTime(const AutoTuneStep *step, uint8_t sample, float controlPeriod)
+{
+	return (((int16_t) sample - AUTOTUNE_PRESTEP) * step->periodsPerSample + (step->periodsPerSample + 1) / 2.0f) * controlPeriod;
+}
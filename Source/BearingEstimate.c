@@ -0,0 +1,172 @@
+/****************************************************************************
+ Module
+   BearingEstimate.c
+
+ Description
+		Estimates the angle to a beacon from the periscope angles of its pulses.
+		  Each angle is kept as an offset from the first, so a beacon that
+			straddles 0/360 degrees averages correctly. When the buffer fills we
+			drop every other sample and keep every other pulse from then on, so
+			the samples still cover the whole beacon however slowly we turn.
+			The estimate is the mean of the samples within BEARING_OUTLIER_DEGREES
+			of their median, so a few stray pulses (reflections, another beacon's
+			harmonics) don't pull it. The fraction of samples that agree is the
+			quality of the bearing.
+****************************************************************************/
+
+#include <Math.h>
+
+#include "ES_Configure.h"
+#include "ES_Framework.h"
+#include "BearingEstimate.h"
+#include "Geometry.h"
+
+/*----------------------------- Module Defines ----------------------------*/
+// Samples further than this from the median are outliers. A beacon is about
+// 6 degrees wide, so its real pulses are all within 3 degrees of its middle
+#define BEARING_OUTLIER_DEGREES 4.0f
+
+/*---------------------------- Module Functions ---------------------------*/
+static float median(float *values, uint8_t count);
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     Bearing_Reset
+
+ Description
+     Forgets all samples
+****************************************************************************/
+void Bearing_Reset(BearingSamples *samples)
+{
+	samples->count = 0;
+	samples->stride = 1;
+	samples->skipped = 0;
+	samples->total = 0;
+}
+
+/****************************************************************************
+ Function
+     Bearing_Add
+
+ Parameters
+     samples : the samples for one beacon
+		 angle : the periscope angle of a pulse, in [0, 360) degrees
+
+ Description
+     Adds a pulse. A few float compares and a store, so that it can be
+		   called from the capture interrupt
+****************************************************************************/
+void Bearing_Add(BearingSamples *samples, float angle)
+{
+	float offset;
+	
+	if (samples->total < 0xffff)
+	{
+		samples->total++;
+	}
+	
+	if (samples->count == 0)
+	{
+		samples->first = angle;
+		samples->offsets[0] = 0;
+		samples->count = 1;
+		return;
+	}
+	
+	// Keep only every stride'th pulse
+	samples->skipped++;
+	if (samples->skipped < samples->stride)
+	{
+		return;
+	}
+	samples->skipped = 0;
+	
+	// When full, halve the samples and how often we take them
+	if (samples->count >= BEARING_MAX_SAMPLES)
+	{
+		for (int i = 1; i < (BEARING_MAX_SAMPLES / 2); i++)
+		{
+			samples->offsets[i] = samples->offsets[2 * i];
+		}
+		samples->count = BEARING_MAX_SAMPLES / 2;
+		samples->stride <<= 1;
+	}
+	
+	// The angles are within a turn of each other, so one step wraps them
+	offset = angle - samples->first;
+	if (offset >= 180.0f)
+	{
+		offset -= 360.0f;
+	}
+	else if (offset < -180.0f)
+	{
+		offset += 360.0f;
+	}
+	samples->offsets[samples->count++] = offset;
+}
+
+/****************************************************************************
+ Function
+     Bearing_Estimate
+
+ Parameters
+     samples : the samples for one beacon
+		 angle : set to the beacon angle, in [0, 360) degrees
+		 quality : set to the fraction (0 to 1) of samples that agree with it
+
+ Returns
+     false if there are no samples
+****************************************************************************/
+bool Bearing_Estimate(const BearingSamples *samples, float *angle, float *quality)
+{
+	float sorted[BEARING_MAX_SAMPLES];
+	float middle;
+	float sum = 0;
+	uint8_t kept = 0;
+	
+	if (samples->count == 0)
+	{
+		return false;
+	}
+	
+	for (int i = 0; i < samples->count; i++)
+	{
+		sorted[i] = samples->offsets[i];
+	}
+	middle = median(sorted, samples->count);
+	
+	// Average the samples that agree with the median
+	for (int i = 0; i < samples->count; i++)
+	{
+		if (fabsf(sorted[i] - middle) <= BEARING_OUTLIER_DEGREES)
+		{
+			sum += sorted[i];
+			kept++;
+		}
+	}
+	
+	*angle = Geo_WrapDegrees(samples->first + (sum / kept));
+	*quality = ((float) kept) / samples->count;
+	return true;
+}
+
+// Sort the values (insertion sort, as there are few) and return their (lower) median
+static float median(float *values, uint8_t count)
+{
+	for (int i = 1; i < count; i++)
+	{
+		float value = values[i];
+		int j = i - 1;
+		
+		while ((j >= 0) && (values[j] > value))
+		{
+			values[j + 1] = values[j];
+			j--;
+		}
+		values[j + 1] = value;
+	}
+	
+	// The lower median is always one of the samples, so at least one agrees with it
+	return values[(count - 1) / 2];
+}
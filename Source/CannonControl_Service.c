@@ -18,12 +18,19 @@
 #include "Math.h"
 #include "Master_SM.h"
 #include "PositionLogic_Service.h"
+#include "FixedPID.h"
+#include "VelocityEstimate.h"
+#include "FeedForward.h"
+#include "AutoTune.h"
+#include "ParamStore.h"
+#include "IsrTiming.h"
 
 /*----------------------------- Module Defines ----------------------------*/
 //Define Gains
 #define STARTUP_P_GAIN 2.5f
 #define STARTUP_THRESH .2f
 
+// The gains below the target are the defaults, until an autotune stores its own
 #define CONTROL_P_GAIN_BELOW .00145f
 #define CONTROL_D_GAIN_BELOW 0.0000f
 #define I_GAIN_BELOW .000095f
@@ -35,6 +42,46 @@
 #define INTEGRAL_CLAMP_MIN -100
 #define INTEGRAL_CLAMP_MAX 100
 
+#define DUTY_CLAMP_MIN -50
+#define DUTY_CLAMP_MAX 50
+
+// Feed-forward: the integral only trims the duty map, by up to
+// FEEDFORWARD_INTEGRAL duty either way, and the map's trim takes it over at
+// FEEDFORWARD_TRIM_RATE per period per duty while we are within
+// FEEDFORWARD_SETTLED_RPM of the target
+#define FEEDFORWARD_INTEGRAL 5
+#define FEEDFORWARD_SETTLED_RPM 100
+#define FEEDFORWARD_TRIM_RATE 1.6e-4f
+
+// A calibration sweep measures the flywheel at this many duties up to DUTY_CLAMP_MAX
+#define CALIBRATION_POINTS 10
+
+// Autotune steps the flywheel from AUTOTUNE_LOW_DUTY to AUTOTUNE_HIGH_DUTY,
+// averaging AUTOTUNE_PERIODS_PER_SAMPLE control periods into each logged sample
+// (so the log takes about 2.5 s, inside CANNON_AUTOTUNE_LOG_T), then sets the
+// gains below the target for a closed loop AUTOTUNE_CLOSED_LOOP_RATIO as slow
+// as the flywheel. The startup boost and the gains above the target stay as
+// they are
+#define AUTOTUNE_LOW_DUTY 12
+#define AUTOTUNE_HIGH_DUTY 37
+#define AUTOTUNE_PERIODS_PER_SAMPLE 5
+#define AUTOTUNE_CLOSED_LOOP_RATIO 0.5f
+#define CONTROL_PERIOD_S (CANNON_CONTROL_INTERRUPT_PERIOD / 1000000.0f)
+
+// RPM = RPM_NUMERATOR / period. RPM_HEADROOM is how far the numerator can be
+// shifted left in 32 bits, which sets the resolution of the fixed-point RPM
+#define RPM_NUMERATOR ((TICKS_PER_MS * SECS_PER_MIN * MS_PER_SEC) / (FLYWHEEL_GEAR_RATIO * ENCODER_PULSES_PER_REV))
+#define RPM_HEADROOM 3
+
+// The velocity estimator averages over up to a flywheel turn of edges within
+// VELOCITY_WINDOW_MS, and reads zero after VELOCITY_STALE_MS without one
+#define VELOCITY_WINDOW_MS 20
+#define VELOCITY_STALE_MS 100
+
+// Without the estimator, the flywheel has stopped once it goes this long
+// without an edge
+#define STOPPED_TIME_MS 200
+
 //Cannon Test Speeds in RPM
 #define CANNON_TEST_PWM 25
 #define CANNON_TEST_RPM 3500
@@ -45,10 +92,28 @@
    relevant to the behavior of this service
 */
 
+#if FIXED_POINT_CONTROL
+static void calculateControlResponse(q16_t currentRPM);
+static q16_t CalculateRPM(void);
+static bool SpeedCheck(q16_t rpm);
+#else
 static void calculateControlResponse(float currentRPM);
 static float CalculateRPM(void);
 static bool SpeedCheck(float rpm);
+#endif
 static float DetermineCannonSpeed(void);
+static void initLoop(void);
+#if FEED_FORWARD
+static void startCalibration(void);
+static void stepCalibration(void);
+#endif
+#if AUTOTUNE
+static void startAutotune(void);
+static void stepAutotune(void);
+#endif
+#if FEED_FORWARD || AUTOTUNE
+static void stopOpenLoop(void);
+#endif
 static uint16_t SpeedCheckTimeoutCounter;
 
 /*---------------------------- Module Variables ---------------------------*/
@@ -56,8 +121,12 @@ static uint16_t SpeedCheckTimeoutCounter;
 static uint8_t MyPriority;
 
 //Encoder Input Capture Variables
+#if VELOCITY_ESTIMATOR
+static VelocityEstimate Velocity;
+#else
 static uint32_t Period;
 static uint32_t LastCapture;
+#endif
 
 //Target RPM
 static float RPMTarget;
@@ -67,6 +136,52 @@ float integralTerm = 0.0; /* integrator control effort */
 
 bool Revving = false;
 
+//Gains P, I and D below the target
+static GainSet Gains = {CONTROL_P_GAIN_BELOW, I_GAIN_BELOW, CONTROL_D_GAIN_BELOW};
+
+#if FIXED_POINT_CONTROL
+//Fixed-point gain schedule, matching the startup/below/above gains of the float
+// law. initLoop fills in the startup and below gains from Gains
+static PIDGains StartupGains;
+static PIDGains BelowGains;
+static const PIDGains AboveGains = {
+	.p = FLOAT_TO_QSCALED(CONTROL_P_GAIN_ABOVE),
+	.i = FLOAT_TO_QGAIN(I_GAIN_ABOVE),
+	.d = FLOAT_TO_QGAIN(CONTROL_D_GAIN_ABOVE),
+	.pScalesWithError = true
+};
+static const PIDSchedule CannonSchedule = {
+	.startup = &StartupGains,
+	.below = &BelowGains,
+	.above = &AboveGains,
+	.startupFraction = FLOAT_TO_Q16(STARTUP_THRESH)
+};
+static PIDState CannonPID;
+
+//Target RPM in Q16, converted outside of the interrupt
+static q16_t RPMTargetQ16;
+#endif
+
+#if FEED_FORWARD
+//The flywheel's duty map. Until a calibration sweep stores its own this is the
+// test point's slope
+static const FeedForwardPoint DefaultMap[] = {{0, 0}, {CANNON_TEST_PWM, CANNON_TEST_RPM}};
+static FeedForwardMap Map;
+
+//Calibration sweep, which drives the flywheel open loop while it runs
+static FeedForwardSweep Sweep;
+static volatile bool Calibrating = false;
+#endif
+
+#if AUTOTUNE
+//Step test, which drives the flywheel open loop while it runs
+static AutoTuneStep Tune;
+static volatile bool Tuning = false;
+
+//The gains a step test started from, put back if it's cut short
+static GainSet PreviousGains;
+#endif
+
 
 
 /*------------------------------ Module Code ------------------------------*/
@@ -90,9 +205,37 @@ bool InitCannonControlService ( uint8_t Priority )
 	GPIO_Init(CANNONANGLE_SYSCTL, CANNONANGLE_BASE, CANNON_DIRECTION_PIN, OUTPUT);
 	GPIO_Clear(CANNONANGLE_BASE, CANNON_DIRECTION_PIN);
 	
+#if VELOCITY_ESTIMATOR
+	//Initialize the speed estimate before the encoder starts recording edges
+	VelocityEstimate_Init(&Velocity, RPM_NUMERATOR, RPM_HEADROOM, ENCODER_PULSES_PER_REV, VELOCITY_WINDOW_MS * TICKS_PER_MS, VELOCITY_STALE_MS * TICKS_PER_MS);
+#endif
+
 	//Initialize Our Input Captures for Encoder
 	InitInputCapture(CANNON_ENCODER_INTERRUPT_PARAMATERS);
 	
+#if FEED_FORWARD
+	//Load the duty map a calibration stored, or the default, before the
+	// control interrupt starts
+	FeedForwardPoint points[FEEDFORWARD_MAX_POINTS];
+	uint8_t numPoints;
+	if (ParamStore_ReadMap(CANNON_MAP, points, &numPoints))
+	{
+		FeedForward_Init(&Map, points, numPoints, FLOAT_TO_QGAIN(FEEDFORWARD_TRIM_RATE));
+	}
+	else
+	{
+		FeedForward_Init(&Map, DefaultMap, sizeof(DefaultMap) / sizeof(DefaultMap[0]), FLOAT_TO_QGAIN(FEEDFORWARD_TRIM_RATE));
+	}
+#endif
+
+#if AUTOTUNE
+	//Use the gains an autotune stored, if it has
+	ParamStore_ReadGains(CANNON_GAINS, &Gains);
+#endif
+
+	//Initialize the control loop before its interrupt starts
+	initLoop();
+
 	//Initialize Periodic Interrupt for Control Laws
 	InitPeriodic(CANNON_CONTROL_INTERRUPT_PARAMATERS);
 	
@@ -144,12 +287,6 @@ ES_Event RunCannonControlService( ES_Event ThisEvent )
   ES_Event ReturnEvent;
   ReturnEvent.EventType = ES_NO_EVENT; // assume no errors
 
-	// If the flywheel has stopped, set a zero period
-	if (ThisEvent.EventType == ES_TIMEOUT && ThisEvent.EventParam == CANNON_STOPPED_TIMER)
-	{
-		Period = 0;
-	}
-	
 	//If we receive any of these events (from keyboard presses)
 		switch (ThisEvent.EventType){
 			case (ES_START_CANNON):
@@ -172,6 +309,30 @@ ES_Event RunCannonControlService( ES_Event ThisEvent )
 					//setTargetCannonSpeed(0);
 				}
 				break;
+#if FEED_FORWARD
+			case (ES_CALIBRATE_CANNON):
+				startCalibration();
+				break;
+#endif
+#if AUTOTUNE
+			case (ES_AUTOTUNE_CANNON):
+				startAutotune();
+				break;
+#endif
+			case (ES_TIMEOUT):
+#if FEED_FORWARD
+				if (ThisEvent.EventParam == CANNON_CALIBRATION_TIMER)
+				{
+					stepCalibration();
+				}
+#endif
+#if AUTOTUNE
+				if (ThisEvent.EventParam == CANNON_AUTOTUNE_TIMER)
+				{
+					stepAutotune();
+				}
+#endif
+				break;
 			}
 			
 			
@@ -182,6 +343,8 @@ ES_Event RunCannonControlService( ES_Event ThisEvent )
 Interrupt Responses
  ***************************************************************************/
 void CannonEncoder_InterruptResponse(void){
+	uint32_t start = currentTimerValue(CANNON_ENCODER_INTERRUPT_PARAMATERS);
+	uint32_t latency = captureAge(CANNON_ENCODER_INTERRUPT_PARAMATERS);
 	uint32_t ThisCapture;
 
 	// start by clearing the source of the interrupt, the input capture event
@@ -190,14 +353,19 @@ void CannonEncoder_InterruptResponse(void){
 	// now grab the captured value and calculate the period
 	ThisCapture = captureInterrupt(CANNON_ENCODER_INTERRUPT_PARAMATERS);
 
+#if VELOCITY_ESTIMATOR
+	//Record the edge for the speed estimate
+	VelocityEstimate_Edge(&Velocity, ThisCapture);
+#else
   //Update the Period based on the difference between the two rising edges
 	Period = ThisCapture - LastCapture;
 		
 	// update LastCapture to prepare for the next edge
 	LastCapture = ThisCapture;
+#endif
 	
-	//Restart the Timer for the Cannon being Stopped
-	ES_Timer_InitTimer(CANNON_STOPPED_TIMER, CANNON_STOPPED_T);
+	// note how long the other interrupts held us off, and how long we took
+	IsrTiming_Record(ISR_CANNON_ENCODER, latency, currentTimerValue(CANNON_ENCODER_INTERRUPT_PARAMATERS) - start);
 }
 
 //Interrupt Response to Manage our Control Feedback loop to the motors
@@ -205,9 +373,50 @@ void CannonControl_PeriodicInterruptResponse(void){
 	// start by clearing the source of the interrupt
 	clearPeriodicInterrupt(CANNON_CONTROL_INTERRUPT_PARAMATERS);
 	
+#if !VELOCITY_ESTIMATOR
+	// If the flywheel has stopped, set a zero period. The encoder interrupt
+	// only notes the time of each edge, and we compare against it here
+	if (currentTimerValue(CANNON_ENCODER_INTERRUPT_PARAMATERS) - LastCapture >= STOPPED_TIME_MS * TICKS_PER_MS)
+	{
+		Period = 0;
+	}
+#endif
+	
 	//Calculate RPM
+#if FIXED_POINT_CONTROL
+	q16_t currentRPM = CalculateRPM();
+#else
 	static float currentRPM;
 	currentRPM = CalculateRPM();
+#endif
+	
+#if FEED_FORWARD
+	// A calibration sweep drives the flywheel open loop and averages its speed
+	if (Calibrating)
+	{
+#if FIXED_POINT_CONTROL
+		FeedForward_SweepSample(&Sweep, currentRPM);
+#else
+		FeedForward_SweepSample(&Sweep, FLOAT_TO_Q16(currentRPM));
+#endif
+		SetPWM_Cannon(FeedForward_SweepDuty(&Sweep));
+		return;
+	}
+#endif
+	
+#if AUTOTUNE
+	// So does an autotune's step test, logging its speed
+	if (Tuning)
+	{
+#if FIXED_POINT_CONTROL
+		AutoTune_Sample(&Tune, currentRPM);
+#else
+		AutoTune_Sample(&Tune, FLOAT_TO_Q16(currentRPM));
+#endif
+		SetPWM_Cannon(AutoTune_Duty(&Tune));
+		return;
+	}
+#endif
 	
 	// If we're supposed to get the cannon up to speed
 	if (Revving)
@@ -243,6 +452,39 @@ void CannonControl_PeriodicInterruptResponse(void){
 /***************************************************************************
 Control Law
  ***************************************************************************/
+#if FIXED_POINT_CONTROL
+static void calculateControlResponse(q16_t currentRPM){
+	//Calculate Error (target is never negative)
+	q16_t RPMError = RPMTargetQ16 - currentRPM;
+	
+	//Pick the startup, below or above gains and run the control law
+	q16_t RequestedDuty = FixedPID_Update(&CannonPID, FixedPID_ScheduleGains(&CannonSchedule, RPMError, RPMTargetQ16), RPMError);
+	
+#if FEED_FORWARD
+	//Add the duty the map says holds the target, and let its trim take over
+	// the integral once we're on it (and not saturated)
+	RequestedDuty += FeedForward_Duty(&Map, RPMTargetQ16);
+	if (RequestedDuty > INT_TO_Q16(DUTY_CLAMP_MAX))
+	{
+		RequestedDuty = INT_TO_Q16(DUTY_CLAMP_MAX);
+	}
+	else if (RequestedDuty < INT_TO_Q16(DUTY_CLAMP_MIN))
+	{
+		RequestedDuty = INT_TO_Q16(DUTY_CLAMP_MIN);
+	}
+	else if ((RPMTargetQ16 != 0) && (Q16_ABS(RPMError) < INT_TO_Q16(FEEDFORWARD_SETTLED_RPM)))
+	{
+		FeedForward_Trim(&Map, CannonPID.integral);
+	}
+#endif
+	
+	//Call the Set PWM Function on the clamped RequestedDuty Value
+	if (RPMTargetQ16 != 0)
+	{
+		SetPWM_Cannon(Q16_TO_FLOAT(RequestedDuty));
+	}
+}
+#else
 static void calculateControlResponse(float currentRPM){
 	static float RPMError; /* make static for speed */
 	static float LastError; /* for Derivative Control */
@@ -256,15 +498,25 @@ static void calculateControlResponse(float currentRPM){
 	
 
 	//Determine Integral Term
-	integralTerm += (above ? I_GAIN_ABOVE : I_GAIN_BELOW ) * RPMError;
+#if FEED_FORWARD
+	//The map holds the target, so the integral only trims it, and we don't
+	// wind it up while we spin up
+	if (RPMError <= (STARTUP_THRESH) * RPMTarget)
+	{
+		integralTerm += (above ? I_GAIN_ABOVE : Gains.i) * RPMError;
+	}
+	integralTerm = clamp(integralTerm, -FEEDFORWARD_INTEGRAL, FEEDFORWARD_INTEGRAL);
+#else
+	integralTerm += (above ? I_GAIN_ABOVE : Gains.i) * RPMError;
 	integralTerm = clamp(integralTerm, INTEGRAL_CLAMP_MIN, INTEGRAL_CLAMP_MAX); /* anti-windup */
+#endif
 	
 	
 	//if we are below the target use D gain if not set it to zero
 	static float D_GAIN ;
 	//if (RPMError > 0)
 	//{
-	D_GAIN = above ? CONTROL_D_GAIN_ABOVE : CONTROL_D_GAIN_BELOW;
+	D_GAIN = above ? CONTROL_D_GAIN_ABOVE : Gains.d;
 	//} else {
 	//	D_GAIN = 0;
 	//}
@@ -275,7 +527,7 @@ static void calculateControlResponse(float currentRPM){
 	{
 		P_GAIN = STARTUP_P_GAIN;
 	} else {
-		P_GAIN = above ? CONTROL_P_GAIN_ABOVE*fabs(RPMError) : CONTROL_P_GAIN_BELOW;
+		P_GAIN = above ? CONTROL_P_GAIN_ABOVE*fabs(RPMError) : Gains.p;
 	}
 	
 	
@@ -287,6 +539,13 @@ static void calculateControlResponse(float currentRPM){
 	}
 	
 	float RequestedDuty = proportionalResponse + derviativeResponse + 	integralTerm;		//(P_GAIN * ((RPMError)+integralTerm+(D_GAIN * (RPMError-LastError))));
+#if FEED_FORWARD
+	RequestedDuty += Q16_TO_FLOAT(FeedForward_Duty(&Map, FLOAT_TO_Q16(fabsf(RPMTarget))));
+	if ((RPMTarget != 0) && (fabsf(RPMError) < FEEDFORWARD_SETTLED_RPM) && (RequestedDuty > DUTY_CLAMP_MIN) && (RequestedDuty < DUTY_CLAMP_MAX))
+	{
+		FeedForward_Trim(&Map, FLOAT_TO_Q16(integralTerm));
+	}
+#endif
 
 	
 	//Save the Last Error
@@ -295,9 +554,10 @@ static void calculateControlResponse(float currentRPM){
 	//Call the Set PWM Function on the clamped RequestedDuty Value
 	if (RPMTarget != 0)
 	{
-		SetPWM_Cannon(clamp(RequestedDuty, -50, 50));
+		SetPWM_Cannon(clamp(RequestedDuty, DUTY_CLAMP_MIN, DUTY_CLAMP_MAX));
 	}
 }
+#endif
 
 
 
@@ -306,13 +566,39 @@ static void calculateControlResponse(float currentRPM){
      Set the New Target Speed Function
 ****************************************************************************/
 void setTargetCannonSpeed(uint32_t newCannonRPM){
+#if FEED_FORWARD || AUTOTUNE
+	//A new speed cuts a calibration sweep or step test short, from rest. That
+	// covers ES_STOP_CANNON
+	stopOpenLoop();
+#endif
 	RPMTarget = newCannonRPM;
-	ES_Timer_InitTimer(CANNON_STOPPED_TIMER, CANNON_STOPPED_T);
+#if FIXED_POINT_CONTROL
+	RPMTargetQ16 = INT_TO_Q16(newCannonRPM);
+#endif
 }
 
 //Returns the RPM
+#if FIXED_POINT_CONTROL
+static q16_t CalculateRPM(void)
+{
+#if VELOCITY_ESTIMATOR
+	return VelocityEstimate_RPM(&Velocity, currentTimerValue(CANNON_ENCODER_INTERRUPT_PARAMATERS));
+#else
+	return FixedPID_Ratio(RPM_NUMERATOR, Period, RPM_HEADROOM);
+#endif
+}
+
+// Return true if the cannon has reached its target RPM
+static bool SpeedCheck(q16_t rpm)
+{
+	return (rpm <= RPMTargetQ16 + INT_TO_Q16(CANNON_RPM_TOLERANCE)) && (rpm >= RPMTargetQ16 - INT_TO_Q16(CANNON_RPM_TOLERANCE));
+}
+#else
 static float CalculateRPM(void) 
 {
+#if VELOCITY_ESTIMATOR
+	return Q16_TO_FLOAT(VelocityEstimate_RPM(&Velocity, currentTimerValue(CANNON_ENCODER_INTERRUPT_PARAMATERS)));
+#else
 	if (Period == 0)
 	{
 		return 0;
@@ -321,6 +607,7 @@ static float CalculateRPM(void)
 	{
 		return ((TICKS_PER_MS * SECS_PER_MIN * MS_PER_SEC) / ((float) Period * FLYWHEEL_GEAR_RATIO * ENCODER_PULSES_PER_REV));
 	}
+#endif
 }
 
 // Return true if the cannon has reached its target RPM
@@ -328,6 +615,165 @@ static bool SpeedCheck(float rpm)
 {
 	return (rpm <= RPMTarget + CANNON_RPM_TOLERANCE) && (rpm >= RPMTarget - CANNON_RPM_TOLERANCE);
 }
+#endif
+
+#if FEED_FORWARD
+// Stop the flywheel and sweep its duty to calibrate the map
+static void startCalibration(void)
+{
+	printf("Calibrating the flywheel feed-forward\r\n");
+	Revving = false;
+	setTargetCannonSpeed(0);
+	FeedForward_StartSweep(&Sweep, DUTY_CLAMP_MAX, CALIBRATION_POINTS);
+	Calibrating = true;
+	ES_Timer_InitTimer(CANNON_CALIBRATION_TIMER, CANNON_CALIBRATION_SETTLE_T);
+}
+
+// Move the sweep on once the flywheel has settled or been measured, and
+// rebuild and store the map from it when it's done
+static void stepCalibration(void)
+{
+	//A new speed has cut the sweep short
+	if (!Calibrating)
+	{
+		return;
+	}
+	
+	if (FeedForward_SweepNext(&Sweep))
+	{
+		ES_Timer_InitTimer(CANNON_CALIBRATION_TIMER, Sweep.measuring ? CANNON_CALIBRATION_MEASURE_T : CANNON_CALIBRATION_SETTLE_T);
+		return;
+	}
+	
+	EnterCritical();
+	Calibrating = false;
+	FeedForward_Init(&Map, Sweep.points, Sweep.numPoints, FLOAT_TO_QGAIN(FEEDFORWARD_TRIM_RATE));
+	ExitCritical();
+	
+	//The control law leaves the duty alone at a zero target, so stop it here
+	SetPWM_Cannon(0);
+	printf("Flywheel map: ");
+	FeedForward_PrintSweep(&Sweep);
+	
+	//Only keep a map that found the flywheel turning
+	if (Map.numPoints < 2)
+	{
+		printf("The flywheel never turned, so the map wasn't stored\r\n");
+	}
+	else if (!ParamStore_WriteMap(CANNON_MAP, Sweep.points, Sweep.numPoints))
+	{
+		printf("Couldn't store the flywheel map\r\n");
+	}
+}
+#endif
+
+#if AUTOTUNE
+// Stop the flywheel and step test it to work out its gains
+static void startAutotune(void)
+{
+	printf("Autotuning the flywheel\r\n");
+	Revving = false;
+	setTargetCannonSpeed(0);
+	AutoTune_Start(&Tune, AUTOTUNE_LOW_DUTY, AUTOTUNE_HIGH_DUTY, AUTOTUNE_PERIODS_PER_SAMPLE);
+	PreviousGains = Gains;
+	Tuning = true;
+	ES_Timer_InitTimer(CANNON_AUTOTUNE_TIMER, CANNON_AUTOTUNE_SETTLE_T);
+}
+
+// Start logging once the flywheel has settled at the low duty, and work out
+// and store its gains once the log is full
+static void stepAutotune(void)
+{
+	PlantModel plant;
+	float kp, ki;
+	
+	//A new speed has cut the test short
+	if (!Tuning)
+	{
+		return;
+	}
+	
+	if (!AutoTune_Done(&Tune))
+	{
+		AutoTune_StartLogging(&Tune);
+		ES_Timer_InitTimer(CANNON_AUTOTUNE_TIMER, CANNON_AUTOTUNE_LOG_T);
+		return;
+	}
+	Tuning = false;
+	
+	//The control law leaves the duty alone at a zero target, so stop it here
+	SetPWM_Cannon(0);
+	
+	if (!AutoTune_Fit(&Tune, CONTROL_PERIOD_S, &plant))
+	{
+		printf("Flywheel autotune failed, keeping P %g I %g D %g\r\n", Gains.p, Gains.i, Gains.d);
+		return;
+	}
+	AutoTune_PIGains(&plant, AUTOTUNE_CLOSED_LOOP_RATIO, CONTROL_PERIOD_S, &kp, &ki);
+	
+	EnterCritical();
+	Gains.p = kp;
+	Gains.i = ki;
+	Gains.d = 0;
+	initLoop();
+	ExitCritical();
+	
+	printf("Flywheel: %g RPM per duty, time constant %g s, dead time %g s\r\n", plant.gain, plant.timeConstant, plant.deadTime);
+	printf("Flywheel gains: P %g I %g D %g%s\r\n", Gains.p, Gains.i, Gains.d, ParamStore_WriteGains(CANNON_GAINS, &Gains) ? "" : " (couldn't store them)");
+}
+#endif
+
+#if FEED_FORWARD || AUTOTUNE
+// Cut a calibration sweep or step test short, leaving the flywheel stopped
+// and an autotune's gains as they were
+static void stopOpenLoop(void)
+{
+#if FEED_FORWARD
+	if (Calibrating)
+	{
+		Calibrating = false;
+		SetPWM_Cannon(0);
+	}
+#endif
+#if AUTOTUNE
+	if (Tuning)
+	{
+		EnterCritical();
+		Tuning = false;
+		Gains = PreviousGains;
+		initLoop();
+		ExitCritical();
+		SetPWM_Cannon(0);
+	}
+#endif
+}
+#endif
+
+// Set up the control loop from Gains, clearing its integral
+static void initLoop(void)
+{
+#if FIXED_POINT_CONTROL
+	StartupGains.p = FLOAT_TO_QGAIN(STARTUP_P_GAIN);
+#if FEED_FORWARD
+	StartupGains.i = 0; // the map holds the target, so winding up on the way would only overshoot it
+#else
+	StartupGains.i = FLOAT_TO_QGAIN(Gains.i);
+#endif
+	StartupGains.d = FLOAT_TO_QGAIN(Gains.d);
+	StartupGains.pScalesWithError = false;
+	BelowGains.p = FLOAT_TO_QGAIN(Gains.p);
+	BelowGains.i = FLOAT_TO_QGAIN(Gains.i);
+	BelowGains.d = FLOAT_TO_QGAIN(Gains.d);
+	BelowGains.pScalesWithError = false;
+#if FEED_FORWARD
+	FixedPID_Init(&CannonPID, INT_TO_Q16(-FEEDFORWARD_INTEGRAL), INT_TO_Q16(FEEDFORWARD_INTEGRAL), INT_TO_Q16(DUTY_CLAMP_MIN), INT_TO_Q16(DUTY_CLAMP_MAX));
+#else
+	FixedPID_Init(&CannonPID, INT_TO_Q16(INTEGRAL_CLAMP_MIN), INT_TO_Q16(INTEGRAL_CLAMP_MAX), INT_TO_Q16(DUTY_CLAMP_MIN), INT_TO_Q16(DUTY_CLAMP_MAX));
+#endif
+#else
+	integralTerm = 0;
+#endif
+}
 
 // Determine how fast the cannon should rev given its distance to the bucket
 // Use a quadratic relationship
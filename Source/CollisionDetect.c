@@ -0,0 +1,108 @@
+/****************************************************************************
+ Module
+   CollisionDetect.c
+
+ Description
+		Spots a drive wheel that has run into something, from the duty we
+		  drive it with and the speed we measure. A first-order model of the
+			motor turns the duty into the speed it should reach (the caller
+			looks that up in the motor's feed-forward map). A wheel that has
+			hit something falls well short of that and keeps slowing down
+			however hard the speed loop pushes. A wheel that is only lagging the
+			model, say while starting up, is speeding up. Period to period the
+			measured speed is mostly encoder noise, so we judge that against the
+			speed COLLISION_LOOKBACK periods back, and call a wheel speeding up
+			only once it has gained a few RPM on it. We call a collision once
+			the measured speed is short of the model by the margin, and not
+			speeding up, for a few control periods in a row. That takes tens of
+			milliseconds instead of the stall timeout's seconds. We only judge
+			while the duty is high enough to mean it (coasting and braking slow
+			the wheel faster than the model would), and not while the wheel
+			reads zero, which it also does until it has got going. The stall
+			timeout still covers a wheel that never moves.
+****************************************************************************/
+
+#include "ES_Configure.h"
+#include "ES_Framework.h"
+#include "CollisionDetect.h"
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     CollisionDetect_Reset
+
+ Description
+     Starts the model from rest
+****************************************************************************/
+void CollisionDetect_Reset(CollisionState *state)
+{
+	uint8_t i;
+
+	state->modelRPM = 0;
+	for (i = 0; i < COLLISION_LOOKBACK; i++)
+	{
+		state->history[i] = 0;
+	}
+	state->next = 0;
+	state->forward = true;
+	state->count = 0;
+}
+
+/****************************************************************************
+ Function
+     CollisionDetect_Update
+
+ Parameters
+     state : the motor's detector
+		 model : its motor model and margins
+		 duty : the duty (percent) we are driving it with this period
+		 steadyRPM : the speed (Q16 RPM) that duty holds the motor at
+		 forward : the direction we are driving it
+		 measuredRPM : its measured speed (Q16 RPM, either direction)
+
+ Returns
+     true if it has run into something. We then start counting again, so
+		   a wheel that stays stuck reports again after as many periods
+****************************************************************************/
+bool CollisionDetect_Update(CollisionState *state, const CollisionModel *model, uint8_t duty, q16_t steadyRPM, bool forward, q16_t measuredRPM)
+{
+	q16_t expected;
+	bool slowing;
+
+	// Reversing: the model's speed is now the wrong way, and it has to pass
+	// through zero before we can expect anything of the wheel. The speeds we
+	// kept were the other way too
+	if (forward != state->forward)
+	{
+		q16_t modelRPM = state->modelRPM;
+
+		CollisionDetect_Reset(state);
+		state->modelRPM = -modelRPM;
+		state->forward = forward;
+	}
+
+	// Step the model toward the speed this duty should give
+	state->modelRPM += Q16_MUL(model->decay, steadyRPM - state->modelRPM);
+
+	// Short of the model by the margin, and turning but not speeding up
+	expected = Q16_MUL(model->keep, state->modelRPM) - model->offset;
+	slowing = (measuredRPM > 0) && (measuredRPM < state->history[state->next] + model->rise);
+	state->history[state->next] = measuredRPM;
+	state->next = (state->next + 1) % COLLISION_LOOKBACK;
+
+	if ((duty >= model->minDuty) && (measuredRPM < expected) && slowing)
+	{
+		state->count++;
+	}
+	else
+	{
+		state->count = 0;
+	}
+
+	if (state->count >= model->periods)
+	{
+		state->count = 0;
+		return true;
+	}
+	return false;
+}
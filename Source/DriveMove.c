@@ -0,0 +1,113 @@
+/****************************************************************************
+ Module
+   DriveMove.c
+
+ Description
+		The two-wheel side of the drive's profiled tick moves. The motion
+		  profile runs on the wheel with further to go, and the other follows
+			at its share of that speed. Cross-coupling pulls the follower back
+			to its share of the lead wheel's ticks, by speeding one wheel up and
+			slowing the other in proportion to how far they are out of step.
+			The move arrives on both wheels' ticks together, once the wheels
+			have settled close to the target.
+****************************************************************************/
+
+#include "ES_Configure.h"
+#include "ES_Framework.h"
+#include "DriveMove.h"
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     DriveMove_SyncCorrection
+
+ Parameters
+     leadTicks, followTicks : each wheel's ticks since the move (or steer)
+		   began
+		 followRatio : the follower's share of the lead wheel's ticks (Q16)
+		 gain : RPM per tick out of step (Q16)
+		 maxCorrection : the most we correct by (Q16 RPM)
+
+ Returns
+     how much faster to drive the lead wheel, and slower the follower (Q16
+		   RPM). Negative when the follower has got ahead
+****************************************************************************/
+q16_t DriveMove_SyncCorrection(uint32_t leadTicks, uint32_t followTicks, q16_t followRatio, q16_t gain, q16_t maxCorrection)
+{
+	q16_t error = INT_TO_Q16(followTicks) - (q16_t) ((int64_t) leadTicks * followRatio);
+	q16_t correction = Q16_MUL(error, gain);
+	
+	if (correction > maxCorrection)
+	{
+		return maxCorrection;
+	}
+	if (correction < -maxCorrection)
+	{
+		return -maxCorrection;
+	}
+	return correction;
+}
+
+/****************************************************************************
+ Function
+     DriveMove_TicksToGo
+
+ Parameters
+     tickSum, targetSum : both wheels' ticks so far and to the target, added
+		   together
+		 followRatio : the follower's share of the lead wheel's ticks (Q16)
+
+ Returns
+     the lead wheel ticks to go for the motion profile. The wheels between
+		   them have (1 + followRatio) ticks to go for every lead wheel tick;
+			 we round up so we don't stop short
+****************************************************************************/
+uint32_t DriveMove_TicksToGo(uint32_t tickSum, uint32_t targetSum, q16_t followRatio)
+{
+	if (tickSum >= targetSum)
+	{
+		return 0;
+	}
+	return (uint32_t) ((((uint64_t) (targetSum - tickSum) << Q16_SHIFT) + INT_TO_Q16(1) + followRatio - 1) / (uint64_t) (INT_TO_Q16(1) + followRatio));
+}
+
+/****************************************************************************
+ Function
+     DriveMove_ResetSettle
+
+ Description
+     Starts watching a new move (or steer) from moving
+****************************************************************************/
+void DriveMove_ResetSettle(SettleState *settle)
+{
+	settle->stillPeriods = 0;
+}
+
+/****************************************************************************
+ Function
+     DriveMove_Settled
+
+ Parameters
+     settle : the move's settle state
+		 tickSum, targetSum : as for DriveMove_TicksToGo
+		 tolerance : how many ticks short still counts as there
+		 periods : control periods without a tick that count as settled
+
+ Returns
+     true once the wheels are within tolerance of the target and neither
+		   has ticked for periods. Call it every control period. The encoders
+			 can't tell us we've overshot, so that counts as close too
+****************************************************************************/
+bool DriveMove_Settled(SettleState *settle, uint32_t tickSum, uint32_t targetSum, uint32_t tolerance, uint8_t periods)
+{
+	if (tickSum != settle->lastTickSum)
+	{
+		settle->lastTickSum = tickSum;
+		settle->stillPeriods = 0;
+	}
+	else if (settle->stillPeriods < periods)
+	{
+		settle->stillPeriods++;
+	}
+	return (tickSum + tolerance >= targetSum) && (settle->stillPeriods >= periods);
+}
@@ -23,13 +23,37 @@
 #include "PositionLogic_Service.h"
 #include "PhotoTransistor_Service.h"
 #include "Strategy_SM.h"
+#include "FixedPID.h"
+#include "Odometry.h"
+#include "MotionProfile.h"
+#include "MotionQueue.h"
+#include "DriveMove.h"
+#include "EdgeWatch.h"
+#include "VelocityEstimate.h"
+#include "CollisionDetect.h"
+#include "FeedForward.h"
+#include "AutoTune.h"
+#include "ParamStore.h"
 
 /*----------------------------- Module Defines ----------------------------*/
-//Define Gains
+//Define Gains (the defaults, until an autotune stores its own)
 #define P_GAIN 1.32f
 #define D_GAIN  0.0f //2.5f
 #define I_GAIN .15f
 
+#define DUTY_MIN 0
+#define DUTY_MAX 100
+
+// RPM = RPM_NUMERATOR / period. RPM_HEADROOM is how far the numerator can be
+// shifted left in 32 bits, which sets the resolution of the fixed-point RPM
+#define RPM_NUMERATOR ((TICKS_PER_MS * SECS_PER_MIN * MS_PER_SEC) / (DRIVE_GEAR_RATIO * ENCODER_PULSES_PER_REV))
+#define RPM_HEADROOM 8
+
+// The velocity estimator averages over up to a motor turn of edges within
+// VELOCITY_WINDOW_MS, and reads zero after VELOCITY_STALE_MS without one
+#define VELOCITY_WINDOW_MS 12
+#define VELOCITY_STALE_MS 100
+
 //Test Conditions
 #define FULL_SPEED 100.0f
 #define HALF_SPEED_L 50.0f
@@ -38,26 +62,128 @@
 #define ROTATE_90_TIME 500
 #define ROTATE_45_TIME 300
 
+//A wheel has stopped once it goes STOPPED_TIME_MS without an edge, and has
+// stalled (we report a collision) if it should be turning and goes
+// STALL_THRESHOLD + 1 of those
+#define STOPPED_TIME_MS 350
 #define STALL_THRESHOLD 4
+#define STALL_TIME_MS (STOPPED_TIME_MS * (STALL_THRESHOLD + 1))
+
+//A wheel has run into something once, while driven at COLLISION_MIN_DUTY or
+// more, it reads below (1 - COLLISION_MARGIN) of its motor model's speed less
+// COLLISION_OFFSET_RPM, and isn't speeding up (by COLLISION_RISE_RPM over
+// COLLISION_LOOKBACK periods), for COLLISION_PERIODS control periods in a row
+#define COLLISION_MARGIN 0.4f
+#define COLLISION_OFFSET_RPM 20.0f
+#define COLLISION_RISE_RPM 3.0f
+#define COLLISION_MIN_DUTY 15
+#define COLLISION_PERIODS 5
+
+//Feed-forward: the loops' integrals only trim the duty maps, by up to
+// FEEDFORWARD_INTEGRAL duty either way. While a wheel is within
+// FEEDFORWARD_SETTLED_RPM of its target, its map's trim takes over what the
+// integral adds at FEEDFORWARD_TRIM_RATE per period per duty (a couple of seconds)
+#define FEEDFORWARD_INTEGRAL 10
+#define FEEDFORWARD_SETTLED_RPM 5
+#define FEEDFORWARD_TRIM_RATE 1.7e-5f
+
+//A calibration sweep measures each wheel at this many duties up to DUTY_MAX
+#define CALIBRATION_POINTS 10
+
+//Autotune steps both wheels from AUTOTUNE_LOW_DUTY to AUTOTUNE_HIGH_DUTY,
+// averaging AUTOTUNE_PERIODS_PER_SAMPLE control periods into each logged sample
+// (so the log takes about half a second, inside DRIVE_AUTOTUNE_LOG_T), then
+// sets gains for a closed loop AUTOTUNE_CLOSED_LOOP_RATIO as slow as the motors
+#define AUTOTUNE_LOW_DUTY 25
+#define AUTOTUNE_HIGH_DUTY 75
+#define AUTOTUNE_PERIODS_PER_SAMPLE 4
+#define AUTOTUNE_CLOSED_LOOP_RATIO 0.2f
+#define CONTROL_PERIOD_S (DRIVE_CONTROL_INTERRUPT_PERIOD / 1000000.0f)
+
+//While following a path we ask for a new steer every PATH_UPDATE_PERIODS
+// control periods, until we are within PATH_FINAL_TICKS of the end
+#define PATH_UPDATE_PERIODS 10
+#define PATH_FINAL_TICKS 40
+#if PATH_FOLLOWING && !PROFILED_MOVES
+#error "PATH_FOLLOWING needs PROFILED_MOVES"
+#endif
+
+//Cross-coupling: RPM we move each wheel's target per tick the wheels are out
+// of step, up to SYNC_MAX_RPM
+#define SYNC_GAIN 4.0f
+#define SYNC_MAX_RPM 20.0f
+
+//A profiled move arrives once both wheels between them are within
+// ARRIVAL_TOLERANCE ticks of the target and neither has ticked for
+// SETTLE_PERIODS control periods
+#define ARRIVAL_TOLERANCE 2
+#define SETTLE_PERIODS 15
 
 /*---------------------------- Module Functions ---------------------------*/
 /* prototypes for private functions for this service.They should be functions
    relevant to the behavior of this service
 */
 
-static uint8_t calculateControlResponse(uint32_t ThisPeriod, float integralTerm, float targetSpeed, bool isRight);
+#if FIXED_POINT_CONTROL
+static uint8_t calculateControlResponse(q16_t currentRPM, PIDState *pid, q16_t targetSpeed, bool isRight);
+static q16_t CalculateRPM(bool isRight);
+#else
+static uint8_t calculateControlResponse(float currentRPM, float integralTerm, float targetSpeed, bool isRight);
+static float CalculateRPM(bool isRight);
+#endif
+static void initLoops(void);
 static void implementControlResponse(uint8_t left, uint8_t right);
-static float CalculateRPM(uint32_t period);
+static void checkStalls(void);
+#if MODEL_COLLISIONS
+static void checkCollisions(uint8_t leftDuty, uint8_t rightDuty, q16_t leftRPM, q16_t rightRPM);
+static q16_t steadyRPM(uint8_t duty, bool isRight);
+#endif
+#if FEED_FORWARD
+static void startCalibration(void);
+static void stepCalibration(void);
+static void sweepPeriod(void);
+static void loadMap(FeedForwardMap *map, DutyMapID id, const FeedForwardPoint *defaults, uint8_t numDefaults);
+#endif
+#if AUTOTUNE
+static void startAutotune(void);
+static void stepAutotune(void);
+static void tunePeriod(void);
+#endif
+#if FEED_FORWARD || AUTOTUNE
+static void stopOpenLoop(void);
+#endif
+static void startMove(uint32_t leftTicks, uint32_t rightTicks, bool negativeLeft, bool negativeRight);
+static bool queueMove(uint32_t leftTicks, uint32_t rightTicks, bool negativeLeft, bool negativeRight);
+static bool startNextMove(void);
+static void clearMotionQueue(void);
+#if PROFILED_MOVES
+static void startProfile(uint32_t leftTicks, uint32_t rightTicks, bool negativeLeft, bool negativeRight);
+static void updateProfile(void);
+static q16_t syncCorrection(void);
+static bool nextMoveContinues(void);
+#endif
+#if PATH_FOLLOWING
+static bool reversesWheel(float leftScale, float rightScale);
+static void brakeForSteer(void);
+static void startPendingSteer(void);
+#endif
+static bool reachedTarget(void);
+static void arrive(void);
 
 /*---------------------------- Module Variables ---------------------------*/
 // with the introduction of Gen2, we need a module level Priority variable
 static uint8_t MyPriority;
 
 //Encoder Input Capture Variables
+#if VELOCITY_ESTIMATOR
+static VelocityEstimate Velocity_Left;
+static VelocityEstimate Velocity_Right;
+#else
 static uint32_t Left_Period;
 static uint32_t Left_LastCapture;
 static uint32_t Right_Period;
 static uint32_t Right_LastCapture;
+#endif
 
 //Encoder Tick Counters
 static uint32_t LeftEncoderTicks;
@@ -67,6 +193,10 @@ static uint32_t RightEncoderTicks;
 static float RPMTarget_Left;
 static float RPMTarget_Right;
 
+//Direction each wheel was last driven, for odometry (kept while coasting to a stop)
+static bool LeftForward = true;
+static bool RightForward = true;
+
 //TargetTicks
 static uint32_t TargetTicks_Left;
 static uint32_t TargetTicks_Right;
@@ -77,13 +207,109 @@ static float integralTerm_Right = 0.0; /* integrator control effort */
 static float LastError_Left = 0;
 static float LastError_Right = 0;
 
+//Speed loop gains P, I and D for both wheels
+static GainSet Gains = {P_GAIN, I_GAIN, D_GAIN};
+
+#if FIXED_POINT_CONTROL
+//Fixed-point controls, set up from Gains by initLoops
+static PIDGains DriveGains;
+static PIDState PID_Left;
+static PIDState PID_Right;
+
+//Target RPM magnitudes in Q16, converted outside of the interrupt
+static q16_t RPMTargetQ16_Left;
+static q16_t RPMTargetQ16_Right;
+#endif
+
+#if PROFILED_MOVES
+//Motion profile for tick moves. It runs on the wheel with further to go, and
+// the other wheel follows at FollowRatio of its speed
+static const MotionLimits DriveLimits = MOTION_LIMITS(PROFILE_MAX_RPM, PROFILE_MIN_RPM, PROFILE_ACCELERATION,
+	PROFILE_JERK, PROFILE_STOP_ACCELERATION, PROFILE_POSITION_GAIN, DRIVE_CONTROL_INTERRUPT_PERIOD,
+	DRIVE_GEAR_RATIO * ENCODER_PULSES_PER_REV);
+static MotionProfile Profile;
+static bool Profiling = false;
+static bool LeftLeads;
+static q16_t FollowRatio;
+#endif
+
+#if PATH_FOLLOWING
+//Set while the profile is following a path that PositionLogic steers
+static bool Following = false;
+static bool PathUpdatePending = false;
+static uint8_t PathPeriods = 0;
+
+//A steer that would reverse a wheel we are driving, held until the profile
+// has brought us to rest
+static bool SteerPending = false;
+static uint32_t PendingTicks;
+static float PendingLeftScale;
+static float PendingRightScale;
+#endif
+
+//Queued moves (rotate, drive or arc, all as tick moves) that we run back to
+// back from the encoder interrupts, only posting ES_ARRIVED after the last one
+static MotionQueue Queue;
+static bool QueueActive = false; // the current move came from the queue
+static MotionPrimitive CurrentMove;
+
+#if PROFILED_MOVES
+//Lead wheel ticks of the queued moves that carry straight on from the current
+// one, which the profile doesn't brake for
+static uint32_t BlendTicks = 0;
+
+//Each wheel's count when the current move (or steer) started, which the
+// cross-coupling measures from
+static uint32_t SyncBase_Left = 0;
+static uint32_t SyncBase_Right = 0;
+
+//Control periods since either wheel last ticked, for settling on the target
+static SettleState Settle;
+#endif
+
 static bool isMoving = false; //initialize to false
 
 static bool AligningToBucket = false;
 static bool BackingUp = false;
 
-static uint8_t StallCounter_Left = 0;
-static uint8_t StallCounter_Right = 0;
+//Each wheel's last edge time (on its capture timer), which the control
+// interrupt checks for stalls. We watch for them from the start of a drive
+// until we report one
+static EdgeWatch Edges_Left;
+static EdgeWatch Edges_Right;
+static bool WatchingStalls = false;
+
+#if MODEL_COLLISIONS
+//Each drive motor's model, run on the duty we give it, to spot collisions early
+static const CollisionModel DriveModel = COLLISION_MODEL(DRIVE_TIME_CONSTANT_MS, DRIVE_CONTROL_INTERRUPT_PERIOD,
+	COLLISION_MARGIN, COLLISION_OFFSET_RPM, COLLISION_RISE_RPM, COLLISION_MIN_DUTY, COLLISION_PERIODS);
+static CollisionState Collision_Left;
+static CollisionState Collision_Right;
+#endif
+
+#if FEED_FORWARD
+//Each wheel's duty map. Until a calibration sweep stores its own these are the
+// motor model's
+static const FeedForwardPoint DefaultMap_Left[] = {{0, 0}, {DUTY_MAX, (uint16_t) (DUTY_MAX * DRIVE_RPM_PER_DUTY)}};
+static const FeedForwardPoint DefaultMap_Right[] = {{0, 0}, {DUTY_MAX, (uint16_t) (DUTY_MAX * DRIVE_RPM_PER_DUTY)}};
+static FeedForwardMap Map_Left;
+static FeedForwardMap Map_Right;
+
+//Calibration sweeps, which drive both wheels open loop while they run
+static FeedForwardSweep Sweep_Left;
+static FeedForwardSweep Sweep_Right;
+static volatile bool Calibrating = false;
+#endif
+
+#if AUTOTUNE
+//Step tests, which drive both wheels open loop while they run
+static AutoTuneStep Tune_Left;
+static AutoTuneStep Tune_Right;
+static volatile bool Tuning = false;
+
+//The gains a step test started from, put back if it's cut short
+static GainSet PreviousGains;
+#endif
 
 /*------------------------------ Module Code ------------------------------*/
 /****************************************************************************
@@ -103,10 +329,41 @@ bool InitDriveTrainControlService ( uint8_t Priority )
 
   MyPriority = Priority;
 
+#if VELOCITY_ESTIMATOR
+	//Initialize the speed estimates before the encoders start recording edges
+	VelocityEstimate_Init(&Velocity_Left, RPM_NUMERATOR, RPM_HEADROOM, ENCODER_PULSES_PER_REV, VELOCITY_WINDOW_MS * TICKS_PER_MS, VELOCITY_STALE_MS * TICKS_PER_MS);
+	VelocityEstimate_Init(&Velocity_Right, RPM_NUMERATOR, RPM_HEADROOM, ENCODER_PULSES_PER_REV, VELOCITY_WINDOW_MS * TICKS_PER_MS, VELOCITY_STALE_MS * TICKS_PER_MS);
+#endif
+
+	//Start the stall checks from no edges, before the encoders record any
+	EdgeWatch_Init(&Edges_Left);
+	EdgeWatch_Init(&Edges_Right);
+	
 	//Initialize Our Input Captures for Each Powertrain Encoder
 	InitInputCapture(DRIVE_LEFT_ENCODER_INTERRUPT_PARAMATERS);
 	InitInputCapture(DRIVE_RIGHT_ENCODER_INTERRUPT_PARAMATERS);
 	
+#if FEED_FORWARD
+	//Load the duty maps a calibration stored, or the defaults, before the
+	// control interrupt starts
+	loadMap(&Map_Left, DRIVE_LEFT_MAP, DefaultMap_Left, sizeof(DefaultMap_Left) / sizeof(DefaultMap_Left[0]));
+	loadMap(&Map_Right, DRIVE_RIGHT_MAP, DefaultMap_Right, sizeof(DefaultMap_Right) / sizeof(DefaultMap_Right[0]));
+#endif
+
+#if AUTOTUNE
+	//Use the gains an autotune stored, if it has
+	ParamStore_ReadGains(DRIVE_GAINS, &Gains);
+#endif
+
+	//Initialize the control loops before their interrupt starts
+	initLoops();
+
+#if MODEL_COLLISIONS
+	//Start the motor models from rest
+	CollisionDetect_Reset(&Collision_Left);
+	CollisionDetect_Reset(&Collision_Right);
+#endif
+
 	//Initialize Periodic Interrupt for Control Laws
 	InitPeriodic(DRIVE_CONTROL_INTERRUPT_PARAMATERS);
   
@@ -182,70 +439,35 @@ ES_Event RunDriveTrainControlService( ES_Event ThisEvent )
 			case (ES_STOP_DRIVE):
 				setTargetDriveSpeed(0, 0);
 				break;
+#if FEED_FORWARD
+			case (ES_CALIBRATE_DRIVE):
+				startCalibration();
+				break;
+#endif
+#if AUTOTUNE
+			case (ES_AUTOTUNE_DRIVE):
+				startAutotune();
+				break;
+#endif
+			case (ES_TIMEOUT):
+#if FEED_FORWARD
+				if (ThisEvent.EventParam == DRIVE_CALIBRATION_TIMER)
+				{
+					stepCalibration();
+				}
+#endif
+#if AUTOTUNE
+				if (ThisEvent.EventParam == DRIVE_AUTOTUNE_TIMER)
+				{
+					stepAutotune();
+				}
+#endif
+				break;
 			default:
 				break;
 		}
 	}
 	
-	// If the left motor timed out
-	if ((ThisEvent.EventType == ES_TIMEOUT) && (ThisEvent.EventParam == MOTOR_STOPPED_L))
-	{
-		// Give it a zero period
-		EnterCritical();
-		Left_Period = 0;
-		Left_LastCapture = 0;
-		ExitCritical();
-		
-		// If it wasn't supposed to stop, update the stall counter
-		if (RPMTarget_Left != 0)
-		{
-			StallCounter_Left++;
-			
-			// if the motor has stalled, report a collision
-			if (StallCounter_Left > STALL_THRESHOLD)
-			{
-				ES_Timer_StopTimer(MOTOR_STOPPED_R);
-				ES_Event CollisionEvent;
-				CollisionEvent.EventType = ES_COLLISION;
-				PostMasterSM(CollisionEvent);
-				StallCounter_Left = 0;
-			}
-			else
-			{
-				ES_Timer_InitTimer(MOTOR_STOPPED_L, MOTOR_STOPPED_T);
-			}
-		}
-	}
-	// if the right motor timed out
-	else if ((ThisEvent.EventType == ES_TIMEOUT) && (ThisEvent.EventParam == MOTOR_STOPPED_R))
-	{
-		// Give it a zero period
-		EnterCritical();
-		Right_Period = 0;
-		Right_LastCapture = 0;
-		ExitCritical();
-		
-		// If it wasn't supposed to stop, update the stall counter
-		if (RPMTarget_Right != 0)
-		{
-			StallCounter_Right++;
-			
-			// if the motor has stalled, report a collision
-			if (StallCounter_Right > STALL_THRESHOLD)
-			{
-				ES_Timer_StopTimer(MOTOR_STOPPED_L);
-				ES_Event CollisionEvent;
-				CollisionEvent.EventType = ES_COLLISION;
-				PostMasterSM(CollisionEvent);
-				StallCounter_Right = 0;
-			}
-			else
-			{
-				ES_Timer_InitTimer(MOTOR_STOPPED_R, MOTOR_STOPPED_T);
-			}
-		}
-	}
-	
   return ReturnEvent;
 }
 
@@ -260,46 +482,39 @@ void DriveEncoder_Left_InterruptResponse(void){
 	
 	// increment the encoder ticks that we have seen
 	LeftEncoderTicks++;
+	Odometry_LeftTick(LeftForward);
 	
-	StallCounter_Left = 0;
-	
-	// Check if we've reached our target, and if so, stop
-	if (LeftEncoderTicks >= TargetTicks_Left && (!AligningToBucket) && TargetTicks_Left != 0)
+#if PROFILED_MOVES
+	// Run straight on into the next queued move if it carries on from this one.
+	// Otherwise the control interrupt stops us on the target
+	if (reachedTarget() && nextMoveContinues())
 	{
-		setTargetEncoderTicks(0, 0, false, false);
-		
-		// If this was not a backup operation
-		if (!BackingUp)
-		{
-			ES_Event NewEvent;
-			NewEvent.EventType = ES_ARRIVED;
-			PostMasterSM(NewEvent);
-			isMoving = false;
-			ResetEncoderTicks();
-			ResetUpdateTimes();
-		}
-		else
-		{
-			BackingUp = false;
-			ES_Event NewEvent;
-			NewEvent.EventType = ES_RESET_DESTINATION;
-			PostMasterSM(NewEvent);
-			printf("rp8\r\n");
-		}
+		startNextMove();
+	}
+#else
+	// Check if we've reached our target, and if so, start the next queued move or stop
+	if (reachedTarget() && !startNextMove())
+	{
+		arrive();
 	}
+#endif
 	
 	// now grab the captured value and calculate the period
 	ThisCapture = captureInterrupt(DRIVE_LEFT_ENCODER_INTERRUPT_PARAMATERS);
 
+	// remember when, for the stall check
+	EdgeWatch_Edge(&Edges_Left, ThisCapture);
+
+#if VELOCITY_ESTIMATOR
+	//Record the edge for the speed estimate
+	VelocityEstimate_Edge(&Velocity_Left, ThisCapture);
+#else
   //Update the Period based on the difference between the two rising edges
 	Left_Period = ThisCapture - Left_LastCapture;
 	
 	// update LastCapture to prepare for the next edge
 	Left_LastCapture = ThisCapture;	
-	
-	//Start the Motor Stopped Timer Again
-	ES_Timer_SetTimer(MOTOR_STOPPED_L, MOTOR_STOPPED_T);
-	
+#endif
 }
 
 
@@ -311,46 +526,39 @@ void DriveEncoder_Right_InterruptResponse(void){
 	
 	// increment the encoder ticks that we have seen
 	RightEncoderTicks++;
+	Odometry_RightTick(RightForward);
 	
-	StallCounter_Right = 0;
-	
-	// Check if we've reached our target, and if so, stop
-	if (RightEncoderTicks >= TargetTicks_Right && (!AligningToBucket) && TargetTicks_Right != 0)
+#if PROFILED_MOVES
+	// Run straight on into the next queued move if it carries on from this one.
+	// Otherwise the control interrupt stops us on the target
+	if (reachedTarget() && nextMoveContinues())
 	{
-		setTargetEncoderTicks(0, 0, false, false);
-		
-		// If this was not a backup operation
-		if (!BackingUp)
-		{
-			ES_Event NewEvent;
-			NewEvent.EventType = ES_ARRIVED;
-			PostMasterSM(NewEvent);
-			isMoving = false;
-			ResetEncoderTicks();
-			ResetUpdateTimes();
-		//}
-		}
-		else
-		{
-			BackingUp = false;
-			ES_Event NewEvent;
-			NewEvent.EventType = ES_RESET_DESTINATION;
-			PostMasterSM(NewEvent);
-			printf("rp9\r\n");
-		}
+		startNextMove();
 	}
+#else
+	// Check if we've reached our target, and if so, start the next queued move or stop
+	if (reachedTarget() && !startNextMove())
+	{
+		arrive();
+	}
+#endif
 	
 	// now grab the captured value and calculate the period
 	ThisCapture = captureInterrupt(DRIVE_RIGHT_ENCODER_INTERRUPT_PARAMATERS);
 
+	// remember when, for the stall check
+	EdgeWatch_Edge(&Edges_Right, ThisCapture);
+
+#if VELOCITY_ESTIMATOR
+	//Record the edge for the speed estimate
+	VelocityEstimate_Edge(&Velocity_Right, ThisCapture);
+#else
   //Update the Period based on the difference between the two rising edges
 	Right_Period = ThisCapture - Right_LastCapture;
 
 	// update LastCapture to prepare for the next edge
 	Right_LastCapture = ThisCapture;
-
-	//Start the Motor Stopped Timer Again
-	ES_Timer_SetTimer(MOTOR_STOPPED_R, MOTOR_STOPPED_T);
+#endif
 }
 
 //Interrupt Response to Manage our Control Feedback loop to the motors
@@ -359,36 +567,124 @@ void DriveControl_PeriodicInterruptResponse(void) {
 	// start by clearing the source of the interrupt
 	clearPeriodicInterrupt(DRIVE_CONTROL_INTERRUPT_PARAMATERS);
 	
+#if FEED_FORWARD
+	//A calibration sweep runs the wheels open loop instead
+	if (Calibrating)
+	{
+		sweepPeriod();
+		checkStalls();
+		return;
+	}
+#endif
+	
+#if AUTOTUNE
+	//So does an autotune's step test
+	if (Tuning)
+	{
+		tunePeriod();
+		checkStalls();
+		return;
+	}
+#endif
+	
+#if PROFILED_MOVES
+	//Step the motion profile to get this period's targets
+	if (Profiling)
+	{
+		updateProfile();
+	}
+#endif
+	
 	//Calculate Control Response individually
-	uint8_t RequestedDuty_Left = calculateControlResponse(Left_Period, integralTerm_Left, RPMTarget_Left, false);
-	uint8_t RequestedDuty_Right = calculateControlResponse(Right_Period, integralTerm_Right, RPMTarget_Right, true);
+#if FIXED_POINT_CONTROL
+	q16_t RPM_Left = CalculateRPM(false);
+	q16_t RPM_Right = CalculateRPM(true);
+	uint8_t RequestedDuty_Left = calculateControlResponse(RPM_Left, &PID_Left, RPMTargetQ16_Left, false);
+	uint8_t RequestedDuty_Right = calculateControlResponse(RPM_Right, &PID_Right, RPMTargetQ16_Right, true);
+#else
+	float RPM_Left = CalculateRPM(false);
+	float RPM_Right = CalculateRPM(true);
+	uint8_t RequestedDuty_Left = calculateControlResponse(RPM_Left, integralTerm_Left, RPMTarget_Left, false);
+	uint8_t RequestedDuty_Right = calculateControlResponse(RPM_Right, integralTerm_Right, RPMTarget_Right, true);
+#endif
 
 	//Implement Control Response Similtaneously
 	implementControlResponse(RequestedDuty_Left, RequestedDuty_Right);
+	
+#if MODEL_COLLISIONS
+	//Look for a wheel that has run into something
+#if FIXED_POINT_CONTROL
+	checkCollisions(RequestedDuty_Left, RequestedDuty_Right, RPM_Left, RPM_Right);
+#else
+	checkCollisions(RequestedDuty_Left, RequestedDuty_Right, FLOAT_TO_Q16(RPM_Left), FLOAT_TO_Q16(RPM_Right));
+#endif
+#endif
+	
+	//Look for wheels that have stopped or stalled
+	checkStalls();
 }
 
 /***************************************************************************
 Control Law
  ***************************************************************************/
-static uint8_t calculateControlResponse(uint32_t ThisPeriod, float integralTerm, float targetSpeed, bool isRight){
+#if FIXED_POINT_CONTROL
+static uint8_t calculateControlResponse(q16_t currentRPM, PIDState *pid, q16_t targetSpeed, bool isRight){
+	//Calculate Error (target is already an absolute value)
+	q16_t RPMError = targetSpeed - currentRPM;
+	
+	//Run the fixed-point control law, which clamps to its output range
+	q16_t RequestedDuty = FixedPID_Update(pid, &DriveGains, RPMError);
+	
+#if FEED_FORWARD
+	//Add the duty the map says holds the target. Once we're on it (and not
+	// saturated), whatever the integral still adds is the map's error, which
+	// its trim takes over
+	FeedForwardMap *map = isRight ? &Map_Right : &Map_Left;
+	RequestedDuty += FeedForward_Duty(map, targetSpeed);
+	if (RequestedDuty > INT_TO_Q16(DUTY_MAX))
+	{
+		RequestedDuty = INT_TO_Q16(DUTY_MAX);
+	}
+	else if (RequestedDuty < INT_TO_Q16(DUTY_MIN))
+	{
+		RequestedDuty = INT_TO_Q16(DUTY_MIN);
+	}
+	else if ((targetSpeed != 0) && (Q16_ABS(RPMError) < INT_TO_Q16(FEEDFORWARD_SETTLED_RPM)))
+	{
+		FeedForward_Trim(map, pid->integral);
+	}
+#endif
+	return (uint8_t) Q16_TO_INT(RequestedDuty);
+}
+#else
+static uint8_t calculateControlResponse(float currentRPM, float integralTerm, float targetSpeed, bool isRight){
 	float RPMError; /* make static for speed */
-	float currentRPM;
 	float lastError;
 	
-	//Calculate RPM (Need new formula
-	currentRPM = CalculateRPM(ThisPeriod);
-	
 	//Calculate Error (absolute)
 	RPMError = fabs(targetSpeed) - currentRPM; //fabs is absolute value
 	
 	lastError = isRight ? LastError_Right : LastError_Left;
 	
 	//Determine Integral Term
-	integralTerm += I_GAIN * RPMError;
+	integralTerm += Gains.i * RPMError;
+#if FEED_FORWARD
+	integralTerm = fminf(fmaxf(integralTerm, -FEEDFORWARD_INTEGRAL / Gains.p), FEEDFORWARD_INTEGRAL / Gains.p); /* it only trims the map */
+#else
 	integralTerm = clamp(integralTerm, 0, 100); /* anti-windup */
+#endif
 	
 	//Calculate Desired Duty Cycle
-	float RequestedDuty = (P_GAIN * ((RPMError)+integralTerm+(D_GAIN * (RPMError-lastError))));
+	float RequestedDuty = (Gains.p * ((RPMError)+integralTerm+(Gains.d * (RPMError-lastError))));
+#if FEED_FORWARD
+	//Add the map's duty, and let its trim take over the integral once we're on the target
+	FeedForwardMap *map = isRight ? &Map_Right : &Map_Left;
+	RequestedDuty += Q16_TO_FLOAT(FeedForward_Duty(map, FLOAT_TO_Q16(fabsf(targetSpeed))));
+	if ((targetSpeed != 0) && (fabsf(RPMError) < FEEDFORWARD_SETTLED_RPM) && (RequestedDuty > DUTY_MIN) && (RequestedDuty < DUTY_MAX))
+	{
+		FeedForward_Trim(map, FLOAT_TO_Q16(Gains.p * integralTerm));
+	}
+#endif
 	if (isRight)
 	{
 		LastError_Right = RPMError;
@@ -401,6 +697,357 @@ static uint8_t calculateControlResponse(uint32_t ThisPeriod, float integralTerm,
 	}
 	return clamp(RequestedDuty, 0, 100);
 }
+#endif
+
+// A move has arrived once the wheels between them have covered its ticks, so
+// one wheel running ahead doesn't end it early
+static bool reachedTarget(void)
+{
+	uint32_t target = TargetTicks_Left + TargetTicks_Right;
+	
+	return (!AligningToBucket) && (target != 0) && ((LeftEncoderTicks + RightEncoderTicks) >= target);
+}
+
+// Stop at the end of a move (or the last of the queue) and tell the master
+static void arrive(void)
+{
+	setTargetEncoderTicks(0, 0, false, false);
+	
+	// If this was not a backup operation
+	if (!BackingUp)
+	{
+		ES_Event NewEvent;
+		NewEvent.EventType = ES_ARRIVED;
+		PostMasterSM(NewEvent);
+		isMoving = false;
+		ResetEncoderTicks();
+#if !LOCALIZE_WHILE_DRIVING
+		ResetUpdateTimes();
+#endif
+	}
+	else
+	{
+		BackingUp = false;
+		ES_Event NewEvent;
+		NewEvent.EventType = ES_RESET_DESTINATION;
+		PostMasterSM(NewEvent);
+		printf("rp8\r\n");
+	}
+}
+
+// Zero the period of a wheel that has stopped, and report a collision if one
+// we are driving has stalled. The encoder interrupts only note the time of
+// each edge, and we compare against it here
+static void checkStalls(void)
+{
+	// Read each edge time before the timer, so an edge in between can't look
+	// like it's in the future
+	uint32_t leftEdge = EdgeWatch_LastEdge(&Edges_Left);
+	uint32_t leftAge = currentTimerValue(DRIVE_LEFT_ENCODER_INTERRUPT_PARAMATERS) - leftEdge;
+	uint32_t rightEdge = EdgeWatch_LastEdge(&Edges_Right);
+	uint32_t rightAge = currentTimerValue(DRIVE_RIGHT_ENCODER_INTERRUPT_PARAMATERS) - rightEdge;
+	
+#if !VELOCITY_ESTIMATOR
+	// Give a stopped wheel a zero period
+	if (leftAge >= STOPPED_TIME_MS * TICKS_PER_MS)
+	{
+		Left_Period = 0;
+		Left_LastCapture = 0;
+	}
+	if (rightAge >= STOPPED_TIME_MS * TICKS_PER_MS)
+	{
+		Right_Period = 0;
+		Right_LastCapture = 0;
+	}
+#endif
+	
+	// If a wheel that's supposed to be turning has stalled, report a collision
+	if (WatchingStalls && (((RPMTarget_Left != 0) && (leftAge >= STALL_TIME_MS * TICKS_PER_MS))
+		|| ((RPMTarget_Right != 0) && (rightAge >= STALL_TIME_MS * TICKS_PER_MS))))
+	{
+		ES_Event CollisionEvent;
+		CollisionEvent.EventType = ES_COLLISION;
+		PostMasterSM(CollisionEvent);
+		WatchingStalls = false;
+	}
+}
+
+#if MODEL_COLLISIONS
+// Run each wheel's motor model on the duty we just gave it, and report a
+// collision if a wheel we are driving falls well short of it
+static void checkCollisions(uint8_t leftDuty, uint8_t rightDuty, q16_t leftRPM, q16_t rightRPM)
+{
+	// Keep both models running, whether or not we are watching
+	bool leftHit = CollisionDetect_Update(&Collision_Left, &DriveModel, leftDuty, steadyRPM(leftDuty, false), LeftForward, leftRPM);
+	bool rightHit = CollisionDetect_Update(&Collision_Right, &DriveModel, rightDuty, steadyRPM(rightDuty, true), RightForward, rightRPM);
+	
+	if (WatchingStalls && (leftHit || rightHit))
+	{
+		ES_Event CollisionEvent;
+#if FEED_FORWARD || AUTOTUNE
+		//Don't keep driving into it open loop
+		stopOpenLoop();
+#endif
+		CollisionEvent.EventType = ES_COLLISION;
+		PostMasterSM(CollisionEvent);
+		WatchingStalls = false;
+	}
+}
+
+// The speed a duty holds a wheel at: from its calibrated map when we have
+// one, or else the nominal motor model
+static q16_t steadyRPM(uint8_t duty, bool isRight)
+{
+#if FEED_FORWARD
+	return FeedForward_RPM(isRight ? &Map_Right : &Map_Left, INT_TO_Q16(duty));
+#else
+	return Q16_MUL(FLOAT_TO_Q16(DRIVE_RPM_PER_DUTY), INT_TO_Q16(duty));
+#endif
+}
+#endif
+
+#if FEED_FORWARD
+// Stop, and sweep both wheels' duty to calibrate their maps. Run it with the
+// drive wheels off the ground
+static void startCalibration(void)
+{
+	printf("Calibrating the drive feed-forward\r\n");
+	setTargetEncoderTicks(0, 0, false, false);
+	isMoving = false;
+	FeedForward_StartSweep(&Sweep_Left, DUTY_MAX, CALIBRATION_POINTS);
+	FeedForward_StartSweep(&Sweep_Right, DUTY_MAX, CALIBRATION_POINTS);
+	Calibrating = true;
+	ES_Timer_InitTimer(DRIVE_CALIBRATION_TIMER, DRIVE_CALIBRATION_SETTLE_T);
+}
+
+// Move the sweeps on once the wheels have settled or been measured, and
+// rebuild and store the maps from them when they are done
+static void stepCalibration(void)
+{
+	bool more;
+	
+	//A stop or a new move has cut the sweep short
+	if (!Calibrating)
+	{
+		return;
+	}
+	
+	more = FeedForward_SweepNext(&Sweep_Left);
+	FeedForward_SweepNext(&Sweep_Right);
+	if (more)
+	{
+		ES_Timer_InitTimer(DRIVE_CALIBRATION_TIMER, Sweep_Left.measuring ? DRIVE_CALIBRATION_MEASURE_T : DRIVE_CALIBRATION_SETTLE_T);
+		return;
+	}
+	
+	EnterCritical();
+	Calibrating = false;
+	FeedForward_Init(&Map_Left, Sweep_Left.points, Sweep_Left.numPoints, FLOAT_TO_QGAIN(FEEDFORWARD_TRIM_RATE));
+	FeedForward_Init(&Map_Right, Sweep_Right.points, Sweep_Right.numPoints, FLOAT_TO_QGAIN(FEEDFORWARD_TRIM_RATE));
+	ExitCritical();
+	
+	printf("Left drive map: ");
+	FeedForward_PrintSweep(&Sweep_Left);
+	printf("Right drive map: ");
+	FeedForward_PrintSweep(&Sweep_Right);
+	
+	//Only keep maps that found the wheels turning
+	if ((Map_Left.numPoints < 2) || (Map_Right.numPoints < 2))
+	{
+		printf("A wheel never turned, so the maps weren't stored\r\n");
+	}
+	else if (!ParamStore_WriteMap(DRIVE_LEFT_MAP, Sweep_Left.points, Sweep_Left.numPoints)
+		|| !ParamStore_WriteMap(DRIVE_RIGHT_MAP, Sweep_Right.points, Sweep_Right.numPoints))
+	{
+		printf("Couldn't store the drive maps\r\n");
+	}
+}
+
+// Drive both wheels forward at the sweep's duty, and add their speeds to its
+// averages
+static void sweepPeriod(void)
+{
+	uint8_t duty = FeedForward_SweepDuty(&Sweep_Left);
+	
+#if FIXED_POINT_CONTROL
+	FeedForward_SweepSample(&Sweep_Left, CalculateRPM(false));
+	FeedForward_SweepSample(&Sweep_Right, CalculateRPM(true));
+#else
+	FeedForward_SweepSample(&Sweep_Left, FLOAT_TO_Q16(CalculateRPM(false)));
+	FeedForward_SweepSample(&Sweep_Right, FLOAT_TO_Q16(CalculateRPM(true)));
+#endif
+	SetPWM_DriveLeft(duty, LEFT_DRIVE_FORWARD_PIN_DIRECTION);
+	SetPWM_DriveRight(duty, RIGHT_DRIVE_FORWARD_PIN_DIRECTION);
+}
+
+// Build a wheel's map from the points a calibration stored, or from its
+// defaults if none has
+static void loadMap(FeedForwardMap *map, DutyMapID id, const FeedForwardPoint *defaults, uint8_t numDefaults)
+{
+	FeedForwardPoint points[FEEDFORWARD_MAX_POINTS];
+	uint8_t numPoints;
+	
+	if (ParamStore_ReadMap(id, points, &numPoints))
+	{
+		FeedForward_Init(map, points, numPoints, FLOAT_TO_QGAIN(FEEDFORWARD_TRIM_RATE));
+	}
+	else
+	{
+		FeedForward_Init(map, defaults, numDefaults, FLOAT_TO_QGAIN(FEEDFORWARD_TRIM_RATE));
+	}
+}
+#endif
+
+#if AUTOTUNE
+// Stop, and step test both wheels to work out the speed loop gains. Run it
+// where the robot can drive straight ahead for a second, so the motors carry
+// its weight as they do in a match
+static void startAutotune(void)
+{
+	printf("Autotuning the drive\r\n");
+	setTargetEncoderTicks(0, 0, false, false);
+	isMoving = false;
+	AutoTune_Start(&Tune_Left, AUTOTUNE_LOW_DUTY, AUTOTUNE_HIGH_DUTY, AUTOTUNE_PERIODS_PER_SAMPLE);
+	AutoTune_Start(&Tune_Right, AUTOTUNE_LOW_DUTY, AUTOTUNE_HIGH_DUTY, AUTOTUNE_PERIODS_PER_SAMPLE);
+	PreviousGains = Gains;
+	
+	//Both wheels drive forward, and we watch them for a collision on the way
+	EnterCritical();
+	LeftForward = true;
+	RightForward = true;
+#if MODEL_COLLISIONS
+	CollisionDetect_Reset(&Collision_Left);
+	CollisionDetect_Reset(&Collision_Right);
+	WatchingStalls = true;
+#endif
+	Tuning = true;
+	ExitCritical();
+	ES_Timer_InitTimer(DRIVE_AUTOTUNE_TIMER, DRIVE_AUTOTUNE_SETTLE_T);
+}
+
+// Start logging once the wheels have settled at the low duty. Once the logs
+// are full, fit both motors and store gains for the average of them, since
+// one set of gains drives both wheels
+static void stepAutotune(void)
+{
+	PlantModel left, right, plant;
+	float kp, ki;
+	
+	//A stop, a new move or a collision has cut the test short
+	if (!Tuning)
+	{
+		return;
+	}
+	
+	if (!AutoTune_Done(&Tune_Left) || !AutoTune_Done(&Tune_Right))
+	{
+		AutoTune_StartLogging(&Tune_Left);
+		AutoTune_StartLogging(&Tune_Right);
+		ES_Timer_InitTimer(DRIVE_AUTOTUNE_TIMER, DRIVE_AUTOTUNE_LOG_T);
+		return;
+	}
+	Tuning = false;
+	WatchingStalls = false;
+	
+	if (!AutoTune_Fit(&Tune_Left, CONTROL_PERIOD_S, &left) || !AutoTune_Fit(&Tune_Right, CONTROL_PERIOD_S, &right))
+	{
+		printf("Drive autotune failed, keeping P %g I %g D %g\r\n", Gains.p, Gains.i, Gains.d);
+		return;
+	}
+	plant.gain = (left.gain + right.gain) / 2;
+	plant.timeConstant = (left.timeConstant + right.timeConstant) / 2;
+	plant.deadTime = (left.deadTime + right.deadTime) / 2;
+	AutoTune_PIGains(&plant, AUTOTUNE_CLOSED_LOOP_RATIO, CONTROL_PERIOD_S, &kp, &ki);
+	
+	//Our law's integral is scaled by P
+	EnterCritical();
+	Gains.p = kp;
+	Gains.i = ki / kp;
+	Gains.d = 0;
+	initLoops();
+	ExitCritical();
+	
+	printf("Drive motors: %g RPM per duty, time constant %g s, dead time %g s\r\n", plant.gain, plant.timeConstant, plant.deadTime);
+	printf("Drive gains: P %g I %g D %g%s\r\n", Gains.p, Gains.i, Gains.d, ParamStore_WriteGains(DRIVE_GAINS, &Gains) ? "" : " (couldn't store them)");
+}
+
+// Drive both wheels forward at the step test's duty, and log their speeds
+static void tunePeriod(void)
+{
+#if FIXED_POINT_CONTROL
+	q16_t leftRPM = CalculateRPM(false);
+	q16_t rightRPM = CalculateRPM(true);
+#else
+	q16_t leftRPM = FLOAT_TO_Q16(CalculateRPM(false));
+	q16_t rightRPM = FLOAT_TO_Q16(CalculateRPM(true));
+#endif
+	uint8_t leftDuty, rightDuty;
+	
+	AutoTune_Sample(&Tune_Left, leftRPM);
+	AutoTune_Sample(&Tune_Right, rightRPM);
+	leftDuty = AutoTune_Duty(&Tune_Left);
+	rightDuty = AutoTune_Duty(&Tune_Right);
+	SetPWM_DriveLeft(leftDuty, LEFT_DRIVE_FORWARD_PIN_DIRECTION);
+	SetPWM_DriveRight(rightDuty, RIGHT_DRIVE_FORWARD_PIN_DIRECTION);
+	
+#if MODEL_COLLISIONS
+	//The motor models work open loop too, so watch for a wall on the way
+	checkCollisions(leftDuty, rightDuty, leftRPM, rightRPM);
+#endif
+}
+#endif
+
+#if FEED_FORWARD || AUTOTUNE
+// Cut a calibration sweep or step test short, leaving the wheels stopped and
+// an autotune's gains as they were. Safe to call from the control interrupt
+static void stopOpenLoop(void)
+{
+#if FEED_FORWARD
+	if (Calibrating)
+	{
+		Calibrating = false;
+		SetPWM_DriveLeft(0, LEFT_DRIVE_FORWARD_PIN_DIRECTION);
+		SetPWM_DriveRight(0, RIGHT_DRIVE_FORWARD_PIN_DIRECTION);
+	}
+#endif
+#if AUTOTUNE
+	if (Tuning)
+	{
+		EnterCritical();
+		Tuning = false;
+		Gains = PreviousGains;
+		initLoops();
+		ExitCritical();
+		SetPWM_DriveLeft(0, LEFT_DRIVE_FORWARD_PIN_DIRECTION);
+		SetPWM_DriveRight(0, RIGHT_DRIVE_FORWARD_PIN_DIRECTION);
+	}
+#endif
+}
+#endif
+
+// Set up both speed loops from Gains, clearing their integrals
+static void initLoops(void)
+{
+#if FIXED_POINT_CONTROL
+	//The float law is P * (e + integral + D * de), which is the parallel form
+	// with gains P, P*I and P*D and the integral clamp scaled by P
+	DriveGains.p = FLOAT_TO_QGAIN(Gains.p);
+	DriveGains.i = FLOAT_TO_QGAIN(Gains.p * Gains.i);
+	DriveGains.d = FLOAT_TO_QGAIN(Gains.p * Gains.d);
+	DriveGains.pScalesWithError = false;
+#if FEED_FORWARD
+	//On top of the maps they only add a correction, which can be negative
+	FixedPID_Init(&PID_Left, INT_TO_Q16(-FEEDFORWARD_INTEGRAL), INT_TO_Q16(FEEDFORWARD_INTEGRAL), INT_TO_Q16(-DUTY_MAX), INT_TO_Q16(DUTY_MAX));
+	FixedPID_Init(&PID_Right, INT_TO_Q16(-FEEDFORWARD_INTEGRAL), INT_TO_Q16(FEEDFORWARD_INTEGRAL), INT_TO_Q16(-DUTY_MAX), INT_TO_Q16(DUTY_MAX));
+#else
+	FixedPID_Init(&PID_Left, 0, FLOAT_TO_Q16(Gains.p * DUTY_MAX), INT_TO_Q16(DUTY_MIN), INT_TO_Q16(DUTY_MAX));
+	FixedPID_Init(&PID_Right, 0, FLOAT_TO_Q16(Gains.p * DUTY_MAX), INT_TO_Q16(DUTY_MIN), INT_TO_Q16(DUTY_MAX));
+#endif
+#else
+	integralTerm_Left = 0;
+	integralTerm_Right = 0;
+#endif
+}
 
 //Actually Command the PWM Changes
 static void implementControlResponse(uint8_t left, uint8_t right){
@@ -409,9 +1056,26 @@ static void implementControlResponse(uint8_t left, uint8_t right){
 	SetPWM_DriveRight(right, (RPMTarget_Right > 0) ? RIGHT_DRIVE_FORWARD_PIN_DIRECTION : RIGHT_DRIVE_BACKWARD_PIN_DIRECTION);
 }
 
-// Calculate our current RPM given an encoder period
-static float CalculateRPM(uint32_t period) 
+// Calculate a wheel's current RPM from its encoder
+#if FIXED_POINT_CONTROL
+static q16_t CalculateRPM(bool isRight)
+{
+#if VELOCITY_ESTIMATOR
+	return isRight ? VelocityEstimate_RPM(&Velocity_Right, currentTimerValue(DRIVE_RIGHT_ENCODER_INTERRUPT_PARAMATERS))
+		: VelocityEstimate_RPM(&Velocity_Left, currentTimerValue(DRIVE_LEFT_ENCODER_INTERRUPT_PARAMATERS));
+#else
+	return FixedPID_Ratio(RPM_NUMERATOR, isRight ? Right_Period : Left_Period, RPM_HEADROOM);
+#endif
+}
+#else
+static float CalculateRPM(bool isRight) 
 {
+#if VELOCITY_ESTIMATOR
+	return Q16_TO_FLOAT(isRight ? VelocityEstimate_RPM(&Velocity_Right, currentTimerValue(DRIVE_RIGHT_ENCODER_INTERRUPT_PARAMATERS))
+		: VelocityEstimate_RPM(&Velocity_Left, currentTimerValue(DRIVE_LEFT_ENCODER_INTERRUPT_PARAMATERS)));
+#else
+	uint32_t period = isRight ? Right_Period : Left_Period;
+	
 	if (period == 0)
 	{
 		return 0;
@@ -420,7 +1084,9 @@ static float CalculateRPM(uint32_t period)
 	{
 		return ((TICKS_PER_MS * SECS_PER_MIN * MS_PER_SEC) / (period * DRIVE_GEAR_RATIO * ENCODER_PULSES_PER_REV));
 	}
+#endif
 }
+#endif
 	
 
 /****************************************************************************
@@ -429,23 +1095,64 @@ static float CalculateRPM(uint32_t period)
 ****************************************************************************/
 void setTargetDriveSpeed(float newRPMTarget_left, float newRPMTarget_right){
 	//printf("Setting drive speed to: %f, %f\r\n", newRPMTarget_left, newRPMTarget_right);
+#if PROFILED_MOVES
+	//A new speed overrides any profiled move
+	Profiling = false;
+#endif
+#if PATH_FOLLOWING
+	Following = false;
+	SteerPending = false;
+#endif
+#if FEED_FORWARD || AUTOTUNE
+	//And cuts a calibration sweep or step test short, from rest. That covers
+	// a stop, and the move the master backs away from a collision with
+	stopOpenLoop();
+#endif
 	RPMTarget_Left = newRPMTarget_left;
 	RPMTarget_Right = newRPMTarget_right;
 	
+	if (newRPMTarget_left != 0)
+	{
+		LeftForward = newRPMTarget_left > 0;
+	}
+	if (newRPMTarget_right != 0)
+	{
+		RightForward = newRPMTarget_right > 0;
+	}
+	
 	if (newRPMTarget_left != 0 && newRPMTarget_right != 0)
 	{
-		ES_Timer_InitTimer(MOTOR_STOPPED_L, MOTOR_STOPPED_T);
-		ES_Timer_InitTimer(MOTOR_STOPPED_R, MOTOR_STOPPED_T);
+		//Time stalls from now
+		EnterCritical();
+		EdgeWatch_Start(&Edges_Left, currentTimerValue(DRIVE_LEFT_ENCODER_INTERRUPT_PARAMATERS));
+		EdgeWatch_Start(&Edges_Right, currentTimerValue(DRIVE_RIGHT_ENCODER_INTERRUPT_PARAMATERS));
+		WatchingStalls = true;
+		ExitCritical();
+#if !LOCALIZE_WHILE_DRIVING
 		ResetAbsolutePosition();
+#endif
 		integralTerm_Left = 0;
 		integralTerm_Right = 0;
 		LastError_Left = 0;
 		LastError_Right = 0;
 	}
+	else if (newRPMTarget_left == 0 && newRPMTarget_right == 0)
+	{
+		WatchingStalls = false;
+	}
 	integralTerm_Left = 0;
 	integralTerm_Right = 0;
 	LastError_Left = 0;
 	LastError_Right = 0;
+	
+#if FIXED_POINT_CONTROL
+	EnterCritical();
+	RPMTargetQ16_Left = FLOAT_TO_Q16(fabsf(newRPMTarget_left));
+	RPMTargetQ16_Right = FLOAT_TO_Q16(fabsf(newRPMTarget_right));
+	FixedPID_Reset(&PID_Left);
+	FixedPID_Reset(&PID_Right);
+	ExitCritical();
+#endif
 }
 
 /****************************************************************************
@@ -454,6 +1161,7 @@ void setTargetDriveSpeed(float newRPMTarget_left, float newRPMTarget_right){
 ****************************************************************************/
 void setDriveToAlignToBucket(void)
 {
+	clearMotionQueue();
 	AligningToBucket = true;
 	setTargetDriveSpeed(.9f * DEFAULT_DRIVE_RPM, .9f * -DEFAULT_DRIVE_RPM);
 } 
@@ -464,6 +1172,7 @@ void setDriveToAlignToBucket(void)
 ****************************************************************************/
 void clearDriveAligningToBucket(void)
 {
+	clearMotionQueue();
 	AligningToBucket = false;
 	setTargetDriveSpeed(0.0, 0.0);
 }
@@ -473,11 +1182,152 @@ void clearDriveAligningToBucket(void)
      Set the New Target Encoder Ticks
 ****************************************************************************/
 void setTargetEncoderTicks(uint32_t leftTicks, uint32_t rightTicks, bool negativeLeft, bool negativeRight){
+	clearMotionQueue();
+	startMove(leftTicks, rightTicks, negativeLeft, negativeRight);
+}
+
+/****************************************************************************
+ Function
+     QueueRotation
+
+ Parameters
+     ticks : ticks for each wheel to turn
+		 clockwise : true to turn right
+
+ Returns
+     false if the queue is full
+		 
+ Description
+     Queues a turn in place. Queued moves run back to back, with ES_ARRIVED
+		   posted only after the last. The first starts at once (replacing
+			 anything we were doing) unless a queued move is already running.
+			 Any other move, or a collision, clears the queue.
+****************************************************************************/
+bool QueueRotation(uint32_t ticks, bool clockwise)
+{
+	return queueMove(ticks, ticks, !clockwise, clockwise);
+}
+
+/****************************************************************************
+ Function
+     QueueDrive
+
+ Description
+     Queues a straight move of the given ticks (see QueueRotation)
+****************************************************************************/
+bool QueueDrive(uint32_t ticks, bool forward)
+{
+	return queueMove(ticks, ticks, !forward, !forward);
+}
+
+/****************************************************************************
+ Function
+     QueueArc
+
+ Description
+     Queues an arc with the given ticks for each wheel (see QueueRotation)
+****************************************************************************/
+bool QueueArc(uint32_t leftTicks, uint32_t rightTicks, bool forward)
+{
+	return queueMove(leftTicks, rightTicks, !forward, !forward);
+}
+
+// Add a move to the queue, or start it now if no queued move is running
+static bool queueMove(uint32_t leftTicks, uint32_t rightTicks, bool negativeLeft, bool negativeRight)
+{
+	MotionPrimitive move = {leftTicks, rightTicks, negativeLeft, negativeRight};
+	
+	// Nothing to do, and it would never reach its target
+	if ((leftTicks == 0) && (rightTicks == 0))
+	{
+		return true;
+	}
+	
+	EnterCritical();
+	if (QueueActive)
+	{
+		if (!MotionQueue_Push(&Queue, &move))
+		{
+			ExitCritical();
+			return false;
+		}
+#if PROFILED_MOVES
+		BlendTicks = MotionQueue_BlendTicks(&Queue, &CurrentMove);
+#endif
+		ExitCritical();
+		return true;
+	}
+	ExitCritical();
+	
+	clearMotionQueue();
+	startMove(leftTicks, rightTicks, negativeLeft, negativeRight);
+	QueueActive = true;
+	return true;
+}
+
+// Start the next queued move when the current one reaches its target,
+// carrying on without braking when it heads the same way. Returns false if
+// there was none (the caller stops and posts ES_ARRIVED)
+static bool startNextMove(void)
+{
+	MotionPrimitive next;
+	
+	if (!QueueActive || !MotionQueue_Pop(&Queue, &next))
+	{
+		QueueActive = false;
+		return false;
+	}
+	
+	// Each move counts its ticks from zero
+	ResetEncoderTicks();
+	
+#if PROFILED_MOVES
+	if (Profiling && MotionQueue_Continues(&CurrentMove, &next))
+	{
+		CurrentMove = next;
+		TargetTicks_Left = next.leftTicks;
+		TargetTicks_Right = next.rightTicks;
+		FollowRatio = LeftLeads ? FixedPID_Ratio(next.rightTicks, next.leftTicks, Q16_SHIFT) : FixedPID_Ratio(next.leftTicks, next.rightTicks, Q16_SHIFT);
+		SyncBase_Left = 0;
+		SyncBase_Right = 0;
+		BlendTicks = MotionQueue_BlendTicks(&Queue, &CurrentMove);
+		return true;
+	}
+#endif
+	startMove(next.leftTicks, next.rightTicks, next.negativeLeft, next.negativeRight);
+#if PROFILED_MOVES
+	BlendTicks = MotionQueue_BlendTicks(&Queue, &CurrentMove);
+#endif
+	return true;
+}
+
+// Forget any queued moves
+static void clearMotionQueue(void)
+{
+	EnterCritical();
+	QueueActive = false;
+	MotionQueue_Clear(&Queue);
+#if PROFILED_MOVES
+	BlendTicks = 0;
+#endif
+	ExitCritical();
+}
+
+// Start a single move from where we are
+static void startMove(uint32_t leftTicks, uint32_t rightTicks, bool negativeLeft, bool negativeRight)
+{
 	isMoving = true;
+	CurrentMove.leftTicks = leftTicks;
+	CurrentMove.rightTicks = rightTicks;
+	CurrentMove.negativeLeft = negativeLeft;
+	CurrentMove.negativeRight = negativeRight;
 	
 	TargetTicks_Left = leftTicks;
 	TargetTicks_Right = rightTicks;
 	
+#if PROFILED_MOVES
+	startProfile(leftTicks, rightTicks, negativeLeft, negativeRight);
+#else
 	if (leftTicks == rightTicks)
 	{
 		if (leftTicks == 0)
@@ -491,17 +1341,264 @@ void setTargetEncoderTicks(uint32_t leftTicks, uint32_t rightTicks, bool negativ
 	}
 	else
 	{
+		// The wheel with further to go runs at the default speed, and the other
+		// at its share of that, each in its own direction
+		float leftRPM;
+		float rightRPM;
+		
 		if (leftTicks > rightTicks)
 		{
-			setTargetDriveSpeed(DEFAULT_DRIVE_RPM, (((float) rightTicks) / leftTicks) * DEFAULT_DRIVE_RPM);
+			leftRPM = DEFAULT_DRIVE_RPM;
+			rightRPM = (((float) rightTicks) / leftTicks) * DEFAULT_DRIVE_RPM;
 		}
 		else
 		{
-			setTargetDriveSpeed(DEFAULT_DRIVE_RPM, (((float) leftTicks) / rightTicks) * DEFAULT_DRIVE_RPM);
+			leftRPM = (((float) leftTicks) / rightTicks) * DEFAULT_DRIVE_RPM;
+			rightRPM = DEFAULT_DRIVE_RPM;
 		}
+		setTargetDriveSpeed(negativeLeft ? -leftRPM : leftRPM, negativeRight ? -rightRPM : rightRPM);
+	}
+#endif
+}
+
+#if PROFILED_MOVES
+// Start a profiled move from rest, at the creep speed until the control
+// interrupt takes over
+static void startProfile(uint32_t leftTicks, uint32_t rightTicks, bool negativeLeft, bool negativeRight)
+{
+	uint32_t leadTicks = (leftTicks > rightTicks) ? leftTicks : rightTicks;
+	float leftRPM;
+	float rightRPM;
+	
+	if (leadTicks == 0)
+	{
+		setTargetDriveSpeed(0, 0);
+		return;
 	}
+	
+	leftRPM = (PROFILE_MIN_RPM * leftTicks) / leadTicks;
+	rightRPM = (PROFILE_MIN_RPM * rightTicks) / leadTicks;
+	setTargetDriveSpeed(negativeLeft ? -leftRPM : leftRPM, negativeRight ? -rightRPM : rightRPM);
+	
+	EnterCritical();
+	LeftLeads = leftTicks >= rightTicks;
+	FollowRatio = LeftLeads ? FixedPID_Ratio(rightTicks, leftTicks, Q16_SHIFT) : FixedPID_Ratio(leftTicks, rightTicks, Q16_SHIFT);
+	SyncBase_Left = LeftEncoderTicks;
+	SyncBase_Right = RightEncoderTicks;
+	DriveMove_ResetSettle(&Settle);
+	MotionProfile_Reset(&Profile);
+	Profiling = true;
+	ExitCritical();
 }
 
+// Check whether the next queued move carries on from the current one
+static bool nextMoveContinues(void)
+{
+	const MotionPrimitive *next = MotionQueue_Next(&Queue);
+	
+	return Profiling && QueueActive && (next != NULL) && MotionQueue_Continues(&CurrentMove, next);
+}
+
+// How much faster to drive the lead wheel (and slower the follower) to bring
+// the follower back to its share of the lead wheel's ticks (Q16 RPM)
+static q16_t syncCorrection(void)
+{
+	uint32_t lead = LeftLeads ? (LeftEncoderTicks - SyncBase_Left) : (RightEncoderTicks - SyncBase_Right);
+	uint32_t follow = LeftLeads ? (RightEncoderTicks - SyncBase_Right) : (LeftEncoderTicks - SyncBase_Left);
+	
+	return DriveMove_SyncCorrection(lead, follow, FollowRatio, FLOAT_TO_Q16(SYNC_GAIN), FLOAT_TO_Q16(SYNC_MAX_RPM));
+}
+
+// Set both wheels' targets from the profile of the leading wheel, and stop
+// once the wheels have settled on the target
+static void updateProfile(void)
+{
+	uint32_t tickSum = LeftEncoderTicks + RightEncoderTicks;
+	uint32_t targetSum = TargetTicks_Left + TargetTicks_Right;
+	uint32_t ticksToGo = BlendTicks;
+	q16_t leadRPM;
+	q16_t followRPM;
+	q16_t correction;
+	
+	//Settle: arrive once we're close and neither wheel has ticked for a while
+	if (DriveMove_Settled(&Settle, tickSum, targetSum, ARRIVAL_TOLERANCE, SETTLE_PERIODS))
+	{
+#if PATH_FOLLOWING
+		//We only stopped to turn a wheel round
+		if (SteerPending)
+		{
+			startPendingSteer();
+			return;
+		}
+#endif
+		if (!startNextMove())
+		{
+			arrive();
+		}
+		return;
+	}
+	
+	//Run the profile on the lead wheel ticks the wheels have left between them
+	ticksToGo += DriveMove_TicksToGo(tickSum, targetSum, FollowRatio);
+	leadRPM = MotionProfile_Step(&Profile, &DriveLimits, ticksToGo);
+	followRPM = Q16_MUL(leadRPM, FollowRatio);
+	
+	//Pull the wheels back into step, unless we are stopping
+	if (leadRPM != 0)
+	{
+		correction = syncCorrection();
+		leadRPM = (leadRPM > -correction) ? (leadRPM + correction) : 0;
+		followRPM = (followRPM > correction) ? (followRPM - correction) : 0;
+	}
+	
+#if PATH_FOLLOWING
+	//Ask for a fresh steer every few periods, until we are close enough to the
+	// end that the geometry gets touchy
+	if (Following && (++PathPeriods >= PATH_UPDATE_PERIODS) && !PathUpdatePending && (ticksToGo > PATH_FINAL_TICKS))
+	{
+		ES_Event NewEvent;
+		NewEvent.EventType = ES_PATH_UPDATE;
+		PathUpdatePending = PostPositionLogicService(NewEvent);
+		PathPeriods = 0;
+	}
+#endif
+	
+	//An encoder interrupt may have ended the move while we were working
+	EnterCritical();
+	if (Profiling)
+	{
+#if FIXED_POINT_CONTROL
+		RPMTargetQ16_Left = LeftLeads ? leadRPM : followRPM;
+		RPMTargetQ16_Right = LeftLeads ? followRPM : leadRPM;
+#else
+		//The float targets carry the direction in their sign
+		RPMTarget_Left = (LeftForward ? 1 : -1) * Q16_TO_FLOAT(LeftLeads ? leadRPM : followRPM);
+		RPMTarget_Right = (RightForward ? 1 : -1) * Q16_TO_FLOAT(LeftLeads ? followRPM : leadRPM);
+#endif
+	}
+	ExitCritical();
+}
+#endif
+
+#if PATH_FOLLOWING
+/****************************************************************************
+ Function
+     setTargetPath
+
+ Parameters
+     ticksToGo : ticks left for the faster wheel to the end of the path
+		 leftScale, rightScale : each wheel's share of the faster wheel's speed
+		   (negative drives it backwards)
+
+ Description
+     Starts following a path on the motion profile, or re-steers the one we
+		   are following without slowing down. Call it again as the pose
+			 estimate changes (we post ES_PATH_UPDATE to PositionLogic when it's
+			 time). A re-steer that would reverse a wheel we are driving (say
+			 from a pivot onto an arc) first brakes to rest on the profile, and
+			 then starts the new path from there. Posts ES_ARRIVED at the end,
+			 like any other move.
+****************************************************************************/
+void setTargetPath(uint32_t ticksToGo, float leftScale, float rightScale)
+{
+	bool leftLeads = fabsf(leftScale) >= fabsf(rightScale);
+	float lead = leftLeads ? fabsf(leftScale) : fabsf(rightScale);
+	float follow = leftLeads ? fabsf(rightScale) : fabsf(leftScale);
+	
+	if ((ticksToGo == 0) || (lead == 0))
+	{
+		setTargetEncoderTicks(0, 0, false, false);
+		return;
+	}
+	
+	// Never flip a wheel's direction at speed
+	if (Following && reversesWheel(leftScale, rightScale))
+	{
+		EnterCritical();
+		if (!SteerPending)
+		{
+			brakeForSteer();
+		}
+		SteerPending = true;
+		PendingTicks = ticksToGo;
+		PendingLeftScale = leftScale;
+		PendingRightScale = rightScale;
+		PathUpdatePending = false;
+		ExitCritical();
+		return;
+	}
+	
+	// Start from rest at the creep speed, like any other profiled move
+	if (!Following)
+	{
+		clearMotionQueue();
+		setTargetDriveSpeed((PROFILE_MIN_RPM * leftScale) / lead, (PROFILE_MIN_RPM * rightScale) / lead);
+		EnterCritical();
+		MotionProfile_Reset(&Profile);
+		PathPeriods = 0;
+		DriveMove_ResetSettle(&Settle);
+		Profiling = true;
+		Following = true;
+		ExitCritical();
+	}
+	
+	EnterCritical();
+	isMoving = true;
+	PathUpdatePending = false;
+	SteerPending = false;
+	LeftLeads = leftLeads;
+	FollowRatio = FLOAT_TO_Q16(follow / lead);
+	
+	// Both wheels' shares of the path end the move
+	TargetTicks_Left = LeftEncoderTicks + (uint32_t) (leftLeads ? ticksToGo : ((ticksToGo * follow) / lead));
+	TargetTicks_Right = RightEncoderTicks + (uint32_t) (leftLeads ? ((ticksToGo * follow) / lead) : ticksToGo);
+	SyncBase_Left = LeftEncoderTicks;
+	SyncBase_Right = RightEncoderTicks;
+	
+	// The profile sets the speeds; these carry the directions
+	if (leftScale != 0)
+	{
+		LeftForward = leftScale > 0;
+	}
+	if (rightScale != 0)
+	{
+		RightForward = rightScale > 0;
+	}
+	RPMTarget_Left = (leftScale > 0) ? PROFILE_MIN_RPM : ((leftScale < 0) ? -PROFILE_MIN_RPM : 0);
+	RPMTarget_Right = (rightScale > 0) ? PROFILE_MIN_RPM : ((rightScale < 0) ? -PROFILE_MIN_RPM : 0);
+	ExitCritical();
+}
+
+// Check whether a steer would turn round a wheel we are driving
+static bool reversesWheel(float leftScale, float rightScale)
+{
+	return ((RPMTarget_Left != 0) && (leftScale != 0) && ((leftScale > 0) != LeftForward))
+		|| ((RPMTarget_Right != 0) && (rightScale != 0) && ((rightScale > 0) != RightForward));
+}
+
+// Bring the path we are following to rest as soon as the profile can, keeping
+// our directions and the wheels' ratio. The position loop holds the lead wheel
+// under sqrt(stopGain * ticks to go), so that is how far we need
+static void brakeForSteer(void)
+{
+	uint32_t stopTicks = (uint32_t) ((((uint64_t) Profile.velocity * (uint64_t) Profile.velocity) / (uint64_t) DriveLimits.stopGain) >> Q16_SHIFT) + 1;
+	uint32_t followTicks = Q16_TO_INT((q16_t) ((int64_t) stopTicks * FollowRatio));
+	
+	TargetTicks_Left = LeftEncoderTicks + (LeftLeads ? stopTicks : followTicks);
+	TargetTicks_Right = RightEncoderTicks + (LeftLeads ? followTicks : stopTicks);
+	SyncBase_Left = LeftEncoderTicks;
+	SyncBase_Right = RightEncoderTicks;
+}
+
+// Start the steer we stopped for from rest
+static void startPendingSteer(void)
+{
+	Following = false;
+	SteerPending = false;
+	setTargetPath(PendingTicks, PendingLeftScale, PendingRightScale);
+}
+#endif
+
 /****************************************************************************
  Function
      Return the number of left encoder ticks since our last absolute position update
@@ -539,6 +1636,19 @@ bool IsMoving(void)
 	return isMoving;
 }
 
+/****************************************************************************
+ Function
+     Return true iff we are following a path
+****************************************************************************/
+bool IsFollowingPath(void)
+{
+#if PATH_FOLLOWING
+	return Following;
+#else
+	return false;
+#endif
+}
+
 /****************************************************************************
  Function
      Set the backup operation flag
@@ -548,3 +1658,46 @@ void SetBackingUp(bool val)
 	BackingUp = val;
 }
 
+/****************************************************************************
+ Function
+     CenterOnStation
+
+ Parameters
+     lateralOffset : how far the station is to our right (inches, left negative)
+		 
+ Returns
+     true iff a corrective move was started
+
+ Description
+     Pivots in place so that the hall sensors, which sit ahead of the wheels,
+		   swing over the center of the station. Posts ES_ARRIVED when done, like
+			 any other move.
+****************************************************************************/
+bool CenterOnStation(float lateralOffset)
+{
+	float ratio;
+	float angle;
+	uint32_t ticks;
+	
+	// Close enough, don't move
+	if (fabsf(lateralOffset) < STATION_CENTERED_TOLERANCE)
+	{
+		return false;
+	}
+	
+	// The sensors move sideways by forward distance * sin(angle) as we pivot.
+	// Offsets past what they can resolve are corrected by that much
+	ratio = fminf(fabsf(lateralOffset), MAX_RESOLVED_STATION_OFFSET) / HALL_SENSOR_FORWARD_DISTANCE;
+	angle = asinf(ratio);
+	
+	ticks = (angle * DISTANCE_BETWEEN_WHEELS * DRIVE_GEAR_RATIO * ENCODER_PULSES_PER_REV) / (2 * WHEEL_CIRCUMFERENCE);
+	if (ticks == 0)
+	{
+		return false;
+	}
+	
+	// Turn right (left wheel forward) for a station to our right, and vice versa
+	setTargetEncoderTicks(ticks, ticks, lateralOffset < 0, lateralOffset > 0);
+	return true;
+}
+
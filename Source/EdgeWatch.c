@@ -0,0 +1,108 @@
+/****************************************************************************
+ Module
+   EdgeWatch.c
+
+ Description
+		Tells when an encoder has stopped, from the time of its last edge. The
+		  capture interrupt only stores that time; a periodic check (a control
+			interrupt or an event checker) compares it against the timer. Read
+			the edge time before the timer, so an edge in between can't look
+			like it's in the future. Ages are unsigned differences, so they are
+			right across the timer's wrap as long as we look more often than
+			that.
+****************************************************************************/
+
+#include "ES_Configure.h"
+#include "ES_Framework.h"
+#include "EdgeWatch.h"
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     EdgeWatch_Init
+
+ Description
+     Starts with nothing to report until the first edge or start
+****************************************************************************/
+void EdgeWatch_Init(EdgeWatch *watch)
+{
+	watch->lastEdge = 0;
+	watch->reportedEdge = 0;
+	watch->reported = true;
+}
+
+/****************************************************************************
+ Function
+     EdgeWatch_Start
+
+ Parameters
+     now : the capture timer
+
+ Description
+     Times a stop from now, as if there had been an edge, so one that never
+		   gets going is reported too. Call it from a critical section if
+			 anything else needs to see it together with this
+****************************************************************************/
+void EdgeWatch_Start(EdgeWatch *watch, uint32_t now)
+{
+	watch->lastEdge = now;
+	watch->reported = false;
+}
+
+/****************************************************************************
+ Function
+     EdgeWatch_Edge
+
+ Parameters
+     time : the edge's capture time
+
+ Description
+     Interrupt side
+****************************************************************************/
+void EdgeWatch_Edge(EdgeWatch *watch, uint32_t time)
+{
+	watch->lastEdge = time;
+}
+
+/****************************************************************************
+ Function
+     EdgeWatch_LastEdge
+
+ Returns
+     the time of the last edge (or start). Read it before the timer
+****************************************************************************/
+uint32_t EdgeWatch_LastEdge(const EdgeWatch *watch)
+{
+	return watch->lastEdge;
+}
+
+/****************************************************************************
+ Function
+     EdgeWatch_Stopped
+
+ Parameters
+     lastEdge : from EdgeWatch_LastEdge
+		 now : the capture timer, read after lastEdge
+		 stoppedTicks : capture ticks without an edge that count as stopped
+
+ Returns
+     true once per stop, the first time we look after stoppedTicks without
+		   an edge. The next edge (or start) starts watching again
+****************************************************************************/
+bool EdgeWatch_Stopped(EdgeWatch *watch, uint32_t lastEdge, uint32_t now, uint32_t stoppedTicks)
+{
+	// Already reported this stop
+	if (watch->reported && (lastEdge == watch->reportedEdge))
+	{
+		return false;
+	}
+	watch->reported = false;
+	
+	if (now - lastEdge < stoppedTicks)
+	{
+		return false;
+	}
+	watch->reported = true;
+	watch->reportedEdge = lastEdge;
+	return true;
+}
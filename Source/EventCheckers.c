@@ -117,3 +117,34 @@ bool Check4Keystroke(void)
   }
   return false;
 }
+
+/****************************************************************************
+ Function
+   Check4BeaconPulses
+ Parameters
+   None
+ Returns
+   bool: true if a pulse posted an event
+ Description
+   processes the beacon pulses the phototransistor interrupt has recorded
+   since we last looked
+****************************************************************************/
+bool Check4BeaconPulses(void)
+{
+  return ProcessBeaconPulses();
+}
+
+/****************************************************************************
+ Function
+   Check4PeriscopeStopped
+ Parameters
+   None
+ Returns
+   bool: true if we posted that the periscope has stopped
+ Description
+   checks how long it has been since the periscope's last encoder edge
+****************************************************************************/
+bool Check4PeriscopeStopped(void)
+{
+  return CheckPeriscopeStopped();
+}
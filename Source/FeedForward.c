@@ -0,0 +1,284 @@
+/****************************************************************************
+ Module
+   FeedForward.c
+
+ Description
+		Feed-forward duty maps for the speed loops. Each motor has a table of
+		  the steady speed it reaches at a set of duties, measured on the robot
+			by a calibration sweep. For a speed setpoint we interpolate the duty
+			that should hold it and the PID loop only adds a correction, so it
+			no longer has to wind its integral up from zero on every new target.
+			We have no battery voltage to compensate with, so each map also has
+			a trim that scales it. While the loop is on its target we move the
+			trim slowly in the direction of the integral. That soaks up a sagging
+			battery (and a heavier load than the sweep saw) over a few seconds,
+			and the next setpoint starts from the duty the motor needs now.
+****************************************************************************/
+
+#include <stdio.h>
+#include "ES_Configure.h"
+#include "ES_Framework.h"
+#include "FeedForward.h"
+
+/*----------------------------- Module Defines ----------------------------*/
+// Limits on the trim, so a wheel held against something can't wind it away
+#define TRIM_MIN FLOAT_TO_Q16(0.5f)
+#define TRIM_MAX FLOAT_TO_Q16(2.0f)
+
+// Fractional bits of the untrimmed duty, for FixedPID_Ratio: a duty (Q16,
+// up to 100%) shifts this far in 32 bits, so takes the fast divide
+#define TRIM_HEADROOM 9
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     FeedForward_Init
+
+ Parameters
+     map : the map to build
+		 points : steady speeds measured at increasing duties
+		 numPoints : how many
+		 trimRate : trim per control period per unit (Q16 duty) of integral
+
+ Description
+     Points that are no faster than the one before tell us nothing, except
+		   that a motor that isn't turning yet needs more duty to get going, so
+			 we keep the highest duty that left it at rest. The trim starts at 1
+****************************************************************************/
+void FeedForward_Init(FeedForwardMap *map, const FeedForwardPoint *points, uint8_t numPoints, qgain_t trimRate)
+{
+	uint8_t i;
+	uint8_t n = 0;
+
+	for (i = 0; (i < numPoints) && (n < FEEDFORWARD_MAX_POINTS); i++)
+	{
+		q16_t rpm = INT_TO_Q16(points[i].rpm);
+		q16_t duty = INT_TO_Q16(points[i].duty);
+
+		if ((n > 0) && (rpm <= map->rpm[n - 1]))
+		{
+			if (map->rpm[n - 1] == 0)
+			{
+				map->duty[n - 1] = duty;
+			}
+			continue;
+		}
+		map->rpm[n] = rpm;
+		map->duty[n] = duty;
+		n++;
+	}
+
+	// The slope on to each next point, with the last one carrying on past the
+	// end of the map
+	for (i = 0; (i + 1) < n; i++)
+	{
+		map->slope[i] = (q16_t) (((int64_t) (map->duty[i + 1] - map->duty[i]) << Q16_SHIFT) / (map->rpm[i + 1] - map->rpm[i]));
+		map->rpmSlope[i] = (map->duty[i + 1] > map->duty[i])
+			? (q16_t) (((int64_t) (map->rpm[i + 1] - map->rpm[i]) << Q16_SHIFT) / (map->duty[i + 1] - map->duty[i])) : 0;
+	}
+	if (n > 0)
+	{
+		map->slope[n - 1] = (n > 1) ? map->slope[n - 2] : 0;
+		map->rpmSlope[n - 1] = (n > 1) ? map->rpmSlope[n - 2] : 0;
+	}
+
+	map->numPoints = n;
+	map->trim = INT_TO_Q16(1);
+	map->trimRate = trimRate;
+}
+
+/****************************************************************************
+ Function
+     FeedForward_Duty
+
+ Parameters
+     map : the motor's map
+		 rpm : the speed we want (Q16 RPM)
+
+ Returns
+     the duty (Q16 percent) that should hold that speed, or 0 for no speed.
+		   Safe to call from the control interrupt
+****************************************************************************/
+q16_t FeedForward_Duty(const FeedForwardMap *map, q16_t rpm)
+{
+	uint8_t i = 0;
+	q16_t duty;
+
+	if ((rpm <= 0) || (map->numPoints == 0))
+	{
+		return 0;
+	}
+
+	// Interpolate from the last point at or below this speed (or out from the
+	// first one)
+	while (((i + 1) < map->numPoints) && (map->rpm[i + 1] <= rpm))
+	{
+		i++;
+	}
+	duty = map->duty[i] + Q16_MUL(map->slope[i], rpm - map->rpm[i]);
+	if (duty < 0)
+	{
+		duty = 0;
+	}
+	return Q16_MUL(map->trim, duty);
+}
+
+/****************************************************************************
+ Function
+     FeedForward_RPM
+
+ Parameters
+     map : the motor's map
+		 duty : the duty we are driving it with (Q16 percent)
+
+ Returns
+     the speed (Q16 RPM) the map says that duty holds, 0 for a duty too
+		   small to turn the motor. Safe to call from the control interrupt
+****************************************************************************/
+q16_t FeedForward_RPM(const FeedForwardMap *map, q16_t duty)
+{
+	uint8_t i = 0;
+	q16_t rpm;
+
+	if ((duty <= 0) || (map->numPoints == 0))
+	{
+		return 0;
+	}
+
+	// Undo the trim, then interpolate from the last point at or below this
+	// duty (or out from the first one)
+	duty = FixedPID_Ratio((uint32_t) duty, (uint32_t) map->trim, TRIM_HEADROOM);
+	while (((i + 1) < map->numPoints) && (map->duty[i + 1] <= duty))
+	{
+		i++;
+	}
+	rpm = map->rpm[i] + Q16_MUL(map->rpmSlope[i], duty - map->duty[i]);
+	return (rpm < 0) ? 0 : rpm;
+}
+
+/****************************************************************************
+ Function
+     FeedForward_Trim
+
+ Parameters
+     map : the motor's map
+		 integral : the loop's integral (Q16 duty), the duty it is adding on
+		   top of the map
+
+ Description
+     Call it each control period the loop is on its target. The integral is
+		   the map's error there, so we move the trim to take it over
+****************************************************************************/
+void FeedForward_Trim(FeedForwardMap *map, q16_t integral)
+{
+	q16_t trim = map->trim + QGAIN_MUL(map->trimRate, integral);
+
+	map->trim = (trim > TRIM_MAX) ? TRIM_MAX : ((trim < TRIM_MIN) ? TRIM_MIN : trim);
+}
+
+/****************************************************************************
+ Function
+     FeedForward_StartSweep
+
+ Parameters
+     sweep : the sweep to start
+		 maxDuty : the last duty to measure (percent)
+		 numPoints : how many duties, evenly spaced up to maxDuty
+
+ Description
+     Starts settling at the first duty. Call FeedForward_SweepNext when it
+		   has settled, and again each time a measurement is done
+****************************************************************************/
+void FeedForward_StartSweep(FeedForwardSweep *sweep, uint8_t maxDuty, uint8_t numPoints)
+{
+	uint8_t i;
+
+	sweep->numPoints = (numPoints > FEEDFORWARD_MAX_POINTS) ? FEEDFORWARD_MAX_POINTS : numPoints;
+	for (i = 0; i < sweep->numPoints; i++)
+	{
+		sweep->points[i].duty = (uint8_t) ((maxDuty * (i + 1)) / sweep->numPoints);
+		sweep->points[i].rpm = 0;
+	}
+	sweep->step = 0;
+	sweep->measuring = false;
+}
+
+/****************************************************************************
+ Function
+     FeedForward_SweepDuty
+
+ Returns
+     the duty (percent) to drive the motor with, 0 once the sweep is done
+****************************************************************************/
+uint8_t FeedForward_SweepDuty(const FeedForwardSweep *sweep)
+{
+	return (sweep->step < sweep->numPoints) ? sweep->points[sweep->step].duty : 0;
+}
+
+/****************************************************************************
+ Function
+     FeedForward_SweepSample
+
+ Description
+     Adds the motor's speed (Q16 RPM) to the average while we are
+		   measuring. Call it from the control interrupt
+****************************************************************************/
+void FeedForward_SweepSample(FeedForwardSweep *sweep, q16_t rpm)
+{
+	if (sweep->measuring)
+	{
+		sweep->sum += (uint64_t) ((rpm < 0) ? 0 : rpm);
+		sweep->samples++;
+	}
+}
+
+/****************************************************************************
+ Function
+     FeedForward_SweepNext
+
+ Returns
+     false once the sweep is done
+
+ Description
+     After settling, starts measuring. After measuring, records the average
+		   speed and moves on to settle at the next duty. The control interrupt
+			 stops summing as soon as we clear measuring, so the sum is ours to read
+****************************************************************************/
+bool FeedForward_SweepNext(FeedForwardSweep *sweep)
+{
+	if (!sweep->measuring)
+	{
+		sweep->sum = 0;
+		sweep->samples = 0;
+		sweep->measuring = true;
+		return true;
+	}
+
+	sweep->measuring = false;
+	if (sweep->samples != 0)
+	{
+		sweep->points[sweep->step].rpm = (uint16_t) Q16_TO_INT((sweep->sum / sweep->samples) + (1 << (Q16_SHIFT - 1)));
+	}
+	sweep->step++;
+	return sweep->step < sweep->numPoints;
+}
+
+/****************************************************************************
+ Function
+     FeedForward_PrintSweep
+
+ Description
+     Prints the measured points as an initializer to paste in as the
+		   motor's default map
+****************************************************************************/
+void FeedForward_PrintSweep(const FeedForwardSweep *sweep)
+{
+	uint8_t i;
+
+	printf("{");
+	for (i = 0; i < sweep->numPoints; i++)
+	{
+		printf("%s{%u, %u}", (i == 0) ? "" : ", ", sweep->points[i].duty, sweep->points[i].rpm);
+	}
+	printf("}\r\n");
+}
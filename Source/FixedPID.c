@@ -0,0 +1,156 @@
+/****************************************************************************
+ Module
+   FixedPID.c
+
+ Description
+		Fixed-point PID kernel used by the drive and cannon control interrupts.
+		  Errors, integrals and outputs are Q16 and gains are Q24, so an update
+			is a handful of integer multiplies with no float math or divides.
+			The control law is the parallel form:
+				out = P*e + D*(e - lastE) + integral,   integral += I*e
+			with the integral clamped to its limits (anti-windup) and the output
+			clamped to the actuator range.
+****************************************************************************/
+
+#include "ES_Configure.h"
+#include "ES_Framework.h"
+#include "FixedPID.h"
+
+/*----------------------------- Module Defines ----------------------------*/
+#define Q16_MAX 0x7fffffff
+
+/*---------------------------- Module Functions ---------------------------*/
+static q16_t clampQ16(int64_t X, q16_t min, q16_t max);
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     FixedPID_Init
+
+ Description
+     Sets the integral and output limits of a loop and clears its state
+****************************************************************************/
+void FixedPID_Init(PIDState *pid, q16_t integralMin, q16_t integralMax, q16_t outputMin, q16_t outputMax)
+{
+	pid->integralMin = integralMin;
+	pid->integralMax = integralMax;
+	pid->outputMin = outputMin;
+	pid->outputMax = outputMax;
+	FixedPID_Reset(pid);
+}
+
+/****************************************************************************
+ Function
+     FixedPID_Reset
+
+ Description
+     Clears the integral and derivative history, e.g. on a new setpoint
+****************************************************************************/
+void FixedPID_Reset(PIDState *pid)
+{
+	pid->integral = 0;
+	pid->lastError = 0;
+}
+
+/****************************************************************************
+ Function
+     FixedPID_ScheduleGains
+
+ Description
+     Picks the gain set for the given error. While the error is more than
+		   startupFraction of the target we use the startup gains, otherwise
+			 we use the below gains until we reach the target and the above gains
+			 from then on.
+****************************************************************************/
+const PIDGains *FixedPID_ScheduleGains(const PIDSchedule *schedule, q16_t error, q16_t target)
+{
+	if ((schedule->startup != 0) && (error > Q16_MUL(schedule->startupFraction, target)))
+	{
+		return schedule->startup;
+	}
+	return (error <= 0) ? schedule->above : schedule->below;
+}
+
+/****************************************************************************
+ Function
+     FixedPID_Update
+
+ Description
+     Runs one control period with the given gains and returns the clamped
+		   output (Q16)
+****************************************************************************/
+q16_t FixedPID_Update(PIDState *pid, const PIDGains *gains, q16_t error)
+{
+	int64_t proportional;
+	int64_t output;
+
+	// A quadratic proportional response scales the gain by the error magnitude.
+	// The gain is Q40, and stays Q40 times |error| so that small errors keep
+	// their precision (for errors up to a few thousand RPM this fits in 64 bits)
+	if (gains->pScalesWithError)
+	{
+		int64_t pGain = ((int64_t) gains->p * Q16_ABS(error)) >> Q16_SHIFT;
+		proportional = (pGain * error) >> QSCALED_SHIFT;
+	}
+	else
+	{
+		proportional = QGAIN_MUL(gains->p, error);
+	}
+
+	//Determine Integral Term, clamping for anti-windup
+	pid->integral = clampQ16((int64_t) pid->integral + QGAIN_MUL(gains->i, error), pid->integralMin, pid->integralMax);
+
+	//Sum the proportional, derivative and integral responses
+	output = proportional + QGAIN_MUL(gains->d, error - pid->lastError) + pid->integral;
+
+	//Save the Last Error
+	pid->lastError = error;
+
+	return clampQ16(output, pid->outputMin, pid->outputMax);
+}
+
+/****************************************************************************
+ Function
+     FixedPID_Ratio
+
+ Description
+     Returns numerator / denominator in Q16, saturating at the Q16 maximum.
+		   headroom (at most Q16_SHIFT) sets the fractional resolution of the
+			 result. A numerator that fits in 32 bits shifted left by headroom
+			 (the RPM numerators) takes one 32-bit divide; a bigger one (e.g. a
+			 move's encoder ticks at full Q16 headroom) takes the slower 64-bit
+			 divide rather than wrapping.
+			 Returns 0 for a zero denominator (e.g. a stopped motor).
+****************************************************************************/
+q16_t FixedPID_Ratio(uint32_t numerator, uint32_t denominator, uint8_t headroom)
+{
+	uint32_t quotient;
+
+	if (denominator == 0)
+	{
+		return 0;
+	}
+
+	if (numerator <= (UINT32_MAX >> headroom))
+	{
+		quotient = (numerator << headroom) / denominator;
+	}
+	else
+	{
+		uint64_t wide = ((uint64_t) numerator << headroom) / denominator;
+		quotient = (wide > UINT32_MAX) ? UINT32_MAX : (uint32_t) wide;
+	}
+
+	// saturate rather than wrap on a glitch-short period
+	if (quotient > (uint32_t) (Q16_MAX >> (Q16_SHIFT - headroom)))
+	{
+		return Q16_MAX;
+	}
+	return (q16_t) (quotient << (Q16_SHIFT - headroom));
+}
+
+// Clamp a wide intermediate to the given Q16 range
+static q16_t clampQ16(int64_t X, q16_t min, q16_t max)
+{
+	return (X > max) ? max : ((X < min) ? min : (q16_t) X);
+}
@@ -0,0 +1,145 @@
+/****************************************************************************
+ Module
+   Geometry.c
+
+ Description
+		Single precision trig and angle helpers for the positioning math.
+		  Everything here stays in float, so the M4's FPU does the work
+			instead of the double precision software library. Sine and cosine
+			share one range reduction to [-pi/4, pi/4] and are then evaluated
+			with short Taylor polynomials (error well under 1e-6 there).
+			Geo_Atan2 folds into [0, 1] and uses a minimax polynomial (error
+			about 1e-5 radians), for loops that need thousands of bearings.
+****************************************************************************/
+
+#include <Math.h>
+
+#include "ES_Configure.h"
+#include "ES_Framework.h"
+#include "Geometry.h"
+
+/*----------------------------- Module Defines ----------------------------*/
+#define TWO_OVER_PI 0.636619772f
+
+// pi/2 split in two, so that the reduction doesn't lose precision
+#define HALF_PI_HI 1.57079637f
+#define HALF_PI_LO -4.37113883e-8f
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     Geo_SinCos
+
+ Parameters
+     angle : in radians
+		 sinOut, cosOut : where to put the sine and cosine
+
+ Description
+     Returns both the sine and cosine of an angle for the price of one
+		   range reduction
+****************************************************************************/
+void Geo_SinCos(float angle, float *sinOut, float *cosOut)
+{
+	// Find the nearest multiple of pi/2 and the remainder from it
+	float quadrant = floorf((angle * TWO_OVER_PI) + 0.5f);
+	float r = (angle - (quadrant * HALF_PI_HI)) - (quadrant * HALF_PI_LO);
+	float r2 = r * r;
+	
+	// Evaluate both polynomials on the remainder
+	float s = r + (r * r2 * (-1.66666667e-1f + r2 * (8.33333333e-3f + r2 * (-1.98412698e-4f + r2 * 2.75573192e-6f))));
+	float c = 1.0f + (r2 * (-0.5f + r2 * (4.16666667e-2f + r2 * (-1.38888889e-3f + r2 * 2.48015873e-5f))));
+	
+	// Rotate the result back into the right quadrant
+	switch (((int32_t) quadrant) & 3)
+	{
+		case 0:
+			*sinOut = s;
+			*cosOut = c;
+			break;
+		case 1:
+			*sinOut = c;
+			*cosOut = -s;
+			break;
+		case 2:
+			*sinOut = -s;
+			*cosOut = -c;
+			break;
+		default:
+			*sinOut = -c;
+			*cosOut = s;
+			break;
+	}
+}
+
+// Returns the sine of an angle in radians
+float Geo_Sin(float angle)
+{
+	float s;
+	float c;
+	Geo_SinCos(angle, &s, &c);
+	return s;
+}
+
+// Returns the cosine of an angle in radians
+float Geo_Cos(float angle)
+{
+	float s;
+	float c;
+	Geo_SinCos(angle, &s, &c);
+	return c;
+}
+
+/****************************************************************************
+ Function
+     Geo_Atan2
+
+ Description
+     Returns the angle of (x, y) in (-pi, pi], like atan2f but cheaper
+****************************************************************************/
+float Geo_Atan2(float y, float x)
+{
+	float absX = fabsf(x);
+	float absY = fabsf(y);
+	float ratio;
+	float ratioSquared;
+	float angle;
+	
+	if ((absX == 0) && (absY == 0))
+	{
+		return 0;
+	}
+	
+	// Work with the smaller over the larger, so the ratio is in [0, 1]
+	ratio = (absX >= absY) ? (absY / absX) : (absX / absY);
+	ratioSquared = ratio * ratio;
+	angle = ratio * (0.9998660f + (ratioSquared * (-0.3302995f + (ratioSquared * (0.1801410f
+		+ (ratioSquared * (-0.0851330f + (ratioSquared * 0.0208351f))))))));
+	
+	// Unfold into the right octant and quadrant
+	if (absY > absX)
+	{
+		angle = GEO_HALF_PI - angle;
+	}
+	if (x < 0)
+	{
+		angle = GEO_PI - angle;
+	}
+	return (y < 0) ? -angle : angle;
+}
+
+// Returns an equivalent angle in the range [0, 360) degrees
+float Geo_WrapDegrees(float angle)
+{
+	float wrapped = angle - (360.0f * floorf(angle * (1.0f / 360.0f)));
+	
+	// rounding can land a tiny negative angle exactly on 360
+	return (wrapped >= 360.0f) ? (wrapped - 360.0f) : wrapped;
+}
+
+// Returns an equivalent angle in the range [0, 2*pi) radians
+float Geo_WrapRadians(float angle)
+{
+	float wrapped = angle - (GEO_TWO_PI * floorf(angle * (1.0f / GEO_TWO_PI)));
+	
+	return (wrapped >= GEO_TWO_PI) ? (wrapped - GEO_TWO_PI) : wrapped;
+}
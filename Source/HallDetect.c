@@ -0,0 +1,201 @@
+/****************************************************************************
+ Module
+   HallDetect.c
+
+ Description
+		Decides which polling station the hall effect sensors are over. Each
+		  sensor classifies its own periods (so edges from other sensors can't
+			corrupt them) and keeps its own histogram of matched frequencies,
+			which it drops if it changes its mind about the frequency. A station
+			is reported once the sensors' combined confidence in one frequency
+			reaches the threshold: the pulses they have counted for it, plus a
+			bonus for each extra sensor that agrees.
+			The hall effect interrupts feed it edges; it touches no hardware.
+****************************************************************************/
+
+#include "ES_Configure.h"
+#include "ES_Framework.h"
+#include "HallDetect.h"
+
+/*----------------------------- Module Defines ----------------------------*/
+#define MAX_HISTOGRAM_COUNT 0xff
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     HallDetect_Init
+
+ Parameters
+     detector : the detector to set up
+		 table : a period table built by PeriodBins_Build from the station periods
+		 threshold : confidence needed to report a station
+		 agreementBonus : confidence added for each extra sensor that agrees
+****************************************************************************/
+void HallDetect_Init(HallDetector *detector, const PeriodBinTable *table, uint8_t threshold, uint8_t agreementBonus)
+{
+	detector->table = table;
+	detector->threshold = threshold;
+	detector->agreementBonus = agreementBonus;
+	HallDetect_Reset(detector);
+}
+
+/****************************************************************************
+ Function
+     HallDetect_Reset
+
+ Description
+     Forgets every sensor's histogram (but not its last capture, so its next
+		   edge still gives a period)
+****************************************************************************/
+void HallDetect_Reset(HallDetector *detector)
+{
+	for (int i = 0; i < HALL_DETECT_SENSORS; i++)
+	{
+		detector->sensors[i].lastFrequency = PERIOD_BIN_NONE;
+		for (int j = 0; j < HALL_DETECT_FREQUENCIES; j++)
+		{
+			detector->sensors[i].histogram[j] = 0;
+		}
+	}
+}
+
+/****************************************************************************
+ Function
+     HallDetect_Period
+
+ Parameters
+     detector : the detector
+		 sensor : index of the sensor that saw the edge
+		 capture : the edge's capture time
+
+ Returns
+     the frequency index of the period since the sensor's last edge, or
+		   PERIOD_BIN_NONE if it matches no station
+
+ Description
+     Call it on every edge, so the sensor's last capture stays current
+****************************************************************************/
+uint8_t HallDetect_Period(HallDetector *detector, uint8_t sensor, uint32_t capture)
+{
+	HallSensor *thisSensor = &detector->sensors[sensor];
+	uint8_t frequencyIndex = PeriodBins_Classify(detector->table, capture - thisSensor->lastCapture);
+
+	thisSensor->lastCapture = capture;
+	return frequencyIndex;
+}
+
+/****************************************************************************
+ Function
+     HallDetect_Count
+
+ Parameters
+     detector : the detector
+		 sensor : index of the sensor that saw the period
+		 frequencyIndex : the period's frequency index, from HallDetect_Period
+		 sensorMask : set to the sensors that have seen this frequency
+
+ Returns
+     true if the sensors are now confident enough to report the station
+****************************************************************************/
+bool HallDetect_Count(HallDetector *detector, uint8_t sensor, uint8_t frequencyIndex, uint8_t *sensorMask)
+{
+	HallSensor *thisSensor = &detector->sensors[sensor];
+
+	// A sensor sitting over a station sees one frequency. If this sensor just
+	// changed its mind, its earlier history is not trustworthy
+	if ((thisSensor->lastFrequency != PERIOD_BIN_NONE) && (thisSensor->lastFrequency != frequencyIndex))
+	{
+		for (int i = 0; i < HALL_DETECT_FREQUENCIES; i++)
+		{
+			thisSensor->histogram[i] = 0;
+		}
+	}
+	thisSensor->lastFrequency = frequencyIndex;
+
+	if (thisSensor->histogram[frequencyIndex] < MAX_HISTOGRAM_COUNT)
+	{
+		thisSensor->histogram[frequencyIndex]++;
+	}
+
+	return HallDetect_Confidence(detector, frequencyIndex, sensorMask) >= detector->threshold;
+}
+
+/****************************************************************************
+ Function
+     HallDetect_Confidence
+
+ Returns
+     our confidence that we are over the given frequency: the pulses seen by
+		   all sensors plus a bonus for each extra sensor that agrees. Also
+			 returns a mask of the sensors that saw it (bit 0 = sensor 0)
+****************************************************************************/
+uint8_t HallDetect_Confidence(const HallDetector *detector, uint8_t frequencyIndex, uint8_t *sensorMask)
+{
+	uint16_t score = 0;
+	uint8_t agreeing = 0;
+
+	*sensorMask = 0;
+	for (int i = 0; i < HALL_DETECT_SENSORS; i++)
+	{
+		if (detector->sensors[i].histogram[frequencyIndex] != 0)
+		{
+			score += detector->sensors[i].histogram[frequencyIndex];
+			*sensorMask |= (1 << i);
+			agreeing++;
+		}
+	}
+
+	if (agreeing > 1)
+	{
+		score += detector->agreementBonus * (agreeing - 1);
+	}
+	return (score > MAX_HISTOGRAM_COUNT) ? MAX_HISTOGRAM_COUNT : score;
+}
+
+/****************************************************************************
+ Function
+     HallDetect_StationOffset
+
+ Parameters
+     detector : the detector
+		 frequencyIndex : the station's frequency index
+		 lateralPositions : each sensor's distance right of the centerline
+		 maxOffset : the furthest off center the sensors can place a station
+
+ Returns
+     how far the station's field is right of our centerline, as the centroid
+		   of the positions of the sensors that saw the frequency, weighted by
+			 how many pulses each counted, and no more than maxOffset either way
+
+ Description
+     A sensor counts from when it reaches the field, so the counts already
+		   carry which sensor got there first. Weighting by arrival times instead
+			 places the station no better (tests/test_HallDetect.c).
+****************************************************************************/
+float HallDetect_StationOffset(const HallDetector *detector, uint8_t frequencyIndex, const float *lateralPositions, float maxOffset)
+{
+	float weightedSum = 0;
+	uint16_t totalPulses = 0;
+	float offset;
+
+	for (int i = 0; i < HALL_DETECT_SENSORS; i++)
+	{
+		weightedSum += detector->sensors[i].histogram[frequencyIndex] * lateralPositions[i];
+		totalPulses += detector->sensors[i].histogram[frequencyIndex];
+	}
+
+	if (totalPulses == 0)
+	{
+		return 0;
+	}
+	offset = weightedSum / totalPulses;
+	if (offset > maxOffset)
+	{
+		return maxOffset;
+	}
+	else if (offset < -maxOffset)
+	{
+		return -maxOffset;
+	}
+	return offset;
+}
@@ -27,7 +27,10 @@
 #include "SendingByte_SM.h"
 #include "PACLogic_SM.h"
 #include "DriveTrainControl_Service.h"
+#include "IsrTiming.h"
 #include "AttackStrategy_SM.h"
+#include "PeriodBins.h"
+#include "HallDetect.h"
 /*----------------------------- Module Defines ----------------------------*/
 // define constants for the states for this machine
 // and any other local defines
@@ -36,8 +39,16 @@
 
 #define PERIOD_MEASURING_ERROR_TOLERANCE 8 //in micr
 #define NUMBER_PULSES_TO_STOP 4
-#define NUMBER_HALL_EFFECT_SENSORS 4
-#define NUMBER_FREQUENCIES 16
+
+// Confidence needed to report a station: as many pulses, across the sensors,
+// as the shared buckets needed. In the simulation in tests/test_HallDetect.c
+// a bonus for each extra sensor that agrees locks no sooner (the sensors over
+// a station see the same edges at once), but lets stray edges on several
+// sensors add up to a station, so there is none
+#define CONFIDENCE_THRESHOLD (NUMBER_PULSES_TO_STOP + 1)
+#define SENSOR_AGREEMENT_BONUS 0
+#define NUMBER_HALL_EFFECT_SENSORS HALL_DETECT_SENSORS
+#define NUMBER_FREQUENCIES HALL_DETECT_FREQUENCIES
 
 //Pound Define Index in Array Corresponding to Hall Effect Position
 #define LEFT_OUTER_INDEX 0
@@ -46,6 +57,10 @@
 #define RIGHT_OUTER_INDEX 3
 
 #define MICROSECONDS 1000000
+
+// Period lookup bins are 2^7 = 128 ticks (3.2us) wide
+#define HE_BIN_SHIFT 7
+#define HE_NUM_BINS PERIOD_BIN_COUNT(HE_f_200, HE_f_1000, PERIOD_MEASURING_ERROR_TOLERANCE, HE_BIN_SHIFT)
 #define NULL_PERIOD_INDEX 100 //we want to return this if we found no frequencies
 /*---------------------------- Module Functions ---------------------------*/
 /* prototypes for private functions for this machine, things like during
@@ -59,14 +74,25 @@ static void initializeHEInterrupts(void);
 static void enableHEInterrupts(void);
 static void disableHEInterrupts(void);
 
-static void updateBuckets(uint32_t CurrentPeriod);
-static bool toleranceCheck(uint32_t value, uint32_t target, uint32_t tol);
+static void updateSensor(uint8_t sensor, uint32_t ThisCapture);
 
 /*---------------------------- Module Variables ---------------------------*/
 // everybody needs a state variable, you may need others as well
 static HallEffectState_t CurrentState;
 
-static uint8_t buckets[NUMBER_FREQUENCIES];
+//Each sensor's period history and histogram of matched frequencies
+static HallDetector Detector;
+
+//Lateral position of each sensor relative to the centerline (inches, right positive)
+static const float SensorLateralPositions[NUMBER_HALL_EFFECT_SENSORS] = {
+	-HALL_SENSOR_OUTER_LATERAL,
+	-HALL_SENSOR_INNER_LATERAL,
+	HALL_SENSOR_INNER_LATERAL,
+	HALL_SENSOR_OUTER_LATERAL
+};
+
+//Lateral offset of the last detected station from our centerline (inches, right positive)
+static float StationOffset;
 
 //Create Array with different Possibile Periods in Microseconds (note although it says _f these are actually directly periods in Microseconds
 uint32_t HallEffect_P[] = {	
@@ -87,12 +113,18 @@ uint32_t HallEffect_P[] = {
 	HE_f_253, 
 	HE_f_200};
 
-//Last Capture from Interrupts
-	uint32_t lastCaptureOuterLeft;
-	uint32_t lastCaptureInnerLeft;
-	uint32_t lastCaptureInnerRight;
-	uint32_t lastCaptureOuterRight;
-	
+//Period lookup table, built at startup from HallEffect_P
+static uint8_t HE_Bins[HE_NUM_BINS];
+static uint32_t HE_Lower[NUMBER_FREQUENCIES];
+static uint32_t HE_Upper[NUMBER_FREQUENCIES];
+static PeriodBinTable HE_Table = {
+	.shift = HE_BIN_SHIFT,
+	.numBins = HE_NUM_BINS,
+	.bins = HE_Bins,
+	.lower = HE_Lower,
+	.upper = HE_Upper
+};
+
 /*------------------------------ Module Code ------------------------------*/
 /****************************************************************************
  Function
@@ -117,10 +149,7 @@ ES_Event RunHallEffectSM( ES_Event CurrentEvent )
 	 // If we stop seeing pulses on the hall sensor, reset
 	 if ((CurrentEvent.EventType == ES_TIMEOUT) && (CurrentEvent.EventParam == HALL_EFFECT_TIMEOUT_TIMER))
 	 {
-	 	 for (int i = 0; i < NUMBER_FREQUENCIES; i++)
-	 	 {
-	 	 	 buckets[i] = 0;
-	 	 }
+	 	 HallDetect_Reset(&Detector);
 		 
 		 // Go back to the measuring state
 		 ES_Event MeasureEvent;
@@ -197,6 +226,10 @@ ES_Event RunHallEffectSM( ES_Event CurrentEvent )
 ****************************************************************************/
 void StartHallEffectSM ( ES_Event CurrentEvent )
 {
+	//Build the period lookup before any edges arrive
+	PeriodBins_Build(&HE_Table, HallEffect_P, NUMBER_FREQUENCIES, PERIOD_MEASURING_ERROR_TOLERANCE);
+	HallDetect_Init(&Detector, &HE_Table, CONFIDENCE_THRESHOLD, SENSOR_AGREEMENT_BONUS);
+	
   //Initialize the Hall Effect Interrupts
 	initializeHEInterrupts();
 	
@@ -352,146 +385,131 @@ void disableHEInterrupts(void){
 /***************************************************************************
 Interrupt Responses
  ***************************************************************************/
-//OUTER LEFT 
+//OUTER LEFT
 void HE_OuterLeft_InterruptResponse(void){
+	uint32_t start = currentTimerValue(HALLSENSOR_OUTER_LEFT_INTERRUPT_PARAMATERS);
+	uint32_t latency = captureAge(HALLSENSOR_OUTER_LEFT_INTERRUPT_PARAMATERS);
+	
 	//Clear the Source of the Interrupt
 	clearCaptureInterrupt(HALLSENSOR_OUTER_LEFT_INTERRUPT_PARAMATERS);
-	//printf("outerleft\r\n");
-	// Determine Capture time
-	uint32_t ThisCapture = captureInterrupt(HALLSENSOR_OUTER_LEFT_INTERRUPT_PARAMATERS);
-	
-	// Calculate period ( in microseconds)
-	uint32_t Period = ((ThisCapture - lastCaptureOuterLeft) * MICROSECONDS_DIVISOR) / TICKS_PER_MS;
 	
-	//Update Our Last Capture
-	lastCaptureOuterLeft = ThisCapture;
+	// Update this sensor's history with the capture time
+	updateSensor(LEFT_OUTER_INDEX, captureInterrupt(HALLSENSOR_OUTER_LEFT_INTERRUPT_PARAMATERS));
 	
-	// Update our knowledge of the most recent periods
-	updateBuckets(Period);
+	// note how long the other interrupts held us off, and how long we took
+	IsrTiming_Record(ISR_HALL_EFFECT, latency, currentTimerValue(HALLSENSOR_OUTER_LEFT_INTERRUPT_PARAMATERS) - start);
 }
 
 //INNER LEFT
 void HE_InnerLeft_InterruptResponse(void){
+	uint32_t start = currentTimerValue(HALLSENSOR_INNER_LEFT_INTERRUPT_PARAMATERS);
+	uint32_t latency = captureAge(HALLSENSOR_INNER_LEFT_INTERRUPT_PARAMATERS);
+	
 	//Clear the Source of the Interrupt
 	clearCaptureInterrupt(HALLSENSOR_INNER_LEFT_INTERRUPT_PARAMATERS);
-	//printf("innerleft\r\n");
-	// Determine Capture time
-	uint32_t ThisCapture = captureInterrupt(HALLSENSOR_INNER_LEFT_INTERRUPT_PARAMATERS);
-	
-	// Calculate period ( in microseconds)
-	uint32_t Period = ((ThisCapture - lastCaptureInnerLeft) * MICROSECONDS_DIVISOR) / TICKS_PER_MS;
 	
-	//Update Our Last Capture
-	lastCaptureInnerLeft = ThisCapture;
+	// Update this sensor's history with the capture time
+	updateSensor(LEFT_INNER_INDEX, captureInterrupt(HALLSENSOR_INNER_LEFT_INTERRUPT_PARAMATERS));
 	
-	// Update our knowledge of the most recent periods
-	updateBuckets(Period);
+	// note how long the other interrupts held us off, and how long we took
+	IsrTiming_Record(ISR_HALL_EFFECT, latency, currentTimerValue(HALLSENSOR_INNER_LEFT_INTERRUPT_PARAMATERS) - start);
 }
 
 //INNER RIGHT
 void HE_InnerRight_InterruptResponse(void){
+	uint32_t start = currentTimerValue(HALLSENSOR_INNER_RIGHT_INTERRUPT_PARAMATERS);
+	uint32_t latency = captureAge(HALLSENSOR_INNER_RIGHT_INTERRUPT_PARAMATERS);
+	
 	//Clear the Source of the Interrupt
 	clearCaptureInterrupt(HALLSENSOR_INNER_RIGHT_INTERRUPT_PARAMATERS);
-	//printf("innerright\r\n");
-	// Determine Capture time
-	uint32_t ThisCapture = captureInterrupt(HALLSENSOR_INNER_RIGHT_INTERRUPT_PARAMATERS);
-	
-	// Calculate period ( in microseconds)
-	uint32_t Period = ((ThisCapture - lastCaptureInnerRight) * MICROSECONDS_DIVISOR) / TICKS_PER_MS;
 	
-	//Update Our Last Capture
-	lastCaptureInnerRight = ThisCapture;
+	// Update this sensor's history with the capture time
+	updateSensor(RIGHT_INNER_INDEX, captureInterrupt(HALLSENSOR_INNER_RIGHT_INTERRUPT_PARAMATERS));
 	
-	// Update our knowledge of the most recent periods
-	updateBuckets(Period);
+	// note how long the other interrupts held us off, and how long we took
+	IsrTiming_Record(ISR_HALL_EFFECT, latency, currentTimerValue(HALLSENSOR_INNER_RIGHT_INTERRUPT_PARAMATERS) - start);
 }
 
 //OUTER RIGHT
 void HE_OuterRight_InterruptResponse(void){
+	uint32_t start = currentTimerValue(HALLSENSOR_OUTER_RIGHT_INTERRUPT_PARAMATERS);
+	uint32_t latency = captureAge(HALLSENSOR_OUTER_RIGHT_INTERRUPT_PARAMATERS);
+	
 	//Clear the Source of the Interrupt
 	clearCaptureInterrupt(HALLSENSOR_OUTER_RIGHT_INTERRUPT_PARAMATERS);
-	//printf("outerright\r\n");
-	// Determine Capture time
-	uint32_t ThisCapture = captureInterrupt(HALLSENSOR_OUTER_RIGHT_INTERRUPT_PARAMATERS);
 	
-	// Calculate period ( in microseconds)
-	uint32_t Period = ((ThisCapture - lastCaptureOuterRight) * MICROSECONDS_DIVISOR) / TICKS_PER_MS;
+	// Update this sensor's history with the capture time
+	updateSensor(RIGHT_OUTER_INDEX, captureInterrupt(HALLSENSOR_OUTER_RIGHT_INTERRUPT_PARAMATERS));
 	
-	//Update Our Last Capture
-	lastCaptureOuterRight = ThisCapture;
-	
-	// Update our knowledge of the most recent periods
-	updateBuckets(Period);
+	// note how long the other interrupts held us off, and how long we took
+	IsrTiming_Record(ISR_HALL_EFFECT, latency, currentTimerValue(HALLSENSOR_OUTER_RIGHT_INTERRUPT_PARAMATERS) - start);
 }
 
 
-
-
-
-
 /***************************************************************************
-Update the Array with Periods to shift everything down whenever we get a new one
+Update a sensor's period history and histogram whenever it sees an edge
  ***************************************************************************/
-void updateBuckets(uint32_t CurrentPeriod){
+static void updateSensor(uint8_t sensor, uint32_t ThisCapture){
+	// Classify the period (in capture ticks) against the hall effect frequencies
+	// Each sensor uses its own last capture, so edges from other sensors can't corrupt it
+	uint8_t FrequencyIndex = HallDetect_Period(&Detector, sensor, ThisCapture);
 	
 	if (!CheckGameStarted())
 	{
 		return;
 	}
 	
-	//Shift Periods Down
-	for (int i = 0; i < NUMBER_FREQUENCIES; i++){
-			// If the period matches a legitimate period per the field spec
-			if (toleranceCheck(CurrentPeriod, HallEffect_P[i], PERIOD_MEASURING_ERROR_TOLERANCE))
-			{
-				// Increment the number of periods seen for that frequency
-				buckets[i]++;
-				
-				// If we have seen enough of a given frequency to consider it a match
-				if (buckets[i] > NUMBER_PULSES_TO_STOP)
-				{
-					// If we do not own this frequency
-					if (!checkOwnFrequency(i)){
-						//Disable the Interrupts
-						disableHEInterrupts();
-						
-						// Stop the timeout timer, as we have a match
-						ES_Timer_StopTimer(HALL_EFFECT_TIMEOUT_TIMER);
-						 
-						//Post to master that we detected a polling station
-						ES_Event ThisEvent;
-						ThisEvent.EventType = ES_PS_DETECTED;
-						ThisEvent.EventParam = i; //Pass Index Over
-						
-						//set the target frequency index
-						SetTargetFrequencyIndex(i);
-						
-						PostMasterSM(ThisEvent);
-						
-					}
-					
-					// reset all buckets
-					for (int i = 0; i < NUMBER_FREQUENCIES; i++){
-						buckets[i] = 0;
-					}
-				}
-				else
-				{
-					// Restart the hall effect timeout timer
-					ES_Timer_InitTimer(HALL_EFFECT_TIMEOUT_TIMER, HALL_EFFECT_TIMEOUT_T);
-				}
-				
-				return;
-			}
+	// If the period did not match a legitimate period per the field spec, ignore it
+	if (FrequencyIndex == PERIOD_BIN_NONE)
+	{
+		return;
+	}
+	
+	// If the sensors together are confident enough to consider it a match
+	uint8_t SensorMask;
+	if (HallDetect_Count(&Detector, sensor, FrequencyIndex, &SensorMask))
+	{
+		// If we do not own this frequency
+		if (!checkOwnFrequency(FrequencyIndex)){
+			//Disable the Interrupts
+			disableHEInterrupts();
+			
+			// Stop the timeout timer, as we have a match
+			ES_Timer_StopTimer(HALL_EFFECT_TIMEOUT_TIMER);
+			 
+			//Post to master that we detected a polling station, along with which sensors saw it
+			ES_Event ThisEvent;
+			ThisEvent.EventType = ES_PS_DETECTED;
+			ThisEvent.EventParam = PS_DETECTED_PARAM(FrequencyIndex, SensorMask);
+			
+			//Latch where the station sits across the chassis, to go with the event
+			StationOffset = HallDetect_StationOffset(&Detector, FrequencyIndex, SensorLateralPositions, MAX_RESOLVED_STATION_OFFSET);
+			
+			//set the target frequency index
+			SetTargetFrequencyIndex(FrequencyIndex);
+			
+			PostMasterSM(ThisEvent);
+			
+		}
+		
+		// reset all sensor histories
+		HallDetect_Reset(&Detector);
+	}
+	else
+	{
+		// Restart the hall effect timeout timer
+		ES_Timer_InitTimer(HALL_EFFECT_TIMEOUT_TIMER, HALL_EFFECT_TIMEOUT_T);
 	}
 }
 
-// Returns true if the value matches the target within a specified tolerance
-static bool toleranceCheck(uint32_t value, uint32_t target, uint32_t tol){
-	//Check if within Tolerance
-	if ( (value <= target + tol) && (value >= target - tol)){
-		return true;
-	} else {
-		return false;
-	}
-}	
+/****************************************************************************
+ Function
+     GetStationOffset
+
+ Returns
+     The lateral offset (inches, right positive) of the station reported by the
+		   last ES_PS_DETECTED
+****************************************************************************/
+float GetStationOffset(void){
+	return StationOffset;
+}
@@ -237,6 +237,7 @@ typedef struct {
 	int cint_periodic;
 	int eim;
 	int raw;
+	int value;
 } Timer;
 
 typedef struct {
@@ -248,8 +249,8 @@ typedef struct {
 
 static Timer timers[] = 
 {
-	{.raw = TIMER_O_TAR, .enable = TIMER_CTL_TAEN, .ilr = TIMER_O_TAILR, .mr = TIMER_O_TAMR, .mr_m = TIMER_TAMR_TAMR_M, .mr_period = TIMER_TAMR_TAMR_PERIOD, .ams = TIMER_TAMR_TAAMS, .cdir = TIMER_TAMR_TACDIR, .cmr = TIMER_TAMR_TACMR, .cap = TIMER_TAMR_TAMR_CAP, .event_m = TIMER_CTL_TAEVENT_M, .stall = TIMER_CTL_TASTALL, .toim = TIMER_IMR_TATOIM, .cint = TIMER_ICR_CAECINT, .cint_periodic = TIMER_ICR_TATOCINT, .eim = TIMER_IMR_CAEIM},
-	{.raw = TIMER_O_TBR, .enable = TIMER_CTL_TBEN, .ilr = TIMER_O_TBILR, .mr = TIMER_O_TBMR, .mr_m = TIMER_TBMR_TBMR_M, .mr_period = TIMER_TBMR_TBMR_PERIOD, .ams = TIMER_TBMR_TBAMS, .cdir = TIMER_TBMR_TBCDIR, .cmr = TIMER_TBMR_TBCMR, .cap = TIMER_TBMR_TBMR_CAP, .event_m = TIMER_CTL_TBEVENT_M, .stall = TIMER_CTL_TBSTALL, .toim = TIMER_IMR_TBTOIM, .cint = TIMER_ICR_CBECINT, .cint_periodic = TIMER_ICR_TBTOCINT, .eim = TIMER_IMR_CBEIM}
+	{.raw = TIMER_O_TAR, .value = TIMER_O_TAV, .enable = TIMER_CTL_TAEN, .ilr = TIMER_O_TAILR, .mr = TIMER_O_TAMR, .mr_m = TIMER_TAMR_TAMR_M, .mr_period = TIMER_TAMR_TAMR_PERIOD, .ams = TIMER_TAMR_TAAMS, .cdir = TIMER_TAMR_TACDIR, .cmr = TIMER_TAMR_TACMR, .cap = TIMER_TAMR_TAMR_CAP, .event_m = TIMER_CTL_TAEVENT_M, .stall = TIMER_CTL_TASTALL, .toim = TIMER_IMR_TATOIM, .cint = TIMER_ICR_CAECINT, .cint_periodic = TIMER_ICR_TATOCINT, .eim = TIMER_IMR_CAEIM},
+	{.raw = TIMER_O_TBR, .value = TIMER_O_TBV, .enable = TIMER_CTL_TBEN, .ilr = TIMER_O_TBILR, .mr = TIMER_O_TBMR, .mr_m = TIMER_TBMR_TBMR_M, .mr_period = TIMER_TBMR_TBMR_PERIOD, .ams = TIMER_TBMR_TBAMS, .cdir = TIMER_TBMR_TBCDIR, .cmr = TIMER_TBMR_TBCMR, .cap = TIMER_TBMR_TBMR_CAP, .event_m = TIMER_CTL_TBEVENT_M, .stall = TIMER_CTL_TBSTALL, .toim = TIMER_IMR_TBTOIM, .cint = TIMER_ICR_CBECINT, .cint_periodic = TIMER_ICR_TBTOCINT, .eim = TIMER_IMR_CBEIM}
 };
 
 static Timerpair timerpairs[] = 
@@ -478,6 +479,25 @@ uint32_t captureInterrupt(
 	uint32_t time_length){
 	return HWREG(timerpairs[timer_num].base + timers[timer_letter].raw);
 	}
+
+//call this to get the current (free running) value of a capture timer
+uint32_t currentTimerValue(
+	uint8_t timer_num, 
+	uint8_t timer_letter,
+	uint8_t priority,
+	uint32_t time_length){
+	return HWREG(timerpairs[timer_num].base + timers[timer_letter].value);
+	}
+
+//call this to get how many ticks ago the captured edge happened. Each capture
+//  timer has its own count, but the age of an edge is the same on all of them
+uint32_t captureAge(
+	uint8_t timer_num, 
+	uint8_t timer_letter,
+	uint8_t priority,
+	uint32_t time_length){
+	return HWREG(timerpairs[timer_num].base + timers[timer_letter].value) - HWREG(timerpairs[timer_num].base + timers[timer_letter].raw);
+	}
 	
 
 
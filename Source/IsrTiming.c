@@ -0,0 +1,76 @@
+/****************************************************************************
+ Module
+   IsrTiming.c
+
+ Description
+		Keeps the worst case of each priority 0 capture interrupt: its latency
+		  (how long after its edge it started, i.e. the capture's age on entry)
+			and its duration, both in capture ticks. A capture source loses an
+			edge when its latency runs past the time to its next edge, so these
+			show how close each one comes.
+****************************************************************************/
+
+#include "ES_Configure.h"
+#include "ES_Framework.h"
+#include "IsrTiming.h"
+
+/*---------------------------- Module Variables ---------------------------*/
+static volatile uint32_t LongestLatency[NUM_TIMED_ISRS];
+static volatile uint32_t LongestDuration[NUM_TIMED_ISRS];
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     IsrTiming_Record
+
+ Parameters
+     isr : which interrupt
+		 latency : capture ticks from its edge to its entry
+		 duration : capture ticks it ran for
+
+ Description
+     Call at the end of the interrupt
+****************************************************************************/
+void IsrTiming_Record(TimedIsr isr, uint32_t latency, uint32_t duration)
+{
+	if (latency > LongestLatency[isr])
+	{
+		LongestLatency[isr] = latency;
+	}
+	if (duration > LongestDuration[isr])
+	{
+		LongestDuration[isr] = duration;
+	}
+}
+
+/****************************************************************************
+ Function
+     IsrTiming_Get
+
+ Description
+     Returns the longest latency and duration (capture ticks) since the last
+		   reset
+****************************************************************************/
+void IsrTiming_Get(TimedIsr isr, uint32_t *longestLatency, uint32_t *longestDuration)
+{
+	*longestLatency = LongestLatency[isr];
+	*longestDuration = LongestDuration[isr];
+}
+
+/****************************************************************************
+ Function
+     IsrTiming_Reset
+
+ Description
+     Starts a new measurement
+****************************************************************************/
+void IsrTiming_Reset(void)
+{
+	EnterCritical();
+	for (int i = 0; i < NUM_TIMED_ISRS; i++)
+	{
+		LongestLatency[i] = 0;
+		LongestDuration[i] = 0;
+	}
+	ExitCritical();
+}
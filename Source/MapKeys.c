@@ -27,11 +27,14 @@
 #include "Master_SM.h"
 #include "DEFINITIONS.h"
 #include "DriveTrainControl_Service.h"
+#include "CannonControl_Service.h"
+#include "ParamStore.h"
 #include "PeriscopeControl_Service.h"
 #include "PositionLogic_Service.h"
 #include "PWM_Service.h"
 #include "AttackStrategy_SM.h"
 #include "PhotoTransistor_Service.h"
+#include "IsrTiming.h"
 
 /*----------------------------- Module Defines ----------------------------*/
 
@@ -39,6 +42,7 @@
 /* prototypes for private functions for this service.They should be functions
    relevant to the behavior of this service
 */
+static void PrintIsrTiming(void);
 
 
 /*---------------------------- Module Variables ---------------------------*/
@@ -188,6 +192,39 @@ ES_Event RunMapKeys( ES_Event ThisEvent )
 						case 'R' : ThisEvent.EventType = ES_CANNON_READY;
 											printf("Releasing hopper\r\n");
 											break;
+						case 'F' : ThisEvent.EventType = ES_CALIBRATE_DRIVE;
+											printf("Commanding: ES_CALIBRATE_DRIVE (wheels off the ground) \n\r");
+											break;
+						case 'G' : ThisEvent.EventType = ES_NO_EVENT;
+											{
+												ES_Event CalibrateEvent;
+												CalibrateEvent.EventType = ES_CALIBRATE_CANNON;
+												PostCannonControlService(CalibrateEvent);
+											}
+											printf("Commanding: ES_CALIBRATE_CANNON \n\r");
+											break;
+						case 'T' : ThisEvent.EventType = ES_AUTOTUNE_DRIVE;
+											printf("Commanding: ES_AUTOTUNE_DRIVE (room to drive ahead) \n\r");
+											break;
+						case 'Y' : ThisEvent.EventType = ES_NO_EVENT;
+											{
+												ES_Event AutotuneEvent;
+												AutotuneEvent.EventType = ES_AUTOTUNE_CANNON;
+												PostCannonControlService(AutotuneEvent);
+											}
+											printf("Commanding: ES_AUTOTUNE_CANNON \n\r");
+											break;
+						case 'U' : ThisEvent.EventType = ES_NO_EVENT;
+											ParamStore_ForgetGains(DRIVE_GAINS);
+											ParamStore_ForgetGains(CANNON_GAINS);
+											ParamStore_ForgetMap(DRIVE_LEFT_MAP);
+											ParamStore_ForgetMap(DRIVE_RIGHT_MAP);
+											ParamStore_ForgetMap(CANNON_MAP);
+											printf("Forgot the autotuned gains and calibrated maps, reset to use the defaults\r\n");
+											break;
+						case 'I' : ThisEvent.EventType = ES_NO_EVENT;
+											PrintIsrTiming();
+											break;
 
         }
 				
@@ -200,4 +237,27 @@ ES_Event RunMapKeys( ES_Event ThisEvent )
   return ReturnEvent;
 }
 
-
+/***************************************************************************
+ private functions
+ ***************************************************************************/
+// Print the worst latency and duration of each priority 0 capture interrupt,
+// and the beacon pulses dropped, then start measuring again
+static void PrintIsrTiming(void)
+{
+	static const char *Names[NUM_TIMED_ISRS] = {"periscope encoder", "cannon encoder", "phototransistor", "hall effect"};
+	uint32_t latency;
+	uint32_t duration;
+	
+	for (int i = 0; i < NUM_TIMED_ISRS; i++)
+	{
+		IsrTiming_Get((TimedIsr) i, &latency, &duration);
+		
+		// in tenths of a microsecond, as the interrupts only take a few
+		latency = (latency * 10) / (TICKS_PER_MS / 1000);
+		duration = (duration * 10) / (TICKS_PER_MS / 1000);
+		printf("%s: longest latency %lu.%lu us, longest run %lu.%lu us\r\n", Names[i],
+			(unsigned long) (latency / 10), (unsigned long) (latency % 10), (unsigned long) (duration / 10), (unsigned long) (duration % 10));
+	}
+	printf("beacon pulses dropped: %u\r\n", GetDroppedBeaconPulses());
+	IsrTiming_Reset();
+}
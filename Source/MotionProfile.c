@@ -0,0 +1,161 @@
+/****************************************************************************
+ Module
+   MotionProfile.c
+
+ Description
+		Jerk- and acceleration-limited velocity setpoints for encoder tick
+		  moves. Each control period we take the distance to go and work out
+			the braking it would take to stop there (v^2 / 2d, less the distance
+			we cover while the jerk limit swings us round to braking). Until that reaches
+			the acceleration limit we accelerate toward full speed, and from then
+			on we brake just that hard, so we come to rest at the target however
+			short the move. Our acceleration changes by no more than the jerk
+			limit each period. On top of that a position loop on the ticks to
+			go caps the setpoint at the speed the wheels can really stop from
+			in that distance, which catches them when they lag the profile on
+			the way down, and takes over from the creep speed over the last
+			few ticks to bring the setpoint to zero at the target. All the math is fixed point so it can run in the drive
+			control interrupt.
+****************************************************************************/
+
+#include "ES_Configure.h"
+#include "ES_Framework.h"
+#include "MotionProfile.h"
+
+/*---------------------------- Module Functions ---------------------------*/
+static uint32_t isqrt(uint64_t x);
+static q16_t clamp(q16_t x, q16_t min, q16_t max);
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     MotionProfile_Reset
+
+ Description
+     Starts a profile from rest
+****************************************************************************/
+void MotionProfile_Reset(MotionProfile *profile)
+{
+	profile->velocity = 0;
+	profile->accel = 0;
+	profile->braking = false;
+}
+
+/****************************************************************************
+ Function
+     MotionProfile_Step
+
+ Parameters
+     profile : the profile to advance by one control period
+		 limits : its velocity, acceleration and jerk limits
+		 ticksToGo : encoder ticks left to the target
+
+ Returns
+     the velocity setpoint (Q16 RPM). This is at least the minimum velocity
+		   until the last few ticks (positionGain * ticksToGo), and zero at the
+			 target
+****************************************************************************/
+q16_t MotionProfile_Step(MotionProfile *profile, const MotionLimits *limits, uint32_t ticksToGo)
+{
+	int64_t brakingTicks;
+	q16_t swing;
+	q16_t needed;
+	q16_t error;
+	q16_t wantedAccel;
+	q16_t setpoint;
+	q16_t limit;
+	q16_t creep;
+
+	if (ticksToGo == 0)
+	{
+		MotionProfile_Reset(profile);
+		return 0;
+	}
+
+	// The braking it would take to stop in time (v^2 / 2d), allowing for the
+	// ticks we cover while the jerk limit swings our acceleration round to
+	// full braking, v * (a + A)^2 / 2JA
+	swing = profile->accel + limits->maxAccel;
+	swing = Q16_MUL(profile->velocity, Q16_MUL(swing, swing));
+	brakingTicks = (int64_t) ticksToGo - (((int64_t) swing * limits->leadGain) >> (2 * Q16_SHIFT));
+	needed = limits->maxAccel;
+	if (brakingTicks > 0)
+	{
+		uint64_t braking = ((((uint64_t) profile->velocity * (uint64_t) profile->velocity) / (uint64_t) brakingTicks) * (uint64_t) limits->brakeGain) >> (2 * Q16_SHIFT);
+		if (braking < (uint64_t) needed)
+		{
+			needed = (q16_t) braking;
+		}
+	}
+
+	// Once we need full braking we keep braking just hard enough to stop at
+	// the target, otherwise we head for full speed, easing off as we get close
+	// so that the jerk limit can bring our acceleration back to zero as we arrive
+	if (needed >= limits->maxAccel)
+	{
+		profile->braking = true;
+	}
+	if (profile->braking)
+	{
+		wantedAccel = -needed;
+	}
+	else
+	{
+		error = limits->maxVelocity - profile->velocity;
+		wantedAccel = (q16_t) isqrt(2 * (uint64_t) limits->maxJerk * (uint64_t) Q16_ABS(error));
+		wantedAccel = clamp(wantedAccel, 0, limits->maxAccel);
+	}
+
+	profile->accel += clamp(wantedAccel - profile->accel, -limits->maxJerk, limits->maxJerk);
+	profile->velocity = clamp(profile->velocity + profile->accel, 0, limits->maxVelocity);
+
+	// Don't push against a limit we've already hit
+	if ((profile->velocity == 0) || (profile->velocity == limits->maxVelocity))
+	{
+		profile->accel = 0;
+	}
+
+	// Position loop: no faster than we can stop from in the ticks to go, and
+	// over the last few ticks proportional to them. We creep in at the
+	// minimum velocity until then
+	limit = (q16_t) isqrt(((uint64_t) limits->stopGain * ticksToGo) << Q16_SHIFT);
+	if ((int64_t) limits->positionGain * ticksToGo < limit)
+	{
+		limit = (q16_t) (limits->positionGain * ticksToGo);
+	}
+	creep = (limit < limits->minVelocity) ? limit : limits->minVelocity;
+	setpoint = (profile->velocity < limit) ? profile->velocity : limit;
+	return (setpoint < creep) ? creep : setpoint;
+}
+
+// Integer square root (bit by bit, no divides)
+static uint32_t isqrt(uint64_t x)
+{
+	uint64_t root = 0;
+	uint64_t bit = 1ull << 62;
+
+	while (bit > x)
+	{
+		bit >>= 2;
+	}
+	while (bit != 0)
+	{
+		if (x >= root + bit)
+		{
+			x -= root + bit;
+			root = (root >> 1) + bit;
+		}
+		else
+		{
+			root >>= 1;
+		}
+		bit >>= 2;
+	}
+	return (uint32_t) root;
+}
+
+// Clamp to the given range
+static q16_t clamp(q16_t x, q16_t min, q16_t max)
+{
+	return (x > max) ? max : ((x < min) ? min : x);
+}
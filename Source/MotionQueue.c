@@ -0,0 +1,120 @@
+/****************************************************************************
+ Module
+   MotionQueue.c
+
+ Description
+		The drivetrain's queue of tick moves, which it runs back to back. A move
+		  that heads the same way as the one before it, with the same leading
+			wheel, continues it: the motion profile runs into it without braking,
+			so the profile's distance to go takes in the lead wheel ticks of every
+			queued move that continues on from the current one.
+****************************************************************************/
+
+#include <stddef.h>
+
+#include "ES_Configure.h"
+#include "ES_Framework.h"
+#include "MotionQueue.h"
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     MotionQueue_Clear
+
+ Description
+     Forgets any queued moves
+****************************************************************************/
+void MotionQueue_Clear(MotionQueue *queue)
+{
+	queue->head = 0;
+	queue->count = 0;
+}
+
+/****************************************************************************
+ Function
+     MotionQueue_Push
+
+ Returns
+     false (and leaves the queue alone) if the queue is full
+****************************************************************************/
+bool MotionQueue_Push(MotionQueue *queue, const MotionPrimitive *move)
+{
+	if (queue->count >= MOTION_QUEUE_SIZE)
+	{
+		return false;
+	}
+	queue->moves[(queue->head + queue->count) % MOTION_QUEUE_SIZE] = *move;
+	queue->count++;
+	return true;
+}
+
+/****************************************************************************
+ Function
+     MotionQueue_Pop
+
+ Returns
+     false if the queue is empty, otherwise takes the oldest move into move
+****************************************************************************/
+bool MotionQueue_Pop(MotionQueue *queue, MotionPrimitive *move)
+{
+	if (queue->count == 0)
+	{
+		return false;
+	}
+	*move = queue->moves[queue->head];
+	queue->head = (queue->head + 1) % MOTION_QUEUE_SIZE;
+	queue->count--;
+	return true;
+}
+
+/****************************************************************************
+ Function
+     MotionQueue_Next
+
+ Returns
+     the move MotionQueue_Pop would take, or NULL if the queue is empty
+****************************************************************************/
+const MotionPrimitive *MotionQueue_Next(const MotionQueue *queue)
+{
+	return (queue->count == 0) ? NULL : &queue->moves[queue->head];
+}
+
+/****************************************************************************
+ Function
+     MotionQueue_Continues
+
+ Returns
+     true if to heads the same way as from, with the same leading wheel, so
+		   we can run into it without braking
+****************************************************************************/
+bool MotionQueue_Continues(const MotionPrimitive *from, const MotionPrimitive *to)
+{
+	return (to->negativeLeft == from->negativeLeft) && (to->negativeRight == from->negativeRight)
+		&& ((to->leftTicks >= to->rightTicks) == (from->leftTicks >= from->rightTicks));
+}
+
+/****************************************************************************
+ Function
+     MotionQueue_BlendTicks
+
+ Returns
+     the lead wheel ticks of the queued moves that carry straight on from
+		   current, up to the first that doesn't
+****************************************************************************/
+uint32_t MotionQueue_BlendTicks(const MotionQueue *queue, const MotionPrimitive *current)
+{
+	const MotionPrimitive *last = current;
+	uint32_t ticks = 0;
+	
+	for (uint8_t i = 0; i < queue->count; i++)
+	{
+		const MotionPrimitive *move = &queue->moves[(queue->head + i) % MOTION_QUEUE_SIZE];
+		if (!MotionQueue_Continues(last, move))
+		{
+			break;
+		}
+		ticks += (move->leftTicks >= move->rightTicks) ? move->leftTicks : move->rightTicks;
+		last = move;
+	}
+	return ticks;
+}
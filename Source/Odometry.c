@@ -0,0 +1,274 @@
+/****************************************************************************
+ Module
+   Odometry.c
+
+ Description
+		Dead reckoning from the drive encoders. Every encoder edge moves one
+		  wheel by a fixed distance, which turns us by a fixed angle about the
+			other wheel and moves our center by half that distance along our
+			heading. We integrate that in the encoder interrupts in fixed point:
+			position is Q16 inches and heading is a binary angle (2^32 = one
+			full turn, so it wraps for free). Beacon fixes re-anchor the pose.
+****************************************************************************/
+
+#include "ES_Configure.h"
+#include "ES_Framework.h"
+#include "DEFINITIONS.h"
+#include "Geometry.h"
+#include "Odometry.h"
+
+/*----------------------------- Module Defines ----------------------------*/
+#define TICK_INCHES (WHEEL_CIRCUMFERENCE / (ENCODER_PULSES_PER_REV * DRIVE_GEAR_RATIO))
+
+// How far our center moves for one wheel tick, in Q24 inches
+#define HALF_TICK_Q24 ((int32_t) (TICK_INCHES * 0.5f * 16777216.0f))
+
+// How far we turn for one wheel tick, as a binary angle
+#define TICK_HEADING ((uint32_t) ((TICK_INCHES / DISTANCE_BETWEEN_WHEELS) * (4294967296.0f / GEO_TWO_PI)))
+
+#define QUARTER_TURN 0x40000000ul
+// A Q24 step times a Q15 sine, back down to Q16 (rounded, so that thousands
+// of steps don't accumulate a bias)
+#define STEP_SHIFT (QGAIN_SHIFT - Q16_SHIFT + 15)
+#define STEP_ROUND (1L << (STEP_SHIFT - 1))
+
+/*---------------------------- Module Functions ---------------------------*/
+static void step(int32_t direction, uint32_t headingChange);
+static int32_t sinQ15(uint32_t angle);
+
+/*---------------------------- Module Variables ---------------------------*/
+// Quarter wave sine table, 64 steps from 0 to 90 degrees, Q15
+static const int16_t QuarterSine[65] = {
+	0, 804, 1608, 2410, 3212, 4011, 4808, 5602, 6393, 7179, 7962, 8739, 9512, 10278, 11039, 11793,
+	12539, 13279, 14010, 14732, 15446, 16151, 16846, 17530, 18204, 18868, 19519, 20159, 20787, 21403, 22005, 22594,
+	23170, 23731, 24279, 24811, 25329, 25832, 26319, 26790, 27245, 27683, 28105, 28510, 28898, 29268, 29621, 29956,
+	30273, 30571, 30852, 31113, 31356, 31580, 31785, 31971, 32137, 32285, 32412, 32521, 32609, 32678, 32728, 32757,
+	32767
+};
+
+static q16_t PoseX; // inches
+static q16_t PoseY; // inches
+static uint32_t PoseHeading; // binary angle, counterclockwise
+static bool Anchored = false;
+
+// Counts anchors, which invalidate earlier snapshots
+static uint16_t Epoch = 0;
+
+// The corrections applied since the last anchor. Snapshots are taken without
+// them and get them back when read, so a correction moves every snapshot of
+// the epoch along with the pose instead of invalidating them
+static q16_t CorrectionX;
+static q16_t CorrectionY;
+static uint32_t CorrectionHeading;
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     Odometry_Anchor
+
+ Description
+     Sets our pose from an absolute fix (e.g. the beacons)
+****************************************************************************/
+void Odometry_Anchor(float x, float y, float thetaDegrees)
+{
+	EnterCritical();
+	PoseX = FLOAT_TO_Q16(x);
+	PoseY = FLOAT_TO_Q16(y);
+	PoseHeading = (uint32_t) (Geo_WrapDegrees(thetaDegrees) * (4294967296.0f / 360.0f));
+	Anchored = true;
+	CorrectionX = 0;
+	CorrectionY = 0;
+	CorrectionHeading = 0;
+	Epoch++;
+	ExitCritical();
+}
+
+/****************************************************************************
+ Function
+     Odometry_Correct
+
+ Description
+     Shifts our pose by a small correction (e.g. from a beacon bearing),
+		   keeping any ticks counted since the correction was computed.
+			 Snapshots already taken shift with it
+****************************************************************************/
+void Odometry_Correct(float dx, float dy, float dThetaDegrees)
+{
+	q16_t correctionX = FLOAT_TO_Q16(dx);
+	q16_t correctionY = FLOAT_TO_Q16(dy);
+	int32_t correctionHeading = (int32_t) (dThetaDegrees * (4294967296.0f / 360.0f));
+	
+	EnterCritical();
+	PoseX += correctionX;
+	PoseY += correctionY;
+	PoseHeading += (uint32_t) correctionHeading;
+	CorrectionX += correctionX;
+	CorrectionY += correctionY;
+	CorrectionHeading += (uint32_t) correctionHeading;
+	ExitCritical();
+}
+
+/****************************************************************************
+ Function
+     Odometry_IsAnchored
+
+ Returns
+     true iff we have had an absolute fix, so the pose means something
+****************************************************************************/
+bool Odometry_IsAnchored(void)
+{
+	return Anchored;
+}
+
+/****************************************************************************
+ Function
+     Odometry_LeftTick / Odometry_RightTick
+
+ Parameters
+     forward : the direction we are driving that wheel
+
+ Description
+     Call from the encoder interrupts on every edge. Driving the left wheel
+		   forward turns us clockwise, and the right wheel counterclockwise
+****************************************************************************/
+void Odometry_LeftTick(bool forward)
+{
+	step(forward ? 1 : -1, forward ? -TICK_HEADING : TICK_HEADING);
+}
+
+void Odometry_RightTick(bool forward)
+{
+	step(forward ? 1 : -1, forward ? TICK_HEADING : -TICK_HEADING);
+}
+
+/****************************************************************************
+ Function
+     Odometry_GetPose
+
+ Description
+     Returns our current pose in inches and degrees (counterclockwise)
+****************************************************************************/
+void Odometry_GetPose(float *x, float *y, float *thetaDegrees)
+{
+	q16_t poseX;
+	q16_t poseY;
+	uint32_t poseHeading;
+	
+	// Take a consistent snapshot, as the encoder interrupts update all three
+	EnterCritical();
+	poseX = PoseX;
+	poseY = PoseY;
+	poseHeading = PoseHeading;
+	ExitCritical();
+	
+	*x = Q16_TO_FLOAT(poseX);
+	*y = Q16_TO_FLOAT(poseY);
+	*thetaDegrees = poseHeading * (360.0f / 4294967296.0f);
+}
+
+/****************************************************************************
+ Function
+     Odometry_Heading
+
+ Returns
+     Our heading as a binary angle (2^32 = one turn, counterclockwise).
+		   A single read, so cheap and safe from an interrupt
+****************************************************************************/
+uint32_t Odometry_Heading(void)
+{
+	return PoseHeading;
+}
+
+/****************************************************************************
+ Function
+     Odometry_Snapshot
+
+ Description
+     Records our raw pose, e.g. from an interrupt when we see a beacon
+****************************************************************************/
+void Odometry_Snapshot(OdometrySnapshot *snapshot)
+{
+	EnterCritical();
+	snapshot->x = PoseX - CorrectionX;
+	snapshot->y = PoseY - CorrectionY;
+	snapshot->heading = PoseHeading - CorrectionHeading;
+	snapshot->epoch = Epoch;
+	ExitCritical();
+}
+
+/****************************************************************************
+ Function
+     Odometry_SnapshotPose
+
+ Parameters
+     first, last : snapshots bracketing an observation (may be the same)
+
+ Returns
+     false if odometry has been anchored since either snapshot
+
+ Description
+     Gives our pose midway between the two snapshots, in inches and degrees,
+		   with the corrections applied since they were taken
+****************************************************************************/
+bool Odometry_SnapshotPose(const OdometrySnapshot *first, const OdometrySnapshot *last, float *x, float *y, float *thetaDegrees)
+{
+	uint16_t epoch;
+	q16_t correctionX;
+	q16_t correctionY;
+	uint32_t correctionHeading;
+	
+	EnterCritical();
+	epoch = Epoch;
+	correctionX = CorrectionX;
+	correctionY = CorrectionY;
+	correctionHeading = CorrectionHeading;
+	ExitCritical();
+	
+	if ((first->epoch != epoch) || (last->epoch != epoch))
+	{
+		return false;
+	}
+	
+	*x = Q16_TO_FLOAT(((int64_t) first->x + last->x) / 2 + correctionX);
+	*y = Q16_TO_FLOAT(((int64_t) first->y + last->y) / 2 + correctionY);
+	*thetaDegrees = (first->heading + (uint32_t) ((int32_t) (last->heading - first->heading) / 2) + correctionHeading) * (360.0f / 4294967296.0f);
+	return true;
+}
+
+// Move half a tick along the heading midway through the turn
+static void step(int32_t direction, uint32_t headingChange)
+{
+	uint32_t midHeading = PoseHeading + (uint32_t) ((int32_t) headingChange / 2);
+	
+	PoseX += (q16_t) (((int64_t) direction * HALF_TICK_Q24 * sinQ15(midHeading + QUARTER_TURN) + STEP_ROUND) >> STEP_SHIFT);
+	PoseY += (q16_t) (((int64_t) direction * HALF_TICK_Q24 * sinQ15(midHeading) + STEP_ROUND) >> STEP_SHIFT);
+	PoseHeading += headingChange;
+}
+
+// Sine of a binary angle in Q15, interpolated from the quarter wave table
+static int32_t sinQ15(uint32_t angle)
+{
+	uint32_t quadrant = angle >> 30;
+	uint32_t withinQuadrant = angle & (QUARTER_TURN - 1);
+	uint32_t index;
+	int32_t fraction;
+	int32_t value;
+	
+	// Run backwards through the table in the second and fourth quadrants
+	if (quadrant & 1)
+	{
+		withinQuadrant = QUARTER_TURN - withinQuadrant;
+	}
+	
+	// 6 bits pick the table entry and the next 8 interpolate between entries
+	index = withinQuadrant >> 24;
+	fraction = (withinQuadrant >> 16) & 0xff;
+	value = QuarterSine[index];
+	if (index < 64)
+	{
+		value += ((QuarterSine[index + 1] - value) * fraction) >> 8;
+	}
+	
+	// The bottom half of the circle is negative
+	return (quadrant & 2) ? -value : value;
+}
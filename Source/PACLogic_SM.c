@@ -28,6 +28,7 @@
 #include "SendingCMD_SM.h"
 #include "SendingByte_SM.h"
 #include "GameInfo.h"
+#include "HallEffect_SM.h"
 
 /*----------------------------- Module Defines ----------------------------*/
 // define constants for the states for this machine
@@ -106,7 +107,7 @@ ES_Event RunPACLogicSM( ES_Event CurrentEvent )
 									MakeTransition = true;
 							//If we detect a polling station move to the request state
 							} else if (CurrentEvent.EventType == ES_PS_DETECTED){
-									TargetFrequencyIndex = CurrentEvent.EventParam;
+									TargetFrequencyIndex = PS_FREQUENCY_INDEX(CurrentEvent.EventParam);
 									NextState = Capture_t;
 									MakeTransition = true;
 							}
@@ -128,7 +129,7 @@ ES_Event RunPACLogicSM( ES_Event CurrentEvent )
 							//If we detect a polling station move to the request state
 							} else if (CurrentEvent.EventType == ES_PS_DETECTED)
 							{
-								TargetFrequencyIndex = CurrentEvent.EventParam;
+								TargetFrequencyIndex = PS_FREQUENCY_INDEX(CurrentEvent.EventParam);
 								//Defer the Event
 								ES_DeferEvent(DeferralQueue, CurrentEvent); 
 							}
@@ -0,0 +1,237 @@
+/****************************************************************************
+ Module
+   ParamStore.c
+
+ Description
+		Keeps tuned control gains and calibrated duty maps in the TM4C's
+		  EEPROM, so they survive a reset. Each gain set and map has its own
+			record with a check word, and the controllers read theirs at init.
+			A record that is blank (the EEPROM reads all ones), forgotten or
+			damaged doesn't check, and the loop keeps the gains or map it was
+			built with.
+****************************************************************************/
+
+#include "ES_Configure.h"
+#include "ES_Framework.h"
+
+#include "inc/hw_memmap.h"
+#include "inc/hw_types.h"
+#include "inc/hw_sysctl.h"
+#include "driverlib/eeprom.h"
+#include "string.h"
+#include "stddef.h"
+
+#include "ParamStore.h"
+
+/*----------------------------- Module Defines ----------------------------*/
+// Mixed into each record's check word, and changed whenever GainSet changes
+// so that we never read an old layout
+#define RECORD_KEY 0x47a1e501
+
+// The same for the map records, changed whenever FeedForwardPoint or
+// FEEDFORWARD_MAX_POINTS changes
+#define MAP_KEY 0x3d5c9e02
+
+/*---------------------------- Module Functions ---------------------------*/
+static bool startEEPROM(void);
+static uint32_t checkWord(const void *data, uint32_t size, uint32_t key);
+
+/*---------------------------- Module Variables ---------------------------*/
+// A gain set and its check word, as stored
+typedef struct {
+	GainSet gains;
+	uint32_t check;
+} GainRecord;
+
+// A duty map's points and its check word, as stored after the gain sets
+typedef struct {
+	FeedForwardPoint points[FEEDFORWARD_MAX_POINTS];
+	uint32_t numPoints;
+	uint32_t check;
+} MapRecord;
+
+#define MAP_ADDRESS(id) (NUM_GAIN_SETS * sizeof(GainRecord) + (id) * sizeof(MapRecord))
+
+static bool Started = false;
+static bool Ready = false;
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     ParamStore_ReadGains
+
+ Parameters
+     id : the gain set
+		 gains : filled in with the stored gains
+
+ Returns
+     false (leaving gains alone) if none are stored
+****************************************************************************/
+bool ParamStore_ReadGains(GainSetID id, GainSet *gains)
+{
+	GainRecord record;
+
+	if ((id >= NUM_GAIN_SETS) || !startEEPROM())
+	{
+		return false;
+	}
+
+	EEPROMRead((uint32_t *) &record, id * sizeof(GainRecord), sizeof(GainRecord));
+	if (record.check != checkWord(&record.gains, sizeof(GainSet), RECORD_KEY))
+	{
+		return false;
+	}
+	*gains = record.gains;
+	return true;
+}
+
+/****************************************************************************
+ Function
+     ParamStore_WriteGains
+
+ Returns
+     false if the EEPROM couldn't store them
+****************************************************************************/
+bool ParamStore_WriteGains(GainSetID id, const GainSet *gains)
+{
+	GainRecord record;
+
+	if ((id >= NUM_GAIN_SETS) || !startEEPROM())
+	{
+		return false;
+	}
+
+	record.gains = *gains;
+	record.check = checkWord(gains, sizeof(GainSet), RECORD_KEY);
+	return EEPROMProgram((uint32_t *) &record, id * sizeof(GainRecord), sizeof(GainRecord)) == 0;
+}
+
+/****************************************************************************
+ Function
+     ParamStore_ForgetGains
+
+ Description
+     Clears a gain set, so the loop goes back to the gains it was built
+		   with at the next reset
+****************************************************************************/
+void ParamStore_ForgetGains(GainSetID id)
+{
+	GainRecord record;
+
+	if ((id >= NUM_GAIN_SETS) || !startEEPROM())
+	{
+		return;
+	}
+
+	memset(&record, 0, sizeof(record));
+	EEPROMProgram((uint32_t *) &record, id * sizeof(GainRecord), sizeof(GainRecord));
+}
+
+/****************************************************************************
+ Function
+     ParamStore_ReadMap
+
+ Parameters
+     id : the duty map
+		 points : filled in with the stored points (FEEDFORWARD_MAX_POINTS of
+		   room)
+		 numPoints : filled in with how many
+
+ Returns
+     false (leaving points alone) if none are stored
+****************************************************************************/
+bool ParamStore_ReadMap(DutyMapID id, FeedForwardPoint *points, uint8_t *numPoints)
+{
+	MapRecord record;
+
+	if ((id >= NUM_DUTY_MAPS) || !startEEPROM())
+	{
+		return false;
+	}
+
+	EEPROMRead((uint32_t *) &record, MAP_ADDRESS(id), sizeof(MapRecord));
+	if ((record.check != checkWord(&record, offsetof(MapRecord, check), MAP_KEY))
+		|| (record.numPoints < 2) || (record.numPoints > FEEDFORWARD_MAX_POINTS))
+	{
+		return false;
+	}
+	memcpy(points, record.points, record.numPoints * sizeof(FeedForwardPoint));
+	*numPoints = (uint8_t) record.numPoints;
+	return true;
+}
+
+/****************************************************************************
+ Function
+     ParamStore_WriteMap
+
+ Returns
+     false if the EEPROM couldn't store it
+****************************************************************************/
+bool ParamStore_WriteMap(DutyMapID id, const FeedForwardPoint *points, uint8_t numPoints)
+{
+	MapRecord record;
+
+	if ((id >= NUM_DUTY_MAPS) || (numPoints > FEEDFORWARD_MAX_POINTS) || !startEEPROM())
+	{
+		return false;
+	}
+
+	// Clear the padding and unused points too, since they are in the check
+	memset(&record, 0, sizeof(record));
+	memcpy(record.points, points, numPoints * sizeof(FeedForwardPoint));
+	record.numPoints = numPoints;
+	record.check = checkWord(&record, offsetof(MapRecord, check), MAP_KEY);
+	return EEPROMProgram((uint32_t *) &record, MAP_ADDRESS(id), sizeof(MapRecord)) == 0;
+}
+
+/****************************************************************************
+ Function
+     ParamStore_ForgetMap
+
+ Description
+     Clears a duty map, so the motor goes back to the map it was built
+		   with at the next reset
+****************************************************************************/
+void ParamStore_ForgetMap(DutyMapID id)
+{
+	MapRecord record;
+
+	if ((id >= NUM_DUTY_MAPS) || !startEEPROM())
+	{
+		return;
+	}
+
+	memset(&record, 0, sizeof(record));
+	EEPROMProgram((uint32_t *) &record, MAP_ADDRESS(id), sizeof(MapRecord));
+}
+
+// Clock the EEPROM and recover it from any interrupted write, the first time
+// we need it
+static bool startEEPROM(void)
+{
+	if (!Started)
+	{
+		HWREG(SYSCTL_RCGCEEPROM) |= SYSCTL_RCGCEEPROM_R0;
+		while ((HWREG(SYSCTL_PREEPROM) & SYSCTL_PREEPROM_R0) != SYSCTL_PREEPROM_R0);
+		Ready = (EEPROMInit() == EEPROM_INIT_OK);
+		Started = true;
+	}
+	return Ready;
+}
+
+// The check word for size bytes (a whole number of words) of a record: its
+// words mixed with the key
+static uint32_t checkWord(const void *data, uint32_t size, uint32_t key)
+{
+	const uint8_t *bytes = data;
+	uint32_t check = key;
+	uint32_t word;
+	uint32_t i;
+
+	for (i = 0; (i + sizeof(word)) <= size; i += sizeof(word))
+	{
+		memcpy(&word, bytes + i, sizeof(word));
+		check = ((check << 5) | (check >> 27)) ^ word;
+	}
+	return check;
+}
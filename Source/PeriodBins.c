@@ -0,0 +1,102 @@
+/****************************************************************************
+ Module
+   PeriodBins.c
+
+ Description
+		Classifies input capture periods against a table of target periods
+		  without dividing. At init we convert each target period and its
+			tolerance into an inclusive range of raw capture ticks, and mark
+			which period (if any) each 2^shift tick wide bin can belong to.
+			In the interrupt a period is then one subtract, one shift, one
+			table index and a bounds check against the exact range, which gives
+			the same answer as converting to microseconds and tolerance checking
+			each entry in turn.
+****************************************************************************/
+
+#include "ES_Configure.h"
+#include "ES_Framework.h"
+#include "DEFINITIONS.h"
+#include "PeriodBins.h"
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     PeriodBins_Build
+
+ Parameters
+     table : shift, numBins and the bins/lower/upper storage must be set
+		 periods : target periods in microseconds
+		 numPeriods : number of target periods
+		 tolerance : allowed error in microseconds
+
+ Description
+     Fills in the tick ranges and bin table. A period of P microseconds
+		   (rounded down) is within tolerance of T iff its tick count lies in
+			 [(T - tol) * TICKS_PER_US, (T + tol + 1) * TICKS_PER_US - 1]
+			 The bin width must be narrower than the gap between adjacent ranges
+			 so that no bin holds two candidates.
+****************************************************************************/
+void PeriodBins_Build(PeriodBinTable *table, const uint32_t *periods, uint8_t numPeriods, uint32_t tolerance)
+{
+	uint32_t minPeriod = 0xffffffff;
+
+	// Find the shortest period, which sets where the table starts
+	for (int i = 0; i < numPeriods; i++)
+	{
+		if (periods[i] < minPeriod)
+		{
+			minPeriod = periods[i];
+		}
+	}
+	table->base = (minPeriod - tolerance) * TICKS_PER_US;
+
+	// Start with every bin empty
+	for (int b = 0; b < table->numBins; b++)
+	{
+		table->bins[b] = PERIOD_BIN_NONE;
+	}
+
+	// Mark the bins covered by each period's tick range
+	for (int i = 0; i < numPeriods; i++)
+	{
+		table->lower[i] = (periods[i] - tolerance) * TICKS_PER_US;
+		table->upper[i] = ((periods[i] + tolerance + 1) * TICKS_PER_US) - 1;
+
+		for (uint32_t b = (table->lower[i] - table->base) >> table->shift;
+			(b <= ((table->upper[i] - table->base) >> table->shift)) && (b < table->numBins); b++)
+		{
+			table->bins[b] = i;
+		}
+	}
+}
+
+/****************************************************************************
+ Function
+     PeriodBins_Classify
+
+ Parameters
+     table : a table built by PeriodBins_Build
+		 ticks : the period in raw capture ticks
+
+ Returns
+     the index of the matching period, or PERIOD_BIN_NONE
+****************************************************************************/
+uint8_t PeriodBins_Classify(const PeriodBinTable *table, uint32_t ticks)
+{
+	// Periods shorter than the table wrap around to a huge bin number
+	uint32_t bin = (ticks - table->base) >> table->shift;
+	uint8_t candidate;
+
+	if (bin >= table->numBins)
+	{
+		return PERIOD_BIN_NONE;
+	}
+
+	// The bin narrows it down to one candidate; check its exact range
+	candidate = table->bins[bin];
+	if ((candidate == PERIOD_BIN_NONE) || (ticks < table->lower[candidate]) || (ticks > table->upper[candidate]))
+	{
+		return PERIOD_BIN_NONE;
+	}
+	return candidate;
+}
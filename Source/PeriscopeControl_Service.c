@@ -4,7 +4,21 @@
 
  Description
 		Controls the periscope motor, as well as the mechanical servo
-		  which latches the periscope for zeroing
+		  which latches the periscope for zeroing.
+			The motor runs a PI speed loop from the encoder interrupt: every
+			CONTROL_TICKS encoder ticks we time the last CONTROL_TICKS, and
+			correct the duty around the duty we expect the target speed to need.
+			A constant speed keeps the beacon pulse counts (and so the bearing
+			averages) consistent, whatever the battery and friction.
+			When positioning tells us which sectors the beacons should be in,
+			we slow to PERISCOPE_TARGET_RPM through those sectors and sweep the
+			rest at PERISCOPE_SWEEP_RPM, so that each turn takes less time.
+			(The periscope only turns one way, so we can't scan back and forth
+			over the sectors.) The sectors are field bearings, which we turn
+			into periscope angles with the odometry heading as we go, so they
+			follow us round as we turn. If a few turns go by without new
+			sectors (positioning sends them with each bearing), they must be
+			wrong, and we go back to turning evenly.
 ****************************************************************************/
 /*----------------------------- Include Files -----------------------------*/
 /* include header files for this state machine as well as any machines at the
@@ -20,15 +34,72 @@
 #include "DriveTrainControl_Service.h"
 #include "PhotoTransistor_Service.h"
 #include "Master_SM.h"
+#include "FixedPID.h"
+#include "Odometry.h"
+#include "IsrTiming.h"
+#include "EdgeWatch.h"
 #include <Math.h>
 
 /*----------------------------- Module Defines ----------------------------*/
 #define PERISCOPE_FULL_ROTATION_ENCODER_TICKS 1000
 
+// Number of recent encoder edges we remember (must be a power of 2)
+#define EDGE_RING_SIZE 8
+#define EDGE_RING_MASK (EDGE_RING_SIZE - 1)
+
+// All edge times are kept on the first encoder channel's capture timer
+#define PERISCOPE_REFERENCE_TIMER PERISCOPE_ENCODER_INTERRUPT_PARAMATERS_1
+
+// We run the speed loop every this many encoder ticks (both channels), which
+// must be even as we only time edges on the first channel
+#define CONTROL_TICKS 16
+
+// RPM = RPM_NUMERATOR / (capture ticks for CONTROL_TICKS encoder ticks). We
+// divide out the encoder ticks first, as the full product doesn't fit in the
+// 32 bits of an unsigned long
+#define RPM_NUMERATOR (CONTROL_TICKS * TICKS_PER_MS * SECS_PER_MIN * (MS_PER_SEC / PERISCOPE_FULL_ROTATION_ENCODER_TICKS))
+#define RPM_HEADROOM 6
+
+// The preprocessor works in 64 bits, so it can check the target's 32-bit math
+#if ((MS_PER_SEC / PERISCOPE_FULL_ROTATION_ENCODER_TICKS) * PERISCOPE_FULL_ROTATION_ENCODER_TICKS) != MS_PER_SEC
+#error "PERISCOPE_FULL_ROTATION_ENCODER_TICKS must divide MS_PER_SEC for RPM_NUMERATOR"
+#endif
+#if (RPM_NUMERATOR << RPM_HEADROOM) > 0xffffffff
+#error "RPM_NUMERATOR shifted by RPM_HEADROOM overflows 32 bits"
+#endif
+
+// The duty we expect to hold a speed, which the loop corrects around
+#define FEED_FORWARD_DUTY(rpm) ((PERISCOPE_PWM_DUTY * (rpm)) / PERISCOPE_NOMINAL_RPM)
+
+#define TICKS_PER_DEGREE (PERISCOPE_FULL_ROTATION_ENCODER_TICKS / 360.0f)
+
+// The most beacon sectors we slow down for
+#define MAX_SECTORS 4
+
+// We start slowing down this far before a sector, as the motor takes a moment
+#define SECTOR_LEAD_DEGREES 20.0f
+
+// Turns without new sectors before we give up on them
+#define MAX_TURNS_WITHOUT_SECTORS 2
+
+// Gains, in duty percent per RPM of error
+#define PERISCOPE_P_GAIN 0.3f
+#define PERISCOPE_I_GAIN 0.05f
+
+#define INTEGRAL_CLAMP 40
+
+// The periscope has stopped once it goes this long without an edge
+#define STOPPED_TIME_MS 250
+
 /*---------------------------- Module Functions ---------------------------*/
 /* prototypes for private functions for this service.They should be functions
    relevant to the behavior of this service
 */
+static void recordEdge(uint32_t age);
+static void controlSpeed(void);
+static bool inSector(uint16_t tick);
+static uint16_t fieldTick(void);
+static void countTurn(void);
 
 
 /*---------------------------- Module Variables ---------------------------*/
@@ -38,12 +109,55 @@ static uint8_t MyPriority;
 //Encoder Input Capture Variables
 static uint32_t numTicks;
 
+//The time (on the reference timer) of each recent encoder edge, and the tick
+//  count that edge brought us to
+typedef struct {
+	uint32_t time;
+	uint16_t tick;
+} PeriscopeEdge;
+
+static PeriscopeEdge edges[EDGE_RING_SIZE];
+static uint8_t newestEdge;
+static uint8_t numEdges;
+
+//The time (on the reference timer) of the last edge on the first channel,
+//  which CheckPeriscopeStopped compares against, reporting each stop once
+static EdgeWatch Edges;
+
 static bool AligningToBucket = false;
 
 static bool isZeroed;
 
 static bool AttemptingToStop = false;
 
+//Speed loop
+static const PIDGains PeriscopeGains = {
+	.p = FLOAT_TO_QGAIN(PERISCOPE_P_GAIN),
+	.i = FLOAT_TO_QGAIN(PERISCOPE_I_GAIN),
+	.d = 0,
+	.pScalesWithError = false
+};
+static PIDState PeriscopePID;
+static bool Regulating = false;
+static q16_t CurrentRPM;
+
+//Ticks since the last control update, and the time of that update. We don't
+//  have a start time until the first update after starting
+static uint8_t ControlTickCount;
+static uint32_t LastControlTime;
+static bool HaveControlTime;
+
+//The ranges [start, end) we pass beacons at the target speed in, when we sweep
+//  between them. They are in encoder ticks of field bearing (see fieldTick)
+static bool SectorScanning = false;
+static uint16_t SectorStart[MAX_SECTORS];
+static uint16_t SectorEnd[MAX_SECTORS];
+static uint8_t NumSectors;
+static uint8_t TurnsSinceSectors;
+
+//The speed we last measured inside a sector
+static q16_t SectorRPM;
+
 /*------------------------------ Module Code ------------------------------*/
 /****************************************************************************
  Function
@@ -63,6 +177,12 @@ bool InitPeriscopeControlService ( uint8_t Priority )
   MyPriority = Priority;
   printf("Periscope Service Attempt Initialization \n\r");
 	
+	//Initialize the speed loop (we clamp the total duty ourselves)
+	FixedPID_Init(&PeriscopePID, INT_TO_Q16(-INTEGRAL_CLAMP), INT_TO_Q16(INTEGRAL_CLAMP), INT_TO_Q16(-100), INT_TO_Q16(100));
+	
+	//Nothing to report until RequireZero or an edge
+	EdgeWatch_Init(&Edges);
+	
 	//Initialize Our Input Captures for Encoder
 	InitInputCapture(PERISCOPE_ENCODER_INTERRUPT_PARAMATERS_1);
 	InitInputCapture(PERISCOPE_ENCODER_INTERRUPT_PARAMATERS_2);
@@ -115,16 +235,22 @@ ES_Event RunPeriscopeControlService( ES_Event ThisEvent )
 	// Start the periscope
 	if ((ThisEvent.EventType == ES_TIMEOUT) && (ThisEvent.EventParam == START_PERISCOPE_TIMER))
 	{
-		SetPWM_Periscope(PERISCOPE_PWM_DUTY);
+		StartPeriscope();
 	}
 	// If the periscope has stopped
-	else if ((ThisEvent.EventType == ES_TIMEOUT) && (ThisEvent.EventParam == PERISCOPE_STOPPED_TIMER))
+	else if (ThisEvent.EventType == ES_PERISCOPE_STOPPED)
 	{
+		// We are not turning, and the next edge can't be timed against the last
+		EnterCritical();
+		CurrentRPM = 0;
+		HaveControlTime = false;
+		ExitCritical();
+		
 		// If this was intentional (i.e. we are latching the periscope)
 		if (AttemptingToStop)
 		{
 			// Stop the motor
-			SetPWM_Periscope(0);
+			StopPeriscope();
 			
 			// Reset periscope encoder ticks, zeroing the periscope
 			ResetPeriscopeEncoderTicks();
@@ -157,10 +283,10 @@ ES_Event RunPeriscopeControlService( ES_Event ThisEvent )
 		//If we receive any of these events (from keyboard presses)
 		switch (ThisEvent.EventType){
 			case (ES_START_PERISCOPE):
-				SetPWM_Periscope(PERISCOPE_PWM_DUTY);
+				StartPeriscope();
 				break;
 			case (ES_STOP_PERISCOPE):
-				SetPWM_Periscope(0);
+				StopPeriscope();
 				break;
 		}
 	}
@@ -174,24 +300,45 @@ We use the quadrature on the optical encoder - not for determining direction,
 	but for finer resolution on our positioning
  ***************************************************************************/
 void PeriscopeEncoder_InterruptResponse_1(void){
+	uint32_t start = currentTimerValue(PERISCOPE_ENCODER_INTERRUPT_PARAMATERS_1);
+	uint32_t latency = captureAge(PERISCOPE_ENCODER_INTERRUPT_PARAMATERS_1);
+	
 	// start by clearing the source of the interrupt, the input capture event
 	clearCaptureInterrupt(PERISCOPE_ENCODER_INTERRUPT_PARAMATERS_1);
 	
 	// increment encoder ticks
 	numTicks++;
 	
-	// restart the stall timer
-	// We don't need to do this on both encoder interrupts
-	ES_Timer_InitTimer(PERISCOPE_STOPPED_TIMER, PERISCOPE_STOPPED_T);
-	
 	// If we have performed a full rotation, reset to zero
 	if (numTicks >= PERISCOPE_FULL_ROTATION_ENCODER_TICKS)
 	{
 		numTicks = 0;
+		countTurn();
+	}
+	
+	// remember when this edge happened
+	recordEdge(captureAge(PERISCOPE_ENCODER_INTERRUPT_PARAMATERS_1));
+	
+	// run the speed loop every CONTROL_TICKS ticks (two per edge on this channel)
+	ControlTickCount += 2;
+	if (ControlTickCount >= CONTROL_TICKS)
+	{
+		ControlTickCount = 0;
+		controlSpeed();
 	}
+	
+	// note the time for the stop check
+	// We don't need to do this on both encoder interrupts
+	EdgeWatch_Edge(&Edges, edges[newestEdge].time);
+	
+	// note how long the other interrupts held us off, and how long we took
+	IsrTiming_Record(ISR_PERISCOPE_ENCODER, latency, currentTimerValue(PERISCOPE_ENCODER_INTERRUPT_PARAMATERS_1) - start);
 }
 
 void PeriscopeEncoder_InterruptResponse_2(void){
+	uint32_t start = currentTimerValue(PERISCOPE_ENCODER_INTERRUPT_PARAMATERS_2);
+	uint32_t latency = captureAge(PERISCOPE_ENCODER_INTERRUPT_PARAMATERS_2);
+	
 	// start by clearing the source of the interrupt, the input capture event
 	clearCaptureInterrupt(PERISCOPE_ENCODER_INTERRUPT_PARAMATERS_2);
 	
@@ -202,7 +349,196 @@ void PeriscopeEncoder_InterruptResponse_2(void){
 	if (numTicks >= PERISCOPE_FULL_ROTATION_ENCODER_TICKS)
 	{
 		numTicks = 0;
+		countTurn();
 	}
+	
+	// remember when this edge happened
+	recordEdge(captureAge(PERISCOPE_ENCODER_INTERRUPT_PARAMATERS_2));
+	
+	// note how long the other interrupts held us off, and how long we took
+	IsrTiming_Record(ISR_PERISCOPE_ENCODER, latency, currentTimerValue(PERISCOPE_ENCODER_INTERRUPT_PARAMATERS_2) - start);
+}
+
+// Store an encoder edge that happened age ticks ago in the edge ring
+static void recordEdge(uint32_t age)
+{
+	newestEdge = (newestEdge + 1) & EDGE_RING_MASK;
+	edges[newestEdge].time = currentTimerValue(PERISCOPE_REFERENCE_TIMER) - age;
+	edges[newestEdge].tick = numTicks;
+	
+	if (numEdges < EDGE_RING_SIZE)
+	{
+		numEdges++;
+	}
+}
+
+// Time the last CONTROL_TICKS ticks, and correct the motor duty for the speed
+//  they give
+static void controlSpeed(void)
+{
+	uint32_t now = edges[newestEdge].time;
+	uint16_t target = PERISCOPE_TARGET_RPM;
+	q16_t duty;
+	
+	if (HaveControlTime)
+	{
+		CurrentRPM = FixedPID_Ratio(RPM_NUMERATOR, now - LastControlTime, RPM_HEADROOM);
+		
+		// While the latch is stopping us, don't push harder against it
+		if (Regulating && !AttemptingToStop)
+		{
+			// Hurry through the sectors no beacon should be in, and note the
+			// speed we really pass the beacons at
+			if (SectorScanning)
+			{
+				if (inSector(fieldTick()))
+				{
+					SectorRPM = CurrentRPM;
+				}
+				else
+				{
+					target = PERISCOPE_SWEEP_RPM;
+				}
+			}
+			
+			duty = INT_TO_Q16(FEED_FORWARD_DUTY(target)) + FixedPID_Update(&PeriscopePID, &PeriscopeGains, INT_TO_Q16(target) - CurrentRPM);
+			duty = (duty < 0) ? 0 : ((duty > INT_TO_Q16(100)) ? INT_TO_Q16(100) : duty);
+			SetPWM_Periscope(Q16_TO_FLOAT(duty));
+		}
+	}
+	LastControlTime = now;
+	HaveControlTime = true;
+}
+
+/****************************************************************************
+ Function
+     StartPeriscope
+
+ Description
+     Starts the periscope at the duty we expect to give the target speed,
+		   and hands it to the speed loop
+****************************************************************************/
+void StartPeriscope(void)
+{
+	EnterCritical();
+	FixedPID_Reset(&PeriscopePID);
+	HaveControlTime = false;
+	ControlTickCount = 0;
+	Regulating = true;
+	ExitCritical();
+	
+	SetPWM_Periscope(FEED_FORWARD_DUTY(PERISCOPE_TARGET_RPM));
+}
+
+/****************************************************************************
+ Function
+     StopPeriscope
+
+ Description
+     Stops the periscope motor and the speed loop
+****************************************************************************/
+void StopPeriscope(void)
+{
+	EnterCritical();
+	Regulating = false;
+	CurrentRPM = 0;
+	ExitCritical();
+	
+	SetPWM_Periscope(0);
+}
+
+/****************************************************************************
+ Function
+     GetPeriscopeRPM
+
+ Returns
+     The measured periscope speed (Q16 RPM), or 0 if it is stopped
+****************************************************************************/
+q16_t GetPeriscopeRPM(void)
+{
+	return CurrentRPM;
+}
+
+/****************************************************************************
+ Function
+     GetBeaconSweepRPM
+
+ Returns
+     The speed (Q16 RPM) the periscope last passed through a beacon sector
+		   at, or its current speed if we aren't sweeping between sectors.
+			 0 if it is stopped
+****************************************************************************/
+q16_t GetBeaconSweepRPM(void)
+{
+	if (SectorScanning && (CurrentRPM != 0))
+	{
+		return SectorRPM;
+	}
+	return CurrentRPM;
+}
+
+/****************************************************************************
+ Function
+     ScanSectors
+
+ Parameters
+     centers : field bearings (degrees) from us to the beacons
+		 halfWidths : how far (degrees) either side of each we might see it
+		 numSectors : how many sectors there are (at most MAX_SECTORS)
+
+ Description
+     Sweeps quickly between the given sectors from now on. We follow our
+		   heading as we turn, but not our position as we drive, so send new
+			 sectors every bearing or so
+****************************************************************************/
+void ScanSectors(const float *centers, const float *halfWidths, uint8_t numSectors)
+{
+	float start;
+	float end;
+	
+	if (numSectors > MAX_SECTORS)
+	{
+		numSectors = MAX_SECTORS;
+	}
+	
+	EnterCritical();
+	for (int i = 0; i < numSectors; i++)
+	{
+		// A sector wider than a turn covers everything
+		if ((2 * halfWidths[i]) + SECTOR_LEAD_DEGREES >= 360.0f)
+		{
+			SectorScanning = false;
+			ExitCritical();
+			return;
+		}
+		start = ToAppropriateRange(centers[i] - halfWidths[i] - SECTOR_LEAD_DEGREES);
+		end = ToAppropriateRange(centers[i] + halfWidths[i]);
+		SectorStart[i] = (uint16_t) (start * TICKS_PER_DEGREE) % PERISCOPE_FULL_ROTATION_ENCODER_TICKS;
+		SectorEnd[i] = (uint16_t) (end * TICKS_PER_DEGREE) % PERISCOPE_FULL_ROTATION_ENCODER_TICKS;
+	}
+	NumSectors = numSectors;
+	TurnsSinceSectors = 0;
+	
+	// Until we pass through a sector, we are still at the speed we turn evenly at
+	if (!SectorScanning)
+	{
+		SectorRPM = CurrentRPM;
+	}
+	SectorScanning = (numSectors > 0);
+	ExitCritical();
+}
+
+/****************************************************************************
+ Function
+     ScanFullRotation
+
+ Description
+     Turns at a constant speed all the way round, for when we don't know
+		   where to expect the beacons
+****************************************************************************/
+void ScanFullRotation(void)
+{
+	SectorScanning = false;
 }
 
 // Return the current angle of the periscope
@@ -211,10 +547,78 @@ float GetPeriscopeAngle(void)
 	return (numTicks * 180.0) / (ENCODER_PULSES_PER_REV * PERISCOPE_GEAR_RATIO);
 }
 
+/****************************************************************************
+ Function
+     GetPeriscopeAngleAt
+
+ Parameters
+     age : how many capture ticks ago we want the angle (e.g. from captureAge)
+
+ Returns
+     The periscope angle at that time, interpolated between the encoder edges
+		   around it. Must be called at the encoder interrupt priority, so that
+			 the edge ring doesn't change underneath us.
+
+ Description
+     GetPeriscopeAngle only knows the last whole encoder tick at the time it
+		   is called, so beacon pulses picked up anywhere within a tick (and any
+			 latency before we service them) all read the same angle. Here we
+			 place the pulse between the edges on either side of it instead.
+****************************************************************************/
+float GetPeriscopeAngleAt(uint32_t age)
+{
+	uint32_t time = currentTimerValue(PERISCOPE_REFERENCE_TIMER) - age;
+	uint8_t later = newestEdge;
+	uint8_t earlier;
+	float fraction;
+	
+	// Without two edges to go by, fall back to the last tick
+	if (numEdges < 2)
+	{
+		return GetPeriscopeAngle();
+	}
+	
+	// Find the newest edge at or before the requested time
+	for (int i = 0; i < numEdges - 1; i++)
+	{
+		if ((int32_t) (time - edges[later].time) >= 0)
+		{
+			break;
+		}
+		later = (later - 1) & EDGE_RING_MASK;
+	}
+	earlier = (later - 1) & EDGE_RING_MASK;
+	
+	// The time is older than anything we remember
+	if ((int32_t) (time - edges[later].time) < 0)
+	{
+		return (edges[later].tick * 180.0f) / (ENCODER_PULSES_PER_REV * PERISCOPE_GEAR_RATIO);
+	}
+	
+	// Assume we keep rotating at the rate between this edge and the one before it,
+	//  but never move past the next tick
+	fraction = ((float) (time - edges[later].time)) / (edges[later].time - edges[earlier].time);
+	if (fraction > 1.0f)
+	{
+		fraction = 1.0f;
+	}
+	
+	// If the tick count was reset, don't interpolate across it
+	if (edges[later].tick != ((edges[earlier].tick + 1) % PERISCOPE_FULL_ROTATION_ENCODER_TICKS))
+	{
+		fraction = 0;
+	}
+	
+	return ((edges[later].tick + fraction) * 180.0f) / (ENCODER_PULSES_PER_REV * PERISCOPE_GEAR_RATIO);
+}
+
 // reset the periscope angle
 void ResetPeriscopeEncoderTicks(void)
 {
 	numTicks = 0;
+	
+	// Earlier edges no longer match the tick count
+	numEdges = 0;
 }
 
 // Raise the latch servo
@@ -227,14 +631,16 @@ void LatchPeriscope(void)
 void UnlatchPeriscope(void)
 {
 	SetPWM_PeriscopeLatch(PERISCOPE_UNLATCH_DUTY);
-	SetPWM_Periscope(PERISCOPE_PWM_DUTY);
+	StartPeriscope();
 }
 
-// mark that we require the periscope to be zeroed
+// mark that we require the periscope to be zeroed, and time a stop from now
 void RequireZero(void)
 {
 	isZeroed = false;
-	ES_Timer_InitTimer(PERISCOPE_STOPPED_TIMER, PERISCOPE_STOPPED_T);
+	EnterCritical();
+	EdgeWatch_Start(&Edges, currentTimerValue(PERISCOPE_REFERENCE_TIMER));
+	ExitCritical();
 }
 
 // return iff the periscope has been zeroed
@@ -247,4 +653,73 @@ bool IsZeroed(void)
 void SetAttemptingToStop(bool val)
 {
 	AttemptingToStop = val;
+	
+	// Hold a steady duty against the latch rather than whatever the loop last asked for
+	if (val && Regulating)
+	{
+		SetPWM_Periscope(FEED_FORWARD_DUTY(PERISCOPE_TARGET_RPM));
+	}
+}
+
+/****************************************************************************
+ Function
+     CheckPeriscopeStopped
+
+ Returns
+     true iff we posted ES_PERISCOPE_STOPPED
+
+ Description
+     Event checker: posts ES_PERISCOPE_STOPPED to this service once the
+		   periscope goes STOPPED_TIME_MS without an encoder edge (or that long
+			 after RequireZero). We post once per stop; the next edge starts
+			 watching again.
+****************************************************************************/
+bool CheckPeriscopeStopped(void)
+{
+	// Read the edge time before the timer, so an edge in between can't look
+	// like it's in the future
+	uint32_t lastEdge = EdgeWatch_LastEdge(&Edges);
+	
+	if (!EdgeWatch_Stopped(&Edges, lastEdge, currentTimerValue(PERISCOPE_REFERENCE_TIMER), STOPPED_TIME_MS * TICKS_PER_MS))
+	{
+		return false;
+	}
+	
+	ES_Event NewEvent;
+	NewEvent.EventType = ES_PERISCOPE_STOPPED;
+	PostPeriscopeControlService(NewEvent);
+	return true;
+}
+
+// The field bearing the periscope is pointing at, in encoder ticks: its angle
+// on the robot plus our heading (a binary angle, so scale its top bits)
+static uint16_t fieldTick(void)
+{
+	uint32_t headingTicks = (uint32_t) (((uint64_t) Odometry_Heading() * PERISCOPE_FULL_ROTATION_ENCODER_TICKS) >> 32);
+	
+	return (numTicks + headingTicks) % PERISCOPE_FULL_ROTATION_ENCODER_TICKS;
+}
+
+// Count a periscope turn, and stop sweeping once the sectors are stale
+static void countTurn(void)
+{
+	if (SectorScanning && (++TurnsSinceSectors >= MAX_TURNS_WITHOUT_SECTORS))
+	{
+		SectorScanning = false;
+	}
+}
+
+// Check whether a field bearing (encoder ticks) is in one of the beacon sectors
+static bool inSector(uint16_t tick)
+{
+	for (int i = 0; i < NumSectors; i++)
+	{
+		// A sector may wrap through zero
+		if ((SectorStart[i] <= SectorEnd[i]) ? ((tick >= SectorStart[i]) && (tick < SectorEnd[i]))
+			: ((tick >= SectorStart[i]) || (tick < SectorEnd[i])))
+		{
+			return true;
+		}
+	}
+	return false;
 }
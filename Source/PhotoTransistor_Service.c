@@ -2,7 +2,11 @@
  Module
    PhotoTransistor_Service.c
  Description
-	 Manages the phototransistor and its capture of beacon information
+	 Manages the phototransistor and its capture of beacon information.
+	 The capture interrupt only records each pulse (its capture time, the
+	 periscope angle and our odometry pose at that moment) in a ring. We
+	 classify and bucket the pulses from the ring in ProcessBeaconPulses,
+	 which the framework calls between events.
 ****************************************************************************/
 /*----------------------------- Include Files -----------------------------*/
 /* include header files for this state machine as well as any machines at the
@@ -19,11 +23,22 @@
 #include "DriveTrainControl_Service.h"
 #include "GameInfo.h"
 #include "Master_SM.h"
+#include "PeriodBins.h"
+#include "FixedPID.h"
+#include "BearingEstimate.h"
+#include "PulseRing.h"
+#include "IsrTiming.h"
 
 /*----------------------------- Module Defines ----------------------------*/
 
 #define PERIOD_MEASURING_ERROR_TOLERANCE 10 //in microseconds
+
+// Pulses we must see to accept a beacon, and how long without a pulse (ms)
+// ends it, at PERISCOPE_NOMINAL_RPM. Both scale with how long the periscope
+// takes to sweep past a beacon, within the limits below
 #define NUMBER_PULSES_TO_BE_ALIGNED 6
+#define MIN_PULSES_TO_BE_ALIGNED 3
+#define MIN_AVERAGE_BEACONS_T 2 // longer than a few of the slowest beacon periods
 #define NUMBER_PHOTOTRANSISTORS 1
 #define NUMBER_BEACON_FREQUENCIES 4
 #define NUMBER_PULSES_FOR_BUCKET 4
@@ -44,6 +59,15 @@
 #define BEACON_INDEX_SW 3
 
 #define DIRECTION 1 //(use 1 if CW and -1 if CCW)
+
+// Beacon angles older than this are not used for positioning. Each angle is
+// tagged with where we were when we saw it, so this bounds odometry drift
+#define BEACON_MAX_AGE_MS 2000
+#define BEACON_MAX_AGE_TICKS (BEACON_MAX_AGE_MS * TICKS_PER_MS)
+
+// Period lookup bins are 2^7 = 128 ticks (3.2us) wide
+#define BEACON_BIN_SHIFT 7
+#define BEACON_NUM_BINS PERIOD_BIN_COUNT(BEACON_P_SW, BEACON_P_SE, PERIOD_MEASURING_ERROR_TOLERANCE, BEACON_BIN_SHIFT)
 	
 
 
@@ -53,18 +77,23 @@
    relevant to the behavior of this service
 */
 
-static bool ToleranceCheck(uint32_t period, uint32_t targetPeriod, uint8_t tolerance);
-
+static bool HandlePulse(const BeaconPulse *pulse);
 static bool TimeForUpdate(void);
+static uint32_t BeaconAge(uint8_t which);
 
 static void ResetAverage(void);
+static void AdaptToPeriscopeSpeed(void);
 
-static float CalculateAverage(uint8_t which);
+static bool CalculateAverage(uint8_t which, float *angle, float *quality);
 
 /*---------------------------- Module Variables ---------------------------*/
 // with the introduction of Gen2, we need a module level Priority variable
 static uint8_t MyPriority;
 
+//Pulses waiting to be processed. PULSE_RING_SIZE is about 30ms of pulses at the
+//  fastest beacon, which no run function should take
+static PulseRing Pulses;
+
 static Beacon beacons[] = 
 {
 	{.period = BEACON_P_NW, .priorBeacons = {BEACON_INDEX_NE, BEACON_INDEX_SE}, .xShift = 0, 							.yShift = 0, .thetaShift = 0}, //1450 Hz, NW
@@ -78,17 +107,38 @@ static uint32_t LastCapture;
 
 static uint8_t LastBeacon = NULL_BEACON;
 
+//The capture time the beacon averaging timer runs out at, for the pulse that
+//  last restarted it
+static uint32_t AverageDeadline;
+
 static bool AligningToBucket = false;
 
 static uint8_t buckets[NUMBER_BEACON_FREQUENCIES];
 
-static uint8_t numSamples[NUMBER_BEACON_FREQUENCIES];
-static float sums[NUMBER_BEACON_FREQUENCIES];
+static BearingSamples samples[NUMBER_BEACON_FREQUENCIES];
+static OdometrySnapshot firstSeen[NUMBER_BEACON_FREQUENCIES];
+static OdometrySnapshot lastSeen[NUMBER_BEACON_FREQUENCIES];
 
 static uint8_t LastUpdatedBeacon = NULL_BEACON;
 
 static bool Bucketing = true;
 
+//Beacon thresholds for the current periscope speed
+static uint8_t PulsesToBeAligned = NUMBER_PULSES_TO_BE_ALIGNED;
+static uint16_t AverageBeaconsTime = AVERAGE_BEACONS_T;
+
+//Period lookup table, built at init from the beacon periods
+static uint8_t BeaconBins[BEACON_NUM_BINS];
+static uint32_t BeaconLower[NUMBER_BEACON_FREQUENCIES];
+static uint32_t BeaconUpper[NUMBER_BEACON_FREQUENCIES];
+static PeriodBinTable BeaconTable = {
+	.shift = BEACON_BIN_SHIFT,
+	.numBins = BEACON_NUM_BINS,
+	.bins = BeaconBins,
+	.lower = BeaconLower,
+	.upper = BeaconUpper
+};
+
 /*------------------------------ Module Code ------------------------------*/
 /****************************************************************************
  Function
@@ -104,6 +154,18 @@ bool InitPhotoTransistorService ( uint8_t Priority )
 
   MyPriority = Priority;
 
+	//Build the period lookup from the beacon periods
+	uint32_t BeaconPeriods[NUMBER_BEACON_FREQUENCIES];
+	for (int i = 0; i < NUMBER_BEACON_FREQUENCIES; i++)
+	{
+		BeaconPeriods[i] = beacons[i].period;
+	}
+	PeriodBins_Build(&BeaconTable, BeaconPeriods, NUMBER_BEACON_FREQUENCIES, PERIOD_MEASURING_ERROR_TOLERANCE);
+
+	//Start with no pulses recorded for any beacon
+	ResetAverage();
+	PulseRing_Init(&Pulses);
+
   InitInputCapture(PHOTOTRANSISTOR_INTERRUPT_PARAMATERS);
 	
 	disableCaptureInterrupt(PHOTOTRANSISTOR_INTERRUPT_PARAMATERS);
@@ -145,22 +207,43 @@ ES_Event RunPhotoTransistorService( ES_Event ThisEvent )
   ES_Event ReturnEvent;
   ReturnEvent.EventType = ES_NO_EVENT; // assume no errors
   
-	// If we have stopped seeing pulses, it's time to evaluate whether we saw a beacon
+	// Pulses still waiting in the ring come before evaluating a beacon, and may
+	//  have restarted the timer
 	if ((ThisEvent.EventType == ES_TIMEOUT) && (ThisEvent.EventParam == AVERAGE_BEACONS_TIMER))
 	{
-		// If the beacon we were interested in had enough pulses
-		if (numSamples[LastBeacon] >= NUMBER_PULSES_TO_BE_ALIGNED)
+		ProcessBeaconPulses();
+	}
+	
+	// If we have stopped seeing pulses, it's time to evaluate whether we saw a beacon
+	if ((ThisEvent.EventType == ES_TIMEOUT) && (ThisEvent.EventParam == AVERAGE_BEACONS_TIMER)
+		&& (ES_Timer_IsTimerActive(AVERAGE_BEACONS_TIMER) != ES_Timer_ACTIVE))
+	{
+		// If the beacon we were interested in had enough pulses, set the angle to the
+		//  beacon based on the average of the pulses that agree. Aligning to the
+		//  bucket may have dropped the beacon since the timer ran out
+		if ((LastBeacon != NULL_BEACON) && (samples[LastBeacon].total >= PulsesToBeAligned)
+			&& CalculateAverage(LastBeacon, &beacons[LastBeacon].lastEncoderAngle, &beacons[LastBeacon].quality))
 		{
 			// set the last update time for the beacon
-			beacons[LastBeacon].lastUpdateTime = captureInterrupt(PHOTOTRANSISTOR_INTERRUPT_PARAMATERS);
+			beacons[LastBeacon].lastUpdateTime = LastCapture;
 			
-			// set the angle to the beacon based on the average of all pulses measured
-			beacons[LastBeacon].lastEncoderAngle = CalculateAverage(LastBeacon);
+			// and remember where we were while we saw it
+			beacons[LastBeacon].firstSeen = firstSeen[LastBeacon];
+			beacons[LastBeacon].lastSeen = lastSeen[LastBeacon];
 			
 			// Store this beacon as the last updated beacon
 			LastUpdatedBeacon = LastBeacon;
 			
-			// Determine if we should recalculate our position and angle based on whether or not we have received 3 consecutive pulses
+			// Every bearing refines our pose estimate on its own
+			if (!AligningToBucket)
+			{
+				ES_Event BearingEvent;
+				BearingEvent.EventType = ES_BEACON_BEARING;
+				BearingEvent.EventParam = LastBeacon;
+				PostPositionLogicService(BearingEvent);
+			}
+			
+			// Determine if we should recalculate our position and angle based on whether or not we have 3 fresh beacons
 			if (TimeForUpdate())
 			{
 				ES_Event NewEvent;
@@ -179,6 +262,9 @@ ES_Event RunPhotoTransistorService( ES_Event ThisEvent )
 		LastBeacon = NULL_BEACON;
 		
 		ES_Timer_StopTimer(AVERAGE_BEACONS_TIMER);
+		
+		// Between beacons, catch up with any change in the periscope speed
+		AdaptToPeriscopeSpeed();
 	}
 	else if (ThisEvent.EventType == ES_ALIGN_TO_BUCKET)
 	{
@@ -232,6 +318,100 @@ float GetBeaconAngle_C(uint8_t beaconIndex)
 	return beaconAngle_C;
 }
 
+/****************************************************************************
+ Function
+    GetBeaconAngle
+ Parameters
+   beaconIndex : which beacon to query
+ Returns
+   The periscope angle at which we last saw the beacon
+****************************************************************************/
+float GetBeaconAngle(uint8_t beaconIndex)
+{
+	return beacons[beaconIndex].lastEncoderAngle;
+}
+
+/****************************************************************************
+ Function
+    GetBeaconQuality
+ Parameters
+   beaconIndex : which beacon to query
+ Returns
+   The fraction (0 to 1) of the beacon's pulses that agreed on its angle
+****************************************************************************/
+float GetBeaconQuality(uint8_t beaconIndex)
+{
+	return beacons[beaconIndex].quality;
+}
+
+/****************************************************************************
+ Function
+    GetBeaconPose
+ Parameters
+   beaconIndex : which beacon to query
+ Returns
+   false if odometry has been reset since we saw the beacon, otherwise
+   our pose (inches, degrees) when we saw it
+****************************************************************************/
+bool GetBeaconPose(uint8_t beaconIndex, float *x, float *y, float *thetaDegrees)
+{
+	return Odometry_SnapshotPose(&beacons[beaconIndex].firstSeen, &beacons[beaconIndex].lastSeen, x, y, thetaDegrees);
+}
+
+/****************************************************************************
+ Function
+    GetFreshBeacons
+ Returns
+   A mask with bit i set iff beacon i has an angle we can still position from
+****************************************************************************/
+uint8_t GetFreshBeacons(void)
+{
+	uint8_t mask = 0;
+	
+	for (int i = 0; i < NUMBER_BEACON_FREQUENCIES; i++)
+	{
+		if ((beacons[i].lastUpdateTime != 0) && (BeaconAge(i) < BEACON_MAX_AGE_TICKS))
+		{
+			mask |= (1 << i);
+		}
+	}
+	return mask;
+}
+
+/****************************************************************************
+ Function
+    OldestFreshBeacon
+ Returns
+   The fresh beacon that was seen longest ago, or NULL_BEACON if there are none
+****************************************************************************/
+uint8_t OldestFreshBeacon(void)
+{
+	uint8_t fresh = GetFreshBeacons();
+	uint8_t oldest = NULL_BEACON;
+	
+	for (int i = 0; i < NUMBER_BEACON_FREQUENCIES; i++)
+	{
+		if ((fresh & (1 << i)) && ((oldest == NULL_BEACON) || (BeaconAge(i) > BeaconAge(oldest))))
+		{
+			oldest = i;
+		}
+	}
+	return oldest;
+}
+
+/****************************************************************************
+ Function
+    ExpireBeacon
+ Parameters
+   beaconIndex : which beacon to forget
+ Description
+   Forget a beacon's angle, so that we must see it again before using it
+****************************************************************************/
+void ExpireBeacon(uint8_t beaconIndex)
+{
+	beacons[beaconIndex].lastUpdateTime = 0;
+}
+
 /****************************************************************************
  Function
     Get Axis Shifts
@@ -255,73 +435,107 @@ int getThetaShift(uint8_t beaconIndex){
 /***************************************************************************
  private functions
  ***************************************************************************/
-//The interrupt response for our phototransistor
+//The interrupt response for our phototransistor. Record the pulse, and leave
+//  the rest for ProcessBeaconPulses
 void PhotoTransistor_InterruptResponse(void)
 {
+	uint32_t start = currentTimerValue(PHOTOTRANSISTOR_INTERRUPT_PARAMATERS);
+	uint32_t latency = captureAge(PHOTOTRANSISTOR_INTERRUPT_PARAMATERS);
+	BeaconPulse *pulse = PulseRing_Claim(&Pulses);
+	
 	// Clear Interrupt
 	clearCaptureInterrupt(PHOTOTRANSISTOR_INTERRUPT_PARAMATERS);
 	
-	// Determine Capture time
-	uint32_t ThisCapture = captureInterrupt(PHOTOTRANSISTOR_INTERRUPT_PARAMATERS);
+	// If the ring is full, drop the pulse (the ring counts it)
+	if (pulse == NULL)
+	{
+		return;
+	}
+	
+	// Determine Capture time, and the encoder angle and our pose
+	// at the time of the pulse itself, rather than when we got to it
+	pulse->capture = captureInterrupt(PHOTOTRANSISTOR_INTERRUPT_PARAMATERS);
+	pulse->angle = GetPeriscopeAngleAt(captureAge(PHOTOTRANSISTOR_INTERRUPT_PARAMATERS));
+	Odometry_Snapshot(&pulse->seen);
+	PulseRing_Publish(&Pulses);
+	
+	IsrTiming_Record(ISR_PHOTOTRANSISTOR, latency, currentTimerValue(PHOTOTRANSISTOR_INTERRUPT_PARAMATERS) - start);
+}
+
+/****************************************************************************
+ Function
+    ProcessBeaconPulses
+ Returns
+   true if a pulse posted an event (we aligned to the bucket)
+ Description
+   Classifies and buckets every pulse the interrupt has recorded. Called by
+	 the framework's event checkers, and before we evaluate a beacon
+****************************************************************************/
+bool ProcessBeaconPulses(void)
+{
+	const BeaconPulse *pulse;
+	bool posted = false;
+	
+	while ((pulse = PulseRing_Oldest(&Pulses)) != NULL)
+	{
+		if (HandlePulse(pulse))
+		{
+			posted = true;
+		}
+		PulseRing_Release(&Pulses);
+	}
+	return posted;
+}
+
+/****************************************************************************
+ Function
+    GetDroppedBeaconPulses
+ Returns
+   the number of pulses lost to a full ring
+****************************************************************************/
+uint16_t GetDroppedBeaconPulses(void)
+{
+	return PulseRing_Dropped(&Pulses);
+}
+
+// Classify one recorded pulse and update the beacon buckets. Returns true if
+// it posted an event
+static bool HandlePulse(const BeaconPulse *pulse)
+{
+	uint32_t elapsedMs;
 	
-	// Calculate period
-	uint32_t Period = ((ThisCapture - LastCapture) * MICROSECONDS_DIVISOR ) / TICKS_PER_MS;
+	// Classify the period (in capture ticks) against the beacon periods
+	uint8_t i = PeriodBins_Classify(&BeaconTable, pulse->capture - LastCapture);
 	
 	//Store the Last Cpature
-	LastCapture = ThisCapture;
+	LastCapture = pulse->capture;
 	
-	//Iterate Through the different frequency options
-	for (int i = 0; i < NUMBER_BEACON_FREQUENCIES; i++)
+	// If the period matches a beacon period
+	if (i != PERIOD_BIN_NONE)
 	{
-		// If the period matches a beacon period
-		if (ToleranceCheck(Period, beacons[i].period, PERIOD_MEASURING_ERROR_TOLERANCE))
+		// If we're searching for a beacon
+		if (Bucketing)
 		{
-			// If we're searching for a beacon
-			if (Bucketing)
-			{
-				buckets[i]++;
-			}
-			
-			// If we're supposed to align to the bucket, and the number of pulses we've seen for
-			//  this beacon is greater than our threshold
-			if ((AligningToBucket) && (buckets[i] >= NUMBER_PULSES_FOR_BUCKET))
-			{
-				// If this is the beacon corresponding to our target bucket
-				if (((MyColor() == COLOR_BLUE) && (i == BEACON_INDEX_NW)) || ((MyColor() == COLOR_RED) && (i == BEACON_INDEX_SE)))
-				{ 
-					// stop our drive
-					clearDriveAligningToBucket();
-					
-					// Post an aligned event
-					ES_Event AlignedEvent;
-					AlignedEvent.EventType = ES_ALIGNED_TO_BUCKET;
-					PostMasterSM(AlignedEvent);
-					
-					// stop aligning
-					AligningToBucket = false;
-					
-					// reset all buckets
-					for (int j = 0; j < NUMBER_BEACON_FREQUENCIES; j++)
-					{
-						buckets[j] = 0;
-					}
-					
-					// reset average information
-					ResetAverage();
-					
-					// return to searching for beacons
-					Bucketing = true;
-					LastBeacon = NULL_BEACON;
-					ES_Timer_StopTimer(AVERAGE_BEACONS_TIMER);
-					return;
-				}
-			}
-			// If we're not aligning to a bucket, and the number of pulses we've seen for this
-			//  beacon is greater than our threshold
-			else if (buckets[i] >= NUMBER_PULSES_TO_BE_ALIGNED && LastBeacon == NULL_BEACON && !AligningToBucket)
-			{
-				// store the beacon to be recorded
-				LastBeacon = i;
+			buckets[i]++;
+		}
+		
+		// If we're supposed to align to the bucket, and the number of pulses we've seen for
+		//  this beacon is greater than our threshold
+		if ((AligningToBucket) && (buckets[i] >= NUMBER_PULSES_FOR_BUCKET))
+		{
+			// If this is the beacon corresponding to our target bucket
+			if (((MyColor() == COLOR_BLUE) && (i == BEACON_INDEX_NW)) || ((MyColor() == COLOR_RED) && (i == BEACON_INDEX_SE)))
+			{ 
+				// stop our drive
+				clearDriveAligningToBucket();
+				
+				// Post an aligned event
+				ES_Event AlignedEvent;
+				AlignedEvent.EventType = ES_ALIGNED_TO_BUCKET;
+				PostMasterSM(AlignedEvent);
+				
+				// stop aligning
+				AligningToBucket = false;
 				
 				// reset all buckets
 				for (int j = 0; j < NUMBER_BEACON_FREQUENCIES; j++)
@@ -329,43 +543,84 @@ void PhotoTransistor_InterruptResponse(void)
 					buckets[j] = 0;
 				}
 				
-				// restart the timer to evaluate the beacon 
-				ES_Timer_InitTimer(AVERAGE_BEACONS_TIMER, AVERAGE_BEACONS_T);
-				Bucketing = false;
+				// reset average information
+				ResetAverage();
+				
+				// return to searching for beacons
+				Bucketing = true;
+				LastBeacon = NULL_BEACON;
+				ES_Timer_StopTimer(AVERAGE_BEACONS_TIMER);
+				return true;
 			}
+		}
+		// If we're not aligning to a bucket, and the number of pulses we've seen for this
+		//  beacon is greater than our threshold
+		else if (buckets[i] >= PulsesToBeAligned && LastBeacon == NULL_BEACON && !AligningToBucket)
+		{
+			// store the beacon to be recorded, and start timing it from this pulse
+			LastBeacon = i;
+			AverageDeadline = pulse->capture;
 			
-			// increment the sum of all encoder angles for this beacon
-			sums[i] += GetPeriscopeAngle();
-			
-			// increment the number of pulses seen for this beacon
-			numSamples[i]++;
+			// reset all buckets
+			for (int j = 0; j < NUMBER_BEACON_FREQUENCIES; j++)
+			{
+				buckets[j] = 0;
+			}
 			
-			// If the evaluation timer is already running, restart it
-			ES_Timer_SetTimer(AVERAGE_BEACONS_TIMER, AVERAGE_BEACONS_T);
+			Bucketing = false;
 		}
-	}
 		
+		// note where we were, as we may be driving
+		if (samples[i].total == 0)
+		{
+			firstSeen[i] = pulse->seen;
+		}
+		lastSeen[i] = pulse->seen;
+		
+		// record the encoder angle for this beacon
+		Bearing_Add(&samples[i], pulse->angle);
+		
+		// If we are evaluating a beacon and its timer was still running when this
+		//  pulse came in, restart the timer from the pulse, as the interrupt did
+		//  when it handled pulses itself. A pulse after the timer ran out leaves it
+		if ((LastBeacon != NULL_BEACON) && ((int32_t) (AverageDeadline - pulse->capture) >= 0))
+		{
+			AverageDeadline = pulse->capture + (AverageBeaconsTime * TICKS_PER_MS);
+			elapsedMs = (currentTimerValue(PHOTOTRANSISTOR_INTERRUPT_PARAMATERS) - pulse->capture) / TICKS_PER_MS;
+			ES_Timer_InitTimer(AVERAGE_BEACONS_TIMER, (elapsedMs < AverageBeaconsTime) ? (AverageBeaconsTime - elapsedMs) : 1);
+		}
+	}
+	return false;
 }
 
 // Determine if we have enough beacon information to calculate our absolute position
 static bool TimeForUpdate()
 {
+	uint8_t fresh;
+	uint8_t numFresh = 0;
+	
 	// If we're supposed to align to the bucket, don't calculate position
 	if (AligningToBucket)
 	{
 			return false;
 	} 
 	
-	//Get our A, B, and C Update Times
-	uint32_t beaconAUpdateTime = beacons[mostRecentBeaconUpdate()].lastUpdateTime;
-	uint8_t indexB = beacons[mostRecentBeaconUpdate()].priorBeacons[0];
-	uint32_t beaconBUpdateTime = beacons[indexB].lastUpdateTime;
-	uint8_t indexC = beacons[mostRecentBeaconUpdate()].priorBeacons[1];
-	uint32_t beaconCUpdateTime = beacons[indexC].lastUpdateTime;
-
-	//Determine if Sequence has been met
-	//if none of the update times were zero
-	return ((beaconAUpdateTime != 0) && (beaconBUpdateTime != 0) && (beaconCUpdateTime != 0));
+	// Any three fresh beacons will do, whatever order we saw them in
+	fresh = GetFreshBeacons();
+	for (int i = 0; i < NUMBER_BEACON_FREQUENCIES; i++)
+	{
+		if (fresh & (1 << i))
+		{
+			numFresh++;
+		}
+	}
+	return (numFresh >= 3);
+}
+
+// Return how many capture ticks ago we last saw a beacon
+static uint32_t BeaconAge(uint8_t which)
+{
+	return currentTimerValue(PHOTOTRANSISTOR_INTERRUPT_PARAMATERS) - beacons[which].lastUpdateTime;
 }
 
 
@@ -376,12 +631,6 @@ uint8_t mostRecentBeaconUpdate(void){
 
 
 
-//Tolerance Check function to See if We are within our bounds
-static bool ToleranceCheck(uint32_t period, uint32_t targetPeriod, uint8_t tolerance)
-{
-	return ((period <= targetPeriod + tolerance) && (period >= targetPeriod - tolerance));
-}
-
 // reset the update times for each beacon, so that we must see new beacons to 
 // calculate position
 void ResetUpdateTimes(void)
@@ -397,8 +646,7 @@ void ResetAverage(void)
 {
 	for (int i = 0; i < NUMBER_BEACON_FREQUENCIES; i++)
 	{
-		sums[i] = 0;
-		numSamples[i] = 0;
+		Bearing_Reset(&samples[i]);
 	}
 }
 
@@ -411,19 +659,59 @@ void ResetAligningToBucket(void)
 // Manually set beacon angles. Used for testing
 void SetBeaconAngles(float A, float B, float C)
 {
-	beacons[0].lastUpdateTime = 3;
-	beacons[1].lastUpdateTime = 2;
-	beacons[2].lastUpdateTime = 1;
+	uint32_t now = currentTimerValue(PHOTOTRANSISTOR_INTERRUPT_PARAMATERS);
+	
+	beacons[0].lastUpdateTime = now;
+	beacons[1].lastUpdateTime = now - 1;
+	beacons[2].lastUpdateTime = now - 2;
+	beacons[3].lastUpdateTime = 0;
 	
 	beacons[0].lastEncoderAngle = A;
 	beacons[1].lastEncoderAngle = B;
 	beacons[2].lastEncoderAngle = C;
+	beacons[0].quality = 1.0f;
+	beacons[1].quality = 1.0f;
+	beacons[2].quality = 1.0f;
 	
 	LastUpdatedBeacon = 0;
 }
 
-// Return the average of all encoder angles seen for a given beacon
-static float CalculateAverage(uint8_t which)
+// Scale the pulse count and timeout for a beacon to how long the periscope now
+// takes to sweep past one. Runs in the service, so the interrupt only reads them
+static void AdaptToPeriscopeSpeed(void)
 {
-	return sums[which] / numSamples[which];
+	q16_t rpm = GetBeaconSweepRPM();
+	uint32_t pulses;
+	uint32_t time;
+	
+	// Until the periscope has a speed, keep the nominal thresholds
+	if (rpm < INT_TO_Q16(1))
+	{
+		PulsesToBeAligned = NUMBER_PULSES_TO_BE_ALIGNED;
+		AverageBeaconsTime = AVERAGE_BEACONS_T;
+		return;
+	}
+	
+	// Rounded to the nearest pulse and ms
+	pulses = (INT_TO_Q16(NUMBER_PULSES_TO_BE_ALIGNED * PERISCOPE_NOMINAL_RPM) + (rpm >> 1)) / rpm;
+	time = (INT_TO_Q16(AVERAGE_BEACONS_T * PERISCOPE_NOMINAL_RPM) + (rpm >> 1)) / rpm;
+	
+	PulsesToBeAligned = (pulses < MIN_PULSES_TO_BE_ALIGNED) ? MIN_PULSES_TO_BE_ALIGNED :
+		((pulses > NUMBER_PULSES_TO_BE_ALIGNED) ? NUMBER_PULSES_TO_BE_ALIGNED : pulses);
+	AverageBeaconsTime = (time < MIN_AVERAGE_BEACONS_T) ? MIN_AVERAGE_BEACONS_T :
+		((time > AVERAGE_BEACONS_T) ? AVERAGE_BEACONS_T : time);
+}
+
+// Find the angle to a given beacon from the encoder angles of its pulses,
+// leaving out those that disagree
+static bool CalculateAverage(uint8_t which, float *angle, float *quality)
+{
+	BearingSamples pulses;
+	
+	// Work on a copy, so that a pulse arriving now can't change it underneath us
+	EnterCritical();
+	pulses = samples[which];
+	ExitCritical();
+	
+	return Bearing_Estimate(&pulses, angle, quality);
 }
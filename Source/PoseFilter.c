@@ -0,0 +1,310 @@
+/****************************************************************************
+ Module
+   PoseFilter.c
+
+ Description
+		Extended Kalman filter over our pose (x, y in inches, theta in radians).
+		  Odometry carries the estimate between observations, so the filter
+			keeps its mean in the odometry pose itself: predicting grows the
+			covariance by the motion since the last step, and each beacon bearing
+			shifts odometry by the Kalman correction. A bearing whose innovation is
+			too unlikely under the current covariance (Mahalanobis gate) is
+			rejected rather than used.
+
+		The periscope sees beacon k at angle bearing(k) - theta, where bearing(k)
+		  is the direction from us to the beacon in field coordinates. We may
+			have moved since we saw it, so each bearing comes with the odometry
+			pose at that instant, and is compared against that pose. Odometry is
+			precise over that short a move, so correcting the pose then corrects
+			the pose now by the same amount.
+****************************************************************************/
+
+#include <Math.h>
+
+#include "ES_Configure.h"
+#include "ES_Framework.h"
+#include "DEFINITIONS.h"
+#include "Geometry.h"
+#include "Odometry.h"
+#include "PoseFilter.h"
+
+/*----------------------------- Module Defines ----------------------------*/
+// Uncertainty of a triangulated fix (1 sigma)
+#define FIX_POSITION_VARIANCE (2.0f * 2.0f)  // in^2
+#define FIX_HEADING_VARIANCE ((3.0f * GEO_RADIANS_PER_DEGREE) * (3.0f * GEO_RADIANS_PER_DEGREE))
+
+// Odometry noise, growing with distance driven and angle turned
+#define DISTANCE_VARIANCE_PER_INCH 0.02f  // in^2 per inch
+#define TURN_VARIANCE_PER_RADIAN 0.005f  // rad^2 per radian turned
+#define DRIFT_VARIANCE_PER_INCH 0.00005f  // rad^2 per inch driven
+
+// Noise of one averaged beacon bearing (1.5 degrees, 1 sigma)
+#define BEARING_VARIANCE ((1.5f * GEO_RADIANS_PER_DEGREE) * (1.5f * GEO_RADIANS_PER_DEGREE))
+
+// Reject bearings with innovation^2 / S above this (chi-squared, 1 DOF, ~99.7%)
+#define BEARING_GATE 9.0f
+
+/*---------------------------- Module Functions ---------------------------*/
+static float wrapToPi(float angle);
+static void symmetrize(void);
+
+/*---------------------------- Module Variables ---------------------------*/
+static bool Initialized = false;
+
+// The odometry pose at the last predict, which is the filter mean
+static float MeanX;
+static float MeanY;
+static float MeanTheta;
+
+// Until we have a fix, we could be anywhere
+static float P[3][3] = {
+	{FIELD_LENGTH * FIELD_LENGTH, 0, 0},
+	{0, FIELD_LENGTH * FIELD_LENGTH, 0},
+	{0, 0, GEO_PI * GEO_PI}
+};
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     PoseFilter_Reset
+
+ Description
+     Starts the filter from a triangulated fix, and anchors odometry on it
+****************************************************************************/
+void PoseFilter_Reset(float x, float y, float thetaDegrees)
+{
+	Odometry_Anchor(x, y, thetaDegrees);
+	MeanX = x;
+	MeanY = y;
+	MeanTheta = thetaDegrees * GEO_RADIANS_PER_DEGREE;
+	
+	for (int row = 0; row < 3; row++)
+	{
+		for (int col = 0; col < 3; col++)
+		{
+			P[row][col] = 0;
+		}
+	}
+	P[0][0] = FIX_POSITION_VARIANCE;
+	P[1][1] = FIX_POSITION_VARIANCE;
+	P[2][2] = FIX_HEADING_VARIANCE;
+	
+	Initialized = true;
+}
+
+/****************************************************************************
+ Function
+     PoseFilter_IsInitialized
+
+ Returns
+     true iff the filter has been started from a fix
+****************************************************************************/
+bool PoseFilter_IsInitialized(void)
+{
+	return Initialized;
+}
+
+/****************************************************************************
+ Function
+     PoseFilter_Predict
+
+ Description
+     Moves the mean to the current odometry pose, and grows the covariance
+		   by the distance driven and angle turned since the last predict
+****************************************************************************/
+void PoseFilter_Predict(void)
+{
+	float x, y, thetaDegrees;
+	float theta, dTheta, midTheta, distance;
+	float sinMid, cosMid;
+	float distanceVariance, turnVariance;
+	float F[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+	float G[3][2];
+	float FP[3][3];
+	
+	if (!Initialized)
+	{
+		return;
+	}
+	
+	Odometry_GetPose(&x, &y, &thetaDegrees);
+	theta = thetaDegrees * GEO_RADIANS_PER_DEGREE;
+	
+	// Recover the motion as a drive of distance along the mid heading and a turn
+	dTheta = wrapToPi(theta - MeanTheta);
+	midTheta = MeanTheta + (0.5f * dTheta);
+	Geo_SinCos(midTheta, &sinMid, &cosMid);
+	distance = ((x - MeanX) * cosMid) + ((y - MeanY) * sinMid);
+	
+	// Jacobians with respect to the state and to the (distance, turn) noise
+	F[0][2] = -distance * sinMid;
+	F[1][2] = distance * cosMid;
+	G[0][0] = cosMid;
+	G[0][1] = -0.5f * distance * sinMid;
+	G[1][0] = sinMid;
+	G[1][1] = 0.5f * distance * cosMid;
+	G[2][0] = 0;
+	G[2][1] = 1;
+	
+	distanceVariance = DISTANCE_VARIANCE_PER_INCH * fabsf(distance);
+	turnVariance = (TURN_VARIANCE_PER_RADIAN * fabsf(dTheta)) + (DRIFT_VARIANCE_PER_INCH * fabsf(distance));
+	
+	// P = F P F' + G Q G'
+	for (int row = 0; row < 3; row++)
+	{
+		for (int col = 0; col < 3; col++)
+		{
+			FP[row][col] = (F[row][0] * P[0][col]) + (F[row][1] * P[1][col]) + (F[row][2] * P[2][col]);
+		}
+	}
+	for (int row = 0; row < 3; row++)
+	{
+		for (int col = 0; col < 3; col++)
+		{
+			P[row][col] = (FP[row][0] * F[col][0]) + (FP[row][1] * F[col][1]) + (FP[row][2] * F[col][2])
+				+ (G[row][0] * distanceVariance * G[col][0]) + (G[row][1] * turnVariance * G[col][1]);
+		}
+	}
+	
+	MeanX = x;
+	MeanY = y;
+	MeanTheta = theta;
+}
+
+/****************************************************************************
+ Function
+     PoseFilter_UpdateBearing
+
+ Parameters
+     beaconX, beaconY : where the beacon is on the field
+		 angleDegrees : the periscope angle we saw it at
+		 seenX, seenY, seenThetaDegrees : the odometry pose when we saw it
+
+ Returns
+     true if the bearing was used, false if it was gated out as an outlier
+		 
+ Description
+     Call PoseFilter_Predict first, so that the mean is current
+****************************************************************************/
+bool PoseFilter_UpdateBearing(float beaconX, float beaconY, float angleDegrees, float seenX, float seenY, float seenThetaDegrees)
+{
+	float dx = beaconX - seenX;
+	float dy = beaconY - seenY;
+	float distanceSquared = (dx * dx) + (dy * dy);
+	float H[3];
+	float PH[3];
+	float K[3];
+	float innovation;
+	float S;
+	
+	if (!Initialized || (distanceSquared < 1.0f))
+	{
+		return false;
+	}
+	
+	// How far the measured angle is from the one we expect
+	innovation = wrapToPi((angleDegrees * GEO_RADIANS_PER_DEGREE) - (atan2f(dy, dx) - (seenThetaDegrees * GEO_RADIANS_PER_DEGREE)));
+	
+	// derivatives of the expected angle with respect to x, y and theta now.
+	// Turning our heading now also swings where we were about where we are
+	H[0] = dy / distanceSquared;
+	H[1] = -dx / distanceSquared;
+	H[2] = (H[0] * (MeanY - seenY)) - (H[1] * (MeanX - seenX)) - 1.0f;
+	
+	for (int row = 0; row < 3; row++)
+	{
+		PH[row] = (P[row][0] * H[0]) + (P[row][1] * H[1]) + (P[row][2] * H[2]);
+	}
+	S = (H[0] * PH[0]) + (H[1] * PH[1]) + (H[2] * PH[2]) + BEARING_VARIANCE;
+	
+	// Mahalanobis gate
+	if ((innovation * innovation) > (BEARING_GATE * S))
+	{
+		return false;
+	}
+	
+	for (int row = 0; row < 3; row++)
+	{
+		K[row] = PH[row] / S;
+	}
+	
+	// Shift odometry (and with it the mean) by the correction
+	Odometry_Correct(K[0] * innovation, K[1] * innovation, K[2] * innovation * GEO_DEGREES_PER_RADIAN);
+	MeanX += K[0] * innovation;
+	MeanY += K[1] * innovation;
+	MeanTheta += K[2] * innovation;
+	
+	// P = P - K (H P), and HP is PH' as P is symmetric
+	for (int row = 0; row < 3; row++)
+	{
+		for (int col = 0; col < 3; col++)
+		{
+			P[row][col] -= K[row] * PH[col];
+		}
+	}
+	symmetrize();
+	
+	return true;
+}
+
+/****************************************************************************
+ Function
+     PoseFilter_GetCovariance
+
+ Description
+     Copies out the covariance of (x, y, theta), in inches and radians
+****************************************************************************/
+void PoseFilter_GetCovariance(float covariance[3][3])
+{
+	for (int row = 0; row < 3; row++)
+	{
+		for (int col = 0; col < 3; col++)
+		{
+			covariance[row][col] = P[row][col];
+		}
+	}
+}
+
+/****************************************************************************
+ Function
+     PoseFilter_PositionSigma
+
+ Returns
+     The RMS position error we expect, in inches
+****************************************************************************/
+float PoseFilter_PositionSigma(void)
+{
+	return sqrtf(P[0][0] + P[1][1]);
+}
+
+/****************************************************************************
+ Function
+     PoseFilter_HeadingSigma
+
+ Returns
+     The heading error we expect (1 sigma), in degrees
+****************************************************************************/
+float PoseFilter_HeadingSigma(void)
+{
+	return sqrtf(P[2][2]) * GEO_DEGREES_PER_RADIAN;
+}
+
+// Wrap an angle difference to [-PI, PI)
+static float wrapToPi(float angle)
+{
+	return Geo_WrapRadians(angle + GEO_PI) - GEO_PI;
+}
+
+// Rounding slowly breaks the symmetry of P, so average it back
+static void symmetrize(void)
+{
+	for (int row = 0; row < 3; row++)
+	{
+		for (int col = row + 1; col < 3; col++)
+		{
+			float average = 0.5f * (P[row][col] + P[col][row]);
+			P[row][col] = average;
+			P[col][row] = average;
+		}
+	}
+}
@@ -24,12 +24,45 @@
 #include "Strategy_SM.h"
 #include "DriveTrainControl_Service.h"
 #include "AttackStrategy_SM.h"
+#include "Geometry.h"
+#include "Odometry.h"
+#include "PoseFilter.h"
+#include "Relocalizer.h"
+#include "Triangulate.h"
 
 /*----------------------------- Module Defines ----------------------------*/
 
-#define PI 3.14159265f
-#define DEGREE_CONVERSION_RATIO 57.29577951f
-#define RADIAN_CONVERSION_RATIO 0.01745329251f
+#define PI GEO_PI
+#define DEGREE_CONVERSION_RATIO GEO_DEGREES_PER_RADIAN
+#define RADIAN_CONVERSION_RATIO GEO_RADIANS_PER_DEGREE
+
+#define NUMBER_BEACONS 4
+
+// Fixes whose angles disagree by more than this (RMS, degrees) are rejected
+#define MAX_BEACON_RESIDUAL 2.0f
+
+// We know where we are while the pose filter's expected errors are within these
+#define KNOWN_POSITION_SIGMA 6.0f // inches
+#define KNOWN_HEADING_SIGMA 8.0f // degrees
+
+// We have lost track (and triangulate again) past this error, or after this
+// many bearings in a row disagree with the filter
+#define LOST_POSITION_SIGMA 12.0f // inches
+#define MAX_REJECTED_BEARINGS 4
+
+// We don't position from a beacon angle unless at least this fraction of its
+// pulses agreed on it
+#define MIN_BEARING_QUALITY 0.6f
+
+// The periscope passes each beacon slowly within this many degrees of where we
+// expect it, plus three sigma of our heading and position errors
+#define SECTOR_HALF_WIDTH 6.0f
+
+// While following a path, targets further off our heading than this (degrees)
+// are turned toward in place before we arc onto them, and we steer for a point
+// at most PATH_LOOKAHEAD inches ahead on the line to the target
+#define PATH_MAX_ARC_ANGLE 45.0f
+#define PATH_LOOKAHEAD 12.0f
 
 /*---------------------------- Module Functions ---------------------------*/
 /* prototypes for private functions for this service.They should be functions
@@ -37,6 +70,15 @@
 */
 
 static void CalculateAbsolutePosition(void);
+static void UpdatePose(void);
+static void UseBearing(uint8_t beacon);
+static void RelocalizeFromBearing(uint8_t beacon);
+static void Relocalize(void);
+static void UpdateScan(void);
+static bool IsTracking(void);
+static void TriangulateFromTriple(uint8_t first, float *x, float *y, float *theta);
+static uint8_t GatherSightings(uint8_t fresh);
+static float RefinePosition(uint8_t beacons, float *x, float *y, float *theta);
 //static void CalculateRelativePosition(void);
 static float ConvertEncoderTicksToInches(uint32_t ticks);
 static uint32_t ConvertInchesToEncoderTicks(float inches);
@@ -49,6 +91,9 @@ static float DetermineAngleToTarget(float distanceToTarget);
 //static float DetermineAngleToBucket(float distanceToBucket);
 static void AlignToTarget(void);
 static void DriveToTarget(void);
+#if PATH_FOLLOWING
+static void SteerToTarget(void);
+#endif
 
 /*---------------------------- Module Variables ---------------------------*/
 // with the introduction of Gen2, we need a module level Priority variable
@@ -63,6 +108,18 @@ static float TargetY;
 
 static bool AbsolutePosition = false;
 
+static uint8_t RejectedBearings = 0;
+
+// Set while an ES_RELOCALIZE is waiting in our queue
+static bool RelocalizePending = false;
+
+// How far we have moved since we saw each beacon
+static BeaconSighting Sightings[NUMBER_BEACONS];
+
+// Beacon locations in field coordinates, indexed by BEACON_INDEX_
+static const float BeaconX[NUMBER_BEACONS] = {0, FIELD_LENGTH, FIELD_LENGTH, 0};
+static const float BeaconY[NUMBER_BEACONS] = {FIELD_LENGTH, FIELD_LENGTH, 0, 0};
+
 static uint8_t backupIndex;
 
 typedef struct {
@@ -146,7 +203,32 @@ ES_Event RunPositionLogicService( ES_Event ThisEvent )
 	{
 		case ES_CALCULATE_POSITION:
 		{
-			CalculateAbsolutePosition();
+			// Once the filter is tracking, bearings keep it up to date instead
+			if (!IsTracking())
+			{
+				CalculateAbsolutePosition();
+			}
+			UpdateScan();
+			break;
+		}
+		case ES_BEACON_BEARING:
+		{
+			// While we are lost, bearings go to the relocalizer instead
+			if (Relocalizer_IsRunning())
+			{
+				RelocalizeFromBearing(ThisEvent.EventParam);
+			}
+			else
+			{
+				UseBearing(ThisEvent.EventParam);
+			}
+			UpdateScan();
+			break;
+		}
+		case ES_RELOCALIZE:
+		{
+			RelocalizePending = false;
+			Relocalize();
 			break;
 		}
 		// Relative positioning was removed from the competition version of 
@@ -169,14 +251,36 @@ ES_Event RunPositionLogicService( ES_Event ThisEvent )
 		}*/
 		case ES_FACE_TARGET:
 		{
+			UpdatePose();
 			AlignToTarget();
 			break;
 		}
 		case ES_DRIVE_TO_TARGET:
 		{
+			// Turn to face the target and drive to it back to back
+			UpdatePose();
+			AlignToTarget();
 			DriveToTarget();
 			break;
 		}
+#if PATH_FOLLOWING
+		case ES_FOLLOW_PATH:
+		{
+			UpdatePose();
+			SteerToTarget();
+			break;
+		}
+		case ES_PATH_UPDATE:
+		{
+			// Unless something else has taken over the drivetrain since
+			if (IsFollowingPath())
+			{
+				UpdatePose();
+				SteerToTarget();
+			}
+			break;
+		}
+#endif
 		default:
 			break;
 	}
@@ -193,13 +297,16 @@ void SetTargetLocation(float x, float y)
 }
 
 /***************************************************************************
- Set location manually (used for testing)
+ Set our location (from a beacon fix, or manually for testing)
  ***************************************************************************/
 void SetMyLocation(float x, float y, float theta)
 {
 	myX = x;
 	myY = y;
 	myTheta = theta;
+	PoseFilter_Reset(x, y, theta);
+	RejectedBearings = 0;
+	Relocalizer_Stop();
 }
 
 /***************************************************************************
@@ -207,6 +314,7 @@ void SetMyLocation(float x, float y, float theta)
  ***************************************************************************/
 float getX(void)
 {
+	UpdatePose();
 	return myX;
 }
 
@@ -215,9 +323,19 @@ float getX(void)
  ***************************************************************************/
 float getY(void)
 {
+	UpdatePose();
 	return myY;
 }
 
+/***************************************************************************
+ Get my heading (degrees, counterclockwise from the x axis)
+ ***************************************************************************/
+float getTheta(void)
+{
+	UpdatePose();
+	return myTheta;
+}
+
 /***************************************************************************
  Reposition if we are having trouble getting a position
  ***************************************************************************/
@@ -246,6 +364,26 @@ void ExecuteBackup(void)
 	}
 }
 
+/***************************************************************************
+ Find our position again when we have lost it. We first try to work it out
+ in place from whatever beacons we can see, and only back up if that is
+ getting nowhere (no beacons in sight since we started)
+ ***************************************************************************/
+void RecoverPosition(void)
+{
+	// We can't predict where the beacons will be any more
+	ScanFullRotation();
+	
+	if (!Relocalizer_IsRunning())
+	{
+		Relocalizer_Start();
+	}
+	else if (Relocalizer_NumBearings() == 0)
+	{
+		ExecuteBackup();
+	}
+}
+
 /***************************************************************************
  Check if our latest position was determined via triangulation
  ***************************************************************************/
@@ -262,87 +400,334 @@ void ResetAbsolutePosition(void)
 	AbsolutePosition = 0;
 }
 
+/***************************************************************************
+ Check if we have a position at all. Once we have had one beacon fix,
+ odometry keeps it up to date between fixes
+ ***************************************************************************/
+bool IsPositionKnown(void)
+{
+	if (!PoseFilter_IsInitialized())
+	{
+		return false;
+	}
+	PoseFilter_Predict();
+	return (PoseFilter_PositionSigma() <= KNOWN_POSITION_SIGMA) && (PoseFilter_HeadingSigma() <= KNOWN_HEADING_SIGMA);
+}
+
+/***************************************************************************
+ Get the RMS error we expect in our position (inches), and the error we
+ expect in our heading (degrees, 1 sigma)
+ ***************************************************************************/
+float GetPositionUncertainty(void)
+{
+	PoseFilter_Predict();
+	return PoseFilter_PositionSigma();
+}
+
+float GetHeadingUncertainty(void)
+{
+	PoseFilter_Predict();
+	return PoseFilter_HeadingSigma();
+}
+
+/***************************************************************************
+ Get the covariance of our (x, y, theta) estimate, in inches and radians
+ ***************************************************************************/
+void GetPoseCovariance(float covariance[3][3])
+{
+	PoseFilter_Predict();
+	PoseFilter_GetCovariance(covariance);
+}
+
 /***************************************************************************
  Return the distance to the given point
  ***************************************************************************/
 float DistanceToPoint(float TargetX, float TargetY)
 {
-	float yDist = TargetY - myY;
-	float xDist = TargetX - myX;
+	float yDist;
+	float xDist;
+	
+	UpdatePose();
+	yDist = TargetY - myY;
+	xDist = TargetX - myX;
 	
-	return sqrt((yDist * yDist) + (xDist * xDist));
+	return sqrtf((yDist * yDist) + (xDist * xDist));
 }
 
 /***************************************************************************
 Absolute Position Calculations (ie. Photo Transistor Periscope Calculations)
  ***************************************************************************/
-// Calculate absolute position by measuring the angles to 3 beacons. 
-// See explanation of math for more details
+// Calculate absolute position from the most recent angles to the beacons.
+// Any three fresh beacons give a fix. We may have seen them from different
+// places, so we triangulate as if we had not moved, then refine that against
+// where odometry says we were for each beacon. We reject the fix if the
+// angles still disagree afterwards. The angles only change in the
+// phototransistor service, so they can't change while we work
 static void CalculateAbsolutePosition()
 {
-	// Disable our phototransistor interrupts while we work, so that angles don't update
-	// in the middle of the calculations
-	disableCaptureInterrupt(PHOTOTRANSISTOR_INTERRUPT_PARAMATERS);
+	uint8_t fresh;
+	uint8_t numFresh = 0;
+	uint8_t missing = NULL_BEACON;
+	float residual;
+	float x;
+	float y;
+	float theta;
+	
+	// Find which beacons we can use
+	fresh = GatherSightings(GetFreshBeacons());
+	for (int i = 0; i < NUMBER_BEACONS; i++)
+	{
+		if (fresh & (1 << i))
+		{
+			numFresh++;
+		}
+		else
+		{
+			missing = i;
+		}
+	}
+	
+	if (numFresh == NUMBER_BEACONS)
+	{
+		// Start from the triple ending in the beacon we just saw, then use all four
+		TriangulateFromTriple(mostRecentBeaconUpdate(), &x, &y, &theta);
+	}
+	else if (numFresh == (NUMBER_BEACONS - 1))
+	{
+		// The triple starting after the missing beacon is the one that skips it
+		TriangulateFromTriple((missing + 1) % NUMBER_BEACONS, &x, &y, &theta);
+	}
+	else
+	{
+		// Not enough information yet
+		return;
+	}
+	residual = RefinePosition(fresh, &x, &y, &theta);
+	
+	// If four beacons don't agree, one of the angles is bad. Three always fit,
+	//  unless we moved so far between them that the refinement lost its way.
+	//  The oldest is the most likely culprit either way, so forget it and wait
+	//  to see it again
+	if (!(residual <= MAX_BEACON_RESIDUAL))
+	{
+		ExpireBeacon(OldestFreshBeacon());
+		return;
+	}
+	
+	// Written so that a NaN from degenerate angles (two beacons at the same angle) also fails
+	if (!((x >= 0) && (y >= 0) && (x <= FIELD_LENGTH) && (y <= FIELD_LENGTH)))
+	{
+		// If we calculated an invalid position, search for it from the beacons
+		//  we see from here instead
+		RecoverPosition();
+		
+		// Reset all beacon information
+		ResetUpdateTimes();
+	}
+	else
+	{
+		// Otherwise, mark that we now have our absolute position and re-anchor
+		//  odometry on it. We keep the beacon angles, so that the next beacon
+		//  we see gives another fix
+		SetMyLocation(x, y, theta);
+		AbsolutePosition = true;
+	}
+}
 
-	//Get our A, B, and C Encoder Angles
-	uint8_t lastBeaconIndex = mostRecentBeaconUpdate();
-	float A =  GetBeaconAngle_A(lastBeaconIndex);
-	float B =  GetBeaconAngle_B(lastBeaconIndex);
-	float C =  GetBeaconAngle_C(lastBeaconIndex);
+// Work out how far we have moved since seeing each fresh beacon. Returns the
+// fresh beacons we still know that for, and whose angles we trust
+static uint8_t GatherSightings(uint8_t fresh)
+{
+	float nowX, nowY, nowTheta;
+	float seenX, seenY, seenTheta;
+	float sinNow, cosNow;
 	
-	//Get our Shifts for the rotation matrix
-	int xShift = getXShift(lastBeaconIndex);
-	int yShift = getYShift(lastBeaconIndex);
-	int thetaShift = getThetaShift(lastBeaconIndex);
+	Odometry_GetPose(&nowX, &nowY, &nowTheta);
+	Geo_SinCos(ToRadians(nowTheta), &sinNow, &cosNow);
 	
-	//Declare Static Variabels for our Calculations
-	float BMinusC;
-	float AMinusB;
-	float gamma;
-	float delta;
-	float tempAngle;
-	float atan;
-	float myTempX;
-	float myTempY;
+	for (int k = 0; k < NUMBER_BEACONS; k++)
+	{
+		if (!(fresh & (1 << k)))
+		{
+			continue;
+		}
+		if ((GetBeaconQuality(k) < MIN_BEARING_QUALITY) || !GetBeaconPose(k, &seenX, &seenY, &seenTheta))
+		{
+			fresh &= ~(1 << k);
+			continue;
+		}
+		
+		// Odometry's heading may be wrong before our first fix, so keep the move
+		//  in our own frame
+		Sightings[k].forward = ((nowX - seenX) * cosNow) + ((nowY - seenY) * sinNow);
+		Sightings[k].left = ((nowY - seenY) * cosNow) - ((nowX - seenX) * sinNow);
+		Sightings[k].turned = ToAppropriateRange(nowTheta - seenTheta + 180.0f) - 180.0f;
+	}
+	return fresh;
+}
+
+// Refine our pose with the bearing to one beacon, as seen from where we were then
+static void UseBearing(uint8_t beacon)
+{
+	float seenX, seenY, seenTheta;
 	
-	//Perform Calculations with SW corner being used as the axis
-	BMinusC = ToRadians(ToAppropriateRange(B - C));
-	AMinusB = ToRadians(ToAppropriateRange(A - B));
+	if (!PoseFilter_IsInitialized() || (GetBeaconQuality(beacon) < MIN_BEARING_QUALITY)
+		|| !GetBeaconPose(beacon, &seenX, &seenY, &seenTheta))
+	{
+		return;
+	}
 	
-	tempAngle = (1.5f * PI) - BMinusC - AMinusB;
+	PoseFilter_Predict();
+	if (PoseFilter_UpdateBearing(BeaconX[beacon], BeaconY[beacon], GetBeaconAngle(beacon), seenX, seenY, seenTheta))
+	{
+		RejectedBearings = 0;
+		
+		// A bearing since we last moved, and we are confident again
+		AbsolutePosition = IsPositionKnown();
+	}
+	else if (RejectedBearings < MAX_REJECTED_BEARINGS)
+	{
+		RejectedBearings++;
+	}
+}
+
+// Hand one bearing to the relocalizer, and queue up its rounds of work
+static void RelocalizeFromBearing(uint8_t beacon)
+{
+	float seenX, seenY, seenTheta;
+	ES_Event NewEvent;
 	
-	atan = atan2(-sin(tempAngle), (sin(AMinusB)/sin(BMinusC)) + cos(tempAngle));
+	if ((GetBeaconQuality(beacon) < MIN_BEARING_QUALITY) || !GetBeaconPose(beacon, &seenX, &seenY, &seenTheta))
+	{
+		return;
+	}
 	
-	gamma = (atan < 0) ? -atan : PI - atan;
-	delta = tempAngle - gamma;
+	Relocalizer_AddBearing(BeaconX[beacon], BeaconY[beacon], GetBeaconAngle(beacon), seenX, seenY, seenTheta);
 	
-	myX = 96.0 - (96.0 * sin(gamma) * (sin(PI - gamma - BMinusC)/sin(PI - BMinusC)));
-	myY = 96.0 - (96.0 * sin(delta) * (sin(PI - delta - AMinusB)/sin(PI - AMinusB)));
+	if (!RelocalizePending)
+	{
+		RelocalizePending = true;
+		NewEvent.EventType = ES_RELOCALIZE;
+		NewEvent.EventParam = 0;
+		PostPositionLogicService(NewEvent);
+	}
+}
+
+// Run one round of the relocalizer, posting to ourselves for the next so that
+// other services get a turn in between
+static void Relocalize(void)
+{
+	float x, y, theta;
+	ES_Event NewEvent;
 	
-	myTheta = ToAppropriateRange(ToDegrees(ToRadians(360 - B) + gamma + BMinusC - (.5f * PI)));
+	switch (Relocalizer_Step())
+	{
+		case RELOCALIZE_WORKING:
+		{
+			RelocalizePending = true;
+			NewEvent.EventType = ES_RELOCALIZE;
+			NewEvent.EventParam = 0;
+			PostPositionLogicService(NewEvent);
+			break;
+		}
+		case RELOCALIZE_CONVERGED:
+		{
+			// We have found ourselves without moving
+			Relocalizer_GetEstimate(&x, &y, &theta);
+			SetMyLocation(x, y, theta);
+			AbsolutePosition = true;
+			break;
+		}
+		case RELOCALIZE_AMBIGUOUS:
+		{
+			// We can't tell where we are from here, so move and look again
+			ExecuteBackup();
+			Relocalizer_Start();
+			break;
+		}
+		default:
+			break;
+	}
+}
+
+// Point the periscope's slow sectors at where we expect to see the beacons, or
+// have it turn evenly if we don't know where we are well enough
+static void UpdateScan(void)
+{
+	float centers[NUMBER_BEACONS];
+	float halfWidths[NUMBER_BEACONS];
+	float spread;
+	float headingSpread;
+	float xDist;
+	float yDist;
+	float distance;
+	
+	if (Relocalizer_IsRunning() || !IsPositionKnown())
+	{
+		ScanFullRotation();
+		return;
+	}
 	
-	//Peform Rotations and Appropriate Shifts to account for any 3 beacons used
-	myTempX = (myX*cos(ToRadians(thetaShift)) - myY*sin(ToRadians(thetaShift))) + xShift;
-	myTempY = (myX*sin(ToRadians(thetaShift)) + myY*cos(ToRadians(thetaShift))) + yShift;	
-	myTheta = ToAppropriateRange(myTheta + thetaShift); 
-	myX = myTempX;
+	UpdatePose();
+	spread = 3.0f * GetPositionUncertainty();
+	headingSpread = 3.0f * GetHeadingUncertainty();
 	
-	if ((myX < 0) || (myY < 0) || (myX > 96) || (myY > 96))
+	for (int k = 0; k < NUMBER_BEACONS; k++)
 	{
-		// If we calculated an invalid position, backup
-		ExecuteBackup();
+		xDist = BeaconX[k] - myX;
+		yDist = BeaconY[k] - myY;
+		distance = sqrtf((xDist * xDist) + (yDist * yDist));
+		
+		// The periscope follows our heading itself, so it wants the field bearing.
+		//  Our position error moves that most when we are close to the beacon
+		centers[k] = ToAppropriateRange(ToDegrees(Geo_Atan2(yDist, xDist)));
+		halfWidths[k] = SECTOR_HALF_WIDTH + headingSpread
+			+ ((distance > spread) ? ToDegrees(Geo_Atan2(spread, distance)) : 90.0f);
 	}
-	else
+	ScanSectors(centers, halfWidths, NUMBER_BEACONS);
+}
+
+// Bring our pose up to date with odometry, once it has been anchored
+static void UpdatePose(void)
+{
+	if (Odometry_IsAnchored())
 	{
-		// Otherwise, mark that we now have our absolute position
-		AbsolutePosition = true;
+		Odometry_GetPose(&myX, &myY, &myTheta);
 	}
+}
+
+// Check whether the pose filter is still following us, or whether we need
+// a fresh triangulated fix
+static bool IsTracking(void)
+{
+	return PoseFilter_IsInitialized() && (RejectedBearings < MAX_REJECTED_BEARINGS)
+		&& (GetPositionUncertainty() < LOST_POSITION_SIGMA);
+}
+
+// Triangulate from the angles to three beacons: first, and the two beacons
+// before it going clockwise (see explanation of math for more details)
+static void TriangulateFromTriple(uint8_t first, float *x, float *y, float *theta)
+{
+	//Get our A, B, and C Encoder Angles
+	float A =  GetBeaconAngle_A(first);
+	float B =  GetBeaconAngle_B(first);
+	float C =  GetBeaconAngle_C(first);
 	
-	// Reset all beacon information
-	ResetUpdateTimes();
+	Triangulate_Triple(A, B, C, getXShift(first), getYShift(first), getThetaShift(first), x, y, theta);
+}
+
+// Refine a position against the angles to the given beacons, as seen from
+// where we were then (see GatherSightings). Returns the RMS disagreement
+// between measured and predicted angles, in degrees
+static float RefinePosition(uint8_t beacons, float *x, float *y, float *theta)
+{
+	float angles[NUMBER_BEACONS];
 	
-	// Reenable the phototransistor interrupts
-	enableCaptureInterrupt(PHOTOTRANSISTOR_INTERRUPT_PARAMATERS);
+	for (int k = 0; k < NUMBER_BEACONS; k++)
+	{
+		angles[k] = (beacons & (1 << k)) ? GetBeaconAngle(k) : 0;
+	}
+	return Triangulate_Refine(beacons, angles, Sightings, BeaconX, BeaconY, x, y, theta);
 }
 
 
@@ -430,18 +815,10 @@ static float ToRadians(float degrees)
 }
 
 // Return an equivalent value for the angle within
-// the range [0, 360.0]
+// the range [0, 360.0)
 float ToAppropriateRange(float angle)
 {
-	while (angle > 360.0f)
-	{
-		angle -= 360.0f;
-	}
-	while (angle < 0.0f)
-	{
-		angle += 360.0f;
-	}
-	return angle;
+	return Geo_WrapDegrees(angle);
 }
 
 // Return an equivalent value for the angle within
@@ -468,10 +845,14 @@ static uint32_t EncoderTicksForGivenAngle(float angle)
 // Returns the current distance to our target AD bucket
 float DetermineDistanceToBucket(void)
 {
-	float yDist = (MyColor() ? 102.3 : -6.3) - myY;
-	float xDist = (MyColor() ? -6.3 : 102) - myX;
+	float yDist;
+	float xDist;
+	
+	UpdatePose();
+	yDist = (MyColor() ? 102.3f : -6.3f) - myY;
+	xDist = (MyColor() ? -6.3f : 102.0f) - myX;
 	
-	return sqrt((yDist * yDist) + (xDist * xDist));
+	return sqrtf((yDist * yDist) + (xDist * xDist));
 }
 
 // Returns the current distance to the target
@@ -480,13 +861,13 @@ static float DetermineDistanceToTarget(void)
 	float yDist = TargetY - myY;
 	float xDist = TargetX - myX;
 	
-	return sqrt((yDist * yDist) + (xDist * xDist));
+	return sqrtf((yDist * yDist) + (xDist * xDist));
 }
 
 // Returns the angle to the target relative to our current bearing
 static float DetermineAngleToTarget(float distanceToTarget)
 {
-	float theta = ToAppropriateRange(ToDegrees(asin((TargetY - myY)/distanceToTarget)));
+	float theta = ToAppropriateRange(ToDegrees(asinf((TargetY - myY)/distanceToTarget)));
 	if ((TargetX - myX) < 0)
 	{
 		theta = ToAppropriateRange(180 - theta);
@@ -511,7 +892,7 @@ static void AlignToTarget(void)
 {
 	float angle = DetermineAngleToTarget(DetermineDistanceToTarget());
 	uint32_t ticks = EncoderTicksForGivenAngle(angle);
-	setTargetEncoderTicks(ticks, ticks, false, true);
+	QueueRotation(ticks, true);
 }
 
 // Drive towards a target
@@ -526,13 +907,64 @@ static void DriveToTarget(void)
 	if (ticks >= HALL_SENSOR_OFFSET_IN_TICKS)
 	{
 		ticks -= HALL_SENSOR_OFFSET_IN_TICKS;
-		setTargetEncoderTicks(ticks, ticks, false, false);
+		QueueDrive(ticks, true);
 	}
 	else
 	{
 		ticks = HALL_SENSOR_OFFSET_IN_TICKS - ticks;
-		setTargetEncoderTicks(ticks, ticks, true, true);
+		QueueDrive(ticks, false);
 	}
 }
 
-
+#if PATH_FOLLOWING
+// Steer along the arc that leaves along our heading and passes through a
+// point up to PATH_LOOKAHEAD ahead on the line to the target (pure pursuit).
+// A target too far off our heading for a sensible arc is turned toward in
+// place first; the drivetrain brings the turn to rest before the arc, as the
+// inside wheel has to turn round
+static void SteerToTarget(void)
+{
+	float distance = DetermineDistanceToTarget();
+	float angle = DetermineAngleToTarget(distance);
+	float lookahead = (distance < PATH_LOOKAHEAD) ? distance : PATH_LOOKAHEAD;
+	float alpha;
+	float curvature;
+	float arc;
+	float outer;
+	float inner;
+	uint32_t ticks;
+	
+	// Clockwise angle to the target, in (-180, 180]
+	if (angle > 180)
+	{
+		angle -= 360;
+	}
+	
+	if (fabsf(angle) > PATH_MAX_ARC_ANGLE)
+	{
+		// Aim to turn all the way; we re-steer onto an arc well before then
+		ticks = EncoderTicksForGivenAngle(fabsf(angle));
+		setTargetPath(ticks, (angle > 0) ? 1 : -1, (angle > 0) ? -1 : 1);
+		return;
+	}
+	
+	// The arc's curvature and length, then the straight line on to the target
+	alpha = ToRadians(angle);
+	curvature = (2 * sinf(alpha)) / lookahead;
+	arc = (fabsf(alpha) > 0.01f) ? ((lookahead * alpha) / sinf(alpha)) : lookahead;
+	if (ConvertInchesToEncoderTicks(arc + (distance - lookahead)) <= HALL_SENSOR_OFFSET_IN_TICKS)
+	{
+		// We are practically on it, back up onto it instead
+		DriveToTarget();
+		return;
+	}
+	
+	// On the arc the outside wheel covers more ground than our center by
+	// (1 + kW/2); on the straight they match. Stop short so that our hall
+	// sensors land on the station
+	outer = 1 + (fabsf(curvature) * DISTANCE_BETWEEN_WHEELS / 2);
+	inner = (2 - outer) / outer;
+	ticks = ConvertInchesToEncoderTicks((arc * outer) + (distance - lookahead)) - HALL_SENSOR_OFFSET_IN_TICKS;
+	setTargetPath(ticks, (angle > 0) ? 1 : inner, (angle > 0) ? inner : 1);
+}
+#endif
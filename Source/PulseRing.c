@@ -0,0 +1,111 @@
+/****************************************************************************
+ Module
+   PulseRing.c
+
+ Description
+		A single producer, single consumer ring of beacon pulses. The capture
+		  interrupt claims a slot, fills it and publishes it; the task takes the
+			oldest pulse, handles it and releases it. A pulse that finds the ring
+			full is counted and dropped, so the slot the task is reading is never
+			overwritten.
+****************************************************************************/
+
+#include <stddef.h>
+
+#include "ES_Configure.h"
+#include "ES_Framework.h"
+#include "PulseRing.h"
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     PulseRing_Init
+
+ Description
+     Empties the ring and clears its dropped count
+****************************************************************************/
+void PulseRing_Init(PulseRing *ring)
+{
+	ring->head = 0;
+	ring->tail = 0;
+	ring->dropped = 0;
+}
+
+/****************************************************************************
+ Function
+     PulseRing_Claim
+
+ Returns
+     the slot to fill with the next pulse, or NULL (and counts the pulse as
+		   dropped) if the ring is full
+
+ Description
+     Interrupt side. Nothing sees the slot until PulseRing_Publish
+****************************************************************************/
+BeaconPulse *PulseRing_Claim(PulseRing *ring)
+{
+	if (((ring->head + 1) & PULSE_RING_MASK) == ring->tail)
+	{
+		if (ring->dropped < 0xffff)
+		{
+			ring->dropped++;
+		}
+		return NULL;
+	}
+	return &ring->pulses[ring->head];
+}
+
+/****************************************************************************
+ Function
+     PulseRing_Publish
+
+ Description
+     Interrupt side. Hands the slot from PulseRing_Claim to the task
+****************************************************************************/
+void PulseRing_Publish(PulseRing *ring)
+{
+	ring->head = (ring->head + 1) & PULSE_RING_MASK;
+}
+
+/****************************************************************************
+ Function
+     PulseRing_Oldest
+
+ Returns
+     the oldest published pulse, or NULL if there are none
+
+ Description
+     Task side. The pulse stays put until PulseRing_Release
+****************************************************************************/
+const BeaconPulse *PulseRing_Oldest(const PulseRing *ring)
+{
+	if (ring->tail == ring->head)
+	{
+		return NULL;
+	}
+	return &ring->pulses[ring->tail];
+}
+
+/****************************************************************************
+ Function
+     PulseRing_Release
+
+ Description
+     Task side. Frees the slot of the pulse from PulseRing_Oldest
+****************************************************************************/
+void PulseRing_Release(PulseRing *ring)
+{
+	ring->tail = (ring->tail + 1) & PULSE_RING_MASK;
+}
+
+/****************************************************************************
+ Function
+     PulseRing_Dropped
+
+ Returns
+     how many pulses found the ring full (saturates at 0xffff)
+****************************************************************************/
+uint16_t PulseRing_Dropped(const PulseRing *ring)
+{
+	return ring->dropped;
+}
@@ -0,0 +1,542 @@
+/****************************************************************************
+ Module
+   Relocalizer.c
+
+ Description
+		Particle filter that finds our pose from scratch, one beacon bearing at
+		  a time, when triangulation has failed. Each particle is a guess at our
+			pose. The first bearing places particles all over the field, each
+			turned so that it would have seen that beacon where we did. Every
+			later bearing moves the particles by the odometry since the last one,
+			then for a few rounds weights them by how well they explain the last
+			few bearings and resamples with jitter that shrinks as they close in.
+			Each round is one call to Relocalizer_Step, so that the caller can
+			spread the work over several events.
+			Once the particles agree we have our pose; if they still disagree
+			after many bearings (e.g. we are somewhere symmetric, or only see two
+			beacons) we call it ambiguous.
+
+		The periscope sees beacon k at angle bearing(k) - theta, where bearing(k)
+		  is the direction from us to the beacon in field coordinates.
+****************************************************************************/
+
+#include <Math.h>
+
+#include "ES_Configure.h"
+#include "ES_Framework.h"
+#include "DEFINITIONS.h"
+#include "Geometry.h"
+#include "Relocalizer.h"
+
+/*----------------------------- Module Defines ----------------------------*/
+#define NUMBER_PARTICLES 100
+
+// Resampling replaces this many particles with fresh guesses from the newest
+// bearing, so that one bad bearing early on can't trap us in the wrong place
+#define NUMBER_FRESH_PARTICLES 10
+#define NUMBER_KEPT_PARTICLES (NUMBER_PARTICLES - NUMBER_FRESH_PARTICLES)
+
+// Bearing noise for weighting. We use a Cauchy shaped likelihood, which
+// can't be dominated by one outlier pulse the way a Gaussian can
+#define BEARING_SIGMA (3.0f * GEO_RADIANS_PER_DEGREE)
+
+// Odometry noise for moving the particles, as a fraction of the move
+#define MOTION_NOISE_FRACTION 0.1f
+
+// Bearings we weight against, and resampling rounds per bearing
+#define NUMBER_SIGHTINGS 6
+#define ROUNDS_PER_BEARING 3
+
+// Jitter added on resampling, so that copies of a particle spread out. It is
+// a fraction of the particles' spread, but no less than the minimums
+#define JITTER_FRACTION 0.5f
+#define MIN_JITTER_POSITION 0.5f // inches
+#define MIN_JITTER_HEADING (0.5f * GEO_RADIANS_PER_DEGREE)
+
+// Converged when the particles agree this well, and their mean explains a
+// full set of remembered bearings from at least MIN_BEACONS different beacons.
+// Three bearings fit some pose exactly, so we need the rest to catch a bad one
+#define CONVERGED_POSITION_SIGMA 2.5f // inches
+#define CONVERGED_HEADING_SIGMA (4.0f * GEO_RADIANS_PER_DEGREE)
+#define AGREEING_ERROR (4.0f * GEO_RADIANS_PER_DEGREE)
+#define MIN_BEACONS 3
+#define MAX_BEARINGS 16
+
+/*---------------------------- Module Types -------------------------------*/
+typedef struct {
+	float x;
+	float y;
+	float theta; // radians
+} Particle;
+
+// A bearing, and how far we have moved (in our own frame) since we saw it
+typedef struct {
+	float beaconX;
+	float beaconY;
+	float angle;
+	float seenX;
+	float seenY;
+	float seenTheta;
+	float forward;
+	float left;
+	float turned;
+} Sighting;
+
+/*---------------------------- Module Functions ---------------------------*/
+static void seedFromBearing(float beaconX, float beaconY, float angle);
+static void seedParticle(Particle *particle, float beaconX, float beaconY, float angle);
+static void moveParticles(float forward, float left, float turned);
+static void addSighting(float beaconX, float beaconY, float angle, float seenX, float seenY, float seenTheta);
+static void weighParticles(void);
+static bool resample(void);
+static bool estimate(void);
+static bool meanExplainsSightings(void);
+static float randomUnit(void);
+static float randomNoise(float scale);
+static float wrapToPi(float angle);
+
+/*---------------------------- Module Variables ---------------------------*/
+static Particle Particles[NUMBER_PARTICLES];
+static Particle Resampled[NUMBER_PARTICLES];
+static float Weights[NUMBER_PARTICLES];
+
+static bool Running = false;
+static uint8_t NumBearings;
+static uint8_t RoundsLeft;
+
+static Sighting Sightings[NUMBER_SIGHTINGS];
+static uint8_t NumSightings;
+static uint8_t NextSighting;
+
+// The odometry pose of the last bearing we used
+static float LastX;
+static float LastY;
+static float LastTheta;
+
+// The weighted mean of the particles
+static float MeanX;
+static float MeanY;
+static float MeanTheta;
+
+// How far the particles are from their mean (RMS)
+static float SpreadPosition;
+static float SpreadHeading;
+
+static uint32_t RandomState = 0x2545f491;
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     Relocalizer_Start
+
+ Description
+     Forgets everything, so that the next bearing starts a fresh search
+****************************************************************************/
+void Relocalizer_Start(void)
+{
+	// stir the time into our random numbers, so that retries differ
+	RandomState ^= ES_Timer_GetTime();
+	if (RandomState == 0)
+	{
+		RandomState = 1;
+	}
+	NumBearings = 0;
+	NumSightings = 0;
+	NextSighting = 0;
+	RoundsLeft = 0;
+	Running = true;
+}
+
+/****************************************************************************
+ Function
+     Relocalizer_Stop
+****************************************************************************/
+void Relocalizer_Stop(void)
+{
+	Running = false;
+}
+
+/****************************************************************************
+ Function
+     Relocalizer_IsRunning
+****************************************************************************/
+bool Relocalizer_IsRunning(void)
+{
+	return Running;
+}
+
+/****************************************************************************
+ Function
+     Relocalizer_NumBearings
+
+ Returns
+     How many bearings we have used since starting
+****************************************************************************/
+uint8_t Relocalizer_NumBearings(void)
+{
+	return NumBearings;
+}
+
+/****************************************************************************
+ Function
+     Relocalizer_AddBearing
+
+ Parameters
+     beaconX, beaconY : where the beacon is on the field
+		 angleDegrees : the periscope angle we saw it at
+		 seenX, seenY, seenThetaDegrees : the odometry pose when we saw it
+
+ Description
+     Takes in a bearing. Call Relocalizer_Step until it stops returning
+		   RELOCALIZE_WORKING to find out what it told us
+****************************************************************************/
+void Relocalizer_AddBearing(float beaconX, float beaconY, float angleDegrees, float seenX, float seenY, float seenThetaDegrees)
+{
+	float angle = angleDegrees * GEO_RADIANS_PER_DEGREE;
+	float seenTheta = seenThetaDegrees * GEO_RADIANS_PER_DEGREE;
+	
+	if (!Running)
+	{
+		return;
+	}
+	
+	addSighting(beaconX, beaconY, angle, seenX, seenY, seenTheta);
+	
+	if (NumBearings == 0)
+	{
+		seedFromBearing(beaconX, beaconY, angle);
+		RoundsLeft = 0;
+	}
+	else
+	{
+		// Move by the odometry since the last bearing, in the robot's own frame
+		float sinLast, cosLast;
+		Geo_SinCos(LastTheta, &sinLast, &cosLast);
+		moveParticles(((seenX - LastX) * cosLast) + ((seenY - LastY) * sinLast),
+			((seenY - LastY) * cosLast) - ((seenX - LastX) * sinLast),
+			wrapToPi(seenTheta - LastTheta));
+		RoundsLeft = ROUNDS_PER_BEARING;
+	}
+	
+	LastX = seenX;
+	LastY = seenY;
+	LastTheta = seenTheta;
+	NumBearings++;
+}
+
+/****************************************************************************
+ Function
+     Relocalizer_Step
+
+ Returns
+     RELOCALIZE_WORKING if there is more to do for the last bearing, otherwise
+		 whether we have converged, are still searching, or have given up
+****************************************************************************/
+RelocalizeResult Relocalizer_Step(void)
+{
+	if (!Running)
+	{
+		return RELOCALIZE_SEARCHING;
+	}
+	
+	if (RoundsLeft > 0)
+	{
+		RoundsLeft--;
+		weighParticles();
+		
+		// If no particle could be us, start over from the newest bearing
+		if (!resample())
+		{
+			uint8_t newest = (NextSighting + NUMBER_SIGHTINGS - 1) % NUMBER_SIGHTINGS;
+			Sightings[0] = Sightings[newest];
+			NumSightings = 1;
+			NextSighting = 1;
+			NumBearings = 1;
+			RoundsLeft = 0;
+			seedFromBearing(Sightings[0].beaconX, Sightings[0].beaconY, Sightings[0].angle);
+		}
+		else if (RoundsLeft > 0)
+		{
+			estimate();
+			return RELOCALIZE_WORKING;
+		}
+	}
+	
+	if (estimate() && meanExplainsSightings())
+	{
+		return RELOCALIZE_CONVERGED;
+	}
+	return (NumBearings >= MAX_BEARINGS) ? RELOCALIZE_AMBIGUOUS : RELOCALIZE_SEARCHING;
+}
+
+/****************************************************************************
+ Function
+     Relocalizer_GetEstimate
+
+ Description
+     Returns the mean of the particles, in inches and degrees
+****************************************************************************/
+void Relocalizer_GetEstimate(float *x, float *y, float *thetaDegrees)
+{
+	*x = MeanX;
+	*y = MeanY;
+	*thetaDegrees = Geo_WrapDegrees(MeanTheta * GEO_DEGREES_PER_RADIAN);
+}
+
+// Scatter the particles over the field, each turned to have seen the beacon
+// at the given angle
+static void seedFromBearing(float beaconX, float beaconY, float angle)
+{
+	for (int i = 0; i < NUMBER_PARTICLES; i++)
+	{
+		seedParticle(&Particles[i], beaconX, beaconY, angle);
+		Weights[i] = 1.0f / NUMBER_PARTICLES;
+	}
+	estimate();
+}
+
+// Place a particle anywhere on the field, turned to have seen the beacon at
+// the given angle
+static void seedParticle(Particle *particle, float beaconX, float beaconY, float angle)
+{
+	particle->x = randomUnit() * FIELD_LENGTH;
+	particle->y = randomUnit() * FIELD_LENGTH;
+	particle->theta = Geo_Atan2(beaconY - particle->y, beaconX - particle->x) - angle;
+}
+
+// Remember a bearing, and work out how far we have moved since each one we
+// remember
+static void addSighting(float beaconX, float beaconY, float angle, float seenX, float seenY, float seenTheta)
+{
+	float sinNow, cosNow;
+	
+	Sightings[NextSighting].beaconX = beaconX;
+	Sightings[NextSighting].beaconY = beaconY;
+	Sightings[NextSighting].angle = angle;
+	Sightings[NextSighting].seenX = seenX;
+	Sightings[NextSighting].seenY = seenY;
+	Sightings[NextSighting].seenTheta = seenTheta;
+	NextSighting = (NextSighting + 1) % NUMBER_SIGHTINGS;
+	if (NumSightings < NUMBER_SIGHTINGS)
+	{
+		NumSightings++;
+	}
+	
+	// Odometry's heading may be wrong, so keep each move in our own frame
+	Geo_SinCos(seenTheta, &sinNow, &cosNow);
+	for (int j = 0; j < NumSightings; j++)
+	{
+		float dx = seenX - Sightings[j].seenX;
+		float dy = seenY - Sightings[j].seenY;
+		Sightings[j].forward = (dx * cosNow) + (dy * sinNow);
+		Sightings[j].left = (dy * cosNow) - (dx * sinNow);
+		Sightings[j].turned = wrapToPi(seenTheta - Sightings[j].seenTheta);
+	}
+}
+
+// Apply a move given in the robot's frame to every particle, with noise
+static void moveParticles(float forward, float left, float turned)
+{
+	float distanceNoise = MOTION_NOISE_FRACTION * (fabsf(forward) + fabsf(left));
+	float turnNoise = MOTION_NOISE_FRACTION * fabsf(turned);
+	
+	for (int i = 0; i < NUMBER_PARTICLES; i++)
+	{
+		float sinTheta, cosTheta;
+		float noisyForward = forward + randomNoise(distanceNoise);
+		
+		Geo_SinCos(Particles[i].theta, &sinTheta, &cosTheta);
+		Particles[i].x += (noisyForward * cosTheta) - (left * sinTheta);
+		Particles[i].y += (noisyForward * sinTheta) + (left * cosTheta);
+		Particles[i].theta += turned + randomNoise(turnNoise);
+	}
+}
+
+// Weight each particle by how well it explains the bearings we remember,
+// each seen from where that particle would have been then. Particles off the
+// field can't be us
+static void weighParticles(void)
+{
+	for (int i = 0; i < NUMBER_PARTICLES; i++)
+	{
+		float sinTheta, cosTheta;
+		
+		if ((Particles[i].x < 0) || (Particles[i].y < 0) || (Particles[i].x > FIELD_LENGTH) || (Particles[i].y > FIELD_LENGTH))
+		{
+			Weights[i] = 0;
+			continue;
+		}
+		
+		Geo_SinCos(Particles[i].theta, &sinTheta, &cosTheta);
+		Weights[i] = 1.0f;
+		for (int j = 0; j < NumSightings; j++)
+		{
+			float x = Particles[i].x - ((Sightings[j].forward * cosTheta) - (Sightings[j].left * sinTheta));
+			float y = Particles[i].y - ((Sightings[j].forward * sinTheta) + (Sightings[j].left * cosTheta));
+			float error = wrapToPi(Sightings[j].angle - (Geo_Atan2(Sightings[j].beaconY - y, Sightings[j].beaconX - x)
+				- (Particles[i].theta - Sightings[j].turned))) / BEARING_SIGMA;
+			
+			Weights[i] *= 1.0f / (1.0f + (error * error));
+		}
+	}
+}
+
+// Draw a new set of particles in proportion to their weights (low variance
+// sampling), jittering the copies, and top up with fresh guesses from the
+// newest bearing. Returns false if every weight is zero
+static bool resample(void)
+{
+	float total = 0;
+	float step;
+	float pointer;
+	float cumulative;
+	float jitterPosition = JITTER_FRACTION * SpreadPosition;
+	float jitterHeading = JITTER_FRACTION * SpreadHeading;
+	int source = 0;
+	
+	if (jitterPosition < MIN_JITTER_POSITION)
+	{
+		jitterPosition = MIN_JITTER_POSITION;
+	}
+	if (jitterHeading < MIN_JITTER_HEADING)
+	{
+		jitterHeading = MIN_JITTER_HEADING;
+	}
+	
+	for (int i = 0; i < NUMBER_PARTICLES; i++)
+	{
+		total += Weights[i];
+	}
+	
+	if (!(total > 0))
+	{
+		return false;
+	}
+	
+	step = total / NUMBER_KEPT_PARTICLES;
+	pointer = randomUnit() * step;
+	cumulative = Weights[0];
+	for (int i = 0; i < NUMBER_KEPT_PARTICLES; i++)
+	{
+		while ((pointer > cumulative) && (source < (NUMBER_PARTICLES - 1)))
+		{
+			source++;
+			cumulative += Weights[source];
+		}
+		Resampled[i].x = Particles[source].x + randomNoise(jitterPosition);
+		Resampled[i].y = Particles[source].y + randomNoise(jitterPosition);
+		Resampled[i].theta = Particles[source].theta + randomNoise(jitterHeading);
+		pointer += step;
+	}
+	for (int i = NUMBER_KEPT_PARTICLES; i < NUMBER_PARTICLES; i++)
+	{
+		uint8_t newest = (NextSighting + NUMBER_SIGHTINGS - 1) % NUMBER_SIGHTINGS;
+		seedParticle(&Resampled[i], Sightings[newest].beaconX, Sightings[newest].beaconY, Sightings[newest].angle);
+	}
+	
+	for (int i = 0; i < NUMBER_PARTICLES; i++)
+	{
+		Particles[i] = Resampled[i];
+		Weights[i] = 1.0f / NUMBER_PARTICLES;
+	}
+	return true;
+}
+
+// Find the mean of the resampled particles (the fresh guesses are not our
+// estimate). Returns true if they agree closely
+static bool estimate(void)
+{
+	float sumX = 0, sumY = 0, sumSin = 0, sumCos = 0;
+	float spreadPosition = 0, spreadHeading = 0;
+	
+	for (int i = 0; i < NUMBER_KEPT_PARTICLES; i++)
+	{
+		float sinTheta, cosTheta;
+		Geo_SinCos(Particles[i].theta, &sinTheta, &cosTheta);
+		sumX += Particles[i].x;
+		sumY += Particles[i].y;
+		sumSin += sinTheta;
+		sumCos += cosTheta;
+	}
+	MeanX = sumX / NUMBER_KEPT_PARTICLES;
+	MeanY = sumY / NUMBER_KEPT_PARTICLES;
+	MeanTheta = Geo_Atan2(sumSin, sumCos);
+	
+	for (int i = 0; i < NUMBER_KEPT_PARTICLES; i++)
+	{
+		float dx = Particles[i].x - MeanX;
+		float dy = Particles[i].y - MeanY;
+		float dTheta = wrapToPi(Particles[i].theta - MeanTheta);
+		spreadPosition += (dx * dx) + (dy * dy);
+		spreadHeading += dTheta * dTheta;
+	}
+	
+	SpreadPosition = sqrtf(spreadPosition / NUMBER_KEPT_PARTICLES);
+	SpreadHeading = sqrtf(spreadHeading / NUMBER_KEPT_PARTICLES);
+	
+	return (SpreadPosition < CONVERGED_POSITION_SIGMA) && (SpreadHeading < CONVERGED_HEADING_SIGMA);
+}
+
+// Check that the mean pose explains what we have seen, so that we don't settle
+// on a pose that fits a bad bearing
+static bool meanExplainsSightings(void)
+{
+	float sinTheta, cosTheta;
+	uint8_t beacons = 0;
+	
+	if (NumSightings < NUMBER_SIGHTINGS)
+	{
+		return false;
+	}
+	
+	Geo_SinCos(MeanTheta, &sinTheta, &cosTheta);
+	for (int j = 0; j < NumSightings; j++)
+	{
+		float x = MeanX - ((Sightings[j].forward * cosTheta) - (Sightings[j].left * sinTheta));
+		float y = MeanY - ((Sightings[j].forward * sinTheta) + (Sightings[j].left * cosTheta));
+		float error = wrapToPi(Sightings[j].angle - (Geo_Atan2(Sightings[j].beaconY - y, Sightings[j].beaconX - x)
+			- (MeanTheta - Sightings[j].turned)));
+		
+		bool newBeacon = true;
+		
+		if (!(fabsf(error) < AGREEING_ERROR))
+		{
+			return false;
+		}
+		
+		// count each beacon once
+		for (int k = 0; k < j; k++)
+		{
+			if ((Sightings[k].beaconX == Sightings[j].beaconX) && (Sightings[k].beaconY == Sightings[j].beaconY))
+			{
+				newBeacon = false;
+			}
+		}
+		if (newBeacon)
+		{
+			beacons++;
+		}
+	}
+	return beacons >= MIN_BEACONS;
+}
+
+// Uniform random number in [0, 1) from a xorshift generator
+static float randomUnit(void)
+{
+	RandomState ^= RandomState << 13;
+	RandomState ^= RandomState >> 17;
+	RandomState ^= RandomState << 5;
+	return (RandomState >> 8) * (1.0f / 16777216.0f);
+}
+
+// Triangular random noise in (-scale, scale)
+static float randomNoise(float scale)
+{
+	return scale * (randomUnit() + randomUnit() - 1.0f);
+}
+
+// Wrap an angle difference to [-PI, PI)
+static float wrapToPi(float angle)
+{
+	return Geo_WrapRadians(angle + GEO_PI) - GEO_PI;
+}
@@ -31,6 +31,8 @@
 #include "HallEffect_SM.h"
 #include "DriveTrainControl_Service.h"
 #include "AttackStrategy_SM.h"
+#include "PACLogic_SM.h"
+#include "CapturePS_SM.h"
 
 /*----------------------------- Module Defines ----------------------------*/
 // define constants for the states for this machine
@@ -59,6 +61,7 @@ static ES_Event DuringStationCapture_t( ES_Event Event);
 static ES_Event DuringHandleCollision_t( ES_Event Event);
 
 static void ChooseDestination(void);
+static bool CaptureRequestStarted(void);
 
 /*---------------------------- Module Variables ---------------------------*/
 // everybody needs a state variable, you may need others as well
@@ -72,6 +75,9 @@ static uint8_t retryCount;
 
 static uint8_t PositionTimeoutCount;
 
+// Whether we have already squared up over the station we are capturing
+static bool CenteredOnStation;
+
 /*------------------------------ Module Code ------------------------------*/
 /****************************************************************************
  Function
@@ -97,14 +103,14 @@ ES_Event RunStrategySM( ES_Event CurrentEvent )
 	 if ((CurrentEvent.EventType == ES_TIMEOUT) && (CurrentEvent.EventParam == POSITION_CHECK))
 	 {
 		 // if we don't have position
-		 if (!IsAbsolutePosition())
+		 if (!IsPositionKnown())
 		 {
-			 // increment a timeout counter, and execute a backup if we are stalled
+			 // increment a timeout counter, and try to recover if we are stalled
 			 PositionTimeoutCount++;
 			 if (PositionTimeoutCount >= POSITION_TIMEOUT_THRESHOLD)
 			 {
 				 PositionTimeoutCount = 0;
-				 ExecuteBackup();
+				 RecoverPosition();
 			 }
 		 }
 		 else
@@ -207,9 +213,13 @@ ES_Event RunStrategySM( ES_Event CurrentEvent )
 					 // If we have a new destination
 						if (CurrentEvent.EventType == ES_NEW_DESTINATION)
 						{
-							// pause positioning and get ready to rotate
+							// get ready to rotate, pausing positioning unless we can position on the move
+#if !LOCALIZE_WHILE_DRIVING
 							PausePositioning();
-							NextState = FaceTarget_t; //ie. we want to exit and reenter
+#endif
+							// we turn toward the target as part of the trip, either onto
+							// our path as we go or as the first of two queued moves
+							NextState = Travel_t;
 							MakeTransition = true;
 						}
 				 }
@@ -298,6 +308,16 @@ ES_Event RunStrategySM( ES_Event CurrentEvent )
 						  NextState = ChooseDestination_t;
 						  MakeTransition = true;
 						}
+						// once the move that found the station finishes, center ourselves on it,
+						//  unless we are already talking to the station
+						else if ((CurrentEvent.EventType == ES_ARRIVED) && (!CenteredOnStation))
+						{
+							CenteredOnStation = true;
+							if (!CaptureRequestStarted())
+							{
+								CenterOnStation(GetStationOffset());
+							}
+						}
 				 }
 				 break;
 			 }
@@ -533,8 +553,9 @@ static ES_Event DuringChooseDestination_t( ES_Event Event)
     {
         // implement any entry actions required for this state machine
 			
-			// If we have our position, and the attack machine is not going
-			if (IsAbsolutePosition() && (QueryAttackStrategySM() != Attack_t))
+			// If we have our position (odometry keeps it between beacon fixes),
+			//  and the attack machine is not going
+			if (IsPositionKnown() && (QueryAttackStrategySM() != Attack_t))
 			{
 				// choose a new destination
 				ChooseDestination();
@@ -570,7 +591,7 @@ static ES_Event DuringChooseDestination_t( ES_Event Event)
 				if ((Event.EventType == ES_TIMEOUT) && (Event.EventParam == POSITION_CHECK))
 				{
 					// If we have our position and we aren't attacking
-					if (IsAbsolutePosition() && (QueryAttackStrategySM() != Attack_t))
+					if (IsPositionKnown() && (QueryAttackStrategySM() != Attack_t))
 					{
 						// Choose a destination
 						ChooseDestination();
@@ -638,7 +659,11 @@ static ES_Event DuringTravel_t( ES_Event Event)
     {
         // implement any entry actions required for this state machine
 				ES_Event NewEvent;
+#if PATH_FOLLOWING
+				NewEvent.EventType = ES_FOLLOW_PATH;
+#else
 				NewEvent.EventType = ES_DRIVE_TO_TARGET;
+#endif
 				PostPositionLogicService(NewEvent);
 			
 			// Note: relative positioning was disabled for the competition version
@@ -682,6 +707,13 @@ static ES_Event DuringStationCapture_t( ES_Event Event)
     if ( (Event.EventType == ES_ENTRY) || (Event.EventType == ES_ENTRY_HISTORY) )
     {
         // implement any entry actions required for this state machine
+				// If we are already stopped, correct for any offset from the station now,
+				//  otherwise wait until our current move finishes
+				CenteredOnStation = !IsMoving();
+				if (CenteredOnStation && !CaptureRequestStarted())
+				{
+					CenterOnStation(GetStationOffset());
+				}
         
         // after that start any lower level machines that run in this state
         
@@ -814,6 +846,13 @@ static void ChooseDestination(void)
 	PostMasterSM(NewEvent);
 }
 
+// True once the capture has sent the station a request. Pivoting then would
+//  swing the sensors off the station partway through the exchange
+static bool CaptureRequestStarted(void)
+{
+	return (QueryPACLogicSM() == Capture_t) && (QueryCapturePSSM() != Measuring1_t);
+}
+
 // Return the current station target
 uint8_t GetTargetStation(void)
 {
@@ -847,5 +886,5 @@ void ResumePositioning(void)
 	UnlatchPeriscope();
 	
 	// start the periscope
-	SetPWM_Periscope(PERISCOPE_PWM_DUTY);
+	StartPeriscope();
 }
@@ -0,0 +1,255 @@
+/****************************************************************************
+ Module
+   Triangulate.c
+
+ Description
+		Finds our pose from the periscope angles to the beacons, in single
+		  precision on the Geometry kernel. The closed form works with the
+			SW corner as the origin (see explanation of math for more details),
+			then rotates and shifts the result for whichever three beacons it
+			was given. A few Gauss-Newton steps then refine that against the
+			angles to every beacon we have, allowing for how far we moved
+			between seeing them.
+****************************************************************************/
+
+#include <Math.h>
+#include <string.h>
+
+#include "ES_Configure.h"
+#include "ES_Framework.h"
+#include "DEFINITIONS.h"
+#include "Geometry.h"
+#include "Triangulate.h"
+
+/*----------------------------- Module Defines ----------------------------*/
+#define REFINE_ITERATIONS 4
+#define MAX_STEP_HALVINGS 6
+
+/*---------------------------- Module Functions ---------------------------*/
+static float Linearize(uint8_t beacons, const float *angles, const BeaconSighting *sightings,
+	const float *beaconX, const float *beaconY, float x, float y, float theta,
+	float JtJ[3][3], float JtR[3], uint8_t *numBeacons);
+static bool Solve3x3(float A[3][3], float b[3], float out[3]);
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     Triangulate_Triple
+
+ Parameters
+     A, B, C : periscope angles (degrees) to a beacon and the two before it
+		   going clockwise
+		 xShift, yShift, thetaShift : the rotation (degrees) and shift that take
+		   the SW corner solution to the field for this triple
+		 x, y, theta : where to put the pose (inches, degrees)
+
+ Description
+     Two beacons at the same angle give a NaN, which the caller must reject
+****************************************************************************/
+void Triangulate_Triple(float A, float B, float C, int xShift, int yShift, int thetaShift, float *x, float *y, float *theta)
+{
+	float BMinusC;
+	float AMinusB;
+	float gamma;
+	float delta;
+	float tempAngle;
+	float atan;
+	float myTempX;
+	float myTempY;
+	float myTempTheta;
+	
+	//Sines and cosines we need more than once
+	float sinBMinusC, cosBMinusC;
+	float sinAMinusB, cosAMinusB;
+	float sinTemp, cosTemp;
+	float sinGamma, cosGamma;
+	float sinDelta, cosDelta;
+	float sinShift, cosShift;
+	
+	//Perform Calculations with SW corner being used as the axis
+	BMinusC = Geo_WrapDegrees(B - C) * GEO_RADIANS_PER_DEGREE;
+	AMinusB = Geo_WrapDegrees(A - B) * GEO_RADIANS_PER_DEGREE;
+	Geo_SinCos(BMinusC, &sinBMinusC, &cosBMinusC);
+	Geo_SinCos(AMinusB, &sinAMinusB, &cosAMinusB);
+	
+	tempAngle = (1.5f * GEO_PI) - BMinusC - AMinusB;
+	Geo_SinCos(tempAngle, &sinTemp, &cosTemp);
+	
+	atan = atan2f(-sinTemp, (sinAMinusB/sinBMinusC) + cosTemp);
+	
+	gamma = (atan < 0) ? -atan : GEO_PI - atan;
+	delta = tempAngle - gamma;
+	Geo_SinCos(gamma, &sinGamma, &cosGamma);
+	Geo_SinCos(delta, &sinDelta, &cosDelta);
+	
+	// sin(PI - x) = sin(x), and sin(gamma + BMinusC) expands into terms we already have
+	myTempX = FIELD_LENGTH - (FIELD_LENGTH * sinGamma * (((sinGamma * cosBMinusC) + (cosGamma * sinBMinusC))/sinBMinusC));
+	myTempY = FIELD_LENGTH - (FIELD_LENGTH * sinDelta * (((sinDelta * cosAMinusB) + (cosDelta * sinAMinusB))/sinAMinusB));
+	
+	myTempTheta = Geo_WrapDegrees(((360 - B) * GEO_RADIANS_PER_DEGREE + gamma + BMinusC - (.5f * GEO_PI)) * GEO_DEGREES_PER_RADIAN);
+	
+	//Peform Rotations and Appropriate Shifts to account for any 3 beacons used
+	Geo_SinCos(thetaShift * GEO_RADIANS_PER_DEGREE, &sinShift, &cosShift);
+	*x = (myTempX*cosShift - myTempY*sinShift) + xShift;
+	*y = (myTempX*sinShift + myTempY*cosShift) + yShift;	
+	*theta = Geo_WrapDegrees(myTempTheta + thetaShift); 
+}
+
+/****************************************************************************
+ Function
+     Triangulate_Refine
+
+ Parameters
+     beacons : mask of the beacons to use (bit k = beacon k)
+		 angles : periscope angle (degrees) to each beacon, when we saw it
+		 sightings : how far we have moved since seeing each beacon
+		 beaconX, beaconY : where each beacon is (inches)
+		 x, y, theta : a starting pose, replaced by the refined one
+
+ Returns
+     the RMS disagreement between measured and predicted angles, in degrees
+
+ Description
+     The periscope sees beacon k at angle bearing(k) - theta, where bearing(k)
+		   is the direction from us to the beacon in field coordinates, both
+			 taken where we were when we saw it. With three beacons this only
+			 corrects for our moving; with four it is a least-squares fit, and the
+			 residual says whether the angles agree. Either way, a large residual
+			 also means the steps found no good fit from where they started.
+****************************************************************************/
+float Triangulate_Refine(uint8_t beacons, const float *angles, const BeaconSighting *sightings,
+	const float *beaconX, const float *beaconY, float *x, float *y, float *theta)
+{
+	float JtJ[3][3];
+	float JtR[3];
+	float step[3];
+	float sumSquares;
+	uint8_t numBeacons;
+	
+	sumSquares = Linearize(beacons, angles, sightings, beaconX, beaconY, *x, *y, *theta, JtJ, JtR, &numBeacons);
+	for (int iteration = 0; iteration < REFINE_ITERATIONS; iteration++)
+	{
+		float scale = 1.0f;
+		int tries;
+		
+		if (!Solve3x3(JtJ, JtR, step))
+		{
+			break;
+		}
+		
+		// Far from the answer a full step can overshoot, so shorten it until
+		//  the angles agree better than they did
+		for (tries = 0; tries < MAX_STEP_HALVINGS; tries++, scale *= 0.5f)
+		{
+			float trialJtJ[3][3];
+			float trialJtR[3];
+			float trialX = *x + (scale * step[0]);
+			float trialY = *y + (scale * step[1]);
+			float trialTheta = Geo_WrapDegrees(*theta + (scale * step[2] * GEO_DEGREES_PER_RADIAN));
+			float trialSquares = Linearize(beacons, angles, sightings, beaconX, beaconY, trialX, trialY, trialTheta,
+				trialJtJ, trialJtR, &numBeacons);
+			
+			if (trialSquares < sumSquares)
+			{
+				*x = trialX;
+				*y = trialY;
+				*theta = trialTheta;
+				sumSquares = trialSquares;
+				memcpy(JtJ, trialJtJ, sizeof(JtJ));
+				memcpy(JtR, trialJtR, sizeof(JtR));
+				break;
+			}
+		}
+		
+		// No step helps, so we are as close as we will get
+		if (tries == MAX_STEP_HALVINGS)
+		{
+			break;
+		}
+	}
+	
+	return (numBeacons == 0) ? 0 : (sqrtf(sumSquares / numBeacons) * GEO_DEGREES_PER_RADIAN);
+}
+
+// Linearize the angles to the given beacons about a pose: fills in J'J and
+// J'r for the Gauss-Newton step, and returns the sum of the squared angle
+// errors (radians)
+static float Linearize(uint8_t beacons, const float *angles, const BeaconSighting *sightings,
+	const float *beaconX, const float *beaconY, float x, float y, float theta,
+	float JtJ[3][3], float JtR[3], uint8_t *numBeacons)
+{
+	float sinTheta, cosTheta;
+	float sumSquares = 0;
+	
+	for (int row = 0; row < 3; row++)
+	{
+		JtR[row] = 0;
+		for (int col = 0; col < 3; col++)
+		{
+			JtJ[row][col] = 0;
+		}
+	}
+	*numBeacons = 0;
+	Geo_SinCos(theta * GEO_RADIANS_PER_DEGREE, &sinTheta, &cosTheta);
+	
+	for (int k = 0; k < TRIANGULATE_BEACONS; k++)
+	{
+		if (!(beacons & (1 << k)))
+		{
+			continue;
+		}
+		
+		// How far we have moved since, in field coordinates
+		float movedX = (sightings[k].forward * cosTheta) - (sightings[k].left * sinTheta);
+		float movedY = (sightings[k].forward * sinTheta) + (sightings[k].left * cosTheta);
+		
+		float dx = beaconX[k] - (x - movedX);
+		float dy = beaconY[k] - (y - movedY);
+		float distanceSquared = (dx * dx) + (dy * dy);
+		float predicted = (atan2f(dy, dx) * GEO_DEGREES_PER_RADIAN) - (theta - sightings[k].turned);
+		
+		// angle error in radians, wrapped to [-PI, PI)
+		float r = (Geo_WrapDegrees(angles[k] - predicted + 180.0f) - 180.0f) * GEO_RADIANS_PER_DEGREE;
+		
+		// derivatives of the predicted angle with respect to x, y and theta (radians).
+		// Turning us now also swings where we were about where we are
+		float J[3] = {dy / distanceSquared, -dx / distanceSquared, 0};
+		J[2] = (J[0] * movedY) - (J[1] * movedX) - 1.0f;
+		
+		for (int row = 0; row < 3; row++)
+		{
+			JtR[row] += J[row] * r;
+			for (int col = 0; col < 3; col++)
+			{
+				JtJ[row][col] += J[row] * J[col];
+			}
+		}
+		sumSquares += r * r;
+		(*numBeacons)++;
+	}
+	return sumSquares;
+}
+
+// Solve A * out = b for a 3x3 system by Cramer's rule. Returns false if A is singular
+static bool Solve3x3(float A[3][3], float b[3], float out[3])
+{
+	float det = (A[0][0] * ((A[1][1] * A[2][2]) - (A[1][2] * A[2][1])))
+						- (A[0][1] * ((A[1][0] * A[2][2]) - (A[1][2] * A[2][0])))
+						+ (A[0][2] * ((A[1][0] * A[2][1]) - (A[1][1] * A[2][0])));
+	
+	if (fabsf(det) < 1e-12f)
+	{
+		return false;
+	}
+	
+	out[0] = ((b[0] * ((A[1][1] * A[2][2]) - (A[1][2] * A[2][1])))
+					- (A[0][1] * ((b[1] * A[2][2]) - (A[1][2] * b[2])))
+					+ (A[0][2] * ((b[1] * A[2][1]) - (A[1][1] * b[2])))) / det;
+	out[1] = ((A[0][0] * ((b[1] * A[2][2]) - (A[1][2] * b[2])))
+					- (b[0] * ((A[1][0] * A[2][2]) - (A[1][2] * A[2][0])))
+					+ (A[0][2] * ((A[1][0] * b[2]) - (b[1] * A[2][0])))) / det;
+	out[2] = ((A[0][0] * ((A[1][1] * b[2]) - (b[1] * A[2][1])))
+					- (A[0][1] * ((A[1][0] * b[2]) - (b[1] * A[2][0])))
+					+ (b[0] * ((A[1][0] * A[2][1]) - (A[1][1] * A[2][0])))) / det;
+	return true;
+}
@@ -0,0 +1,139 @@
+/****************************************************************************
+ Module
+   VelocityEstimate.c
+
+ Description
+		Encoder speed from a ring of recent edge times (the M/T method). The
+		  encoder interrupt just records each edge's capture time. The control
+			loop then counts back over as many edges as fit in a window and
+			divides their count by the exact time they span. At low speed that
+			is the period between the last two edges. At speed it averages over
+			several, which evens out uneven magnet spacing (a whole motor turn's
+			worth cancels it exactly) without the latency of a fixed gate time.
+			Each estimate also checks how long ago the last edge was: once that
+			is longer than the measured period the wheel must have slowed, so we
+			report no more than one edge per that long, and nothing at all once
+			the edges are stale. A stopping wheel reads down to zero by itself,
+			without waiting for a stopped timer to clear its period.
+****************************************************************************/
+
+#include "ES_Configure.h"
+#include "ES_Framework.h"
+#include "VelocityEstimate.h"
+
+/*------------------------------ Module Code ------------------------------*/
+/****************************************************************************
+ Function
+     VelocityEstimate_Init
+
+ Parameters
+     estimate : the estimator to set up
+		 numerator : RPM * period, for a period in capture ticks
+		 headroom : bits the numerator can be shifted left (see FixedPID_Ratio)
+		 maxIntervals : most edge intervals to average over
+		 window : longest span to average over, in capture ticks
+		 stale : capture ticks without an edge before we call it stopped
+****************************************************************************/
+void VelocityEstimate_Init(VelocityEstimate *estimate, uint32_t numerator, uint8_t headroom, uint8_t maxIntervals, uint32_t window, uint32_t stale)
+{
+	estimate->numerator = numerator;
+	estimate->headroom = headroom;
+	estimate->maxIntervals = (maxIntervals > (VELOCITY_RING_SIZE - 2)) ? (VELOCITY_RING_SIZE - 2) : maxIntervals;
+	estimate->window = window;
+	estimate->stale = stale;
+	VelocityEstimate_Reset(estimate);
+}
+
+/****************************************************************************
+ Function
+     VelocityEstimate_Reset
+
+ Description
+     Forgets the recorded edges, so we read zero until two more come in
+****************************************************************************/
+void VelocityEstimate_Reset(VelocityEstimate *estimate)
+{
+	estimate->numEdges = 0;
+}
+
+/****************************************************************************
+ Function
+     VelocityEstimate_Edge
+
+ Parameters
+     estimate : the estimator for this encoder
+		 capture : the edge's capture time
+
+ Description
+     Records an edge. Call it from the encoder interrupt
+****************************************************************************/
+void VelocityEstimate_Edge(VelocityEstimate *estimate, uint32_t capture)
+{
+	// Store the time before counting the edge, so a reader never sees an
+	// edge without its time
+	estimate->times[estimate->numEdges & VELOCITY_RING_MASK] = capture;
+	estimate->numEdges++;
+}
+
+/****************************************************************************
+ Function
+     VelocityEstimate_RPM
+
+ Parameters
+     estimate : the estimator for this encoder
+		 now : the current value of the encoder's capture timer
+
+ Returns
+     the speed in Q16 RPM, or 0 if stopped
+
+ Description
+     Safe to call while the encoder interrupt is recording edges. We only
+		   read back as far as VELOCITY_RING_SIZE - 1 edges, so one more edge
+			 arriving while we work can't overwrite one we are using.
+****************************************************************************/
+q16_t VelocityEstimate_RPM(const VelocityEstimate *estimate, uint32_t now)
+{
+	uint32_t numEdges = estimate->numEdges;
+	uint32_t newest;
+	uint32_t age;
+	uint32_t span;
+	uint32_t period;
+	uint8_t intervals = 1;
+
+	// Not enough edges to time
+	if (numEdges < 2)
+	{
+		return 0;
+	}
+
+	// An edge after we read the time is as fresh as it gets
+	newest = estimate->times[(numEdges - 1) & VELOCITY_RING_MASK];
+	age = ((int32_t) (now - newest) < 0) ? 0 : (now - newest);
+	if (age >= estimate->stale)
+	{
+		return 0;
+	}
+
+	// Take as many edge intervals as fit in the window, but at least one
+	span = newest - estimate->times[(numEdges - 2) & VELOCITY_RING_MASK];
+	while ((intervals < estimate->maxIntervals) && ((uint32_t) intervals + 1 < numEdges))
+	{
+		uint32_t longer = newest - estimate->times[(numEdges - 2 - intervals) & VELOCITY_RING_MASK];
+		if (longer > estimate->window)
+		{
+			break;
+		}
+		span = longer;
+		intervals++;
+	}
+	period = span / intervals;
+
+	// No edge for longer than the period means we are slowing down, and can be
+	// going no faster than one edge in that long
+	if (age > period)
+	{
+		period = age;
+	}
+
+	return FixedPID_Ratio(estimate->numerator, period, estimate->headroom);
+}
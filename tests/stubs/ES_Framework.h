@@ -0,0 +1,14 @@
+// Host stand-in for the ES framework: the tested modules only need its types,
+// and critical sections, which the single-threaded tests don't need
+#ifndef ES_FRAMEWORK_H
+#define ES_FRAMEWORK_H
+
+#include "ES_Types.h"
+
+#define EnterCritical()
+#define ExitCritical()
+
+// Defined by the tests that need it
+uint16_t ES_Timer_GetTime(void);
+
+#endif
@@ -0,0 +1,2 @@
+// The Keil headers are case-insensitive; the host's aren't
+#include <math.h>
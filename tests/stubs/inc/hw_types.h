@@ -0,0 +1 @@
+// Host stand-in: DEFINITIONS.h includes this, but the tested modules use none of it
@@ -0,0 +1,13 @@
+// Minimal checks for the host tests: each failure is printed, and the test
+// exits non-zero if there were any
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+
+static int Failures = 0;
+
+#define CHECK(cond, ...) do { if (!(cond)) { Failures++; printf("%s:%d: ", __FILE__, __LINE__); printf(__VA_ARGS__); printf("\n"); } } while (0)
+#define TEST_RESULT() (printf("%s\n", Failures ? "FAILED" : "passed"), Failures != 0)
+
+#endif
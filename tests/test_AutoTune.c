@@ -0,0 +1,287 @@
+/****************************************************************************
+ Host test of AutoTune.c: fits of exact first order plus dead time
+ responses, the responses it must refuse, and step tests of simulated drive
+ wheels run as DriveTrainControl_Service.c runs them. The gains it works out
+ for those wheels must step their speed with much less overshoot than the
+ hand-tuned gains, and settle sooner on average.
+****************************************************************************/
+#include <math.h>
+#include "DEFINITIONS.h"
+#include "AutoTune.h"
+#include "FixedPID.h"
+#include "VelocityEstimate.h"
+#include "test.h"
+
+#define STEP 1e-5						// seconds
+#define TICKS_PER_SEC 40000000.0
+#define TICKS_PER_REV (DRIVE_GEAR_RATIO * ENCODER_PULSES_PER_REV)
+#define SETTLE_TIME 0.5			// seconds at the low duty before logging
+#define STEP_TIME 1.0				// seconds at each speed
+#define SETTLED_SHARE 0.05	// within this share of the target counts as settled
+
+// As in DriveTrainControl_Service.c
+#define P_GAIN 1.32f
+#define I_GAIN .15f
+#define DUTY_MAX 100
+#define RPM_NUMERATOR (40000ul * 60 * 1000 / TICKS_PER_REV)
+#define RPM_HEADROOM 8
+#define AUTOTUNE_LOW_DUTY 25
+#define AUTOTUNE_HIGH_DUTY 75
+#define AUTOTUNE_PERIODS_PER_SAMPLE 4
+#define AUTOTUNE_CLOSED_LOOP_RATIO 0.2f
+#define CONTROL_PERIOD_S (DRIVE_CONTROL_INTERRUPT_PERIOD / 1000000.0f)
+
+// Each magnet's share of the mean angle between them
+static const double Spacing[ENCODER_PULSES_PER_REV] = {1.04, 0.97, 1.02, 0.95, 1.02};
+
+static const double Targets[] = {40, 100, 60, 130, 40, 100, 60, 130, 80};
+#define NUM_TARGETS (sizeof(Targets) / sizeof(Targets[0]))
+
+// One wheel: RPM per duty above its dead band, time constant (s), the duty
+// it takes to get it turning, and the duty its load takes on top
+typedef struct {
+	double gain;
+	double timeConstant;
+	double deadBand;
+	double load;
+} Wheel;
+
+// The simulated wheel and its encoder
+typedef struct {
+	const Wheel *wheel;
+	VelocityEstimate estimate;
+	double speed;
+	double position;
+	double nextEdge;
+	unsigned edges;
+} Sim;
+
+static void startSim(Sim *sim, const Wheel *wheel)
+{
+	sim->wheel = wheel;
+	VelocityEstimate_Init(&sim->estimate, RPM_NUMERATOR, RPM_HEADROOM, ENCODER_PULSES_PER_REV, 12 * 40000ul, 100 * 40000ul);
+	sim->speed = 0;
+	sim->position = 0;
+	sim->nextEdge = Spacing[0];
+	sim->edges = 0;
+}
+
+static void stepSim(Sim *sim, double duty, double t)
+{
+	double driving = fmax(duty - sim->wheel->deadBand - sim->wheel->load, 0);
+
+	sim->speed += (sim->wheel->gain * driving - sim->speed) / sim->wheel->timeConstant * STEP;
+	sim->speed = fmax(sim->speed, 0);
+	sim->position += sim->speed / 60 * TICKS_PER_REV * STEP;
+	if (sim->position >= sim->nextEdge)
+	{
+		VelocityEstimate_Edge(&sim->estimate, (uint32_t) (t * TICKS_PER_SEC));
+		sim->edges++;
+		sim->nextEdge += Spacing[sim->edges % ENCODER_PULSES_PER_REV];
+	}
+}
+
+static q16_t readSim(Sim *sim, double t)
+{
+	return VelocityEstimate_RPM(&sim->estimate, (uint32_t) (t * TICKS_PER_SEC));
+}
+
+// Logs a step test of an exact first order plus dead time response with the
+// given gain (RPM per duty), time constant and dead time (s), plus a jump
+// (RPM) the moment the duty steps
+static void logResponse(AutoTuneStep *step, double gain, double timeConstant, double deadTime, double jump)
+{
+	double low = gain * AUTOTUNE_LOW_DUTY;
+	double change = gain * (AUTOTUNE_HIGH_DUTY - AUTOTUNE_LOW_DUTY);
+	int period;
+
+	AutoTune_Start(step, AUTOTUNE_LOW_DUTY, AUTOTUNE_HIGH_DUTY, AUTOTUNE_PERIODS_PER_SAMPLE);
+	AutoTune_StartLogging(step);
+	for (period = 0; !AutoTune_Done(step); period++)
+	{
+		// Each period reads the speed at its end, one period after the duty
+		// we set at its start
+		double sinceStep = (period + 1 - AUTOTUNE_PRESTEP * AUTOTUNE_PERIODS_PER_SAMPLE) * CONTROL_PERIOD_S;
+		double speed = low;
+
+		if (sinceStep > 0)
+		{
+			speed += jump;
+		}
+		if (sinceStep > deadTime)
+		{
+			speed += (change - jump) * (1 - exp(-(sinceStep - deadTime) / timeConstant));
+		}
+		AutoTune_Sample(step, FLOAT_TO_Q16(speed));
+	}
+}
+
+// Time constants the log covers five times over
+static void testFit(void)
+{
+	static const double TimeConstants[] = {0.04, 0.06, 0.08};
+	static const double DeadTimes[] = {0.005, 0.01, 0.02};
+	unsigned i, j;
+
+	for (i = 0; i < sizeof(TimeConstants) / sizeof(TimeConstants[0]); i++)
+	{
+		for (j = 0; j < sizeof(DeadTimes) / sizeof(DeadTimes[0]); j++)
+		{
+			AutoTuneStep step;
+			PlantModel plant;
+
+			logResponse(&step, 1.7, TimeConstants[i], DeadTimes[j], 0);
+			CHECK(AutoTune_Fit(&step, CONTROL_PERIOD_S, &plant), "no fit for time constant %g s, dead time %g s", TimeConstants[i], DeadTimes[j]);
+			CHECK(fabs(plant.gain - 1.7) < 0.02 * 1.7, "fitted a gain of %g, not 1.7", plant.gain);
+			CHECK(fabs(plant.timeConstant - TimeConstants[i]) < 0.1 * TimeConstants[i], "fitted a time constant of %g s, not %g s",
+				plant.timeConstant, TimeConstants[i]);
+			CHECK(fabs(plant.deadTime - DeadTimes[j]) < 2 * CONTROL_PERIOD_S, "fitted a dead time of %g s, not %g s", plant.deadTime, DeadTimes[j]);
+		}
+	}
+}
+
+// Responses that don't give a model we could tune from, leaving the plant
+// as it was
+static void testRefusals(void)
+{
+	AutoTuneStep step;
+	PlantModel plant = {-1, -1, -1};
+
+	logResponse(&step, 0, 0.08, 0.01, 0);
+	CHECK(!AutoTune_Fit(&step, CONTROL_PERIOD_S, &plant), "a motor that didn't speed up was fitted");
+	logResponse(&step, 1.7, 1.0, 0.01, 0);
+	CHECK(!AutoTune_Fit(&step, CONTROL_PERIOD_S, &plant), "a motor that hadn't settled was fitted");
+	// A speed that jumps a third of the way at once, as a glitch or a slipping
+	// wheel gives, puts the dead time below zero
+	logResponse(&step, 1.7, 0.08, 0, 1.7 * (AUTOTUNE_HIGH_DUTY - AUTOTUNE_LOW_DUTY) / 3);
+	CHECK(!AutoTune_Fit(&step, CONTROL_PERIOD_S, &plant), "a response that leads its step was fitted");
+	logResponse(&step, 1.7, 0.08, 0.01, 0);
+	step.logged = AUTOTUNE_SAMPLES - 1;
+	CHECK(!AutoTune_Fit(&step, CONTROL_PERIOD_S, &plant), "an unfinished log was fitted");
+	CHECK((plant.gain == -1) && (plant.timeConstant == -1) && (plant.deadTime == -1), "a refused fit changed the model");
+}
+
+// A step test of the wheel, as the drive runs one
+static bool identify(const Wheel *wheel, PlantModel *plant)
+{
+	AutoTuneStep step;
+	Sim sim;
+	double nextControl = 0;
+	double duty = 0;
+	double t;
+
+	startSim(&sim, wheel);
+	AutoTune_Start(&step, AUTOTUNE_LOW_DUTY, AUTOTUNE_HIGH_DUTY, AUTOTUNE_PERIODS_PER_SAMPLE);
+	for (t = 0; !AutoTune_Done(&step); t += STEP)
+	{
+		if ((t >= SETTLE_TIME) && !step.logging)
+		{
+			AutoTune_StartLogging(&step);
+		}
+		if (t >= nextControl)
+		{
+			nextControl += CONTROL_PERIOD_S;
+			AutoTune_Sample(&step, readSim(&sim, t));
+			duty = AutoTune_Duty(&step);
+		}
+		stepSim(&sim, duty, t);
+	}
+	return AutoTune_Fit(&step, CONTROL_PERIOD_S, plant);
+}
+
+// Steps through Targets under the drive's speed loop (without its map) with
+// the given gains. Fills in the mean and worst ms to settle on each new
+// target, and the most RPM a rise overshot by
+static void steps(const Wheel *wheel, float p, float i, double *mean, double *worst, double *overshoot)
+{
+	PIDGains gains = {FLOAT_TO_QGAIN(p), FLOAT_TO_QGAIN(p * i), 0, false};
+	PIDState pid;
+	Sim sim;
+	double nextControl = 0;
+	double duty = 0;
+	double t = 0;
+	unsigned n;
+
+	startSim(&sim, wheel);
+	FixedPID_Init(&pid, 0, FLOAT_TO_Q16(p * DUTY_MAX), 0, INT_TO_Q16(DUTY_MAX));
+	*mean = 0;
+	*worst = 0;
+	*overshoot = 0;
+	for (n = 0; n < NUM_TARGETS; n++)
+	{
+		q16_t target = FLOAT_TO_Q16(Targets[n]);
+		double start = t;
+		double lastOut = t;
+
+		FixedPID_Reset(&pid);
+		for (; t < start + STEP_TIME; t += STEP)
+		{
+			if (t >= nextControl)
+			{
+				nextControl += CONTROL_PERIOD_S;
+				duty = Q16_TO_INT(FixedPID_Update(&pid, &gains, target - readSim(&sim, t)));
+			}
+			if (fabs(sim.speed - Targets[n]) > SETTLED_SHARE * Targets[n])
+			{
+				lastOut = t;
+			}
+			if ((n > 0) && (Targets[n] > Targets[n - 1]))
+			{
+				*overshoot = fmax(*overshoot, sim.speed - Targets[n]);
+			}
+			stepSim(&sim, duty, t);
+		}
+		// The first target is a start from rest, not a step
+		if (n > 0)
+		{
+			*mean += (lastOut - start) * 1000 / (NUM_TARGETS - 1);
+			*worst = fmax(*worst, (lastOut - start) * 1000);
+		}
+	}
+}
+
+static void testDrive(void)
+{
+	static const Wheel Wheels[] = {{1.7, 0.08, 6, 0}, {1.7, 0.08, 6, 4}, {1.7 * 0.85, 0.08, 6, 4}, {1.7, 0.15, 6, 4}};
+	static const char *Names[] = {"bench", "ground", "ground, 15% sag", "heavy"};
+	unsigned i;
+
+	for (i = 0; i < sizeof(Wheels) / sizeof(Wheels[0]); i++)
+	{
+		PlantModel plant;
+		double handMean, handWorst, handOvershoot;
+		double tunedMean, tunedWorst, tunedOvershoot;
+		float kp, ki;
+
+		if (!identify(&Wheels[i], &plant))
+		{
+			CHECK(false, "no fit for the %s wheel", Names[i]);
+			continue;
+		}
+		AutoTune_PIGains(&plant, AUTOTUNE_CLOSED_LOOP_RATIO, CONTROL_PERIOD_S, &kp, &ki);
+		steps(&Wheels[i], P_GAIN, I_GAIN, &handMean, &handWorst, &handOvershoot);
+		// Our law's integral is scaled by P
+		steps(&Wheels[i], kp, ki / kp, &tunedMean, &tunedWorst, &tunedOvershoot);
+
+		printf("%-16s %.3f RPM/duty, %.3f s, dead %.4f s -> P %.3f I %.4f\n", Names[i], plant.gain, plant.timeConstant, plant.deadTime, kp, ki / kp);
+		printf("%-16s hand: settle mean %3.0f worst %3.0f ms, overshoot %4.1f RPM; tuned: %3.0f, %3.0f ms, %4.1f RPM\n",
+			"", handMean, handWorst, handOvershoot, tunedMean, tunedWorst, tunedOvershoot);
+		// A heavy wheel hasn't quite settled by the end of the log, so reads a
+		// little slow
+		CHECK(fabs(plant.gain - Wheels[i].gain) < 0.1 * Wheels[i].gain, "the %s wheel fitted %g RPM per duty, not %g",
+			Names[i], plant.gain, Wheels[i].gain);
+		CHECK(fabs(plant.timeConstant - Wheels[i].timeConstant) < 0.2 * Wheels[i].timeConstant, "the %s wheel fitted a time constant of %g s, not %g s",
+			Names[i], plant.timeConstant, Wheels[i].timeConstant);
+		CHECK(plant.deadTime < 0.02, "the %s wheel fitted a dead time of %g s", Names[i], plant.deadTime);
+		CHECK(tunedOvershoot * 2 < handOvershoot, "the %s wheel overshot %g RPM tuned, %g RPM by hand", Names[i], tunedOvershoot, handOvershoot);
+		CHECK(tunedMean < handMean, "the %s wheel settled in %g ms tuned, %g ms by hand", Names[i], tunedMean, handMean);
+	}
+}
+
+int main(void)
+{
+	testFit();
+	testRefusals();
+	testDrive();
+	return TEST_RESULT();
+}
@@ -0,0 +1,131 @@
+/****************************************************************************
+ Host test of BearingEstimate.c: beacons straddling the 0/360 wrap, long
+ passes that fill the sample store, and noisy passes with stray pulses.
+****************************************************************************/
+#include <math.h>
+#include <stdlib.h>
+#include "BearingEstimate.h"
+#include "test.h"
+
+#define PASSES 20000
+#define PULSE_NOISE 0.1		// degrees, 1 sigma
+
+static double gauss(void)
+{
+	double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+	double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+	return sqrt(-2 * log(u)) * cos(2 * 3.14159265358979 * v);
+}
+
+// Degrees from b to a, in [-180, 180)
+static double angleBetween(double a, double b)
+{
+	return fmod(a - b + 540.0, 360.0) - 180.0;
+}
+
+// Pulses spread evenly over a beacon 6 degrees wide
+static void addBeacon(BearingSamples *samples, double center, int pulses)
+{
+	int i;
+
+	Bearing_Reset(samples);
+	for (i = 0; i < pulses; i++)
+	{
+		Bearing_Add(samples, (float) fmod(center - 3 + 6.0 * i / (pulses - 1) + 360, 360));
+	}
+}
+
+static void testWrap(void)
+{
+	static const double Centers[] = {0, 0.5, 359.5, 1.9, 358.1};
+	BearingSamples samples;
+	float angle, quality;
+	unsigned i;
+
+	for (i = 0; i < sizeof(Centers) / sizeof(Centers[0]); i++)
+	{
+		addBeacon(&samples, Centers[i], 13);
+		CHECK(Bearing_Estimate(&samples, &angle, &quality), "no estimate at %g deg", Centers[i]);
+		CHECK(fabs(angleBetween(angle, Centers[i])) < 0.05, "beacon at %g deg read %g deg", Centers[i], angle);
+		CHECK(quality == 1.0f, "beacon at %g deg had quality %g", Centers[i], quality);
+		CHECK((angle >= 0) && (angle < 360), "beacon at %g deg read %g deg, out of range", Centers[i], angle);
+	}
+}
+
+// More pulses than the store holds, as at a slow sweep
+static void testLongPass(void)
+{
+	BearingSamples samples;
+	float angle, quality;
+
+	addBeacon(&samples, 359, 200);
+	CHECK(samples.count <= BEARING_MAX_SAMPLES, "stored %d samples", samples.count);
+	CHECK(samples.total == 200, "counted %d pulses", samples.total);
+	CHECK(Bearing_Estimate(&samples, &angle, &quality), "no estimate from a long pass");
+	CHECK(fabs(angleBetween(angle, 359)) < 0.25, "long pass at 359 deg read %g deg", angle);
+
+	Bearing_Reset(&samples);
+	CHECK(!Bearing_Estimate(&samples, &angle, &quality), "no samples should give no estimate");
+}
+
+// RMS error over passes of 6-20 pulses with a share replaced by stray pulses
+// 8-38 degrees off, and the same for a plain mean of the pulses
+static void noisyPasses(double outliers, double *rms, double *meanRms)
+{
+	double squares = 0;
+	double meanSquares = 0;
+	int pass;
+
+	srand(3);
+	for (pass = 0; pass < PASSES; pass++)
+	{
+		BearingSamples samples;
+		double center = 20 + 320 * (rand() / (double) RAND_MAX);
+		int pulses = 6 + rand() % 15;
+		double sum = 0;
+		float angle, quality;
+		int i;
+
+		Bearing_Reset(&samples);
+		for (i = 0; i < pulses; i++)
+		{
+			double pulse = center - 3 + 6.0 * i / (pulses - 1) + PULSE_NOISE * gauss();
+
+			if (rand() / (double) RAND_MAX < outliers)
+			{
+				pulse += ((rand() & 1) ? 1 : -1) * (8 + 30 * (rand() / (double) RAND_MAX));
+			}
+			Bearing_Add(&samples, (float) pulse);
+			sum += pulse;
+		}
+		Bearing_Estimate(&samples, &angle, &quality);
+		squares += angleBetween(angle, center) * angleBetween(angle, center);
+		meanSquares += (sum / pulses - center) * (sum / pulses - center);
+	}
+	*rms = sqrt(squares / PASSES);
+	*meanRms = sqrt(meanSquares / PASSES);
+}
+
+static void testOutliers(void)
+{
+	static const double Shares[] = {0, 0.05, 0.1, 0.2};
+	static const double Limits[] = {0.1, 0.3, 0.5, 1.2};
+	unsigned i;
+
+	for (i = 0; i < sizeof(Shares) / sizeof(Shares[0]); i++)
+	{
+		double rms, meanRms;
+
+		noisyPasses(Shares[i], &rms, &meanRms);
+		printf("%2.0f%% stray pulses: RMS error %.3f deg (plain mean %.3f deg)\n", Shares[i] * 100, rms, meanRms);
+		CHECK(rms < Limits[i], "%g%% stray pulses: RMS error %g deg", Shares[i] * 100, rms);
+	}
+}
+
+int main(void)
+{
+	testWrap();
+	testLongPass();
+	testOutliers();
+	return TEST_RESULT();
+}
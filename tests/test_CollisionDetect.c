@@ -0,0 +1,255 @@
+/****************************************************************************
+ Host test of CollisionDetect.c on a simulated drive wheel, run as the drive
+ runs it (DriveTrainControl_Service.c): the velocity estimate, a profiled
+ move, the feed-forward map plus speed loop, and the detector's model looked
+ up in that map. Each wheel is randomised, and its map is the one a
+ calibration sweep would measure on it.
+****************************************************************************/
+#include <math.h>
+#include <stdlib.h>
+#include "DEFINITIONS.h"
+#include "CollisionDetect.h"
+#include "FeedForward.h"
+#include "FixedPID.h"
+#include "MotionProfile.h"
+#include "VelocityEstimate.h"
+#include "test.h"
+
+#define TRIALS 200
+#define STEP 1e-5						// seconds
+#define TICKS_PER_SEC 40000000.0
+#define TICKS_PER_REV (DRIVE_GEAR_RATIO * ENCODER_PULSES_PER_REV)
+#define CONTROL_PERIOD (DRIVE_CONTROL_INTERRUPT_PERIOD / 1000000.0)
+
+// As in DriveTrainControl_Service.c
+#define P_GAIN 1.32f
+#define I_GAIN .15f
+#define DUTY_MAX 100
+#define RPM_NUMERATOR (40000ul * 60 * 1000 / TICKS_PER_REV)
+#define RPM_HEADROOM 8
+#define FEEDFORWARD_INTEGRAL 10
+#define FEEDFORWARD_SETTLED_RPM 5
+#define FEEDFORWARD_TRIM_RATE 1.7e-5f
+#define COLLISION_MARGIN 0.4f
+#define COLLISION_OFFSET_RPM 20.0f
+#define COLLISION_RISE_RPM 3.0f
+#define COLLISION_MIN_DUTY 15
+#define COLLISION_PERIODS 5
+
+// Each magnet's share of the mean angle between them
+static const double Spacing[ENCODER_PULSES_PER_REV] = {1.04, 0.97, 1.02, 0.95, 1.02};
+
+static const MotionLimits Limits = MOTION_LIMITS(PROFILE_MAX_RPM, PROFILE_MIN_RPM, PROFILE_ACCELERATION,
+	PROFILE_JERK, PROFILE_STOP_ACCELERATION, PROFILE_POSITION_GAIN, DRIVE_CONTROL_INTERRUPT_PERIOD, TICKS_PER_REV);
+static const CollisionModel Model = COLLISION_MODEL(DRIVE_TIME_CONSTANT_MS, DRIVE_CONTROL_INTERRUPT_PERIOD,
+	COLLISION_MARGIN, COLLISION_OFFSET_RPM, COLLISION_RISE_RPM, COLLISION_MIN_DUTY, COLLISION_PERIODS);
+
+typedef enum { NO_HIT, WALL, HEAVY_LOAD } Hit;
+
+// One wheel: RPM per duty, time constant (s) and friction while coasting (RPM/s)
+typedef struct {
+	double gain;
+	double timeConstant;
+	double friction;
+} Wheel;
+
+static double uniform(double low, double high)
+{
+	return low + (high - low) * rand() / (double) RAND_MAX;
+}
+
+// The map a calibration sweep would measure on the wheel
+static void calibrate(FeedForwardMap *map, const Wheel *wheel)
+{
+	FeedForwardPoint points[2] = {{0, 0}, {DUTY_MAX, 0}};
+
+	points[1].rpm = (uint16_t) (DUTY_MAX * wheel->gain);
+	FeedForward_Init(map, points, 2, FLOAT_TO_QGAIN(FEEDFORWARD_TRIM_RATE));
+}
+
+// Drives a move of target ticks, with hit starting at hitTime, or eight 30 ms
+// bumps at 35% of stall torque at random times if bumps. Returns the seconds
+// from the hit until we reported a collision, or -1 if we didn't. Sets
+// *falseAlarm if we reported one with nothing there
+static double drive(const Wheel *wheel, uint32_t target, Hit hit, double hitTime, bool bumps, bool *falseAlarm)
+{
+	static const PIDGains Gains = {FLOAT_TO_QGAIN(P_GAIN), FLOAT_TO_QGAIN(P_GAIN * I_GAIN), 0, false};
+	FeedForwardMap map;
+	CollisionState detector;
+	VelocityEstimate estimate;
+	PIDState pid;
+	MotionProfile profile;
+	double bumpTimes[8];
+	double speed = 0;
+	double position = 0;
+	double nextEdge = Spacing[0];
+	double nextControl = 0;
+	uint32_t ticks = 0;
+	uint8_t duty = 0;
+	double t;
+	int i;
+
+	calibrate(&map, wheel);
+	CollisionDetect_Reset(&detector);
+	VelocityEstimate_Init(&estimate, RPM_NUMERATOR, RPM_HEADROOM, ENCODER_PULSES_PER_REV, 12 * 40000ul, 100 * 40000ul);
+	FixedPID_Init(&pid, INT_TO_Q16(-FEEDFORWARD_INTEGRAL), INT_TO_Q16(FEEDFORWARD_INTEGRAL), INT_TO_Q16(-DUTY_MAX), INT_TO_Q16(DUTY_MAX));
+	MotionProfile_Reset(&profile);
+	for (i = 0; i < 8; i++)
+	{
+		bumpTimes[i] = bumps ? uniform(0.05, 3) : 1e9;
+	}
+	*falseAlarm = false;
+
+	for (t = 0; t < 4; t += STEP)
+	{
+		double load = 0;
+
+		if (t >= nextControl)
+		{
+			q16_t setpoint = MotionProfile_Step(&profile, &Limits, (ticks < target) ? (target - ticks) : 0);
+			q16_t rpm = VelocityEstimate_RPM(&estimate, (uint32_t) (t * TICKS_PER_SEC));
+			q16_t error = setpoint - rpm;
+			q16_t requested = FixedPID_Update(&pid, &Gains, error) + FeedForward_Duty(&map, setpoint);
+
+			nextControl += CONTROL_PERIOD;
+			requested = (requested > INT_TO_Q16(DUTY_MAX)) ? INT_TO_Q16(DUTY_MAX) : ((requested < 0) ? 0 : requested);
+			if ((setpoint != 0) && (requested < INT_TO_Q16(DUTY_MAX)) && (Q16_ABS(error) < INT_TO_Q16(FEEDFORWARD_SETTLED_RPM)))
+			{
+				FeedForward_Trim(&map, pid.integral);
+			}
+			duty = (setpoint == 0) ? 0 : (uint8_t) Q16_TO_INT(requested);
+
+			if (CollisionDetect_Update(&detector, &Model, duty, FeedForward_RPM(&map, INT_TO_Q16(duty)), true, rpm))
+			{
+				if ((hit != NO_HIT) && (t >= hitTime))
+				{
+					return t - hitTime;
+				}
+				*falseAlarm = true;
+				return -1;
+			}
+			if ((hit == NO_HIT) && (ticks >= target) && (speed < 0.5))
+			{
+				return -1;
+			}
+		}
+
+		// Bumps and a heavy load as fractions of the torque that stalls the
+		// wheel at full duty; a wall stops it within about 5 ms
+		for (i = 0; i < 8; i++)
+		{
+			if ((t >= bumpTimes[i]) && (t < bumpTimes[i] + 0.03))
+			{
+				load += 0.35 * wheel->gain * DUTY_MAX / wheel->timeConstant;
+			}
+		}
+		if ((hit == HEAVY_LOAD) && (t >= hitTime))
+		{
+			load += 0.8 * wheel->gain * DUTY_MAX / wheel->timeConstant;
+		}
+		speed += ((wheel->gain * duty - speed) / wheel->timeConstant - load - ((duty == 0) ? wheel->friction : 0)) * STEP;
+		if ((hit == WALL) && (t >= hitTime))
+		{
+			speed -= 30000 * STEP;
+		}
+		speed = fmax(speed, 0);
+
+		position += speed / 60 * TICKS_PER_REV * STEP;
+		if (position >= nextEdge)
+		{
+			VelocityEstimate_Edge(&estimate, (uint32_t) (t * TICKS_PER_SEC));
+			ticks++;
+			nextEdge += Spacing[ticks % ENCODER_PULSES_PER_REV];
+		}
+	}
+	return -1;
+}
+
+typedef struct {
+	int detected;
+	double mean;	// ms
+	double worst;	// ms
+} Detections;
+
+static void addDetection(Detections *detections, double latency)
+{
+	if (latency >= 0)
+	{
+		detections->detected++;
+		detections->mean += latency * 1000;
+		detections->worst = fmax(detections->worst, latency * 1000);
+	}
+}
+
+static void testDrive(void)
+{
+	Detections walls = {0, 0, 0};
+	Detections loads = {0, 0, 0};
+	int clean = 0;
+	int bumped = 0;
+	int trial;
+
+	srand(1);
+	for (trial = 0; trial < TRIALS; trial++)
+	{
+		Wheel wheel = {uniform(1.4, 2.0), uniform(0.06, 0.11), uniform(100, 250)};
+		uint32_t target = (uint32_t) uniform(30, 1200);
+		bool falseAlarm;
+
+		drive(&wheel, target, NO_HIT, 0, false, &falseAlarm);
+		clean += falseAlarm;
+		drive(&wheel, target, NO_HIT, 0, true, &falseAlarm);
+		bumped += falseAlarm;
+		addDetection(&walls, drive(&wheel, 100000, WALL, uniform(0.15, 1.5), false, &falseAlarm));
+		addDetection(&loads, drive(&wheel, 100000, HEAVY_LOAD, uniform(0.15, 1.5), false, &falseAlarm));
+	}
+
+	printf("walls: %d of %d detected, mean %.1f ms, worst %.1f ms\n", walls.detected, TRIALS, walls.mean / walls.detected, walls.worst);
+	printf("80%% of stall: %d of %d detected, mean %.1f ms, worst %.1f ms\n", loads.detected, TRIALS, loads.mean / loads.detected, loads.worst);
+	printf("false alarms: %d of %d clean moves, %d of %d with bumps\n", clean, TRIALS, bumped, TRIALS);
+	CHECK(walls.detected == TRIALS, "missed %d walls", TRIALS - walls.detected);
+	CHECK(walls.worst < 50, "a wall took %g ms to detect", walls.worst);
+	CHECK(loads.detected == TRIALS, "missed %d heavy loads", TRIALS - loads.detected);
+	CHECK(loads.worst < 250, "a heavy load took %g ms to detect", loads.worst);
+	CHECK(clean == 0, "%d false alarms on clean moves", clean);
+	CHECK(bumped * 100 <= TRIALS * 2, "%d false alarms on moves with bumps", bumped);
+}
+
+// A wheel well short of the model only counts while it isn't speeding up,
+// judged over COLLISION_LOOKBACK periods rather than the last one
+static void testSpeedingUp(void)
+{
+	CollisionState detector;
+	q16_t steady = INT_TO_Q16(100);
+	int period;
+	int hits = 0;
+
+	// Bring the model up to speed while the wheel hasn't got going, then climb
+	// in steps of 4 RPM every 8 periods (as a slow wheel reads between edges),
+	// staying short of the model. Compared with the last period alone, each
+	// step reads as not speeding up
+	CollisionDetect_Reset(&detector);
+	for (period = 0; period < 164; period++)
+	{
+		q16_t rpm = (period < 100) ? 0 : INT_TO_Q16(10 + 4 * ((period - 100) / 8));
+		hits += CollisionDetect_Update(&detector, &Model, 60, steady, true, rpm);
+	}
+	CHECK(hits == 0, "a wheel that is speeding up was reported %d times", hits);
+
+	// Holding 30 RPM with +/-2 RPM of noise, against a model at 100
+	CollisionDetect_Reset(&detector);
+	hits = 0;
+	for (period = 0; period < 200; period++)
+	{
+		q16_t rpm = INT_TO_Q16(30 + ((period & 1) ? 2 : -2));
+		hits += CollisionDetect_Update(&detector, &Model, 60, steady, true, rpm);
+	}
+	CHECK(hits > 0, "a noisy wheel held well short of the model was never reported");
+}
+
+int main(void)
+{
+	testSpeedingUp();
+	testDrive();
+	return TEST_RESULT();
+}
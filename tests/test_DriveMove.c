@@ -0,0 +1,449 @@
+/****************************************************************************
+ Host test of DriveMove.c: the cross-coupling's sign, ratio and clamp, then
+ straight moves on two mismatched simulated wheels, run as the drive runs
+ its profiled moves (DriveTrainControl_Service.c), each wheel under its
+ velocity estimate, feed-forward map and speed loop. The heading we end up
+ with, per metre driven, is compared with what the wheels did on their own
+ loops and stopped as soon as either reached its target, as they did
+ before, on a matched floor and with a wheel dragged for 300 ms. Last, how
+ close moves of 10-1000 ticks come to rest on the target, settling on the
+ profile's position loop against cutting the drive on the tick the target
+ is reached, on plants with coulomb drag and stiction.
+****************************************************************************/
+#include <math.h>
+#include <stdlib.h>
+#include "DEFINITIONS.h"
+#include "DriveMove.h"
+#include "FeedForward.h"
+#include "FixedPID.h"
+#include "MotionProfile.h"
+#include "VelocityEstimate.h"
+#include "test.h"
+
+#define STEP 1e-5						// seconds
+#define TICKS_PER_SEC 40000000.0
+#define TICKS_PER_REV (DRIVE_GEAR_RATIO * ENCODER_PULSES_PER_REV)
+#define CONTROL_PERIOD (DRIVE_CONTROL_INTERRUPT_PERIOD / 1000000.0)
+#define TICKS_PER_INCH (TICKS_PER_REV / WHEEL_CIRCUMFERENCE)
+
+// As in DriveTrainControl_Service.c
+#define P_GAIN 1.32f
+#define I_GAIN .15f
+#define DUTY_MAX 100
+#define RPM_NUMERATOR (40000ul * 60 * 1000 / TICKS_PER_REV)
+#define RPM_HEADROOM 8
+#define FEEDFORWARD_INTEGRAL 10
+#define FEEDFORWARD_SETTLED_RPM 5
+#define FEEDFORWARD_TRIM_RATE 1.7e-5f
+#define SYNC_GAIN 4.0f
+#define SYNC_MAX_RPM 20.0f
+#define ARRIVAL_TOLERANCE 2
+#define SETTLE_PERIODS 15
+
+// As before the position loop, the profile held at least the creep speed
+// until the target (so no stopping distance or position gain to speak of)
+#define NO_STOP_ACCELERATION 60000.0f
+#define NO_POSITION_GAIN 1000.0f
+
+// The drag: a fraction of the torque that stalls the wheel at full duty
+#define DRAG_START 0.25			// seconds into the move
+#define DRAG_TIME 0.3				// seconds
+#define DRAG_TORQUE 0.3
+
+static const MotionLimits DriveLimits = MOTION_LIMITS(PROFILE_MAX_RPM, PROFILE_MIN_RPM, PROFILE_ACCELERATION,
+	PROFILE_JERK, PROFILE_STOP_ACCELERATION, PROFILE_POSITION_GAIN, DRIVE_CONTROL_INTERRUPT_PERIOD, TICKS_PER_REV);
+static const MotionLimits CutLimits = MOTION_LIMITS(PROFILE_MAX_RPM, PROFILE_MIN_RPM, PROFILE_ACCELERATION,
+	PROFILE_JERK, NO_STOP_ACCELERATION, NO_POSITION_GAIN, DRIVE_CONTROL_INTERRUPT_PERIOD, TICKS_PER_REV);
+static const PIDGains Gains = {FLOAT_TO_QGAIN(P_GAIN), FLOAT_TO_QGAIN(P_GAIN * I_GAIN), 0, false};
+
+static void testSync(void)
+{
+	q16_t gain = FLOAT_TO_Q16(SYNC_GAIN);
+	q16_t most = FLOAT_TO_Q16(SYNC_MAX_RPM);
+	q16_t half = FLOAT_TO_Q16(0.5f);
+	q16_t one = INT_TO_Q16(1);
+
+	CHECK(DriveMove_SyncCorrection(500, 500, one, gain, most) == 0, "wheels in step were corrected");
+	CHECK(DriveMove_SyncCorrection(600, 300, half, gain, most) == 0, "an arc in step was corrected");
+	CHECK(DriveMove_SyncCorrection(500, 498, one, gain, most) == -Q16_MUL(INT_TO_Q16(2), gain),
+		"a follower 2 ticks behind got %g RPM", Q16_TO_FLOAT(DriveMove_SyncCorrection(500, 498, one, gain, most)));
+	CHECK(DriveMove_SyncCorrection(500, 501, one, gain, most) == gain, "a follower a tick ahead got %g RPM",
+		Q16_TO_FLOAT(DriveMove_SyncCorrection(500, 501, one, gain, most)));
+	CHECK(DriveMove_SyncCorrection(600, 297, half, gain, most) == -Q16_MUL(INT_TO_Q16(3), gain), "an arc's follower 3 ticks behind got %g RPM",
+		Q16_TO_FLOAT(DriveMove_SyncCorrection(600, 297, half, gain, most)));
+	CHECK(DriveMove_SyncCorrection(500, 400, one, gain, most) == -most, "a follower far behind wasn't clamped");
+	CHECK(DriveMove_SyncCorrection(400, 500, one, gain, most) == most, "a follower far ahead wasn't clamped");
+}
+
+// One wheel's motor: RPM per duty, time constant (s), friction while
+// coasting and coulomb drag while moving (RPM/s), and the duty it takes to
+// get it moving from rest
+typedef struct {
+	double gain;
+	double timeConstant;
+	double friction;
+	double drag;
+	double stiction;
+} Wheel;
+
+// Its simulation, and the drive's loop on it
+typedef struct {
+	const Wheel *motor;
+	double speed;				// RPM
+	double position;		// ticks
+	double dragFrom;		// seconds
+	double dragUntil;
+	uint8_t duty;
+	FeedForwardMap map;
+	VelocityEstimate estimate;
+	PIDState pid;
+} SimWheel;
+
+// How the move runs: stepped to DEFAULT_DRIVE_RPM or profiled, and cut on
+// the tick it reaches the target; profiled with each wheel on its own loop
+// and cut when either reaches its target; or as the drive runs it now
+typedef enum { STEPPED, PROFILED_ON_TICK, INDEPENDENT, COUPLED } Mode;
+
+static Mode DriveMode;
+static double Now;
+static SimWheel Wheel_Left;
+static SimWheel Wheel_Right;
+static bool Arrived;
+
+// As in DriveTrainControl_Service.c, with PROFILED_MOVES, for a move forwards
+static uint32_t LeftEncoderTicks;
+static uint32_t RightEncoderTicks;
+static uint32_t TargetTicks_Left;
+static uint32_t TargetTicks_Right;
+static q16_t RPMTargetQ16_Left;
+static q16_t RPMTargetQ16_Right;
+static MotionProfile Profile;
+static bool Profiling;
+static bool LeftLeads;
+static q16_t FollowRatio;
+static uint32_t SyncBase_Left;
+static uint32_t SyncBase_Right;
+static SettleState Settle;
+
+static void setTargetDriveSpeed(float left, float right)
+{
+	Profiling = false;
+	RPMTargetQ16_Left = FLOAT_TO_Q16(left);
+	RPMTargetQ16_Right = FLOAT_TO_Q16(right);
+	FixedPID_Reset(&Wheel_Left.pid);
+	FixedPID_Reset(&Wheel_Right.pid);
+}
+
+static void startProfile(uint32_t leftTicks, uint32_t rightTicks)
+{
+	uint32_t leadTicks = (leftTicks > rightTicks) ? leftTicks : rightTicks;
+
+	TargetTicks_Left = leftTicks;
+	TargetTicks_Right = rightTicks;
+	setTargetDriveSpeed((PROFILE_MIN_RPM * leftTicks) / leadTicks, (PROFILE_MIN_RPM * rightTicks) / leadTicks);
+	LeftLeads = leftTicks >= rightTicks;
+	FollowRatio = LeftLeads ? FixedPID_Ratio(rightTicks, leftTicks, Q16_SHIFT) : FixedPID_Ratio(leftTicks, rightTicks, Q16_SHIFT);
+	SyncBase_Left = LeftEncoderTicks;
+	SyncBase_Right = RightEncoderTicks;
+	DriveMove_ResetSettle(&Settle);
+	MotionProfile_Reset(&Profile);
+	Profiling = true;
+}
+
+static void arrive(void)
+{
+	setTargetDriveSpeed(0, 0);
+	Arrived = true;
+}
+
+static q16_t syncCorrection(void)
+{
+	uint32_t lead = LeftLeads ? (LeftEncoderTicks - SyncBase_Left) : (RightEncoderTicks - SyncBase_Right);
+	uint32_t follow = LeftLeads ? (RightEncoderTicks - SyncBase_Right) : (LeftEncoderTicks - SyncBase_Left);
+
+	return DriveMove_SyncCorrection(lead, follow, FollowRatio, FLOAT_TO_Q16(SYNC_GAIN), FLOAT_TO_Q16(SYNC_MAX_RPM));
+}
+
+static void updateProfile(void)
+{
+	uint32_t tickSum = LeftEncoderTicks + RightEncoderTicks;
+	uint32_t targetSum = TargetTicks_Left + TargetTicks_Right;
+	uint32_t ticksToGo = 0;
+	q16_t leadRPM;
+	q16_t followRPM;
+	q16_t correction;
+
+	if ((DriveMode == COUPLED) && DriveMove_Settled(&Settle, tickSum, targetSum, ARRIVAL_TOLERANCE, SETTLE_PERIODS))
+	{
+		arrive();
+		return;
+	}
+	ticksToGo += DriveMove_TicksToGo(tickSum, targetSum, FollowRatio);
+	leadRPM = MotionProfile_Step(&Profile, (DriveMode == COUPLED) ? &DriveLimits : &CutLimits, ticksToGo);
+	followRPM = Q16_MUL(leadRPM, FollowRatio);
+	if (leadRPM != 0)
+	{
+		correction = syncCorrection();
+		leadRPM = (leadRPM > -correction) ? (leadRPM + correction) : 0;
+		followRPM = (followRPM > correction) ? (followRPM - correction) : 0;
+	}
+	RPMTargetQ16_Left = LeftLeads ? leadRPM : followRPM;
+	RPMTargetQ16_Right = LeftLeads ? followRPM : leadRPM;
+}
+
+// As before cross-coupling: the profile on the lead wheel's own ticks, and
+// each wheel on its own loop
+static void updateIndependent(void)
+{
+	uint32_t leadTicks = LeftLeads ? LeftEncoderTicks : RightEncoderTicks;
+	uint32_t leadTarget = LeftLeads ? TargetTicks_Left : TargetTicks_Right;
+	q16_t leadRPM = MotionProfile_Step(&Profile, &DriveLimits, (leadTicks < leadTarget) ? (leadTarget - leadTicks) : 0);
+	q16_t followRPM = Q16_MUL(leadRPM, FollowRatio);
+
+	RPMTargetQ16_Left = LeftLeads ? leadRPM : followRPM;
+	RPMTargetQ16_Right = LeftLeads ? followRPM : leadRPM;
+}
+
+static void encoderEdge(SimWheel *wheel, uint32_t *ticks)
+{
+	(*ticks)++;
+	// As before, the encoder interrupt stopped the move on the tick
+	if ((DriveMode == INDEPENDENT) && !Arrived && ((LeftEncoderTicks >= TargetTicks_Left) || (RightEncoderTicks >= TargetTicks_Right)))
+	{
+		arrive();
+	}
+	if (((DriveMode == STEPPED) || (DriveMode == PROFILED_ON_TICK)) && !Arrived && (LeftEncoderTicks + RightEncoderTicks >= TargetTicks_Left + TargetTicks_Right))
+	{
+		arrive();
+	}
+	VelocityEstimate_Edge(&wheel->estimate, (uint32_t) (Now * TICKS_PER_SEC));
+}
+
+// The speed loop, as test_CollisionDetect runs it
+static void controlWheel(SimWheel *wheel, q16_t setpoint)
+{
+	q16_t rpm = VelocityEstimate_RPM(&wheel->estimate, (uint32_t) (Now * TICKS_PER_SEC));
+	q16_t error = setpoint - rpm;
+	q16_t requested = FixedPID_Update(&wheel->pid, &Gains, error) + FeedForward_Duty(&wheel->map, setpoint);
+
+	requested = (requested > INT_TO_Q16(DUTY_MAX)) ? INT_TO_Q16(DUTY_MAX) : ((requested < 0) ? 0 : requested);
+	if ((setpoint != 0) && (requested < INT_TO_Q16(DUTY_MAX)) && (Q16_ABS(error) < INT_TO_Q16(FEEDFORWARD_SETTLED_RPM)))
+	{
+		FeedForward_Trim(&wheel->map, wheel->pid.integral);
+	}
+	wheel->duty = (setpoint == 0) ? 0 : (uint8_t) Q16_TO_INT(requested);
+}
+
+static void stepWheel(SimWheel *wheel, uint32_t *ticks)
+{
+	const Wheel *motor = wheel->motor;
+	double load = motor->drag + ((wheel->duty == 0) ? motor->friction : 0);
+
+	if ((Now >= wheel->dragFrom) && (Now < wheel->dragUntil))
+	{
+		load += DRAG_TORQUE * motor->gain * DUTY_MAX / motor->timeConstant;
+	}
+	if ((wheel->speed == 0) && (wheel->duty < motor->stiction))
+	{
+		return;
+	}
+	wheel->speed += ((motor->gain * wheel->duty - wheel->speed) / motor->timeConstant - load) * STEP;
+	wheel->speed = fmax(wheel->speed, 0);
+	wheel->position += wheel->speed / 60 * TICKS_PER_REV * STEP;
+	if (wheel->position >= *ticks + 1)
+	{
+		encoderEdge(wheel, ticks);
+	}
+}
+
+// Both wheels start on the maps the drive ships with, not their own
+static void initWheel(SimWheel *wheel, const Wheel *motor)
+{
+	FeedForwardPoint points[2] = {{0, 0}, {DUTY_MAX, (uint16_t) (DUTY_MAX * DRIVE_RPM_PER_DUTY)}};
+
+	wheel->motor = motor;
+	wheel->speed = 0;
+	wheel->position = 0;
+	wheel->dragFrom = 0;
+	wheel->dragUntil = 0;
+	wheel->duty = 0;
+	FeedForward_Init(&wheel->map, points, 2, FLOAT_TO_QGAIN(FEEDFORWARD_TRIM_RATE));
+	VelocityEstimate_Init(&wheel->estimate, RPM_NUMERATOR, RPM_HEADROOM, ENCODER_PULSES_PER_REV, 12 * 40000ul, 100 * 40000ul);
+	FixedPID_Init(&wheel->pid, INT_TO_Q16(-FEEDFORWARD_INTEGRAL), INT_TO_Q16(FEEDFORWARD_INTEGRAL), INT_TO_Q16(-DUTY_MAX), INT_TO_Q16(DUTY_MAX));
+}
+
+// Where a move came to rest
+typedef struct {
+	double heading;		// degrees, left positive
+	double ticks;			// the wheels' mean travel
+	double time;			// seconds until it had arrived and stopped
+} Rest;
+
+// Drives a straight move of the given ticks, with the right wheel dragged
+// if drag. Returns false if it never came to rest
+static bool drive(Mode mode, const Wheel *left, const Wheel *right, uint32_t ticks, bool drag, Rest *rest)
+{
+	double nextControl = 0;
+
+	DriveMode = mode;
+	Now = 0;
+	Arrived = false;
+	initWheel(&Wheel_Left, left);
+	initWheel(&Wheel_Right, right);
+	if (drag)
+	{
+		Wheel_Right.dragFrom = DRAG_START;
+		Wheel_Right.dragUntil = DRAG_START + DRAG_TIME;
+	}
+	LeftEncoderTicks = 0;
+	RightEncoderTicks = 0;
+	Settle.lastTickSum = 0;
+	startProfile(ticks, ticks);
+	if (mode == STEPPED)
+	{
+		setTargetDriveSpeed(DEFAULT_DRIVE_RPM, DEFAULT_DRIVE_RPM);
+	}
+
+	while (Now < 10)
+	{
+		if (Now >= nextControl)
+		{
+			nextControl += CONTROL_PERIOD;
+			if (Profiling)
+			{
+				if (mode == INDEPENDENT)
+				{
+					updateIndependent();
+				}
+				else
+				{
+					updateProfile();
+				}
+			}
+			controlWheel(&Wheel_Left, RPMTargetQ16_Left);
+			controlWheel(&Wheel_Right, RPMTargetQ16_Right);
+			if (Arrived && (Wheel_Left.speed == 0) && (Wheel_Right.speed == 0))
+			{
+				rest->heading = ((Wheel_Right.position - Wheel_Left.position) / TICKS_PER_INCH / DISTANCE_BETWEEN_WHEELS) * (180 / M_PI);
+				rest->ticks = (Wheel_Left.position + Wheel_Right.position) / 2;
+				rest->time = Now;
+				return true;
+			}
+		}
+		stepWheel(&Wheel_Left, &LeftEncoderTicks);
+		stepWheel(&Wheel_Right, &RightEncoderTicks);
+		Now += STEP;
+	}
+	return false;
+}
+
+typedef struct {
+	double mean;		// degrees per metre
+	double worst;		// degrees per metre
+	double miss;		// worst inches short of or past the target
+} Headings;
+
+static Headings straightMoves(Mode mode, bool drag)
+{
+	static const Wheel Left = {1.7, 0.08, 150, 0, 0};
+	static const Wheel Right = {1.55, 0.10, 190, 0, 0};
+	Headings headings = {0, 0, 0};
+	int moves = 0;
+
+	for (int inches = 12; inches <= 72; inches += 6)
+	{
+		for (int side = 0; side < 2; side++)
+		{
+			Rest rest;
+			bool stopped = drive(mode, side ? &Right : &Left, side ? &Left : &Right, (uint32_t) (inches * TICKS_PER_INCH), drag, &rest);
+			double travelled = rest.ticks / TICKS_PER_INCH;
+			double perMetre = fabs(rest.heading) / (travelled * 0.0254);
+
+			CHECK(stopped, "a %d in move never came to rest", inches);
+			headings.mean += perMetre;
+			headings.worst = fmax(headings.worst, perMetre);
+			headings.miss = fmax(headings.miss, fabs(travelled - inches));
+			moves++;
+		}
+	}
+	headings.mean /= moves;
+	return headings;
+}
+
+static void testHeading(void)
+{
+	Headings independent = straightMoves(INDEPENDENT, false);
+	Headings independentDrag = straightMoves(INDEPENDENT, true);
+	Headings coupled = straightMoves(COUPLED, false);
+	Headings coupledDrag = straightMoves(COUPLED, true);
+
+	printf("mean (worst) |heading error|, deg/m    matched load    300 ms drag on one wheel\n");
+	printf("independent, either wheel stops        %.2f (%.2f)     %.2f (%.2f)\n", independent.mean, independent.worst, independentDrag.mean, independentDrag.worst);
+	printf("coupled, centroid arrives              %.2f (%.2f)     %.2f (%.2f)\n", coupled.mean, coupled.worst, coupledDrag.mean, coupledDrag.worst);
+	printf("worst miss on distance: independent %.2f in, coupled %.2f in (with drag %.2f, %.2f)\n",
+		independent.miss, coupled.miss, independentDrag.miss, coupledDrag.miss);
+	CHECK(coupled.mean < independent.mean, "coupling made the mean heading error worse (%.2f against %.2f deg/m)", coupled.mean, independent.mean);
+	CHECK(coupledDrag.mean * 5 < independentDrag.mean, "with a dragged wheel coupling only cut the mean heading error to %.2f from %.2f deg/m",
+		coupledDrag.mean, independentDrag.mean);
+	CHECK(coupledDrag.worst < 2 * coupled.worst + 0.5, "a dragged wheel still turned a coupled move %.2f deg/m", coupledDrag.worst);
+	CHECK(coupledDrag.miss < 0.5, "a coupled move missed its distance by %.2f in", coupledDrag.miss);
+}
+
+typedef struct {
+	double mean;		// ticks
+	double worst;		// ticks
+	double time;		// seconds, all moves
+} Stops;
+
+static Stops tickMoves(Mode mode)
+{
+	static const Wheel Plants[3] = {
+		{1.7, 0.08, 150, 0, 0},
+		{1.5, 0.12, 200, 100, 8},
+		{1.9, 0.06, 120, 250, 14}};
+	static const uint32_t Moves[] = {10, 25, 50, 100, 200, 400, 700, 1000};
+	Stops stops = {0, 0, 0};
+	int moves = 0;
+
+	for (int plant = 0; plant < 3; plant++)
+	{
+		for (unsigned i = 0; i < sizeof(Moves) / sizeof(Moves[0]); i++)
+		{
+			Rest rest;
+			double error;
+
+			CHECK(drive(mode, &Plants[plant], &Plants[plant], Moves[i], false, &rest), "a %u tick move on plant %d never came to rest", Moves[i], plant);
+			error = fabs(rest.ticks - Moves[i]);
+			stops.mean += error;
+			stops.worst = fmax(stops.worst, error);
+			stops.time += rest.time;
+			moves++;
+		}
+	}
+	stops.mean /= moves;
+	return stops;
+}
+
+static void testArrival(void)
+{
+	Stops stepped = tickMoves(STEPPED);
+	Stops onTick = tickMoves(PROFILED_ON_TICK);
+	Stops settled = tickMoves(COUPLED);
+
+	printf("                                    mean |err|   worst    total time\n");
+	printf("%3.0f RPM step, stop on tick         %5.1f ticks  %5.1f    %6.2f s\n", DEFAULT_DRIVE_RPM, stepped.mean, stepped.worst, stepped.time);
+	printf("profile, stop on tick              %5.1f        %5.1f    %6.2f s\n", onTick.mean, onTick.worst, onTick.time);
+	printf("+ position loop, settle            %5.1f        %5.1f    %6.2f s\n", settled.mean, settled.worst, settled.time);
+	CHECK(settled.mean < onTick.mean / 2, "settling on the position loop only brought the mean error to %.1f from %.1f ticks", settled.mean, onTick.mean);
+	CHECK(settled.worst < onTick.worst, "settling on the position loop left a worst error of %.1f ticks, %.1f before", settled.worst, onTick.worst);
+	CHECK(onTick.mean < stepped.mean, "profiling didn't cut the mean error (%.1f against %.1f ticks)", onTick.mean, stepped.mean);
+	CHECK(settled.time < 1.2 * onTick.time, "settling took %.2f s in all, %.2f s before", settled.time, onTick.time);
+}
+
+int main(void)
+{
+	testSync();
+	testHeading();
+	testArrival();
+	return TEST_RESULT();
+}
@@ -0,0 +1,279 @@
+/****************************************************************************
+ Host test of EdgeWatch.c, and of the stop checks built on last-edge times:
+ the drive's stall check in its control interrupt, the flywheel's stopped
+ check in its control interrupt, and the periscope's event checker. Each
+ motor runs at cruise on a capture clock that wraps part way through, then
+ stops at a random time, and we measure how long after its last edge the
+ stop is seen. The periscope's stop must be reported once, again after the
+ next stop, and from RequireZero with no edges at all. Last, the cost of
+ an edge noting its time against the ES timer reload it replaced.
+****************************************************************************/
+#include <stdlib.h>
+#include <time.h>
+#include "DEFINITIONS.h"
+#include "EdgeWatch.h"
+#include "test.h"
+
+#define TRIALS 500
+#define TICKS_PER_US (TICKS_PER_MS / 1000)
+#define FALSE_STOP UINT32_MAX
+
+// As in DriveTrainControl_Service.c
+#define DRIVE_STOPPED_TIME_MS 350
+#define STALL_THRESHOLD 4
+#define STALL_TIME_MS (DRIVE_STOPPED_TIME_MS * (STALL_THRESHOLD + 1))
+
+// As in CannonControl_Service.c
+#define CANNON_STOPPED_TIME_MS 200
+#define CANNON_TEST_RPM 3500
+
+// As in PeriscopeControl_Service.c, where the stop check runs on the edges of
+// one channel, half of the encoder's ticks
+#define PERISCOPE_STOPPED_TIME_MS 250
+#define PERISCOPE_FULL_ROTATION_ENCODER_TICKS 1000
+
+// The event loop comes round to the periscope's checker this often (us)
+#define LOOP_PASS_MIN_US 20
+#define LOOP_PASS_MAX_US 1000
+
+// One motor's edges, and the periodic check that watches them
+typedef struct {
+	uint32_t edgeTicks;				// capture ticks between edges at cruise
+	uint32_t checkTicks;			// between checks (0: random event loop passes)
+	uint32_t stoppedTicks;		// threshold
+} Watched;
+
+static uint32_t randomTicks(uint32_t low, uint32_t high)
+{
+	return low + (uint32_t) ((double) (high - low) * rand() / RAND_MAX);
+}
+
+static uint32_t nextCheck(const Watched *watched)
+{
+	return watched->checkTicks ? watched->checkTicks : randomTicks(LOOP_PASS_MIN_US * TICKS_PER_US, LOOP_PASS_MAX_US * TICKS_PER_US);
+}
+
+// Runs the motor from start for run capture ticks and then stops it,
+// checking as the service does. Edges can land between the check's two
+// reads. Returns the ticks from the last edge to the check that saw the
+// stop, 0 if none did, or FALSE_STOP if one was seen while the motor was
+// turning. Counts the stops reported after the first in *repeats
+static uint32_t runAndStop(EdgeWatch *watch, const Watched *watched, uint32_t start, uint32_t run, int *repeats)
+{
+	uint32_t now = start;
+	uint32_t elapsed = 0;
+	uint32_t lastEdge = start;
+	uint32_t toEdge = watched->edgeTicks;
+	uint32_t toCheck = nextCheck(watched);
+	uint32_t seen = 0;
+
+	*repeats = 0;
+	EdgeWatch_Start(watch, start);
+	// Look for twice the threshold after the stop, for repeat reports
+	while (elapsed < run + 2 * watched->stoppedTicks + watched->edgeTicks)
+	{
+		uint32_t step = (toEdge < toCheck) ? toEdge : toCheck;
+		bool turning = elapsed + step <= run;
+
+		now += step;
+		elapsed += step;
+		toEdge -= step;
+		toCheck -= step;
+		if ((toEdge == 0) && turning)
+		{
+			EdgeWatch_Edge(watch, now);
+			lastEdge = now;
+		}
+		if (toEdge == 0)
+		{
+			toEdge = watched->edgeTicks;
+		}
+		if (toCheck == 0)
+		{
+			uint32_t edge = EdgeWatch_LastEdge(watch);
+			uint32_t checked = now + 5;
+
+			// Now and then the edge is captured just after we read it
+			if (turning && ((rand() % 8) == 0))
+			{
+				EdgeWatch_Edge(watch, now + 2);
+				lastEdge = now + 2;
+				toEdge = watched->edgeTicks - 2;
+			}
+			toCheck = nextCheck(watched);
+			if (EdgeWatch_Stopped(watch, edge, checked, watched->stoppedTicks))
+			{
+				if (elapsed < run)
+				{
+					return FALSE_STOP;
+				}
+				if (seen != 0)
+				{
+					(*repeats)++;
+				}
+				else
+				{
+					seen = checked - lastEdge;
+				}
+			}
+		}
+	}
+	return seen;
+}
+
+static void testLatency(const char *name, const Watched *watched, uint32_t thresholdMs)
+{
+	EdgeWatch watch;
+	uint32_t best = UINT32_MAX;
+	uint32_t worst = 0;
+	int missed = 0;
+	int falseStops = 0;
+	int repeated = 0;
+
+	EdgeWatch_Init(&watch);
+	for (int trial = 0; trial < TRIALS; trial++)
+	{
+		// Half the runs cross the capture timer's wrap
+		uint32_t start = (trial & 1) ? (UINT32_MAX - randomTicks(0, 2000 * TICKS_PER_MS)) : (uint32_t) rand();
+		uint32_t run = randomTicks(0, 3000 * TICKS_PER_MS);
+		int repeats;
+		uint32_t latency = runAndStop(&watch, watched, start, run, &repeats);
+
+		repeated += repeats;
+		if (latency == FALSE_STOP)
+		{
+			falseStops++;
+			continue;
+		}
+		if (latency == 0)
+		{
+			missed++;
+			continue;
+		}
+		best = (latency < best) ? latency : best;
+		worst = (latency > worst) ? latency : worst;
+	}
+	printf("%-22s stop seen %.2f-%.2f ms after the last edge (threshold %u ms)\n", name,
+		best / (double) TICKS_PER_MS, worst / (double) TICKS_PER_MS, thresholdMs);
+	CHECK(falseStops == 0, "%s: %d stops seen while turning", name, falseStops);
+	CHECK(missed == 0, "%s: %d stops missed", name, missed);
+	CHECK(repeated == 0, "%s: %d stops reported again", name, repeated);
+	CHECK(best >= thresholdMs * TICKS_PER_MS, "%s: a stop was seen after %.2f ms", name, best / (double) TICKS_PER_MS);
+	CHECK(worst < thresholdMs * TICKS_PER_MS + (watched->checkTicks ? watched->checkTicks : LOOP_PASS_MAX_US * TICKS_PER_US) + 5,
+		"%s: a stop took %.2f ms to see", name, worst / (double) TICKS_PER_MS);
+}
+
+static void testStops(void)
+{
+	// A drive wheel at DEFAULT_DRIVE_RPM, checked every control period
+	const Watched drive = {(uint32_t) (60000.0 * TICKS_PER_MS / (DEFAULT_DRIVE_RPM * DRIVE_GEAR_RATIO * ENCODER_PULSES_PER_REV)),
+		DRIVE_CONTROL_INTERRUPT_PERIOD * TICKS_PER_US, STALL_TIME_MS * TICKS_PER_MS};
+	// The flywheel at its test speed
+	const Watched cannon = {(uint32_t) (60000.0 * TICKS_PER_MS / (CANNON_TEST_RPM * FLYWHEEL_GEAR_RATIO * ENCODER_PULSES_PER_REV)),
+		CANNON_CONTROL_INTERRUPT_PERIOD * TICKS_PER_US, CANNON_STOPPED_TIME_MS * TICKS_PER_MS};
+	// The periscope at its sweep speed, checked from the event loop
+	const Watched periscope = {(uint32_t) (60000.0 * TICKS_PER_MS / (PERISCOPE_TARGET_RPM * (PERISCOPE_FULL_ROTATION_ENCODER_TICKS / 2))),
+		0, PERISCOPE_STOPPED_TIME_MS * TICKS_PER_MS};
+
+	srand(47);
+	testLatency("drive stall", &drive, STALL_TIME_MS);
+	testLatency("flywheel stopped", &cannon, CANNON_STOPPED_TIME_MS);
+	testLatency("periscope stopped", &periscope, PERISCOPE_STOPPED_TIME_MS);
+}
+
+// The periscope's reporting: nothing at boot, once per stop, and once after
+// RequireZero even if it never turns
+static void testReports(void)
+{
+	EdgeWatch watch;
+	uint32_t stopped = PERISCOPE_STOPPED_TIME_MS * TICKS_PER_MS;
+	uint32_t now = UINT32_MAX - stopped / 2;
+	int reports = 0;
+	int i;
+
+	EdgeWatch_Init(&watch);
+	for (i = 0; i < 1000; i++, now += TICKS_PER_MS)
+	{
+		reports += EdgeWatch_Stopped(&watch, EdgeWatch_LastEdge(&watch), now, stopped);
+	}
+	CHECK(reports == 0, "%d stops reported before anything started", reports);
+
+	// RequireZero, and the periscope never moves
+	EdgeWatch_Start(&watch, now);
+	for (i = 0; i < 1000; i++, now += TICKS_PER_MS)
+	{
+		reports += EdgeWatch_Stopped(&watch, EdgeWatch_LastEdge(&watch), now, stopped);
+	}
+	CHECK(reports == 1, "a start with no edges reported %d stops", reports);
+
+	// One edge, then stopped again, across the wrap
+	EdgeWatch_Edge(&watch, now);
+	reports = 0;
+	for (i = 0; i < 1000; i++, now += TICKS_PER_MS)
+	{
+		reports += EdgeWatch_Stopped(&watch, EdgeWatch_LastEdge(&watch), now, stopped);
+	}
+	CHECK(reports == 1, "a second stop reported %d times", reports);
+}
+
+// As in ES_Timers.c, which every edge used to call to reload its timer
+typedef void (*PostFunc)(void);
+static void post(void)
+{
+}
+static volatile uint16_t TimerArray[16];
+static volatile uint16_t ActiveFlags;
+static PostFunc const TimerPostFunc[16] = {post, post, post, post, post, post, post, post, post, post, post, post, post, post, post, post};
+static const uint16_t BitNum2SetMask[16] = {1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 16384, 32768};
+
+__attribute__((noinline)) static int initTimer(uint8_t num, uint16_t newTime)
+{
+	if ((num >= 16) || (TimerPostFunc[num] == NULL) || (newTime == 0))
+	{
+		return -1;
+	}
+	TimerArray[num] = newTime;
+	ActiveFlags |= BitNum2SetMask[num];
+	return 0;
+}
+
+static void testCost(void)
+{
+	EdgeWatch watch;
+	volatile int sink = 0;
+	clock_t start;
+	double timerNs;
+	double edgeNs;
+	long i;
+	// Edges per second at cruise: two drive wheels, the flywheel and the periscope
+	double edgesPerSec = 2 * DEFAULT_DRIVE_RPM * DRIVE_GEAR_RATIO * ENCODER_PULSES_PER_REV / 60
+		+ CANNON_TEST_RPM * FLYWHEEL_GEAR_RATIO * ENCODER_PULSES_PER_REV / 60.0
+		+ PERISCOPE_TARGET_RPM * (PERISCOPE_FULL_ROTATION_ENCODER_TICKS / 2) / 60.0;
+
+	start = clock();
+	for (i = 0; i < 50000000; i++)
+	{
+		sink = initTimer((uint8_t) (i & 7), 350);
+	}
+	timerNs = (double) (clock() - start) / CLOCKS_PER_SEC * 1e9 / i;
+
+	EdgeWatch_Init(&watch);
+	start = clock();
+	for (i = 0; i < 50000000; i++)
+	{
+		EdgeWatch_Edge(&watch, (uint32_t) i);
+	}
+	edgeNs = (double) (clock() - start) / CLOCKS_PER_SEC * 1e9 / i;
+	(void) sink;
+
+	printf("cost per edge: timer reload %.2f ns, last-edge time %.2f ns (host)\n", timerNs, edgeNs);
+	printf("at cruise (%.0f edges/s) that is %.1f us/s of interrupt time saved (host)\n", edgesPerSec, edgesPerSec * (timerNs - edgeNs) / 1000);
+}
+
+int main(void)
+{
+	testStops();
+	testReports();
+	testCost();
+	return TEST_RESULT();
+}
@@ -0,0 +1,300 @@
+/****************************************************************************
+ Host test of FeedForward.c: lookups both ways through a map with a dead
+ band (up to full duty, as the loops clamp it), the trim and its limits, and
+ a calibration sweep on a simulated drive wheel, run as
+ DriveTrainControl_Service.c runs it. The map the sweep measures then drives
+ speed steps under the drive's fixed-point speed loop, which must settle
+ sooner than the loop alone, and its trim must take up a sagging battery.
+****************************************************************************/
+#include <math.h>
+#include "DEFINITIONS.h"
+#include "FeedForward.h"
+#include "FixedPID.h"
+#include "VelocityEstimate.h"
+#include "test.h"
+
+#define STEP 1e-5						// seconds
+#define TICKS_PER_SEC 40000000.0
+#define TICKS_PER_REV (DRIVE_GEAR_RATIO * ENCODER_PULSES_PER_REV)
+#define CONTROL_PERIOD (DRIVE_CONTROL_INTERRUPT_PERIOD / 1000000.0)
+#define SETTLE_TIME 0.5			// seconds at each sweep duty before measuring
+#define MEASURE_TIME 0.2		// seconds measuring
+#define STEP_TIME 1.5				// seconds at each speed
+#define SETTLED_SHARE 0.05	// within this share of the target counts as settled
+
+// As in DriveTrainControl_Service.c
+#define P_GAIN 1.32f
+#define I_GAIN .15f
+#define DUTY_MAX 100
+#define RPM_NUMERATOR (40000ul * 60 * 1000 / TICKS_PER_REV)
+#define RPM_HEADROOM 8
+#define CALIBRATION_POINTS 10
+#define FEEDFORWARD_INTEGRAL 10
+#define FEEDFORWARD_SETTLED_RPM 5
+#define FEEDFORWARD_TRIM_RATE 1.7e-5f
+
+// Each magnet's share of the mean angle between them
+static const double Spacing[ENCODER_PULSES_PER_REV] = {1.04, 0.97, 1.02, 0.95, 1.02};
+
+static const double Targets[] = {100, 60, 130, 40, 100, 60, 130, 40};
+#define NUM_TARGETS (sizeof(Targets) / sizeof(Targets[0]))
+
+// One wheel: RPM per duty above its dead band, time constant (s), and the
+// duty it takes to get it turning
+typedef struct {
+	double gain;
+	double timeConstant;
+	double deadBand;
+} Wheel;
+
+// The simulated wheel and its encoder
+typedef struct {
+	const Wheel *wheel;
+	VelocityEstimate estimate;
+	double speed;
+	double position;
+	double nextEdge;
+	unsigned edges;
+} Sim;
+
+static void startSim(Sim *sim, const Wheel *wheel)
+{
+	sim->wheel = wheel;
+	VelocityEstimate_Init(&sim->estimate, RPM_NUMERATOR, RPM_HEADROOM, ENCODER_PULSES_PER_REV, 12 * 40000ul, 100 * 40000ul);
+	sim->speed = 0;
+	sim->position = 0;
+	sim->nextEdge = Spacing[0];
+	sim->edges = 0;
+}
+
+static void stepSim(Sim *sim, double duty, double t)
+{
+	double driving = fmax(duty - sim->wheel->deadBand, 0);
+
+	sim->speed += (sim->wheel->gain * driving - sim->speed) / sim->wheel->timeConstant * STEP;
+	sim->speed = fmax(sim->speed, 0);
+	sim->position += sim->speed / 60 * TICKS_PER_REV * STEP;
+	if (sim->position >= sim->nextEdge)
+	{
+		VelocityEstimate_Edge(&sim->estimate, (uint32_t) (t * TICKS_PER_SEC));
+		sim->edges++;
+		sim->nextEdge += Spacing[sim->edges % ENCODER_PULSES_PER_REV];
+	}
+}
+
+static q16_t readSim(Sim *sim, double t)
+{
+	return VelocityEstimate_RPM(&sim->estimate, (uint32_t) (t * TICKS_PER_SEC));
+}
+
+// Points held at rest keep only the highest duty, and each lookup undoes the
+// other, trim or not
+static void testLookups(void)
+{
+	static const FeedForwardPoint Points[] = {{10, 0}, {20, 0}, {30, 25}, {50, 60}, {50, 58}, {100, 150}};
+	FeedForwardMap map;
+	double rpm;
+
+	FeedForward_Init(&map, Points, sizeof(Points) / sizeof(Points[0]), 0);
+	CHECK(map.numPoints == 4, "kept %u points, expected 4", map.numPoints);
+	CHECK(map.duty[0] == INT_TO_Q16(20), "the dead band ends at %g duty, expected 20", Q16_TO_FLOAT(map.duty[0]));
+	CHECK(FeedForward_Duty(&map, 0) == 0, "no speed should need no duty");
+	CHECK(fabs(Q16_TO_FLOAT(FeedForward_Duty(&map, INT_TO_Q16(60))) - 50) < 0.01, "60 RPM took %g duty, expected 50",
+		Q16_TO_FLOAT(FeedForward_Duty(&map, INT_TO_Q16(60))));
+	CHECK(fabs(Q16_TO_FLOAT(FeedForward_Duty(&map, INT_TO_Q16(105))) - 75) < 0.01, "105 RPM took %g duty, expected 75",
+		Q16_TO_FLOAT(FeedForward_Duty(&map, INT_TO_Q16(105))));
+	CHECK(FeedForward_RPM(&map, INT_TO_Q16(15)) == 0, "15 duty is in the dead band, but held %g RPM",
+		Q16_TO_FLOAT(FeedForward_RPM(&map, INT_TO_Q16(15))));
+
+	for (map.trim = FLOAT_TO_Q16(0.5f); map.trim <= FLOAT_TO_Q16(2.0f); map.trim += FLOAT_TO_Q16(0.25f))
+	{
+		// Up to the most duty we can give
+		for (rpm = 5; FeedForward_Duty(&map, FLOAT_TO_Q16(rpm)) <= INT_TO_Q16(DUTY_MAX); rpm += 5)
+		{
+			double back = Q16_TO_FLOAT(FeedForward_RPM(&map, FeedForward_Duty(&map, FLOAT_TO_Q16(rpm))));
+
+			CHECK(fabs(back - rpm) < 0.05, "at trim %g, %g RPM came back as %g", Q16_TO_FLOAT(map.trim), rpm, back);
+		}
+	}
+}
+
+// The trim follows the integral at its rate, within its limits
+static void testTrim(void)
+{
+	static const FeedForwardPoint Points[] = {{0, 0}, {DUTY_MAX, 170}};
+	FeedForwardMap map;
+	int i;
+
+	FeedForward_Init(&map, Points, 2, FLOAT_TO_QGAIN(FEEDFORWARD_TRIM_RATE));
+	CHECK(map.trim == INT_TO_Q16(1), "the trim should start at 1, not %g", Q16_TO_FLOAT(map.trim));
+	FeedForward_Trim(&map, INT_TO_Q16(5));
+	CHECK(fabs(Q16_TO_FLOAT(map.trim) - (1 + 5 * FEEDFORWARD_TRIM_RATE)) < 1e-4, "one period at 5 duty of integral trimmed to %g",
+		Q16_TO_FLOAT(map.trim));
+	for (i = 0; i < 100000; i++)
+	{
+		FeedForward_Trim(&map, INT_TO_Q16(FEEDFORWARD_INTEGRAL));
+	}
+	CHECK(map.trim == FLOAT_TO_Q16(2.0f), "the trim wound up to %g", Q16_TO_FLOAT(map.trim));
+	for (i = 0; i < 100000; i++)
+	{
+		FeedForward_Trim(&map, INT_TO_Q16(-FEEDFORWARD_INTEGRAL));
+	}
+	CHECK(map.trim == FLOAT_TO_Q16(0.5f), "the trim wound down to %g", Q16_TO_FLOAT(map.trim));
+}
+
+// A calibration sweep of the wheel, as the drive runs one: fills in sweep
+// and returns the seconds it took
+static double sweep(FeedForwardSweep *sweep, const Wheel *wheel)
+{
+	Sim sim;
+	double nextControl = 0;
+	double nextStep = SETTLE_TIME;
+	double t;
+
+	startSim(&sim, wheel);
+	FeedForward_StartSweep(sweep, DUTY_MAX, CALIBRATION_POINTS);
+	for (t = 0; ; t += STEP)
+	{
+		if (t >= nextControl)
+		{
+			nextControl += CONTROL_PERIOD;
+			FeedForward_SweepSample(sweep, readSim(&sim, t));
+		}
+		if (t >= nextStep)
+		{
+			if (!FeedForward_SweepNext(sweep))
+			{
+				return t;
+			}
+			nextStep = t + (sweep->measuring ? MEASURE_TIME : SETTLE_TIME);
+		}
+		stepSim(&sim, FeedForward_SweepDuty(sweep), t);
+	}
+}
+
+// Steps through Targets under the drive's speed loop, with the map if one is
+// given, as the drive's control law runs. Fills in settled with the ms each
+// target took to settle on, and returns the trim it ended with
+static double steps(const Wheel *wheel, FeedForwardMap *map, double *settled)
+{
+	static const PIDGains Gains = {FLOAT_TO_QGAIN(P_GAIN), FLOAT_TO_QGAIN(P_GAIN * I_GAIN), 0, false};
+	PIDState pid;
+	Sim sim;
+	double nextControl = 0;
+	double duty = 0;
+	double t = 0;
+	unsigned i;
+
+	startSim(&sim, wheel);
+	if (map)
+	{
+		FixedPID_Init(&pid, INT_TO_Q16(-FEEDFORWARD_INTEGRAL), INT_TO_Q16(FEEDFORWARD_INTEGRAL), INT_TO_Q16(-DUTY_MAX), INT_TO_Q16(DUTY_MAX));
+	}
+	else
+	{
+		FixedPID_Init(&pid, 0, FLOAT_TO_Q16(P_GAIN * DUTY_MAX), 0, INT_TO_Q16(DUTY_MAX));
+	}
+
+	for (i = 0; i < NUM_TARGETS; i++)
+	{
+		q16_t target = FLOAT_TO_Q16(Targets[i]);
+		double start = t;
+		double lastOut = t;
+
+		FixedPID_Reset(&pid);
+		for (; t < start + STEP_TIME; t += STEP)
+		{
+			if (t >= nextControl)
+			{
+				q16_t error = target - readSim(&sim, t);
+				q16_t requested = FixedPID_Update(&pid, &Gains, error);
+
+				nextControl += CONTROL_PERIOD;
+				if (map)
+				{
+					requested += FeedForward_Duty(map, target);
+					if (requested > INT_TO_Q16(DUTY_MAX))
+					{
+						requested = INT_TO_Q16(DUTY_MAX);
+					}
+					else if (requested < 0)
+					{
+						requested = 0;
+					}
+					else if (Q16_ABS(error) < INT_TO_Q16(FEEDFORWARD_SETTLED_RPM))
+					{
+						FeedForward_Trim(map, pid.integral);
+					}
+				}
+				duty = Q16_TO_INT(requested);
+			}
+			if (fabs(sim.speed - Targets[i]) > SETTLED_SHARE * Targets[i])
+			{
+				lastOut = t;
+			}
+			stepSim(&sim, duty, t);
+		}
+		settled[i] = (lastOut - start) * 1000;
+	}
+	return map ? Q16_TO_FLOAT(map->trim) : 1;
+}
+
+static double mean(const double *values)
+{
+	double sum = 0;
+	unsigned i;
+
+	for (i = 0; i < NUM_TARGETS; i++)
+	{
+		sum += values[i];
+	}
+	return sum / NUM_TARGETS;
+}
+
+static void testSweep(void)
+{
+	static const Wheel Bench = {1.7, 0.08, 6};
+	static const Wheel Sagging = {1.7 * 0.85, 0.08, 6};
+	FeedForwardSweep measured;
+	FeedForwardMap map;
+	double loop[NUM_TARGETS];
+	double mapped[NUM_TARGETS];
+	double trim;
+	double time;
+	uint8_t i;
+
+	time = sweep(&measured, &Bench);
+	printf("sweep took %.1f s: ", time);
+	FeedForward_PrintSweep(&measured);
+	CHECK(measured.numPoints == CALIBRATION_POINTS, "the sweep measured %u points", measured.numPoints);
+	for (i = 0; i < measured.numPoints; i++)
+	{
+		double expected = Bench.gain * fmax(measured.points[i].duty - Bench.deadBand, 0);
+
+		CHECK(fabs(measured.points[i].rpm - expected) <= fmax(0.02 * expected, 1), "%u duty measured %u RPM, expected %g",
+			measured.points[i].duty, measured.points[i].rpm, expected);
+	}
+
+	FeedForward_Init(&map, measured.points, measured.numPoints, FLOAT_TO_QGAIN(FEEDFORWARD_TRIM_RATE));
+	steps(&Bench, NULL, loop);
+	trim = steps(&Bench, &map, mapped);
+	printf("speed steps settle in %.0f ms on the loop alone, %.0f ms with the map (trim %.3f)\n", mean(loop), mean(mapped), trim);
+	CHECK(mean(mapped) < 0.75 * mean(loop), "with the map, speed steps took %g ms, against %g ms without", mean(mapped), mean(loop));
+	CHECK(fabs(trim - 1) < 0.02, "on the wheel it measured, the map trimmed to %g", trim);
+
+	// The same map on a wheel with 15% less to give
+	FeedForward_Init(&map, measured.points, measured.numPoints, FLOAT_TO_QGAIN(FEEDFORWARD_TRIM_RATE));
+	steps(&Sagging, NULL, loop);
+	trim = steps(&Sagging, &map, mapped);
+	printf("with a 15%% sag, %.0f ms on the loop alone, %.0f ms with the map (trim %.3f)\n", mean(loop), mean(mapped), trim);
+	CHECK(trim > 1.1, "a 15%% sag only trimmed the map to %g", trim);
+	CHECK(mean(mapped) < mean(loop), "with a sag and the map, speed steps took %g ms, against %g ms without", mean(mapped), mean(loop));
+}
+
+int main(void)
+{
+	testLookups();
+	testTrim();
+	testSweep();
+	return TEST_RESULT();
+}
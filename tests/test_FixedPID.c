@@ -0,0 +1,228 @@
+/****************************************************************************
+ Host test of FixedPID.c: the fixed-point cannon law must reproduce the float
+ law it replaced (CannonControl_Service.c) over the flywheel's operating range,
+ and FixedPID_Ratio must match the division it stands in for. Also times an
+ update of each law; that is the host's cost, not the Cortex-M4's, whose
+ single-precision FPU and lack of a 64-bit divide weigh them differently.
+****************************************************************************/
+#include <math.h>
+#include <stdlib.h>
+#include <time.h>
+#include "FixedPID.h"
+#include "test.h"
+
+// The cannon's gains and clamps, as in CannonControl_Service.c
+#define STARTUP_P_GAIN 2.5f
+#define STARTUP_THRESH .2f
+#define CONTROL_P_GAIN_BELOW .00145f
+#define CONTROL_D_GAIN_BELOW 0.0000f
+#define I_GAIN_BELOW .000095f
+#define CONTROL_P_GAIN_ABOVE .0000001f
+#define CONTROL_D_GAIN_ABOVE 0.000015f
+#define I_GAIN_ABOVE .00055f
+#define INTEGRAL_CLAMP 100
+#define DUTY_CLAMP 50
+
+// The largest difference we accept between the laws: DUTY_TOLERANCE duty
+// percent, plus GAIN_TOLERANCE of the duty for the gains' rounding to Q24
+#define DUTY_TOLERANCE 0.002
+#define GAIN_TOLERANCE 0.001
+
+// The Q16 startup fraction is a few millionths under STARTUP_THRESH, so the
+// laws can pick different gains within this many RPM of the switch point
+#define SWITCH_MARGIN 0.05
+
+static const PIDGains StartupGains = {FLOAT_TO_QGAIN(STARTUP_P_GAIN), FLOAT_TO_QGAIN(I_GAIN_BELOW), FLOAT_TO_QGAIN(CONTROL_D_GAIN_BELOW), false};
+static const PIDGains BelowGains = {FLOAT_TO_QGAIN(CONTROL_P_GAIN_BELOW), FLOAT_TO_QGAIN(I_GAIN_BELOW), FLOAT_TO_QGAIN(CONTROL_D_GAIN_BELOW), false};
+static const PIDGains AboveGains = {FLOAT_TO_QSCALED(CONTROL_P_GAIN_ABOVE), FLOAT_TO_QGAIN(I_GAIN_ABOVE), FLOAT_TO_QGAIN(CONTROL_D_GAIN_ABOVE), true};
+static const PIDSchedule Schedule = {&StartupGains, &BelowGains, &AboveGains, FLOAT_TO_Q16(STARTUP_THRESH)};
+
+// The float law, in double so it is the reference
+typedef struct {
+	double integral;
+	double lastError;
+} FloatLaw;
+
+static double clampDouble(double x, double limit)
+{
+	return (x > limit) ? limit : ((x < -limit) ? -limit : x);
+}
+
+static double floatLaw(FloatLaw *law, double target, double rpm)
+{
+	double error = target - rpm;
+	bool above = (error <= 0);
+	double p, d, duty;
+
+	law->integral = clampDouble(law->integral + (above ? I_GAIN_ABOVE : I_GAIN_BELOW) * error, INTEGRAL_CLAMP);
+	d = above ? CONTROL_D_GAIN_ABOVE : CONTROL_D_GAIN_BELOW;
+	if (error > STARTUP_THRESH * target)
+	{
+		p = STARTUP_P_GAIN;
+	}
+	else
+	{
+		p = above ? CONTROL_P_GAIN_ABOVE * fabs(error) : CONTROL_P_GAIN_BELOW;
+	}
+	duty = p * error + d * (error - law->lastError) + law->integral;
+	law->lastError = error;
+	return clampDouble(duty, DUTY_CLAMP);
+}
+
+// True if the laws can disagree about the startup gains at this speed
+static bool nearSwitch(double target, double rpm)
+{
+	return fabs(target - rpm - STARTUP_THRESH * target) < SWITCH_MARGIN;
+}
+
+// True (and reports it) if the laws' duties differ by more than we accept
+static bool lawsDiffer(double floatDuty, double fixedDuty, double *worst)
+{
+	double diff = fabs(floatDuty - fixedDuty);
+
+	*worst = fmax(*worst, diff);
+	return diff > DUTY_TOLERANCE + GAIN_TOLERANCE * fabs(floatDuty);
+}
+
+static double fixedLaw(PIDState *pid, double target, double rpm)
+{
+	q16_t targetQ16 = FLOAT_TO_Q16(target);
+	q16_t error = targetQ16 - FLOAT_TO_Q16(rpm);
+	return Q16_TO_FLOAT(FixedPID_Update(pid, FixedPID_ScheduleGains(&Schedule, error, targetQ16), error));
+}
+
+// One period from rest at every target and speed within 1500 RPM of it
+static void testSinglePeriods(void)
+{
+	double worst = 0;
+	int target, offset;
+
+	for (target = 1700; target <= 7000; target += 100)
+	{
+		for (offset = -1500; offset <= 1500; offset += 5)
+		{
+			FloatLaw law = {0, 0};
+			PIDState pid;
+			double floatDuty, fixedDuty;
+
+			if (nearSwitch(target, target + offset))
+			{
+				continue;
+			}
+			FixedPID_Init(&pid, INT_TO_Q16(-INTEGRAL_CLAMP), INT_TO_Q16(INTEGRAL_CLAMP), INT_TO_Q16(-DUTY_CLAMP), INT_TO_Q16(DUTY_CLAMP));
+			floatDuty = floatLaw(&law, target, target + offset);
+			fixedDuty = fixedLaw(&pid, target, target + offset);
+			CHECK(!lawsDiffer(floatDuty, fixedDuty, &worst), "target %d, speed %d: %g duty, expected %g", target, target + offset, fixedDuty, floatDuty);
+		}
+	}
+	printf("single periods: worst difference %g duty\n", worst);
+}
+
+// Long runs of noisy speeds around each target, so the integrals and
+// derivatives have to track each other too
+static void testRuns(void)
+{
+	double worst = 0;
+	int target, i;
+
+	srand(1);
+	for (target = 1700; target <= 7000; target += 500)
+	{
+		FloatLaw law = {0, 0};
+		PIDState pid;
+		double rpm = 0;
+
+		FixedPID_Init(&pid, INT_TO_Q16(-INTEGRAL_CLAMP), INT_TO_Q16(INTEGRAL_CLAMP), INT_TO_Q16(-DUTY_CLAMP), INT_TO_Q16(DUTY_CLAMP));
+		for (i = 0; i < 2000; i++)
+		{
+			double floatDuty, fixedDuty;
+
+			// Spin up, then wander around the target. Both laws integrate
+			// the same way with the startup gains, so a period at the switch
+			// point only differs in its own output
+			rpm = (i < 200) ? (target * i / 200.0) : (target + (rand() % 801) - 400);
+			floatDuty = floatLaw(&law, target, rpm);
+			fixedDuty = fixedLaw(&pid, target, rpm);
+			CHECK(nearSwitch(target, rpm) || !lawsDiffer(floatDuty, fixedDuty, &worst), "target %d, period %d: %g duty, expected %g", target, i, fixedDuty, floatDuty);
+		}
+	}
+	printf("runs: worst difference %g duty\n", worst);
+}
+
+static void testRatio(void)
+{
+	uint32_t denominator;
+
+	// The periscope's RPM numerator and headroom, over periods from
+	// saturation to a crawl
+	for (denominator = 1200; denominator < 100000000; denominator = denominator * 5 / 4)
+	{
+		double expected = 38400000.0 / denominator;
+		double actual = Q16_TO_FLOAT(FixedPID_Ratio(38400000ul, denominator, 6));
+		CHECK(fabs(actual - expected) <= 1.0 / 64, "38400000 / %u: %g, expected %g", denominator, actual, expected);
+	}
+	CHECK(FixedPID_Ratio(38400000ul, 1000, 6) == INT32_MAX, "a glitch-short period should saturate");
+	CHECK(FixedPID_Ratio(1000, 0, 8) == 0, "a zero period should read zero");
+
+	// A move's wheel ticks at full headroom (the drive's follow ratio), up to
+	// and past where the numerator no longer shifts in 32 bits
+	for (denominator = 1000; denominator < 4000000000u; denominator = denominator / 4 * 5)
+	{
+		uint32_t numerator = denominator / 3 * 2;
+		double expected = (double) numerator / denominator;
+		double actual = Q16_TO_FLOAT(FixedPID_Ratio(numerator, denominator, Q16_SHIFT));
+		CHECK(fabs(actual - expected) <= 1.0 / 65536, "%u / %u: %g, expected %g", numerator, denominator, actual, expected);
+	}
+	CHECK(FixedPID_Ratio(4000000000u, 100000, Q16_SHIFT) == INT32_MAX, "a ratio past the Q16 range should saturate");
+}
+
+// Host time per update of each law over a noisy run at one target
+static void testCost(void)
+{
+	enum {UPDATES = 2000000};
+	static q16_t errors[1024];
+	static double rpms[1024];
+	volatile q16_t fixedSink = 0;
+	volatile double floatSink = 0;
+	FloatLaw law = {0, 0};
+	PIDState pid;
+	clock_t start;
+	double fixedTime, floatTime;
+	int i;
+
+	srand(2);
+	for (i = 0; i < 1024; i++)
+	{
+		rpms[i] = 4000 + (rand() % 801) - 400;
+		errors[i] = INT_TO_Q16(4000) - FLOAT_TO_Q16(rpms[i]);
+	}
+	FixedPID_Init(&pid, INT_TO_Q16(-INTEGRAL_CLAMP), INT_TO_Q16(INTEGRAL_CLAMP), INT_TO_Q16(-DUTY_CLAMP), INT_TO_Q16(DUTY_CLAMP));
+
+	start = clock();
+	for (i = 0; i < UPDATES; i++)
+	{
+		q16_t error = errors[i & 1023];
+		fixedSink = FixedPID_Update(&pid, FixedPID_ScheduleGains(&Schedule, error, INT_TO_Q16(4000)), error);
+	}
+	fixedTime = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+	start = clock();
+	for (i = 0; i < UPDATES; i++)
+	{
+		floatSink = floatLaw(&law, 4000, rpms[i & 1023]);
+	}
+	floatTime = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+	(void) fixedSink;
+	(void) floatSink;
+	printf("cost: fixed %.1f ns/update, float %.1f ns/update (host)\n", fixedTime * 1e9 / UPDATES, floatTime * 1e9 / UPDATES);
+}
+
+int main(void)
+{
+	testSinglePeriods();
+	testRuns();
+	testRatio();
+	testCost();
+	return TEST_RESULT();
+}
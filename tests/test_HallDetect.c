@@ -0,0 +1,478 @@
+/****************************************************************************
+ Host test of HallDetect.c on simulated hall sensor edges, fed in capture
+ order as the four interrupts would see them. Each pass drives the sensors
+ over a station at a random frequency and lateral offset; each sensor in
+ the field sees the station's edges with jitter, some edges missed, and
+ stray edges throughout. We compare against the shared buckets it replaced
+ (HallEffect_SM.c before per-sensor detection): how long after the first
+ sensor reaches the field we report the station, how often we report the
+ wrong one or none, and how often stray edges alone report one.
+****************************************************************************/
+#include <math.h>
+#include <stdlib.h>
+#include "DEFINITIONS.h"
+#include "HallDetect.h"
+#include "test.h"
+
+#define PASSES 1000
+#define NOISE_SECONDS 120.0
+#define TICKS_PER_SEC 40000000.0
+#define MAX_EDGES 20000
+
+// As in HallEffect_SM.c
+#define PERIOD_MEASURING_ERROR_TOLERANCE 8
+#define HE_BIN_SHIFT 7
+#define HE_NUM_BINS PERIOD_BIN_COUNT(HE_f_200, HE_f_1000, PERIOD_MEASURING_ERROR_TOLERANCE, HE_BIN_SHIFT)
+#define NUMBER_PULSES_TO_STOP 4
+#define CONFIDENCE_THRESHOLD (NUMBER_PULSES_TO_STOP + 1)
+#define SENSOR_AGREEMENT_BONUS 0
+#define TIMEOUT 0.2						// HALL_EFFECT_TIMEOUT_T, in seconds
+
+static const uint32_t HallEffect_P[HALL_DETECT_FREQUENCIES] = {
+	HE_f_1000, HE_f_947, HE_f_893, HE_f_840, HE_f_787, HE_f_733, HE_f_680, HE_f_627,
+	HE_f_573, HE_f_520, HE_f_467, HE_f_413, HE_f_360, HE_f_307, HE_f_253, HE_f_200};
+static const float LateralPositions[HALL_DETECT_SENSORS] = {
+	-HALL_SENSOR_OUTER_LATERAL, -HALL_SENSOR_INNER_LATERAL, HALL_SENSOR_INNER_LATERAL, HALL_SENSOR_OUTER_LATERAL};
+
+// The simulated field and drive (inches, seconds)
+#define FIELD_RADIUS 1.5
+#define DRIVE_SPEED 8.0
+#define APPROACH 3.0
+#define JITTER_US 1.5
+#define MISSED_EDGES 0.05
+
+static uint8_t Bins[HE_NUM_BINS];
+static uint32_t Lower[HALL_DETECT_FREQUENCIES];
+static uint32_t Upper[HALL_DETECT_FREQUENCIES];
+static PeriodBinTable Table = {.shift = HE_BIN_SHIFT, .numBins = HE_NUM_BINS, .bins = Bins, .lower = Lower, .upper = Upper};
+
+typedef struct {
+	double time;
+	uint8_t sensor;
+} Edge;
+
+static Edge Edges[MAX_EDGES];
+static int NumEdges;
+
+static double gauss(void)
+{
+	double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+	double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+	return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+static double uniform(void)
+{
+	return rand() / (double) RAND_MAX;
+}
+
+static int byTime(const void *a, const void *b)
+{
+	double difference = ((const Edge *) a)->time - ((const Edge *) b)->time;
+	return (difference > 0) - (difference < 0);
+}
+
+static void addEdge(double time, uint8_t sensor)
+{
+	if (NumEdges < MAX_EDGES)
+	{
+		Edges[NumEdges].time = time;
+		Edges[NumEdges].sensor = sensor;
+		NumEdges++;
+	}
+}
+
+// Stray edges on every sensor at strayRate per second, from 0 to duration
+static void addStrays(double duration, double strayRate)
+{
+	for (uint8_t sensor = 0; sensor < HALL_DETECT_SENSORS; sensor++)
+	{
+		double t = 0;
+		while ((strayRate > 0) && ((t -= log((rand() + 1.0) / (RAND_MAX + 1.0)) / strayRate) < duration))
+		{
+			addEdge(t, sensor);
+		}
+	}
+}
+
+// The edges of a pass over a station with the given period, offset right of
+// our centerline. Returns when the first sensor reaches the field
+static double addStation(double period, double offset)
+{
+	double entry = -1;
+
+	for (uint8_t sensor = 0; sensor < HALL_DETECT_SENSORS; sensor++)
+	{
+		double lateral = LateralPositions[sensor] - offset;
+		double reach, start, t;
+
+		if (fabs(lateral) >= FIELD_RADIUS)
+		{
+			continue;
+		}
+		// The sensor is in the field while it is within reach of the station
+		reach = sqrt(FIELD_RADIUS * FIELD_RADIUS - lateral * lateral) / DRIVE_SPEED;
+		start = APPROACH / DRIVE_SPEED - reach;
+		entry = ((entry < 0) || (start < entry)) ? start : entry;
+
+		// Every sensor sees the same field, so the same edges
+		for (t = ceil(start / period) * period; t < start + 2 * reach; t += period)
+		{
+			if (uniform() >= MISSED_EDGES)
+			{
+				addEdge(t + JITTER_US * 1e-6 * gauss(), sensor);
+			}
+		}
+	}
+	return entry;
+}
+
+// The detector it replaced: each sensor's own last capture, one set of buckets
+typedef struct {
+	uint32_t lastCapture[HALL_DETECT_SENSORS];
+	uint8_t buckets[HALL_DETECT_FREQUENCIES];
+} SharedBuckets;
+
+static void resetBuckets(SharedBuckets *shared)
+{
+	for (int i = 0; i < HALL_DETECT_FREQUENCIES; i++)
+	{
+		shared->buckets[i] = 0;
+	}
+}
+
+// Either detector, run as HallEffect_SM.c runs it: a matched period restarts
+// the timeout unless it reports a station, which clears the histories
+typedef struct {
+	bool shared;
+	HallDetector detector;
+	SharedBuckets buckets;
+	double deadline;
+	double firstMatch[HALL_DETECT_SENSORS];	// when each sensor first matched its current frequency
+	float offset;														// the last reported station's offset
+	float arrivalOffset;										// and weighting the sensors by arrival instead
+} Run;
+
+// The offset from when each sensor reached the field rather than how many
+// pulses it counted: the centroid of their positions weighted by how long
+// each has seen the station, plus a period for the edge that started it
+static float arrivalOffset(const Run *run, uint8_t frequencyIndex, double now)
+{
+	double weightedSum = 0;
+	double totalWeight = 0;
+
+	for (int i = 0; i < HALL_DETECT_SENSORS; i++)
+	{
+		if (run->detector.sensors[i].histogram[frequencyIndex] != 0)
+		{
+			double weight = now - run->firstMatch[i] + HallEffect_P[frequencyIndex] * 1e-6;
+			weightedSum += weight * LateralPositions[i];
+			totalWeight += weight;
+		}
+	}
+	return fmax(-MAX_RESOLVED_STATION_OFFSET, fmin(MAX_RESOLVED_STATION_OFFSET, weightedSum / totalWeight));
+}
+
+static void startRun(Run *run, bool shared, uint8_t threshold, uint8_t bonus)
+{
+	run->shared = shared;
+	HallDetect_Init(&run->detector, &Table, threshold, bonus);
+	resetBuckets(&run->buckets);
+	run->deadline = -1;
+}
+
+// Feeds an edge. Returns the frequency index it reported, or PERIOD_BIN_NONE
+static uint8_t feed(Run *run, const Edge *edge, uint32_t startTicks)
+{
+	uint32_t capture = startTicks + (uint32_t) (edge->time * TICKS_PER_SEC);
+	uint8_t frequencyIndex, mask;
+	bool detected;
+
+	if ((run->deadline >= 0) && (edge->time >= run->deadline))
+	{
+		HallDetect_Reset(&run->detector);
+		resetBuckets(&run->buckets);
+		run->deadline = -1;
+	}
+
+	if (run->shared)
+	{
+		frequencyIndex = PeriodBins_Classify(&Table, capture - run->buckets.lastCapture[edge->sensor]);
+		run->buckets.lastCapture[edge->sensor] = capture;
+		if (frequencyIndex == PERIOD_BIN_NONE)
+		{
+			return PERIOD_BIN_NONE;
+		}
+		detected = (++run->buckets.buckets[frequencyIndex] > NUMBER_PULSES_TO_STOP);
+	}
+	else
+	{
+		frequencyIndex = HallDetect_Period(&run->detector, edge->sensor, capture);
+		if (frequencyIndex == PERIOD_BIN_NONE)
+		{
+			return PERIOD_BIN_NONE;
+		}
+		detected = HallDetect_Count(&run->detector, edge->sensor, frequencyIndex, &mask);
+		if (run->detector.sensors[edge->sensor].histogram[frequencyIndex] == 1)
+		{
+			run->firstMatch[edge->sensor] = edge->time;
+		}
+	}
+
+	if (detected)
+	{
+		if (!run->shared)
+		{
+			run->offset = HallDetect_StationOffset(&run->detector, frequencyIndex, LateralPositions, MAX_RESOLVED_STATION_OFFSET);
+			run->arrivalOffset = arrivalOffset(run, frequencyIndex, edge->time);
+		}
+		HallDetect_Reset(&run->detector);
+		resetBuckets(&run->buckets);
+		run->deadline = -1;
+		return frequencyIndex;
+	}
+	run->deadline = edge->time + TIMEOUT;
+	return PERIOD_BIN_NONE;
+}
+
+typedef struct {
+	double meanLatency;				// seconds from the first sensor in the field to the report
+	double worstLatency;
+	double wrong;							// share of passes reporting the wrong station first
+	double missed;						// share of passes reporting nothing
+	double falsePerMinute;		// reports from stray edges alone
+} Result;
+
+static Result simulate(bool shared, uint8_t threshold, uint8_t bonus, double strayRate, unsigned seed)
+{
+	Result result = {0, 0, 0, 0, 0};
+	int detections = 0;
+	int pass, i;
+	double t;
+
+	srand(seed);
+	for (pass = 0; pass < PASSES; pass++)
+	{
+		uint8_t station = rand() % HALL_DETECT_FREQUENCIES;
+		double offset = (2 * uniform() - 1) * (HALL_SENSOR_OUTER_LATERAL + FIELD_RADIUS * 0.9);
+		uint32_t startTicks = rand() * 2654435761u;
+		double entry;
+		Run run;
+
+		NumEdges = 0;
+		entry = addStation(HallEffect_P[station] * 1e-6, offset);
+		addStrays(2 * APPROACH / DRIVE_SPEED, strayRate);
+		qsort(Edges, NumEdges, sizeof(Edge), byTime);
+
+		startRun(&run, shared, threshold, bonus);
+		for (i = 0; i < NumEdges; i++)
+		{
+			uint8_t reported = feed(&run, &Edges[i], startTicks);
+			if (reported != PERIOD_BIN_NONE)
+			{
+				// Stray edges can report before the field; count that as wrong
+				if ((reported != station) || (entry < 0) || (Edges[i].time < entry))
+				{
+					result.wrong++;
+				}
+				else
+				{
+					result.meanLatency += Edges[i].time - entry;
+					result.worstLatency = fmax(result.worstLatency, Edges[i].time - entry);
+					detections++;
+				}
+				break;
+			}
+		}
+		result.missed += (i == NumEdges) && (entry >= 0);
+	}
+	result.meanLatency /= (detections > 0) ? detections : 1;
+	result.wrong /= PASSES;
+	result.missed /= PASSES;
+
+	// Stray edges alone, in chunks that fit the edge buffer
+	for (t = 0; t < NOISE_SECONDS; t += 1)
+	{
+		Run run;
+
+		NumEdges = 0;
+		addStrays(1, strayRate);
+		qsort(Edges, NumEdges, sizeof(Edge), byTime);
+		startRun(&run, shared, threshold, bonus);
+		for (i = 0; i < NumEdges; i++)
+		{
+			result.falsePerMinute += (feed(&run, &Edges[i], 0) != PERIOD_BIN_NONE);
+		}
+	}
+	result.falsePerMinute /= NOISE_SECONDS / 60;
+	return result;
+}
+
+static void print(const char *name, double strayRate, Result r)
+{
+	printf("%-18s strays %4.0f/s: latency mean %5.2f ms worst %5.2f ms, wrong %5.2f%%, missed %5.2f%%, false %6.2f/min\n", name, strayRate,
+		r.meanLatency * 1000, r.worstLatency * 1000, r.wrong * 100, r.missed * 100, r.falsePerMinute);
+}
+
+// Threshold and bonus around the chosen ones, against the shared buckets
+static void testTuning(void)
+{
+	static const double StrayRates[] = {0, 200, 1000};
+	char name[32];
+
+	for (int s = 0; s < 3; s++)
+	{
+		print("shared buckets", StrayRates[s], simulate(true, 0, 0, StrayRates[s], 1));
+		for (uint8_t threshold = CONFIDENCE_THRESHOLD - 1; threshold <= CONFIDENCE_THRESHOLD + 1; threshold++)
+		{
+			for (uint8_t bonus = 0; bonus <= 2; bonus++)
+			{
+				snprintf(name, sizeof(name), "threshold %u+%u", threshold, bonus);
+				print(name, StrayRates[s], simulate(false, threshold, bonus, StrayRates[s], 1));
+			}
+		}
+	}
+}
+
+// The chosen threshold and bonus must lock as soon as the shared buckets did
+// and be fooled far less by stray edges
+static void testChosen(void)
+{
+	Result shared = simulate(true, 0, 0, 0, 2);
+	Result chosen = simulate(false, CONFIDENCE_THRESHOLD, SENSOR_AGREEMENT_BONUS, 0, 2);
+
+	CHECK((chosen.wrong == 0) && (chosen.missed == 0), "clean passes: %g wrong, %g missed", chosen.wrong, chosen.missed);
+	CHECK(chosen.meanLatency <= shared.meanLatency + 0.0002, "clean passes: %g ms to lock, shared buckets took %g ms", chosen.meanLatency * 1000, shared.meanLatency * 1000);
+
+	shared = simulate(true, 0, 0, 200, 2);
+	chosen = simulate(false, CONFIDENCE_THRESHOLD, SENSOR_AGREEMENT_BONUS, 200, 2);
+	CHECK(chosen.wrong <= shared.wrong, "200 strays/s: %g wrong, shared buckets %g", chosen.wrong, shared.wrong);
+	CHECK(chosen.falsePerMinute * 10 <= shared.falsePerMinute, "200 strays/s: %g false/min, shared buckets %g", chosen.falsePerMinute, shared.falsePerMinute);
+
+	shared = simulate(true, 0, 0, 1000, 2);
+	chosen = simulate(false, CONFIDENCE_THRESHOLD, SENSOR_AGREEMENT_BONUS, 1000, 2);
+	CHECK(chosen.wrong * 10 <= shared.wrong, "1000 strays/s: %g wrong, shared buckets %g", chosen.wrong, shared.wrong);
+	CHECK(chosen.falsePerMinute * 10 <= shared.falsePerMinute, "1000 strays/s: %g false/min, shared buckets %g", chosen.falsePerMinute, shared.falsePerMinute);
+}
+
+// Two sensors that each flick between two frequencies, interleaved: neither
+// sees a station, but between them they see one frequency often enough to
+// fill a shared bucket
+static void testInterleaved(void)
+{
+	Run shared, chosen;
+	bool sharedReported = false;
+	bool chosenReported = false;
+	double t[2] = {0, 0.0003};
+	int i;
+
+	NumEdges = 0;
+	for (i = 0; i < 20; i++)
+	{
+		for (uint8_t sensor = 0; sensor < 2; sensor++)
+		{
+			t[sensor] += HallEffect_P[((i + sensor) % 2) ? 9 : 3] * 1e-6;
+			addEdge(t[sensor], sensor);
+		}
+	}
+	qsort(Edges, NumEdges, sizeof(Edge), byTime);
+
+	startRun(&shared, true, 0, 0);
+	startRun(&chosen, false, CONFIDENCE_THRESHOLD, SENSOR_AGREEMENT_BONUS);
+	for (i = 0; i < NumEdges; i++)
+	{
+		sharedReported |= (feed(&shared, &Edges[i], 0) != PERIOD_BIN_NONE);
+		chosenReported |= (feed(&chosen, &Edges[i], 0) != PERIOD_BIN_NONE);
+	}
+	CHECK(sharedReported, "the shared buckets should have been fooled");
+	CHECK(!chosenReported, "interleaved sensors reported a station");
+}
+
+// The offset reported with each clean pass, against where the station was
+// (as far as the sensors can resolve it)
+static void testOffsets(void)
+{
+	double squares = 0, arrivalSquares = 0;
+	double worst = 0, arrivalWorst = 0;
+	int detections = 0;
+
+	srand(3);
+	for (int pass = 0; pass < PASSES; pass++)
+	{
+		uint8_t station = rand() % HALL_DETECT_FREQUENCIES;
+		double offset = (2 * uniform() - 1) * (HALL_SENSOR_OUTER_LATERAL + FIELD_RADIUS * 0.9);
+		double resolved = fmax(-MAX_RESOLVED_STATION_OFFSET, fmin(MAX_RESOLVED_STATION_OFFSET, offset));
+		Run run;
+
+		NumEdges = 0;
+		addStation(HallEffect_P[station] * 1e-6, offset);
+		qsort(Edges, NumEdges, sizeof(Edge), byTime);
+		startRun(&run, false, CONFIDENCE_THRESHOLD, SENSOR_AGREEMENT_BONUS);
+		for (int i = 0; i < NumEdges; i++)
+		{
+			if (feed(&run, &Edges[i], 0) != PERIOD_BIN_NONE)
+			{
+				squares += (run.offset - resolved) * (run.offset - resolved);
+				arrivalSquares += (run.arrivalOffset - resolved) * (run.arrivalOffset - resolved);
+				worst = fmax(worst, fabs(run.offset - resolved));
+				arrivalWorst = fmax(arrivalWorst, fabs(run.arrivalOffset - resolved));
+				detections++;
+				break;
+			}
+		}
+	}
+	printf("offsets: by pulse count RMS %.3f in worst %.3f in, by arrival RMS %.3f in worst %.3f in\n",
+		sqrt(squares / detections), worst, sqrt(arrivalSquares / detections), arrivalWorst);
+	CHECK(sqrt(squares / detections) <= sqrt(arrivalSquares / detections) + 0.02, "pulse counts place the station worse than arrival times");
+}
+
+// The offset's sign is what CenterOnStation turns by: right of the
+// centerline is positive. A station past the inner sensors is as far off as
+// the sensors can tell, however far it really is
+static void testOffsetSign(void)
+{
+	enum {STATION = 10, STATION_PERIOD = HE_f_467};
+	// An inner and outer sensor together put it halfway between them, which
+	// is just as far off
+	static const struct {
+		uint8_t sensors;			// a bit per sensor in the field
+		int sign;
+		bool clamped;
+	} Cases[] = {
+		{0x1, -1, true}, {0x2, -1, false}, {0x3, -1, true}, {0x4, 1, false},
+		{0x8, 1, true}, {0xc, 1, true}, {0x6, 0, false}, {0xf, 0, false}, {0xe, 1, false}};
+
+	for (unsigned c = 0; c < sizeof(Cases) / sizeof(Cases[0]); c++)
+	{
+		static HallDetector detector;
+		uint8_t mask;
+		float offset;
+
+		HallDetect_Init(&detector, &Table, 0xff, SENSOR_AGREEMENT_BONUS);
+		for (uint32_t edge = 0; edge <= NUMBER_PULSES_TO_STOP; edge++)
+		{
+			for (uint8_t sensor = 0; sensor < HALL_DETECT_SENSORS; sensor++)
+			{
+				if ((Cases[c].sensors & (1 << sensor)) && (HallDetect_Period(&detector, sensor, 0xfffff000u + edge * STATION_PERIOD * TICKS_PER_US) == STATION) && (edge > 0))
+				{
+					HallDetect_Count(&detector, sensor, STATION, &mask);
+				}
+			}
+		}
+		offset = HallDetect_StationOffset(&detector, STATION, LateralPositions, MAX_RESOLVED_STATION_OFFSET);
+		CHECK((Cases[c].sign == 0) ? (offset == 0) : ((offset * Cases[c].sign) > 0), "sensors %x: offset %g, expected sign %d", Cases[c].sensors, offset, Cases[c].sign);
+		CHECK(Cases[c].clamped == (fabsf(offset) == MAX_RESOLVED_STATION_OFFSET), "sensors %x: offset %g, clamped at %g", Cases[c].sensors, offset, MAX_RESOLVED_STATION_OFFSET);
+		CHECK(fabsf(offset) <= MAX_RESOLVED_STATION_OFFSET, "sensors %x: offset %g", Cases[c].sensors, offset);
+	}
+}
+
+int main(void)
+{
+	PeriodBins_Build(&Table, HallEffect_P, HALL_DETECT_FREQUENCIES, PERIOD_MEASURING_ERROR_TOLERANCE);
+	testTuning();
+	testChosen();
+	testInterleaved();
+	testOffsets();
+	testOffsetSign();
+	return TEST_RESULT();
+}
@@ -0,0 +1,166 @@
+/****************************************************************************
+ Host test of MotionProfile.c with the drive's limits (DEFINITIONS.h): the
+ profile on its own must respect its limits and stop on the target, and on a
+ simulated wheel under the drive's fixed-point speed loop it must stop much
+ closer to the target than the old step to DEFAULT_DRIVE_RPM.
+****************************************************************************/
+#include <math.h>
+#include "DEFINITIONS.h"
+#include "FixedPID.h"
+#include "MotionProfile.h"
+#include "test.h"
+
+#define TICKS_PER_REV (DRIVE_GEAR_RATIO * ENCODER_PULSES_PER_REV)
+#define CONTROL_PERIOD (DRIVE_CONTROL_INTERRUPT_PERIOD / 1000000.0)
+#define STEP 0.0001		// seconds
+
+// As in DriveTrainControl_Service.c
+#define P_GAIN 1.32f
+#define I_GAIN .15f
+#define RPM_NUMERATOR (40000ul * 60 * 1000 / TICKS_PER_REV)
+#define RPM_HEADROOM 8
+#define STALE_TIME 0.35		// seconds without an edge before we read zero
+
+// The wheel: a first-order response to duty, and friction that stops it
+// when the duty is cut
+#define RPM_PER_DUTY 1.7
+#define TIME_CONSTANT 0.08	// seconds
+#define FRICTION 150				// RPM per second while coasting
+
+static const MotionLimits Limits = MOTION_LIMITS(PROFILE_MAX_RPM, PROFILE_MIN_RPM, PROFILE_ACCELERATION,
+	PROFILE_JERK, PROFILE_STOP_ACCELERATION, PROFILE_POSITION_GAIN, DRIVE_CONTROL_INTERRUPT_PERIOD, TICKS_PER_REV);
+
+static const uint32_t Moves[] = {5, 27, 80, 160, 265, 530, 1000, 2000};
+#define NUM_MOVES (sizeof(Moves) / sizeof(Moves[0]))
+
+// A wheel that follows the setpoints exactly
+static void testLimits(void)
+{
+	unsigned i;
+
+	for (i = 0; i < NUM_MOVES; i++)
+	{
+		MotionProfile profile;
+		double ticks = 0;
+		double lastAccel = 0;
+		double worstAccel = 0;
+		double worstJerk = 0;
+		double top = 0;
+		int periods = 0;
+
+		MotionProfile_Reset(&profile);
+		while ((ticks < Moves[i]) && (periods < 5000))
+		{
+			double lastVelocity = Q16_TO_FLOAT(profile.velocity);
+			double setpoint = Q16_TO_FLOAT(MotionProfile_Step(&profile, &Limits, Moves[i] - (uint32_t) ticks));
+			double accel = Q16_TO_FLOAT(profile.velocity) - lastVelocity;
+
+			worstAccel = fmax(worstAccel, fabs(accel));
+			worstJerk = fmax(worstJerk, fabs(accel - lastAccel));
+			top = fmax(top, setpoint);
+			lastAccel = accel;
+			ticks += setpoint / 60 * TICKS_PER_REV * CONTROL_PERIOD;
+			periods++;
+		}
+
+		CHECK(periods < 5000, "a %u tick move never arrived", Moves[i]);
+		CHECK(ticks < Moves[i] + 1, "a %u tick move ran %g ticks past", Moves[i], ticks - Moves[i]);
+		CHECK(top <= PROFILE_MAX_RPM + 0.01, "a %u tick move reached %g RPM", Moves[i], top);
+		CHECK(worstAccel <= PROFILE_ACCELERATION * CONTROL_PERIOD + 0.01, "a %u tick move accelerated %g RPM in a period", Moves[i], worstAccel);
+		// Reaching zero or full speed cuts the acceleration to zero at once
+		CHECK(worstJerk <= fmax(PROFILE_JERK * CONTROL_PERIOD * CONTROL_PERIOD, worstAccel) + 0.01,
+			"a %u tick move changed its acceleration by %g RPM/period in a period", Moves[i], worstJerk);
+	}
+}
+
+typedef struct {
+	double time;	// seconds until the wheel stopped
+	double error;	// ticks past the target it stopped
+} Result;
+
+// A move of target ticks on the simulated wheel, profiled or stepped to
+// DEFAULT_DRIVE_RPM and cut at the target, as before profiles
+static Result drive(uint32_t target, bool profiled)
+{
+	static const PIDGains Gains = {FLOAT_TO_QGAIN(P_GAIN), FLOAT_TO_QGAIN(P_GAIN * I_GAIN), 0, false};
+	Result result = {-1, 0};
+	MotionProfile profile;
+	PIDState pid;
+	q16_t setpoint = profiled ? 0 : FLOAT_TO_Q16(DEFAULT_DRIVE_RPM);
+	double speed = 0;
+	double position = 0;
+	double lastEdge = -1;
+	double period = 0;
+	double duty = 0;
+	double nextControl = 0;
+	uint32_t ticks = 0;
+	bool arrived = false;
+	double t;
+
+	MotionProfile_Reset(&profile);
+	FixedPID_Init(&pid, 0, FLOAT_TO_Q16(P_GAIN * 100), 0, INT_TO_Q16(100));
+	for (t = 0; t < 10; t += STEP)
+	{
+		if (t >= nextControl)
+		{
+			q16_t rpm = 0;
+
+			nextControl += CONTROL_PERIOD;
+			if (profiled && !arrived)
+			{
+				setpoint = MotionProfile_Step(&profile, &Limits, target - ticks);
+			}
+			if ((period > 0) && (t - lastEdge < STALE_TIME))
+			{
+				rpm = FixedPID_Ratio(RPM_NUMERATOR, (uint32_t) (period * 40000000.0), RPM_HEADROOM);
+			}
+			duty = arrived ? 0 : Q16_TO_INT(FixedPID_Update(&pid, &Gains, setpoint - rpm));
+		}
+
+		speed += ((RPM_PER_DUTY * duty - speed) / TIME_CONSTANT - ((duty == 0) ? FRICTION : 0)) * STEP;
+		speed = fmax(speed, 0);
+		position += speed / 60 * TICKS_PER_REV * STEP;
+		while (position >= ticks + 1)
+		{
+			ticks++;
+			period = (lastEdge >= 0) ? (t - lastEdge) : 0;
+			lastEdge = t;
+			arrived = arrived || (ticks >= target);
+		}
+		if (arrived && (speed < 0.5))
+		{
+			result.time = t;
+			break;
+		}
+	}
+	result.error = position - target;
+	return result;
+}
+
+static void testStops(void)
+{
+	unsigned i;
+
+	printf("ticks   stepped: time   past    profiled: time   past\n");
+	for (i = 0; i < NUM_MOVES; i++)
+	{
+		Result stepped = drive(Moves[i], false);
+		Result profiled = drive(Moves[i], true);
+
+		printf("%5u   %13.3f s %5.1f   %14.3f s %5.1f\n", Moves[i], stepped.time, stepped.error, profiled.time, profiled.error);
+		CHECK(profiled.time > 0, "a profiled %u tick move never stopped", Moves[i]);
+		CHECK(fabs(profiled.error) < 10, "a profiled %u tick move stopped %g ticks past", Moves[i], profiled.error);
+		CHECK(fabs(profiled.error) < stepped.error, "a profiled %u tick move stopped %g ticks past, stepped %g", Moves[i], profiled.error, stepped.error);
+		if (Moves[i] >= 265)
+		{
+			CHECK(profiled.time < stepped.time, "a profiled %u tick move took %g s, stepped %g s", Moves[i], profiled.time, stepped.time);
+		}
+	}
+}
+
+int main(void)
+{
+	testLimits();
+	testStops();
+	return TEST_RESULT();
+}
@@ -0,0 +1,517 @@
+/****************************************************************************
+ Host test of MotionQueue.c: moves come out in order across wraps of the
+ ring, a full queue refuses more, and the blend ticks take in just the moves
+ that carry straight on. Then the drive's tick moves (DriveTrainControl_Service.c)
+ on two simulated wheels, each under its velocity estimate, feed-forward map
+ and speed loop, to time two-leg trips chained through ES_ARRIVED (with the
+ master's latency before the next move) against the same legs queued.
+****************************************************************************/
+#include <math.h>
+#include <stdlib.h>
+#include "DEFINITIONS.h"
+#include "FeedForward.h"
+#include "FixedPID.h"
+#include "MotionProfile.h"
+#include "MotionQueue.h"
+#include "DriveMove.h"
+#include "VelocityEstimate.h"
+#include "test.h"
+
+#define STEP 1e-5						// seconds
+#define TICKS_PER_SEC 40000000.0
+#define TICKS_PER_REV (DRIVE_GEAR_RATIO * ENCODER_PULSES_PER_REV)
+#define CONTROL_PERIOD (DRIVE_CONTROL_INTERRUPT_PERIOD / 1000000.0)
+#define TICKS_PER_INCH (TICKS_PER_REV / WHEEL_CIRCUMFERENCE)
+
+// As in DriveTrainControl_Service.c
+#define P_GAIN 1.32f
+#define I_GAIN .15f
+#define DUTY_MAX 100
+#define RPM_NUMERATOR (40000ul * 60 * 1000 / TICKS_PER_REV)
+#define RPM_HEADROOM 8
+#define FEEDFORWARD_INTEGRAL 10
+#define FEEDFORWARD_SETTLED_RPM 5
+#define FEEDFORWARD_TRIM_RATE 1.7e-5f
+#define SYNC_GAIN 4.0f
+#define SYNC_MAX_RPM 20.0f
+#define ARRIVAL_TOLERANCE 2
+#define SETTLE_PERIODS 15
+
+// The nominal wheel: RPM per duty, time constant (s) and friction while
+// coasting (RPM/s)
+#define RPM_PER_DUTY 1.7
+#define TIME_CONSTANT 0.08
+#define FRICTION 150
+
+static const MotionLimits DriveLimits = MOTION_LIMITS(PROFILE_MAX_RPM, PROFILE_MIN_RPM, PROFILE_ACCELERATION,
+	PROFILE_JERK, PROFILE_STOP_ACCELERATION, PROFILE_POSITION_GAIN, DRIVE_CONTROL_INTERRUPT_PERIOD, TICKS_PER_REV);
+static const PIDGains Gains = {FLOAT_TO_QGAIN(P_GAIN), FLOAT_TO_QGAIN(P_GAIN * I_GAIN), 0, false};
+
+static bool sameMove(const MotionPrimitive *a, const MotionPrimitive *b)
+{
+	return (a->leftTicks == b->leftTicks) && (a->rightTicks == b->rightTicks)
+		&& (a->negativeLeft == b->negativeLeft) && (a->negativeRight == b->negativeRight);
+}
+
+// Fill and empty the queue by every amount, so head wraps at every offset
+static void testOrder(void)
+{
+	MotionQueue queue;
+	MotionPrimitive move;
+	uint32_t pushed = 0;
+	uint32_t popped = 0;
+
+	MotionQueue_Clear(&queue);
+	for (int round = 0; round < 20; round++)
+	{
+		int fill = 1 + round % MOTION_QUEUE_SIZE;
+
+		for (int i = 0; i < fill; i++)
+		{
+			move = (MotionPrimitive) {pushed, pushed + 1, pushed & 1, pushed & 2};
+			CHECK(MotionQueue_Push(&queue, &move), "a queue holding %d refused a move", i);
+			pushed++;
+		}
+		CHECK(MotionQueue_Next(&queue)->leftTicks == popped, "next is move %u, expected %u", MotionQueue_Next(&queue)->leftTicks, popped);
+		while (MotionQueue_Pop(&queue, &move))
+		{
+			MotionPrimitive expected = {popped, popped + 1, popped & 1, popped & 2};
+
+			CHECK(sameMove(&move, &expected), "popped move %u, expected %u", move.leftTicks, popped);
+			popped++;
+		}
+		CHECK(MotionQueue_Next(&queue) == NULL, "an empty queue has a next move");
+	}
+	CHECK(popped == pushed, "%u moves went in and %u came out", pushed, popped);
+
+	// A full queue refuses a move without touching those it holds
+	for (uint32_t i = 0; i < MOTION_QUEUE_SIZE; i++)
+	{
+		move = (MotionPrimitive) {i, i, false, false};
+		MotionQueue_Push(&queue, &move);
+	}
+	move = (MotionPrimitive) {99, 99, false, false};
+	CHECK(!MotionQueue_Push(&queue, &move), "a full queue took a move");
+	CHECK(queue.count == MOTION_QUEUE_SIZE, "a full queue holds %u moves", queue.count);
+	MotionQueue_Pop(&queue, &move);
+	CHECK(move.leftTicks == 0, "a refused move displaced the oldest (popped %u)", move.leftTicks);
+
+	MotionQueue_Clear(&queue);
+	CHECK(!MotionQueue_Pop(&queue, &move), "clear left moves in the queue");
+}
+
+static void testBlend(void)
+{
+	static const MotionPrimitive Forward = {300, 300, false, false};
+	static const MotionPrimitive Back = {200, 200, true, true};
+	static const MotionPrimitive TurnLeft = {100, 100, true, false};
+	static const MotionPrimitive LeftArc = {150, 400, false, false};
+	static const MotionPrimitive RightArc = {400, 150, false, false};
+	MotionQueue queue;
+
+	CHECK(MotionQueue_Continues(&Forward, &Forward), "a straight move doesn't continue another");
+	CHECK(!MotionQueue_Continues(&Forward, &Back), "reversing continues a move");
+	CHECK(!MotionQueue_Continues(&Forward, &TurnLeft), "a turn continues a straight move");
+	CHECK(MotionQueue_Continues(&Forward, &RightArc), "an arc led by the left wheel doesn't continue a straight move");
+	CHECK(!MotionQueue_Continues(&RightArc, &LeftArc), "an arc continues one led by the other wheel");
+
+	// Straight on, straight on, an arc on the same lead wheel, then a turn
+	// that has to stop; only the moves before the turn blend
+	MotionQueue_Clear(&queue);
+	MotionQueue_Push(&queue, &Forward);
+	MotionQueue_Push(&queue, &RightArc);
+	MotionQueue_Push(&queue, &TurnLeft);
+	MotionQueue_Push(&queue, &Forward);
+	CHECK(MotionQueue_BlendTicks(&queue, &Forward) == 700, "blended %u ticks, expected 700", MotionQueue_BlendTicks(&queue, &Forward));
+	CHECK(MotionQueue_BlendTicks(&queue, &Back) == 0, "blended %u ticks onto a reversing move", MotionQueue_BlendTicks(&queue, &Back));
+	CHECK(MotionQueue_BlendTicks(&queue, &LeftArc) == 0, "blended %u ticks onto the other wheel's arc", MotionQueue_BlendTicks(&queue, &LeftArc));
+
+	// The right wheel leads this one, and counts its ticks
+	MotionQueue_Clear(&queue);
+	MotionQueue_Push(&queue, &LeftArc);
+	MotionQueue_Push(&queue, &LeftArc);
+	CHECK(MotionQueue_BlendTicks(&queue, &LeftArc) == 800, "blended %u ticks, expected 800", MotionQueue_BlendTicks(&queue, &LeftArc));
+}
+
+// One simulated wheel, and the drive's loop on it
+typedef struct {
+	double speed;				// RPM, forwards positive
+	double position;		// ticks, forwards positive
+	double travelled;		// ticks either way, for the encoder
+	uint8_t duty;
+	FeedForwardMap map;
+	VelocityEstimate estimate;
+	PIDState pid;
+} SimWheel;
+
+static double Now;
+static SimWheel Wheel_Left;
+static SimWheel Wheel_Right;
+static int Arrivals;
+
+// As in DriveTrainControl_Service.c, with PROFILED_MOVES
+static uint32_t LeftEncoderTicks;
+static uint32_t RightEncoderTicks;
+static bool LeftForward;
+static bool RightForward;
+static uint32_t TargetTicks_Left;
+static uint32_t TargetTicks_Right;
+static q16_t RPMTargetQ16_Left;
+static q16_t RPMTargetQ16_Right;
+static MotionProfile Profile;
+static bool Profiling;
+static bool LeftLeads;
+static q16_t FollowRatio;
+static MotionQueue Queue;
+static bool QueueActive;
+static MotionPrimitive CurrentMove;
+static uint32_t BlendTicks;
+static uint32_t SyncBase_Left;
+static uint32_t SyncBase_Right;
+static SettleState Settle;
+
+static void startMove(uint32_t leftTicks, uint32_t rightTicks, bool negativeLeft, bool negativeRight);
+
+static void setTargetDriveSpeed(float left, float right)
+{
+	Profiling = false;
+	if (left != 0)
+	{
+		LeftForward = left > 0;
+	}
+	if (right != 0)
+	{
+		RightForward = right > 0;
+	}
+	RPMTargetQ16_Left = FLOAT_TO_Q16(fabsf(left));
+	RPMTargetQ16_Right = FLOAT_TO_Q16(fabsf(right));
+	FixedPID_Reset(&Wheel_Left.pid);
+	FixedPID_Reset(&Wheel_Right.pid);
+}
+
+static void clearMotionQueue(void)
+{
+	QueueActive = false;
+	MotionQueue_Clear(&Queue);
+	BlendTicks = 0;
+}
+
+static void setTargetEncoderTicks(uint32_t leftTicks, uint32_t rightTicks, bool negativeLeft, bool negativeRight)
+{
+	clearMotionQueue();
+	startMove(leftTicks, rightTicks, negativeLeft, negativeRight);
+}
+
+static void startProfile(uint32_t leftTicks, uint32_t rightTicks, bool negativeLeft, bool negativeRight)
+{
+	uint32_t leadTicks = (leftTicks > rightTicks) ? leftTicks : rightTicks;
+	float leftRPM;
+	float rightRPM;
+
+	if (leadTicks == 0)
+	{
+		setTargetDriveSpeed(0, 0);
+		return;
+	}
+	leftRPM = (PROFILE_MIN_RPM * leftTicks) / leadTicks;
+	rightRPM = (PROFILE_MIN_RPM * rightTicks) / leadTicks;
+	setTargetDriveSpeed(negativeLeft ? -leftRPM : leftRPM, negativeRight ? -rightRPM : rightRPM);
+	LeftLeads = leftTicks >= rightTicks;
+	FollowRatio = LeftLeads ? FixedPID_Ratio(rightTicks, leftTicks, Q16_SHIFT) : FixedPID_Ratio(leftTicks, rightTicks, Q16_SHIFT);
+	SyncBase_Left = LeftEncoderTicks;
+	SyncBase_Right = RightEncoderTicks;
+	DriveMove_ResetSettle(&Settle);
+	MotionProfile_Reset(&Profile);
+	Profiling = true;
+}
+
+static void startMove(uint32_t leftTicks, uint32_t rightTicks, bool negativeLeft, bool negativeRight)
+{
+	CurrentMove = (MotionPrimitive) {leftTicks, rightTicks, negativeLeft, negativeRight};
+	TargetTicks_Left = leftTicks;
+	TargetTicks_Right = rightTicks;
+	startProfile(leftTicks, rightTicks, negativeLeft, negativeRight);
+}
+
+static void queueMove(uint32_t leftTicks, uint32_t rightTicks, bool negativeLeft, bool negativeRight)
+{
+	MotionPrimitive move = {leftTicks, rightTicks, negativeLeft, negativeRight};
+
+	if (QueueActive)
+	{
+		CHECK(MotionQueue_Push(&Queue, &move), "the queue was full");
+		BlendTicks = MotionQueue_BlendTicks(&Queue, &CurrentMove);
+		return;
+	}
+	clearMotionQueue();
+	startMove(leftTicks, rightTicks, negativeLeft, negativeRight);
+	QueueActive = true;
+}
+
+static bool startNextMove(void)
+{
+	MotionPrimitive next;
+
+	if (!QueueActive || !MotionQueue_Pop(&Queue, &next))
+	{
+		QueueActive = false;
+		return false;
+	}
+	LeftEncoderTicks = 0;
+	RightEncoderTicks = 0;
+	if (Profiling && MotionQueue_Continues(&CurrentMove, &next))
+	{
+		CurrentMove = next;
+		TargetTicks_Left = next.leftTicks;
+		TargetTicks_Right = next.rightTicks;
+		FollowRatio = LeftLeads ? FixedPID_Ratio(next.rightTicks, next.leftTicks, Q16_SHIFT) : FixedPID_Ratio(next.leftTicks, next.rightTicks, Q16_SHIFT);
+		SyncBase_Left = 0;
+		SyncBase_Right = 0;
+		BlendTicks = MotionQueue_BlendTicks(&Queue, &CurrentMove);
+		return true;
+	}
+	startMove(next.leftTicks, next.rightTicks, next.negativeLeft, next.negativeRight);
+	BlendTicks = MotionQueue_BlendTicks(&Queue, &CurrentMove);
+	return true;
+}
+
+static bool nextMoveContinues(void)
+{
+	const MotionPrimitive *next = MotionQueue_Next(&Queue);
+
+	return Profiling && QueueActive && (next != NULL) && MotionQueue_Continues(&CurrentMove, next);
+}
+
+static bool reachedTarget(void)
+{
+	uint32_t target = TargetTicks_Left + TargetTicks_Right;
+
+	return (target != 0) && ((LeftEncoderTicks + RightEncoderTicks) >= target);
+}
+
+// Stands in for posting ES_ARRIVED to the master
+static void arrive(void)
+{
+	setTargetEncoderTicks(0, 0, false, false);
+	LeftEncoderTicks = 0;
+	RightEncoderTicks = 0;
+	Arrivals++;
+}
+
+static q16_t syncCorrection(void)
+{
+	uint32_t lead = LeftLeads ? (LeftEncoderTicks - SyncBase_Left) : (RightEncoderTicks - SyncBase_Right);
+	uint32_t follow = LeftLeads ? (RightEncoderTicks - SyncBase_Right) : (LeftEncoderTicks - SyncBase_Left);
+
+	return DriveMove_SyncCorrection(lead, follow, FollowRatio, FLOAT_TO_Q16(SYNC_GAIN), FLOAT_TO_Q16(SYNC_MAX_RPM));
+}
+
+static void updateProfile(void)
+{
+	uint32_t tickSum = LeftEncoderTicks + RightEncoderTicks;
+	uint32_t targetSum = TargetTicks_Left + TargetTicks_Right;
+	uint32_t ticksToGo = BlendTicks;
+	q16_t leadRPM;
+	q16_t followRPM;
+	q16_t correction;
+
+	if (DriveMove_Settled(&Settle, tickSum, targetSum, ARRIVAL_TOLERANCE, SETTLE_PERIODS))
+	{
+		if (!startNextMove())
+		{
+			arrive();
+		}
+		return;
+	}
+	ticksToGo += DriveMove_TicksToGo(tickSum, targetSum, FollowRatio);
+	leadRPM = MotionProfile_Step(&Profile, &DriveLimits, ticksToGo);
+	followRPM = Q16_MUL(leadRPM, FollowRatio);
+	if (leadRPM != 0)
+	{
+		correction = syncCorrection();
+		leadRPM = (leadRPM > -correction) ? (leadRPM + correction) : 0;
+		followRPM = (followRPM > correction) ? (followRPM - correction) : 0;
+	}
+	RPMTargetQ16_Left = LeftLeads ? leadRPM : followRPM;
+	RPMTargetQ16_Right = LeftLeads ? followRPM : leadRPM;
+}
+
+static void encoderEdge(SimWheel *wheel, uint32_t *ticks)
+{
+	(*ticks)++;
+	if (reachedTarget() && nextMoveContinues())
+	{
+		startNextMove();
+	}
+	VelocityEstimate_Edge(&wheel->estimate, (uint32_t) (Now * TICKS_PER_SEC));
+}
+
+// The speed loop, as test_CollisionDetect runs it
+static void controlWheel(SimWheel *wheel, q16_t setpoint)
+{
+	q16_t rpm = VelocityEstimate_RPM(&wheel->estimate, (uint32_t) (Now * TICKS_PER_SEC));
+	q16_t error = setpoint - rpm;
+	q16_t requested = FixedPID_Update(&wheel->pid, &Gains, error) + FeedForward_Duty(&wheel->map, setpoint);
+
+	requested = (requested > INT_TO_Q16(DUTY_MAX)) ? INT_TO_Q16(DUTY_MAX) : ((requested < 0) ? 0 : requested);
+	if ((setpoint != 0) && (requested < INT_TO_Q16(DUTY_MAX)) && (Q16_ABS(error) < INT_TO_Q16(FEEDFORWARD_SETTLED_RPM)))
+	{
+		FeedForward_Trim(&wheel->map, wheel->pid.integral);
+	}
+	wheel->duty = (setpoint == 0) ? 0 : (uint8_t) Q16_TO_INT(requested);
+}
+
+// The wheel's motor, driven the way the drive last set it, and its encoder,
+// which counts ticks either way
+static void stepWheel(SimWheel *wheel, bool forward, uint32_t *ticks)
+{
+	double drive = (forward ? 1 : -1) * RPM_PER_DUTY * wheel->duty;
+	double before = wheel->speed;
+
+	wheel->speed += (drive - wheel->speed) / TIME_CONSTANT * STEP;
+	if (wheel->duty == 0)
+	{
+		wheel->speed -= ((before > 0) ? FRICTION : -FRICTION) * STEP;
+		if ((wheel->speed > 0) != (before > 0))
+		{
+			wheel->speed = 0;
+		}
+	}
+	wheel->position += wheel->speed / 60 * TICKS_PER_REV * STEP;
+	wheel->travelled += fabs(wheel->speed) / 60 * TICKS_PER_REV * STEP;
+	if (wheel->travelled >= 1)
+	{
+		wheel->travelled -= 1;
+		encoderEdge(wheel, ticks);
+	}
+}
+
+static void initWheel(SimWheel *wheel)
+{
+	FeedForwardPoint points[2] = {{0, 0}, {DUTY_MAX, (uint16_t) (DUTY_MAX * RPM_PER_DUTY)}};
+
+	wheel->speed = 0;
+	wheel->position = 0;
+	wheel->travelled = 0;
+	wheel->duty = 0;
+	FeedForward_Init(&wheel->map, points, 2, FLOAT_TO_QGAIN(FEEDFORWARD_TRIM_RATE));
+	VelocityEstimate_Init(&wheel->estimate, RPM_NUMERATOR, RPM_HEADROOM, ENCODER_PULSES_PER_REV, 12 * 40000ul, 100 * 40000ul);
+	FixedPID_Init(&wheel->pid, INT_TO_Q16(-FEEDFORWARD_INTEGRAL), INT_TO_Q16(FEEDFORWARD_INTEGRAL), INT_TO_Q16(-DUTY_MAX), INT_TO_Q16(DUTY_MAX));
+}
+
+static void resetDrive(void)
+{
+	Now = 0;
+	Arrivals = 0;
+	initWheel(&Wheel_Left);
+	initWheel(&Wheel_Right);
+	LeftEncoderTicks = 0;
+	RightEncoderTicks = 0;
+	Settle.lastTickSum = 0;
+	setTargetEncoderTicks(0, 0, false, false);
+}
+
+// Runs the drive for the given time, or until it has posted arrivals
+// ES_ARRIVED in all. Returns false if it ran out of time first
+static bool run(double seconds, int arrivals)
+{
+	double end = Now + seconds;
+	double nextControl = ceil(Now / CONTROL_PERIOD) * CONTROL_PERIOD;
+
+	while (Now < end)
+	{
+		if (Now >= nextControl)
+		{
+			nextControl += CONTROL_PERIOD;
+			if (Profiling)
+			{
+				updateProfile();
+			}
+			controlWheel(&Wheel_Left, RPMTargetQ16_Left);
+			controlWheel(&Wheel_Right, RPMTargetQ16_Right);
+			if (Arrivals >= arrivals)
+			{
+				return true;
+			}
+		}
+		stepWheel(&Wheel_Left, LeftForward, &LeftEncoderTicks);
+		stepWheel(&Wheel_Right, RightForward, &RightEncoderTicks);
+		Now += STEP;
+	}
+	return false;
+}
+
+// Seconds to run two legs chained (each from ES_ARRIVED, after the master's
+// latency) or queued, or -1 if they never arrived
+static double trip(const MotionPrimitive *first, const MotionPrimitive *second, double latency, bool queued)
+{
+	resetDrive();
+	if (queued)
+	{
+		queueMove(first->leftTicks, first->rightTicks, first->negativeLeft, first->negativeRight);
+		queueMove(second->leftTicks, second->rightTicks, second->negativeLeft, second->negativeRight);
+		return run(10, 1) ? Now : -1;
+	}
+	setTargetEncoderTicks(first->leftTicks, first->rightTicks, first->negativeLeft, first->negativeRight);
+	if (!run(10, 1))
+	{
+		return -1;
+	}
+	run(latency, 2);
+	setTargetEncoderTicks(second->leftTicks, second->rightTicks, second->negativeLeft, second->negativeRight);
+	return run(10, 2) ? Now : -1;
+}
+
+static void testDeadTime(void)
+{
+	static const double Latencies[] = {0, 0.002, 0.010};
+	uint32_t turn = (uint32_t) ((M_PI / 2) * DISTANCE_BETWEEN_WHEELS * TICKS_PER_REV / (2 * WHEEL_CIRCUMFERENCE));
+	uint32_t inches24 = (uint32_t) (24 * TICKS_PER_INCH);
+	uint32_t inches12 = (uint32_t) (12 * TICKS_PER_INCH);
+	const MotionPrimitive legs[2][2] = {
+		{{turn, turn, false, true}, {inches24, inches24, false, false}},
+		{{inches24, inches24, false, false}, {inches12, inches12, false, false}}};
+	static const char *Names[2] = {"90 deg turn + 24 in", "24 in + 12 in straight"};
+
+	printf("                          chained (latency)               queued\n");
+	printf("                          0 ms      2 ms      10 ms\n");
+	for (int i = 0; i < 2; i++)
+	{
+		double chained[3];
+		double queued = trip(&legs[i][0], &legs[i][1], 0, true);
+		double leftTicks = Wheel_Left.position;
+		double rightTicks = Wheel_Right.position;
+
+		for (int j = 0; j < 3; j++)
+		{
+			chained[j] = trip(&legs[i][0], &legs[i][1], Latencies[j], false);
+			CHECK(chained[j] > 0, "%s chained at %g ms never arrived", Names[i], Latencies[j] * 1000);
+		}
+		printf("%-24s  %.3f s   %.3f s   %.3f s    %.3f s\n", Names[i], chained[0], chained[1], chained[2], queued);
+		CHECK(queued > 0, "%s queued never arrived", Names[i]);
+		CHECK(chained[2] > chained[0], "%s chained didn't slow with latency", Names[i]);
+
+		// A turn then a drive still stops to reverse a wheel, so queueing it
+		// only saves the latency, give or take a few periods of settling
+		CHECK(queued < chained[0] + 5 * CONTROL_PERIOD, "%s queued took %.3f s, chained %.3f s", Names[i], queued, chained[0]);
+
+		// Each wheel ends up where the two legs put it
+		double wantLeft = (legs[i][0].negativeLeft ? -1.0 : 1.0) * legs[i][0].leftTicks + (legs[i][1].negativeLeft ? -1.0 : 1.0) * legs[i][1].leftTicks;
+		double wantRight = (legs[i][0].negativeRight ? -1.0 : 1.0) * legs[i][0].rightTicks + (legs[i][1].negativeRight ? -1.0 : 1.0) * legs[i][1].rightTicks;
+		CHECK(fabs(leftTicks - wantLeft) < 6 && fabs(rightTicks - wantRight) < 6, "%s queued ended at %.1f, %.1f ticks, expected %.0f, %.0f",
+			Names[i], leftTicks, rightTicks, wantLeft, wantRight);
+		if (i == 1)
+		{
+			// Straight on blends into one profile, with no stop between
+			CHECK(queued < chained[0] - 0.1, "a blended straight move only saved %.3f s", chained[0] - queued);
+		}
+	}
+}
+
+int main(void)
+{
+	testOrder();
+	testBlend();
+	testDeadTime();
+	return TEST_RESULT();
+}
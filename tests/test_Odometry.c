@@ -0,0 +1,208 @@
+/****************************************************************************
+ Host test of Odometry.c: random drives about the field (spins, straight
+ legs, arcs, some in reverse) tick by tick, against the exact motion of a
+ wheel pivoting about the other in double. The same half-tick midpoint steps
+ in double split the drift into what the step model costs and what the
+ fixed point costs. Also times a tick; that is the host's cost, not the
+ Cortex-M4's.
+****************************************************************************/
+#include <math.h>
+#include <stdlib.h>
+#include <time.h>
+#include "DEFINITIONS.h"
+#include "Odometry.h"
+#include "test.h"
+
+#define PI 3.14159265358979
+#define LEGS 2000
+#define FIELD_MARGIN 12.0
+#define CHECKPOINTS (LEGS + 1)
+
+// As in Odometry.c
+#define TICK_INCHES ((double) WHEEL_CIRCUMFERENCE / (ENCODER_PULSES_PER_REV * DRIVE_GEAR_RATIO))
+
+typedef struct {
+	double x;
+	double y;
+	double theta;					// radians, counterclockwise
+} Pose;
+
+// Exactly: one wheel moves a tick, pivoting us about the other
+static void exactTick(Pose *pose, int left, int forward)
+{
+	double turn = (forward ? 1 : -1) * (left ? -1 : 1) * TICK_INCHES / DISTANCE_BETWEEN_WHEELS;
+	double chord = DISTANCE_BETWEEN_WHEELS * sin(fabs(turn) / 2);
+
+	pose->x += (forward ? 1 : -1) * chord * cos(pose->theta + turn / 2);
+	pose->y += (forward ? 1 : -1) * chord * sin(pose->theta + turn / 2);
+	pose->theta += turn;
+}
+
+// As Odometry.c models it: half a tick straight along the heading midway through the turn
+static void modelTick(Pose *pose, int left, int forward)
+{
+	double turn = (forward ? 1 : -1) * (left ? -1 : 1) * TICK_INCHES / DISTANCE_BETWEEN_WHEELS;
+
+	pose->x += (forward ? 1 : -1) * TICK_INCHES / 2 * cos(pose->theta + turn / 2);
+	pose->y += (forward ? 1 : -1) * TICK_INCHES / 2 * sin(pose->theta + turn / 2);
+	pose->theta += turn;
+}
+
+static void tick(Pose *exact, Pose *model, int left, int forward)
+{
+	exactTick(exact, left, forward);
+	modelTick(model, left, forward);
+	if (left)
+	{
+		Odometry_LeftTick(forward);
+	}
+	else
+	{
+		Odometry_RightTick(forward);
+	}
+}
+
+// Drive the two wheels the given number of ticks, interleaving their edges
+// evenly as the encoders would
+static long drive(Pose *exact, Pose *model, long leftTicks, long rightTicks)
+{
+	long leftCount = labs(leftTicks);
+	long rightCount = labs(rightTicks);
+	long total = leftCount + rightCount;
+	long leftDone = 0;
+
+	for (long i = 0; i < total; i++)
+	{
+		// The left wheel's share of the edges so far, rounded
+		if ((leftDone * total) < ((i + 1) * leftCount) - (total / 2))
+		{
+			tick(exact, model, 1, leftTicks > 0);
+			leftDone++;
+		}
+		else
+		{
+			tick(exact, model, 0, rightTicks > 0);
+		}
+	}
+	return total;
+}
+
+static double headingError(double a, double b)
+{
+	return fabs(remainder(a - b, 2 * PI)) * 180 / PI;
+}
+
+static int byValue(const void *a, const void *b)
+{
+	double difference = *(const double *) a - *(const double *) b;
+	return (difference > 0) - (difference < 0);
+}
+
+static void testDrift(void)
+{
+	static double positionErrors[CHECKPOINTS], modelErrors[CHECKPOINTS];
+	Pose exact = {FIELD_LENGTH / 2, FIELD_LENGTH / 2, 0};
+	Pose model = exact;
+	double worstHeading = 0, worstModelHeading = 0;
+	double travel = 0;
+	long ticks = 0;
+	int count = 0;
+
+	srand(33);
+	Odometry_Anchor(exact.x, exact.y, 0);
+	for (int leg = 0; leg < LEGS; leg++)
+	{
+		double targetX = FIELD_MARGIN + (FIELD_LENGTH - 2 * FIELD_MARGIN) * (rand() / (double) RAND_MAX);
+		double targetY = FIELD_MARGIN + (FIELD_LENGTH - 2 * FIELD_MARGIN) * (rand() / (double) RAND_MAX);
+		double distance = hypot(targetX - exact.x, targetY - exact.y);
+		double turn = remainder(atan2(targetY - exact.y, targetX - exact.x) - exact.theta, 2 * PI);
+		int reverse = rand() % 4 == 0;
+		long spinTicks, legTicks;
+		float x, y, theta;
+
+		// Backing up, we face away from the target
+		if (reverse)
+		{
+			turn = remainder(turn + PI, 2 * PI);
+		}
+		spinTicks = lround(fabs(turn) * DISTANCE_BETWEEN_WHEELS / 2 / TICK_INCHES);
+		ticks += drive(&exact, &model, (turn > 0) ? -spinTicks : spinTicks, (turn > 0) ? spinTicks : -spinTicks);
+
+		legTicks = lround(distance / TICK_INCHES) * (reverse ? -1 : 1);
+		if (rand() % 3 == 0)
+		{
+			// An arc: one wheel a little faster, so we land near the target
+			long difference = legTicks / 20;
+			ticks += drive(&exact, &model, legTicks - difference, legTicks + difference);
+		}
+		else
+		{
+			ticks += drive(&exact, &model, legTicks, legTicks);
+		}
+		travel += (2 * spinTicks + 2 * labs(legTicks)) * TICK_INCHES;
+
+		Odometry_GetPose(&x, &y, &theta);
+		positionErrors[count] = hypot(x - exact.x, y - exact.y);
+		modelErrors[count] = hypot(model.x - exact.x, model.y - exact.y);
+		worstHeading = fmax(worstHeading, headingError(Odometry_Heading() * (2 * PI / 4294967296.0), exact.theta));
+		worstModelHeading = fmax(worstModelHeading, headingError(model.theta, exact.theta));
+		count++;
+	}
+
+	printf("drift: %d legs, %ld ticks, %.0f in of wheel travel\n", LEGS, ticks, travel);
+	printf("  final position error %.3g in (model alone %.3g in)\n", positionErrors[count - 1], modelErrors[count - 1]);
+	printf("  worst heading error %.2g deg (model alone %.2g deg)\n", worstHeading, worstModelHeading);
+	qsort(positionErrors, count, sizeof(double), byValue);
+	qsort(modelErrors, count, sizeof(double), byValue);
+	printf("  position error after each leg: median %.3g, 99%% %.3g, max %.3g in (model alone max %.3g in)\n",
+		positionErrors[count / 2], positionErrors[(count * 99) / 100], positionErrors[count - 1], modelErrors[count - 1]);
+
+	CHECK(worstHeading < 0.01, "heading drifted %g deg", worstHeading);
+	CHECK(positionErrors[count - 1] < 0.5, "position drifted %g in", positionErrors[count - 1]);
+}
+
+// Spinning in place turns the heading error into nothing but heading, so the
+// rounding of each tick's turn shows on its own
+static void testSpin(void)
+{
+	Pose exact = {FIELD_LENGTH / 2, FIELD_LENGTH / 2, 0};
+	Pose model = exact;
+	long ticks;
+	float x, y, theta;
+
+	Odometry_Anchor(exact.x, exact.y, 0);
+	ticks = drive(&exact, &model, -100000, 100000);
+	Odometry_GetPose(&x, &y, &theta);
+	printf("spin: %ld ticks, %.1f turns; heading error %.2g deg, position error %.3g in\n", ticks, exact.theta / (2 * PI),
+		headingError(Odometry_Heading() * (2 * PI / 4294967296.0), exact.theta), hypot(x - exact.x, y - exact.y));
+	CHECK(headingError(Odometry_Heading() * (2 * PI / 4294967296.0), exact.theta) < 0.01, "spinning drifted the heading");
+	CHECK(hypot(x - exact.x, y - exact.y) < 0.1, "spinning in place moved us %g in", hypot(x - exact.x, y - exact.y));
+}
+
+static void testCost(void)
+{
+	volatile uint32_t sink = 0;
+	clock_t start;
+	double seconds;
+	long i;
+
+	Odometry_Anchor(FIELD_LENGTH / 2, FIELD_LENGTH / 2, 0);
+	start = clock();
+	for (i = 0; i < 20000000; i++)
+	{
+		// Back and forth, so we stay put
+		Odometry_LeftTick((i & 2) != 0);
+		sink = Odometry_Heading();
+	}
+	seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+	(void) sink;
+	printf("cost: %.1f ns per tick (host)\n", seconds * 1e9 / i);
+}
+
+int main(void)
+{
+	testDrift();
+	testSpin();
+	testCost();
+	return TEST_RESULT();
+}
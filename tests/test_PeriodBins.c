@@ -0,0 +1,155 @@
+/****************************************************************************
+ Host test of PeriodBins.c with the hall effect and beacon tables: every tick
+ count from a microsecond under the shortest range to one over the longest
+ must classify as the divide and tolerance scan it replaced did, and no bin
+ may hold two candidates (a later period would silently take over an
+ earlier one's bins). Also times a classification each way; that is the
+ host's cost, not the Cortex-M4's, where the divide is the expensive part.
+****************************************************************************/
+#include <time.h>
+#include "DEFINITIONS.h"
+#include "PeriodBins.h"
+#include "test.h"
+
+// As in HallEffect_SM.c
+#define HE_TOLERANCE 8
+#define HE_BIN_SHIFT 7
+#define NUMBER_FREQUENCIES 16
+#define HE_NUM_BINS PERIOD_BIN_COUNT(HE_f_200, HE_f_1000, HE_TOLERANCE, HE_BIN_SHIFT)
+
+static const uint32_t HallEffect_P[NUMBER_FREQUENCIES] = {
+	HE_f_1000, HE_f_947, HE_f_893, HE_f_840, HE_f_787, HE_f_733, HE_f_680, HE_f_627,
+	HE_f_573, HE_f_520, HE_f_467, HE_f_413, HE_f_360, HE_f_307, HE_f_253, HE_f_200};
+
+// As in PhotoTransistor_Service.c
+#define BEACON_TOLERANCE 10
+#define BEACON_BIN_SHIFT 7
+#define NUMBER_BEACON_FREQUENCIES 4
+#define BEACON_P_NW 690
+#define BEACON_P_NE 588
+#define BEACON_P_SE 800
+#define BEACON_P_SW 513
+#define BEACON_NUM_BINS PERIOD_BIN_COUNT(BEACON_P_SW, BEACON_P_SE, BEACON_TOLERANCE, BEACON_BIN_SHIFT)
+
+static const uint32_t BeaconPeriods[NUMBER_BEACON_FREQUENCIES] = {BEACON_P_NW, BEACON_P_NE, BEACON_P_SE, BEACON_P_SW};
+
+// The classification the table replaced: divide to microseconds, then take
+// the first period within tolerance
+static uint8_t scanClassify(uint32_t ticks, const uint32_t *periods, uint8_t numPeriods, uint32_t tolerance)
+{
+	uint32_t period = (ticks * MICROSECONDS_DIVISOR) / TICKS_PER_MS;
+
+	for (uint8_t i = 0; i < numPeriods; i++)
+	{
+		if ((period <= periods[i] + tolerance) && (period >= periods[i] - tolerance))
+		{
+			return i;
+		}
+	}
+	return PERIOD_BIN_NONE;
+}
+
+// The span of tick counts we check: a microsecond either side of the ranges
+static void tickSpan(const uint32_t *periods, uint8_t numPeriods, uint32_t tolerance, uint32_t *first, uint32_t *last)
+{
+	uint32_t minPeriod = periods[0];
+	uint32_t maxPeriod = periods[0];
+
+	for (uint8_t i = 1; i < numPeriods; i++)
+	{
+		minPeriod = (periods[i] < minPeriod) ? periods[i] : minPeriod;
+		maxPeriod = (periods[i] > maxPeriod) ? periods[i] : maxPeriod;
+	}
+	*first = (minPeriod - tolerance - 1) * TICKS_PER_US;
+	*last = (maxPeriod + tolerance + 2) * TICKS_PER_US - 1;
+}
+
+static void testTable(const char *name, PeriodBinTable *table, const uint32_t *periods, uint8_t numPeriods, uint32_t tolerance)
+{
+	static uint8_t candidates[1024];
+	uint32_t first, last, ticks, b;
+	volatile uint8_t sink = 0;
+	int mismatches = 0;
+	int matched = 0;
+	clock_t start;
+	double scanTime, binTime;
+	int pass;
+
+	PeriodBins_Build(table, periods, numPeriods, tolerance);
+
+	// Count the periods whose exact tick range reaches into each bin
+	CHECK(table->numBins <= sizeof(candidates), "%s: %u bins is more than the test holds", name, table->numBins);
+	for (b = 0; b < table->numBins; b++)
+	{
+		candidates[b] = 0;
+	}
+	for (uint8_t i = 0; i < numPeriods; i++)
+	{
+		for (b = (table->lower[i] - table->base) >> table->shift; b <= ((table->upper[i] - table->base) >> table->shift); b++)
+		{
+			CHECK(b < table->numBins, "%s: period %u runs past the table", name, periods[i]);
+			if (b < table->numBins)
+			{
+				candidates[b]++;
+			}
+		}
+	}
+	for (b = 0; b < table->numBins; b++)
+	{
+		CHECK(candidates[b] <= 1, "%s: bin %u holds %u candidates", name, b, candidates[b]);
+	}
+
+	tickSpan(periods, numPeriods, tolerance, &first, &last);
+	for (ticks = first; ticks <= last; ticks++)
+	{
+		uint8_t expected = scanClassify(ticks, periods, numPeriods, tolerance);
+		uint8_t actual = PeriodBins_Classify(table, ticks);
+
+		matched += (expected != PERIOD_BIN_NONE);
+		// Only the first few are worth printing
+		if ((actual != expected) && (++mismatches <= 10))
+		{
+			printf("%s: %u ticks classified as %u, expected %u\n", name, ticks, actual, expected);
+		}
+	}
+	CHECK(mismatches == 0, "%s: %d tick counts classified differently", name, mismatches);
+
+	start = clock();
+	for (pass = 0; pass < 20; pass++)
+	{
+		for (ticks = first; ticks <= last; ticks++)
+		{
+			sink = scanClassify(ticks, periods, numPeriods, tolerance);
+		}
+	}
+	scanTime = (double) (clock() - start) / CLOCKS_PER_SEC;
+	start = clock();
+	for (pass = 0; pass < 20; pass++)
+	{
+		for (ticks = first; ticks <= last; ticks++)
+		{
+			sink = PeriodBins_Classify(table, ticks);
+		}
+	}
+	binTime = (double) (clock() - start) / CLOCKS_PER_SEC;
+	(void) sink;
+
+	printf("%s: ticks %u-%u, %d in range; scan %.1f ns, bins %.1f ns per period (host)\n", name, first, last, matched,
+		scanTime * 1e9 / (20.0 * (last - first + 1)), binTime * 1e9 / (20.0 * (last - first + 1)));
+}
+
+int main(void)
+{
+	static uint8_t heBins[HE_NUM_BINS];
+	static uint32_t heLower[NUMBER_FREQUENCIES];
+	static uint32_t heUpper[NUMBER_FREQUENCIES];
+	static uint8_t beaconBins[BEACON_NUM_BINS];
+	static uint32_t beaconLower[NUMBER_BEACON_FREQUENCIES];
+	static uint32_t beaconUpper[NUMBER_BEACON_FREQUENCIES];
+	PeriodBinTable heTable = {.shift = HE_BIN_SHIFT, .numBins = HE_NUM_BINS, .bins = heBins, .lower = heLower, .upper = heUpper};
+	PeriodBinTable beaconTable = {.shift = BEACON_BIN_SHIFT, .numBins = BEACON_NUM_BINS, .bins = beaconBins, .lower = beaconLower, .upper = beaconUpper};
+
+	testTable("hall effect", &heTable, HallEffect_P, NUMBER_FREQUENCIES, HE_TOLERANCE);
+	testTable("beacons", &beaconTable, BeaconPeriods, NUMBER_BEACON_FREQUENCIES, BEACON_TOLERANCE);
+	return TEST_RESULT();
+}
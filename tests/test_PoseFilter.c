@@ -0,0 +1,214 @@
+/****************************************************************************
+ Host test of PoseFilter.c and Odometry.c: a robot with slipping wheels
+ drives random legs about the field while the periscope turns, and every
+ beacon it sees goes to the filter a little later, with the odometry
+ snapshot taken when it was seen (as PhotoTransistor_Service does).
+****************************************************************************/
+#include <math.h>
+#include <stdlib.h>
+#include "DEFINITIONS.h"
+#include "Odometry.h"
+#include "PoseFilter.h"
+#include "test.h"
+
+#define PI 3.14159265358979
+#define STEP 0.0005						// seconds
+#define PERISCOPE_TURN (60.0 / PERISCOPE_SWEEP_RPM)	// seconds per periscope turn
+#define BEARING_NOISE 1.5				// degrees, 1 sigma
+#define WHEEL_SLIP 0.05					// 1 sigma, per step
+// Seconds between handling the bearings seen. Handling them every half turn
+// means each one is applied after the corrections from the ones before it
+#define EVENT_PERIOD (PERISCOPE_TURN / 2)
+#define NUM_BEACONS 4
+#define MAX_PENDING 8
+
+static const double BeaconX[NUM_BEACONS] = {0, FIELD_LENGTH, FIELD_LENGTH, 0};
+static const double BeaconY[NUM_BEACONS] = {FIELD_LENGTH, FIELD_LENGTH, 0, 0};
+
+// A bearing seen but not yet handled
+typedef struct {
+	int beacon;
+	double angle;
+	OdometrySnapshot seen;
+} Pending;
+
+// The true pose, and what the simulation has counted
+static double X, Y, Theta;
+static double LeftTravel, RightTravel;
+static double Periscope, Time, NextEvent;
+static double LastRelative[NUM_BEACONS];
+static Pending Queue[MAX_PENDING];
+static int NumPending;
+static int Used, Refused, Stale;
+
+static double gauss(void)
+{
+	double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+	double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+	return sqrt(-2 * log(u)) * cos(2 * PI * v);
+}
+
+static double wrap(double angle)
+{
+	while (angle >= PI)
+	{
+		angle -= 2 * PI;
+	}
+	while (angle < -PI)
+	{
+		angle += 2 * PI;
+	}
+	return angle;
+}
+
+// Hand the queued bearings to the filter, each against the pose it was seen at
+static void handleBearings(void)
+{
+	int i;
+
+	for (i = 0; i < NumPending; i++)
+	{
+		float x, y, theta;
+
+		if (!Odometry_SnapshotPose(&Queue[i].seen, &Queue[i].seen, &x, &y, &theta))
+		{
+			Stale++;
+			continue;
+		}
+		PoseFilter_Predict();
+		if (PoseFilter_UpdateBearing(BeaconX[Queue[i].beacon], BeaconY[Queue[i].beacon], Queue[i].angle, x, y, theta))
+		{
+			Used++;
+		}
+		else
+		{
+			Refused++;
+		}
+	}
+	NumPending = 0;
+}
+
+// One step with the wheels at the given speeds (in/s)
+static void step(double left, double right)
+{
+	double tick = WHEEL_CIRCUMFERENCE / (ENCODER_PULSES_PER_REV * DRIVE_GEAR_RATIO);
+	double leftMove = left * STEP * (1 + WHEEL_SLIP * gauss());
+	double rightMove = right * STEP * (1 + WHEEL_SLIP * gauss());
+	double turn = (rightMove - leftMove) / DISTANCE_BETWEEN_WHEELS;
+	int k;
+
+	X += (leftMove + rightMove) / 2 * cos(Theta + turn / 2);
+	Y += (leftMove + rightMove) / 2 * sin(Theta + turn / 2);
+	Theta += turn;
+
+	// The encoders count the commanded motion, not the slip
+	LeftTravel += left * STEP;
+	RightTravel += right * STEP;
+	while (fabs(LeftTravel) >= tick)
+	{
+		Odometry_LeftTick(LeftTravel > 0);
+		LeftTravel -= (LeftTravel > 0) ? tick : -tick;
+	}
+	while (fabs(RightTravel) >= tick)
+	{
+		Odometry_RightTick(RightTravel > 0);
+		RightTravel -= (RightTravel > 0) ? tick : -tick;
+	}
+
+	Periscope += 2 * PI * STEP / PERISCOPE_TURN;
+	Time += STEP;
+	for (k = 0; k < NUM_BEACONS; k++)
+	{
+		double bearing = atan2(BeaconY[k] - Y, BeaconX[k] - X) - Theta;
+		double relative = wrap(Periscope - bearing);
+
+		if ((LastRelative[k] < 0) && (relative >= 0) && (relative < 0.5) && (NumPending < MAX_PENDING))
+		{
+			Queue[NumPending].beacon = k;
+			Queue[NumPending].angle = bearing * 180 / PI + BEARING_NOISE * gauss();
+			Odometry_Snapshot(&Queue[NumPending].seen);
+			NumPending++;
+		}
+		LastRelative[k] = relative;
+	}
+
+	if (Time >= NextEvent)
+	{
+		NextEvent += EVENT_PERIOD;
+		handleBearings();
+	}
+}
+
+// A correction moves snapshots already taken with it; an anchor invalidates them
+static void testSnapshots(void)
+{
+	OdometrySnapshot before;
+	float x, y, theta;
+	float snapX, snapY, snapTheta;
+	int i;
+
+	Odometry_Anchor(20, 30, 45);
+	for (i = 0; i < 500; i++)
+	{
+		Odometry_LeftTick(true);
+		Odometry_RightTick(true);
+	}
+	Odometry_GetPose(&x, &y, &theta);
+	Odometry_Snapshot(&before);
+	Odometry_Correct(1.5f, -0.75f, 2);
+
+	CHECK(Odometry_SnapshotPose(&before, &before, &snapX, &snapY, &snapTheta), "a correction shouldn't invalidate a snapshot");
+	CHECK((fabs(snapX - (x + 1.5)) < 0.001) && (fabs(snapY - (y - 0.75)) < 0.001) && (fabs(snapTheta - (theta + 2)) < 0.001),
+		"the snapshot should move with the correction: (%g, %g, %g), expected (%g, %g, %g)", snapX, snapY, snapTheta, x + 1.5, y - 0.75, theta + 2);
+
+	Odometry_Anchor(20, 30, 45);
+	CHECK(!Odometry_SnapshotPose(&before, &before, &snapX, &snapY, &snapTheta), "an anchor should invalidate a snapshot");
+}
+
+// Random legs, handling bearings as they come in, and no stops to look
+static void testDriving(void)
+{
+	double speed = DEFAULT_DRIVE_RPM / 60 * WHEEL_CIRCUMFERENCE;
+	double squares = 0;
+	int legs = 100;
+	int leg;
+
+	srand(5);
+	X = 20;
+	Y = 20;
+	Theta = 0.3;
+	PoseFilter_Reset(X, Y, Theta * 180 / PI);
+	for (leg = 0; leg < legs; leg++)
+	{
+		double targetX = 10 + 76 * (rand() / (double) RAND_MAX);
+		double targetY = 10 + 76 * (rand() / (double) RAND_MAX);
+		float x, y, theta;
+		double turn, distance, t;
+
+		Odometry_GetPose(&x, &y, &theta);
+		turn = wrap(atan2(targetY - y, targetX - x) - theta * PI / 180);
+		distance = hypot(targetX - x, targetY - y);
+		for (t = 0; t < fabs(turn) * DISTANCE_BETWEEN_WHEELS / 2 / speed; t += STEP)
+		{
+			step((turn > 0) ? -speed : speed, (turn > 0) ? speed : -speed);
+		}
+		for (t = 0; t < distance / speed; t += STEP)
+		{
+			step(speed, speed);
+		}
+		Odometry_GetPose(&x, &y, &theta);
+		squares += (x - X) * (x - X) + (y - Y) * (y - Y);
+	}
+
+	printf("%d legs: %d bearings used, %d gated out, %d stale; RMS error on arrival %.2f in\n", legs, Used, Refused, Stale, sqrt(squares / legs));
+	CHECK(Stale == 0, "%d bearings were refused because another one corrected odometry first", Stale);
+	CHECK(Refused * 20 < Used, "too many bearings gated out (%d of %d)", Refused, Used + Refused);
+	CHECK(sqrt(squares / legs) < 1.5, "RMS error on arrival %g in", sqrt(squares / legs));
+}
+
+int main(void)
+{
+	testSnapshots();
+	testDriving();
+	return TEST_RESULT();
+}
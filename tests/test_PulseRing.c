@@ -0,0 +1,199 @@
+/****************************************************************************
+ Host test of PulseRing.c, the ring between the phototransistor capture
+ interrupt and ProcessBeaconPulses. Pulses must come out in order across many
+ wraps of the indices, a full ring must drop (and count) new pulses without
+ touching the ones waiting, including the one the task is part way through,
+ and the count must saturate. Then random bursts and drains, checked by
+ sequence number, and how long the task can leave the ring at the fastest
+ beacon before it drops a pulse.
+****************************************************************************/
+#include <stdlib.h>
+#include "DEFINITIONS.h"
+#include "PeriodBins.h"
+#include "PulseRing.h"
+#include "test.h"
+
+// As in PhotoTransistor_Service.c, the fastest beacon's period (us)
+#define BEACON_P_SW 513
+
+// Each pulse carries its sequence number as its capture time
+static uint32_t Pushed;
+static uint32_t Drained;
+
+static bool push(PulseRing *ring)
+{
+	BeaconPulse *pulse = PulseRing_Claim(ring);
+
+	if (pulse == NULL)
+	{
+		return false;
+	}
+	pulse->capture = Pushed;
+	pulse->angle = (float) (Pushed % 360);
+	PulseRing_Publish(ring);
+	Pushed++;
+	return true;
+}
+
+// Drains up to count pulses, checking they come out in order. Returns how many it took
+static int drain(PulseRing *ring, int count)
+{
+	const BeaconPulse *pulse;
+	int taken = 0;
+
+	while ((taken < count) && ((pulse = PulseRing_Oldest(ring)) != NULL))
+	{
+		CHECK(pulse->capture == Drained, "drained pulse %u, expected %u", pulse->capture, Drained);
+		CHECK(pulse->angle == (float) (Drained % 360), "pulse %u came out with angle %g", Drained, pulse->angle);
+		PulseRing_Release(ring);
+		Drained++;
+		taken++;
+	}
+	return taken;
+}
+
+static void reset(PulseRing *ring)
+{
+	PulseRing_Init(ring);
+	Pushed = 0;
+	Drained = 0;
+}
+
+// Bursts of every size from 1 to full, so head and tail wrap at every offset
+static void testWrap(void)
+{
+	static PulseRing ring;
+
+	reset(&ring);
+	for (int round = 0; round < 10; round++)
+	{
+		for (int burst = 1; burst < PULSE_RING_SIZE; burst++)
+		{
+			for (int i = 0; i < burst; i++)
+			{
+				CHECK(push(&ring), "a burst of %d didn't fit (round %d)", burst, round);
+			}
+			CHECK(drain(&ring, PULSE_RING_SIZE) == burst, "a burst of %d didn't all come back", burst);
+			CHECK(PulseRing_Oldest(&ring) == NULL, "the ring should be empty");
+		}
+	}
+	printf("wrap: %u pulses through, %u dropped\n", Pushed, PulseRing_Dropped(&ring));
+	CHECK(PulseRing_Dropped(&ring) == 0, "%u pulses dropped", PulseRing_Dropped(&ring));
+}
+
+static void testOverflow(void)
+{
+	static PulseRing ring;
+	const BeaconPulse *held;
+	int i;
+
+	// Start part way round, so full straddles the wrap
+	reset(&ring);
+	for (i = 0; i < PULSE_RING_SIZE / 2 + 5; i++)
+	{
+		push(&ring);
+	}
+	drain(&ring, PULSE_RING_SIZE);
+
+	for (i = 0; push(&ring); i++)
+	{
+	}
+	CHECK(i == PULSE_RING_SIZE - 1, "the ring took %d pulses, expected %d", i, PULSE_RING_SIZE - 1);
+	CHECK(PulseRing_Dropped(&ring) == 1, "dropped %u, expected 1", PulseRing_Dropped(&ring));
+
+	// The task has the oldest pulse in hand when more arrive. They must not land on it
+	held = PulseRing_Oldest(&ring);
+	for (i = 0; i < 10; i++)
+	{
+		CHECK(!push(&ring), "a full ring took a pulse");
+	}
+	CHECK(held->capture == Drained, "the pulse being handled was overwritten (%u, expected %u)", held->capture, Drained);
+	CHECK(PulseRing_Dropped(&ring) == 11, "dropped %u, expected 11", PulseRing_Dropped(&ring));
+
+	// Freeing one slot makes room for exactly one
+	CHECK(drain(&ring, 1) == 1, "couldn't drain a full ring");
+	CHECK(push(&ring), "a freed slot wasn't reused");
+	CHECK(!push(&ring), "the ring took more than the slot freed");
+	CHECK(drain(&ring, PULSE_RING_SIZE) == PULSE_RING_SIZE - 1, "the ring didn't give back all it held");
+
+	// The count stops at its limit rather than wrapping back to zero
+	for (i = 0; i < PULSE_RING_SIZE - 1; i++)
+	{
+		push(&ring);
+	}
+	for (i = 0; i < 70000; i++)
+	{
+		push(&ring);
+	}
+	CHECK(PulseRing_Dropped(&ring) == 0xffff, "dropped count %u, expected it saturated", PulseRing_Dropped(&ring));
+	drain(&ring, PULSE_RING_SIZE);
+
+	PulseRing_Init(&ring);
+	CHECK((PulseRing_Dropped(&ring) == 0) && (PulseRing_Oldest(&ring) == NULL), "init should empty the ring");
+}
+
+// Random bursts and drains; what comes out is what went in, minus the drops
+static void testRandom(void)
+{
+	static PulseRing ring;
+	uint32_t refused = 0;
+
+	srand(40);
+	reset(&ring);
+	for (int step = 0; step < 200000; step++)
+	{
+		int burst = rand() % 22;
+
+		for (int i = 0; i < burst; i++)
+		{
+			// A refused pulse keeps its number, as if it never came
+			refused += !push(&ring);
+		}
+		drain(&ring, rand() % 24);
+	}
+	drain(&ring, PULSE_RING_SIZE);
+	printf("random: %u pulses through, %u dropped\n", Pushed, PulseRing_Dropped(&ring));
+	CHECK(Drained == Pushed, "%u pulses went in and %u came out", Pushed, Drained);
+	CHECK(PulseRing_Dropped(&ring) == ((refused < 0xffff) ? refused : 0xffff), "counted %u drops, saw %u", PulseRing_Dropped(&ring), refused);
+}
+
+// Pulses at the fastest beacon, with the task coming back at a fixed gap
+static void testDrainGap(void)
+{
+	static PulseRing ring;
+	uint32_t period = BEACON_P_SW * TICKS_PER_US;
+	uint32_t longestClean = 0;
+
+	for (uint32_t gapPulses = 8; gapPulses <= 80; gapPulses++)
+	{
+		reset(&ring);
+		for (int visit = 0; visit < 50; visit++)
+		{
+			for (uint32_t i = 0; i < gapPulses; i++)
+			{
+				push(&ring);
+			}
+			drain(&ring, PULSE_RING_SIZE);
+		}
+		if (PulseRing_Dropped(&ring) == 0)
+		{
+			longestClean = gapPulses;
+		}
+		else
+		{
+			CHECK(PulseRing_Dropped(&ring) == 50 * (gapPulses - (PULSE_RING_SIZE - 1)), "a gap of %u pulses dropped %u", gapPulses, PulseRing_Dropped(&ring));
+		}
+	}
+	printf("drain gap: at %u us pulses the task can be away %.1f ms (%u pulses) without a drop\n", BEACON_P_SW,
+		longestClean * period / (double) TICKS_PER_MS, longestClean);
+	CHECK(longestClean == PULSE_RING_SIZE - 1, "the ring holds %u pulses, expected %d", longestClean, PULSE_RING_SIZE - 1);
+}
+
+int main(void)
+{
+	testWrap();
+	testOverflow();
+	testRandom();
+	testDrainGap();
+	return TEST_RESULT();
+}
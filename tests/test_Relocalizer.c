@@ -0,0 +1,135 @@
+/****************************************************************************
+ Host test of Relocalizer.c: a stationary robot at a random pose feeds it
+ noisy bearings from the corner beacons in periscope order until it
+ converges or gives up.
+****************************************************************************/
+#include <math.h>
+#include <stdlib.h>
+#include "DEFINITIONS.h"
+#include "Relocalizer.h"
+#include "test.h"
+
+#define PI 3.14159265358979
+#define TRIALS 300
+#define BEARING_NOISE 1.5		// degrees, 1 sigma
+#define WRONG_DISTANCE 6.0	// inches off that we count as converging on the wrong pose
+#define NUM_BEACONS 4
+
+static const double BeaconX[NUM_BEACONS] = {0, FIELD_LENGTH, FIELD_LENGTH, 0};
+static const double BeaconY[NUM_BEACONS] = {FIELD_LENGTH, FIELD_LENGTH, 0, 0};
+
+typedef struct {
+	int converged;
+	int ambiguous;
+	int wrong;
+	double bearings;		// mean bearings to converge
+	double error;				// mean position error when converged (inches)
+} Result;
+
+uint16_t ES_Timer_GetTime(void)
+{
+	return (uint16_t) rand();
+}
+
+static double gauss(void)
+{
+	double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+	double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+	return sqrt(-2 * log(u)) * cos(2 * PI * v);
+}
+
+static double uniform(void)
+{
+	return rand() / (double) RAND_MAX;
+}
+
+// Runs TRIALS poses, seeing the beacons in visible (a bit per beacon), with a
+// share of the bearings replaced by stray pulses
+static Result run(unsigned visible, double outliers)
+{
+	Result result = {0, 0, 0, 0, 0};
+	int trial;
+
+	srand(7);
+	for (trial = 0; trial < TRIALS; trial++)
+	{
+		double x = 8 + 80 * uniform();
+		double y = 8 + 80 * uniform();
+		double theta = 2 * PI * uniform();
+		RelocalizeResult status = RELOCALIZE_SEARCHING;
+		int beacon = rand() % NUM_BEACONS;
+		int bearings = 0;
+
+		Relocalizer_Start();
+		while (status == RELOCALIZE_SEARCHING)
+		{
+			double angle;
+
+			beacon = (beacon + 1) % NUM_BEACONS;
+			if (!(visible & (1u << beacon)))
+			{
+				continue;
+			}
+			angle = (atan2(BeaconY[beacon] - y, BeaconX[beacon] - x) - theta) * 180 / PI + BEARING_NOISE * gauss();
+			if (uniform() < outliers)
+			{
+				angle += 20 + 100 * uniform();
+			}
+			Relocalizer_AddBearing(BeaconX[beacon], BeaconY[beacon], angle, 0, 0, 0);
+			while ((status = Relocalizer_Step()) == RELOCALIZE_WORKING);
+			bearings++;
+		}
+
+		if (status == RELOCALIZE_CONVERGED)
+		{
+			float estimateX, estimateY, estimateTheta;
+			double error;
+
+			Relocalizer_GetEstimate(&estimateX, &estimateY, &estimateTheta);
+			error = hypot(estimateX - x, estimateY - y);
+			result.converged++;
+			result.bearings += bearings;
+			result.error += error;
+			result.wrong += (error > WRONG_DISTANCE);
+		}
+		else
+		{
+			result.ambiguous++;
+		}
+	}
+	if (result.converged)
+	{
+		result.bearings /= result.converged;
+		result.error /= result.converged;
+	}
+	return result;
+}
+
+static void report(const char *name, Result result)
+{
+	printf("%s: %d of %d converged after %.1f bearings, mean error %.2f in, %d wrong, %d ambiguous\n",
+		name, result.converged, TRIALS, result.bearings, result.error, result.wrong, result.ambiguous);
+}
+
+int main(void)
+{
+	Result clean = run(0xf, 0);
+	Result stray = run(0xf, 0.05);
+	Result three = run(0x7, 0);
+	Result two = run(0x3, 0);
+
+	report("four beacons", clean);
+	report("four beacons, 5% stray pulses", stray);
+	report("three beacons", three);
+	report("two beacons", two);
+
+	CHECK(clean.converged * 100 >= TRIALS * 98, "with every beacon in sight we should converge");
+	CHECK(clean.error < 2.5, "mean error %g in", clean.error);
+	CHECK(clean.bearings < 8, "converging took %g bearings", clean.bearings);
+	CHECK(stray.converged * 100 >= TRIALS * 90, "stray pulses shouldn't stop us converging");
+	CHECK(stray.wrong * 100 <= TRIALS * 5, "%d of %d trials converged on the wrong pose", stray.wrong, TRIALS);
+	CHECK(three.converged * 100 >= TRIALS * 80, "three beacons should usually be enough");
+	CHECK(three.wrong * 100 <= TRIALS * 10, "%d of %d trials converged on the wrong pose", three.wrong, TRIALS);
+	CHECK(two.converged == 0, "two beacons don't fix our pose, so we should always give up");
+	return TEST_RESULT();
+}
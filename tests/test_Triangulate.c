@@ -0,0 +1,426 @@
+/****************************************************************************
+ Host test of Triangulate.c and the Geometry.c kernel under it. The trig
+ helpers must track libm, and the single precision triangulation must
+ reproduce the double precision code it replaced (PositionLogic_Service.c,
+ with its rotated Y stored) over a grid of poses and all four beacon
+ triples. Prints the error distribution against the true pose, and times a
+ fix each way; that is the host's cost, not the Cortex-M4's, where the old
+ double math ran in software.
+ Then puts noisy bearings through the fixes CalculateAbsolutePosition makes
+ (a triple alone, three beacons refined, four refined and checked against
+ the residual), standing and driving between sightings, and counts how
+ often a fix is rejected with and without one bad bearing. Last, counts
+ fixes per periscope revolution under the old rule (the three in sweep
+ order, then start over) and the new one (any three fresh).
+****************************************************************************/
+#include <math.h>
+#include <stdlib.h>
+#include <time.h>
+#include "DEFINITIONS.h"
+#include "Geometry.h"
+#include "Triangulate.h"
+#include "test.h"
+
+#define PI 3.14159265358979
+#define NUM_BEACONS 4
+#define GRID_MARGIN 4.0				// inches from the walls
+#define GRID_STEP 4.0
+#define HEADING_STEP 10.0			// degrees
+#define MAX_GRID_POSES 80000
+
+// The pose grid for the noisy fixes
+#define NOISY_GRID_SIDE 15
+#define NOISY_GRID_HEADINGS 9
+#define NOISY_GRID_POSES (NOISY_GRID_SIDE * NOISY_GRID_SIDE * NOISY_GRID_HEADINGS)
+#define BEARING_NOISE 0.5					// degrees, standard deviation
+#define BAD_BEARING 15.0					// degrees
+
+// As in PositionLogic_Service.c
+#define MAX_BEACON_RESIDUAL 2.0f
+
+// As in PhotoTransistor_Service.c, in periscope revolutions at PERISCOPE_SWEEP_RPM
+#define BEACON_MAX_AGE_REVS ((2000 * PERISCOPE_SWEEP_RPM) / 60000)
+#define SWEEP_SIGHTINGS 40000
+#define MISSED_SIGHTING 0.1
+
+// As in PositionLogic_Service.c and PhotoTransistor_Service.c, indexed by
+// BEACON_INDEX_: where each beacon is, the two before it going clockwise, and
+// the shift from the SW corner solution for the triple it starts
+static const double BeaconX[NUM_BEACONS] = {0, FIELD_LENGTH, FIELD_LENGTH, 0};
+static const double BeaconY[NUM_BEACONS] = {FIELD_LENGTH, FIELD_LENGTH, 0, 0};
+static const int PriorBeacons[NUM_BEACONS][2] = {{1, 2}, {2, 3}, {3, 0}, {0, 1}};
+static const int XShift[NUM_BEACONS] = {0, 0, FIELD_LENGTH, FIELD_LENGTH};
+static const int YShift[NUM_BEACONS] = {0, FIELD_LENGTH, FIELD_LENGTH, 0};
+static const int ThetaShift[NUM_BEACONS] = {0, 270, 180, 90};
+
+// The periscope angle (degrees) at which a robot at (x, y, theta) sees beacon k
+static double periscopeAngle(double x, double y, double theta, int k)
+{
+	double angle = atan2(BeaconY[k] - y, BeaconX[k] - x) * 180 / PI - theta;
+	return angle - 360 * floor(angle / 360);
+}
+
+static float wrapDegrees(float angle)
+{
+	while (angle > 360.0f)
+	{
+		angle -= 360.0f;
+	}
+	while (angle < 0.0f)
+	{
+		angle += 360.0f;
+	}
+	return angle;
+}
+
+// The triangulation Triangulate_Triple replaced, in double as it was
+// compiled, with the rotated Y stored (it used to be dropped)
+static void doubleTriple(float A, float B, float C, int xShift, int yShift, int thetaShift, double *x, double *y, double *theta)
+{
+	float BMinusC = wrapDegrees(B - C) * (PI / 180);
+	float AMinusB = wrapDegrees(A - B) * (PI / 180);
+	float tempAngle = (1.5f * PI) - BMinusC - AMinusB;
+	float atan = atan2(-sin(tempAngle), (sin(AMinusB) / sin(BMinusC)) + cos(tempAngle));
+	float gamma = (atan < 0) ? -atan : PI - atan;
+	float delta = tempAngle - gamma;
+	float myX = 96.0 - (96.0 * sin(gamma) * (sin(PI - gamma - BMinusC) / sin(PI - BMinusC)));
+	float myY = 96.0 - (96.0 * sin(delta) * (sin(PI - delta - AMinusB) / sin(PI - AMinusB)));
+	float myTheta = wrapDegrees((((360 - B) * (PI / 180)) + gamma + BMinusC - (.5f * PI)) * (180 / PI));
+
+	*x = (myX * cos(thetaShift * (PI / 180)) - myY * sin(thetaShift * (PI / 180))) + xShift;
+	*y = (myX * sin(thetaShift * (PI / 180)) + myY * cos(thetaShift * (PI / 180))) + yShift;
+	*theta = wrapDegrees(myTheta + thetaShift);
+}
+
+static double gauss(void)
+{
+	double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+	double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+	return sqrt(-2 * log(u)) * cos(2 * PI * v);
+}
+
+static double headingError(double a, double b)
+{
+	double difference = fmod(fabs(a - b), 360);
+	return fmin(difference, 360 - difference);
+}
+
+static int byValue(const void *a, const void *b)
+{
+	double difference = *(const double *) a - *(const double *) b;
+	return (difference > 0) - (difference < 0);
+}
+
+// Sorts the errors and prints their distribution
+static void printDistribution(const char *name, double *errors, int count)
+{
+	double sum = 0;
+
+	qsort(errors, count, sizeof(double), byValue);
+	for (int i = 0; i < count; i++)
+	{
+		sum += errors[i];
+	}
+	printf("%s: mean %.3g, median %.3g, 99%% %.3g, max %.3g\n", name, sum / count, errors[count / 2],
+		errors[(count * 99) / 100], errors[count - 1]);
+}
+
+static void testKernel(void)
+{
+	double worstSin = 0, worstAtan = 0, worstWrap = 0;
+	float angle;
+
+	for (angle = -20 * GEO_PI; angle <= 20 * GEO_PI; angle += 0.0007f)
+	{
+		float s, c;
+
+		Geo_SinCos(angle, &s, &c);
+		worstSin = fmax(worstSin, fmax(fabs(s - sin(angle)), fabs(c - cos(angle))));
+		// Either side of the -x axis is the same angle
+		worstAtan = fmax(worstAtan, fabs(remainder(Geo_Atan2(3 * s, 3 * c) - atan2(3.0 * s, 3.0 * c), 2 * PI)));
+	}
+	for (angle = -2000; angle <= 2000; angle += 0.37f)
+	{
+		double expected = fmod(fmod(angle, 360.0) + 360, 360);
+		double wrapped = Geo_WrapDegrees(angle);
+
+		CHECK((wrapped >= 0) && (wrapped < 360), "Geo_WrapDegrees(%g) = %g", angle, wrapped);
+		worstWrap = fmax(worstWrap, headingError(wrapped, expected));
+	}
+	printf("kernel: sincos worst %.2g, atan2 worst %.2g rad, wrap worst %.2g deg\n", worstSin, worstAtan, worstWrap);
+	CHECK(worstSin < 2e-6, "Geo_SinCos is %g off", worstSin);
+	CHECK(worstAtan < 2e-5, "Geo_Atan2 is %g off", worstAtan);
+	CHECK(worstWrap < 1e-4, "Geo_WrapDegrees is %g off", worstWrap);
+}
+
+// Every pose on the grid, through every triple
+static void testGrid(void)
+{
+	static double againstOld[MAX_GRID_POSES], againstTruth[MAX_GRID_POSES], oldAgainstTruth[MAX_GRID_POSES];
+	double worstHeading = 0;
+	int count = 0;
+	volatile double sink = 0;
+	clock_t start;
+	double floatTime, doubleTime;
+	int timed = 0;
+
+	for (double x = GRID_MARGIN; x <= FIELD_LENGTH - GRID_MARGIN; x += GRID_STEP)
+	{
+		for (double y = GRID_MARGIN; y <= FIELD_LENGTH - GRID_MARGIN; y += GRID_STEP)
+		{
+			for (double theta = 0; theta < 360; theta += HEADING_STEP)
+			{
+				for (int k = 0; (k < NUM_BEACONS) && (count < MAX_GRID_POSES); k++)
+				{
+					float A = periscopeAngle(x, y, theta, k);
+					float B = periscopeAngle(x, y, theta, PriorBeacons[k][0]);
+					float C = periscopeAngle(x, y, theta, PriorBeacons[k][1]);
+					float newX, newY, newTheta;
+					double oldX, oldY, oldTheta;
+
+					Triangulate_Triple(A, B, C, XShift[k], YShift[k], ThetaShift[k], &newX, &newY, &newTheta);
+					doubleTriple(A, B, C, XShift[k], YShift[k], ThetaShift[k], &oldX, &oldY, &oldTheta);
+
+					againstOld[count] = hypot(newX - oldX, newY - oldY);
+					againstTruth[count] = hypot(newX - x, newY - y);
+					oldAgainstTruth[count] = hypot(oldX - x, oldY - y);
+					worstHeading = fmax(worstHeading, headingError(newTheta, oldTheta));
+					CHECK(againstOld[count] < 1e-3, "(%g, %g, %g) triple %d: (%g, %g), double gave (%g, %g)", x, y, theta, k, newX, newY, oldX, oldY);
+					count++;
+				}
+			}
+		}
+	}
+	printf("grid: %d fixes, heading against double worst %.2g deg\n", count, worstHeading);
+	printDistribution("  position against double (in)", againstOld, count);
+	printDistribution("  position against truth (in)", againstTruth, count);
+	printDistribution("  double against truth (in)", oldAgainstTruth, count);
+	CHECK(worstHeading < 1e-3, "heading is %g deg off the double code", worstHeading);
+	CHECK(againstTruth[count - 1] < 2e-3, "a fix is %g in off the true pose", againstTruth[count - 1]);
+
+	start = clock();
+	for (int pass = 0; pass < 20; pass++)
+	{
+		for (double x = GRID_MARGIN; x <= FIELD_LENGTH - GRID_MARGIN; x += GRID_STEP)
+		{
+			for (double y = GRID_MARGIN; y <= FIELD_LENGTH - GRID_MARGIN; y += GRID_STEP)
+			{
+				float outX, outY, outTheta;
+				timed++;
+				Triangulate_Triple(x, y, x + y, 0, FIELD_LENGTH, 270, &outX, &outY, &outTheta);
+				sink = outX + outY + outTheta;
+			}
+		}
+	}
+	floatTime = (double) (clock() - start) / CLOCKS_PER_SEC;
+	start = clock();
+	for (int pass = 0; pass < 20; pass++)
+	{
+		for (double x = GRID_MARGIN; x <= FIELD_LENGTH - GRID_MARGIN; x += GRID_STEP)
+		{
+			for (double y = GRID_MARGIN; y <= FIELD_LENGTH - GRID_MARGIN; y += GRID_STEP)
+			{
+				double outX, outY, outTheta;
+				doubleTriple(x, y, x + y, 0, FIELD_LENGTH, 270, &outX, &outY, &outTheta);
+				sink = outX + outY + outTheta;
+			}
+		}
+	}
+	doubleTime = (double) (clock() - start) / CLOCKS_PER_SEC;
+	(void) sink;
+	printf("cost: float %.0f ns, double %.0f ns per fix (host)\n", floatTime * 1e9 / timed, doubleTime * 1e9 / timed);
+}
+
+// What the periscope and odometry report at (x, y, theta) if we saw the
+// newest beacon now and each one before it a step earlier, moving forward and
+// turning by the given amounts per step. badBeacon (or -1) is off by BAD_BEARING
+static void sight(double x, double y, double theta, int newest, double forwardStep, double turnStep, int badBeacon,
+	float *angles, BeaconSighting *sightings)
+{
+	for (int steps = 0; steps < NUM_BEACONS; steps++)
+	{
+		int k = (newest + steps) % NUM_BEACONS;
+		double seenTheta = theta - (steps * turnStep);
+		double heading = (theta - (steps * turnStep / 2)) * PI / 180;
+		double movedX = steps * forwardStep * cos(heading);
+		double movedY = steps * forwardStep * sin(heading);
+		double angle = periscopeAngle(x - movedX, y - movedY, seenTheta, k) + (BEARING_NOISE * gauss());
+
+		angles[k] = wrapDegrees(angle + ((k == badBeacon) ? BAD_BEARING : 0));
+		// As GatherSightings works it out
+		sightings[k].forward = (movedX * cos(theta * PI / 180)) + (movedY * sin(theta * PI / 180));
+		sightings[k].left = (movedY * cos(theta * PI / 180)) - (movedX * sin(theta * PI / 180));
+		sightings[k].turned = steps * turnStep;
+	}
+}
+
+// The three-beacon triple that skips the given beacon, or the four-beacon
+// triple ending in the newest, as CalculateAbsolutePosition picks them
+static void triple(const float *angles, int first, float *x, float *y, float *theta)
+{
+	Triangulate_Triple(angles[first], angles[PriorBeacons[first][0]], angles[PriorBeacons[first][1]],
+		XShift[first], YShift[first], ThetaShift[first], x, y, theta);
+}
+
+// Noisy fixes over a grid of poses, moving the given amount between sightings
+static void testNoisy(const char *name, double forwardStep, double turnStep)
+{
+	static const float FloatBeaconX[NUM_BEACONS] = {0, FIELD_LENGTH, FIELD_LENGTH, 0};
+	static const float FloatBeaconY[NUM_BEACONS] = {FIELD_LENGTH, FIELD_LENGTH, 0, 0};
+	static double tripleErrors[NOISY_GRID_POSES], threeErrors[NOISY_GRID_POSES], fourErrors[NOISY_GRID_POSES];
+	static double fourHeadings[NOISY_GRID_POSES];
+	int count = 0, accepted = 0, threeAccepted = 0, badRejected = 0;
+	double step = (FIELD_LENGTH - (2 * GRID_MARGIN)) / (NOISY_GRID_SIDE - 1);
+
+	srand(32);
+	for (int i = 0; i < NOISY_GRID_SIDE; i++)
+	{
+		for (int j = 0; j < NOISY_GRID_SIDE; j++)
+		{
+			for (int h = 0; h < NOISY_GRID_HEADINGS; h++)
+			{
+				double x = GRID_MARGIN + (i * step);
+				double y = GRID_MARGIN + (j * step);
+				double theta = h * 360.0 / NOISY_GRID_HEADINGS;
+				int newest = rand() % NUM_BEACONS;
+				int missing = rand() % NUM_BEACONS;
+				float angles[NUM_BEACONS];
+				BeaconSighting sightings[NUM_BEACONS];
+				float fixX, fixY, fixTheta;
+				float residual;
+
+				// Four fresh: the triple ending in the newest, refined over all four
+				sight(x, y, theta, newest, forwardStep, turnStep, -1, angles, sightings);
+				triple(angles, newest, &fixX, &fixY, &fixTheta);
+				tripleErrors[count] = hypot(fixX - x, fixY - y);
+				residual = Triangulate_Refine(0xf, angles, sightings, FloatBeaconX, FloatBeaconY, &fixX, &fixY, &fixTheta);
+				if (residual <= MAX_BEACON_RESIDUAL)
+				{
+					fourErrors[accepted] = hypot(fixX - x, fixY - y);
+					fourHeadings[accepted] = headingError(fixTheta, theta);
+					accepted++;
+				}
+
+				// Three fresh: the triple that skips the missing beacon, refined over
+				//  those three. They fit exactly, unless the refinement failed
+				triple(angles, (missing + 1) % NUM_BEACONS, &fixX, &fixY, &fixTheta);
+				residual = Triangulate_Refine(0xf & ~(1 << missing), angles, sightings, FloatBeaconX, FloatBeaconY, &fixX, &fixY, &fixTheta);
+				if (residual <= MAX_BEACON_RESIDUAL)
+				{
+					threeErrors[threeAccepted++] = hypot(fixX - x, fixY - y);
+				}
+
+				// Four fresh, one of them wrong
+				sight(x, y, theta, newest, forwardStep, turnStep, missing, angles, sightings);
+				triple(angles, newest, &fixX, &fixY, &fixTheta);
+				residual = Triangulate_Refine(0xf, angles, sightings, FloatBeaconX, FloatBeaconY, &fixX, &fixY, &fixTheta);
+				badRejected += !(residual <= MAX_BEACON_RESIDUAL);
+				count++;
+			}
+		}
+	}
+
+	printf("%s: %d poses, %.1f in and %.1f deg between sightings, %.1f deg noise\n", name, count, forwardStep, turnStep, BEARING_NOISE);
+	printDistribution("  triple alone (in)", tripleErrors, count);
+	printDistribution("  three refined (in)", threeErrors, threeAccepted);
+	printDistribution("  four refined (in)", fourErrors, accepted);
+	printDistribution("  four refined heading (deg)", fourHeadings, accepted);
+	printf("  rejected %.1f%% of three beacon fixes; %.1f%% of four, %.1f%% with one bearing %.0f deg off\n",
+		100.0 * (count - threeAccepted) / count, 100.0 * (count - accepted) / count, 100.0 * badRejected / count, BAD_BEARING);
+
+	CHECK(fourErrors[accepted / 2] < tripleErrors[count / 2], "four refined beacons are no better than a triple");
+	CHECK(threeErrors[threeAccepted / 2] <= tripleErrors[count / 2], "refining three beacons is no better than a triple");
+	CHECK(fourErrors[(accepted * 99) / 100] < 3.0, "four beacon fixes are %g in off", fourErrors[(accepted * 99) / 100]);
+	CHECK(count - accepted <= count / 25, "%d clean four beacon fixes rejected", count - accepted);
+	CHECK(count - threeAccepted <= count / 25, "%d clean three beacon fixes rejected", count - threeAccepted);
+	CHECK(badRejected >= count / 2, "only %d fixes with a bad bearing rejected", badRejected);
+}
+
+// Fixes per periscope revolution, sweeping the beacons in order and missing some
+static void testLatency(void)
+{
+	int lastSeen[NUM_BEACONS];
+	int oldFixes = 0, newFixes = 0;
+	int run = 0;
+
+	srand(33);
+	for (int k = 0; k < NUM_BEACONS; k++)
+	{
+		lastSeen[k] = -SWEEP_SIGHTINGS;
+	}
+	for (int sighting = 0; sighting < SWEEP_SIGHTINGS; sighting++)
+	{
+		int k = sighting % NUM_BEACONS;
+		int fresh = 0;
+
+		if ((rand() / (double) RAND_MAX) < MISSED_SIGHTING)
+		{
+			// A miss breaks the run of beacons in order
+			run = 0;
+			continue;
+		}
+		lastSeen[k] = sighting;
+
+		// Old: the beacon and the two before it, seen in order since the last fix
+		if (++run >= 3)
+		{
+			oldFixes++;
+			run = 0;
+		}
+
+		// New: a fix on every beacon while any three are fresh
+		for (int b = 0; b < NUM_BEACONS; b++)
+		{
+			fresh += (sighting - lastSeen[b]) < (BEACON_MAX_AGE_REVS * NUM_BEACONS);
+		}
+		newFixes += (fresh >= 3);
+	}
+	printf("latency: %.0f%% of sightings missed; old rule %.2f, any three fresh %.2f fixes per revolution\n",
+		100 * MISSED_SIGHTING, oldFixes * (double) NUM_BEACONS / SWEEP_SIGHTINGS, newFixes * (double) NUM_BEACONS / SWEEP_SIGHTINGS);
+	CHECK(newFixes > 2 * oldFixes, "any three fresh gives %d fixes, the old rule %d", newFixes, oldFixes);
+}
+
+// Host cost of a triple alone and of a triple refined over four beacons
+static void testRefineCost(void)
+{
+	static const float FloatBeaconX[NUM_BEACONS] = {0, FIELD_LENGTH, FIELD_LENGTH, 0};
+	static const float FloatBeaconY[NUM_BEACONS] = {FIELD_LENGTH, FIELD_LENGTH, 0, 0};
+	volatile float sink = 0;
+	float angles[NUM_BEACONS];
+	BeaconSighting sightings[NUM_BEACONS];
+	clock_t start;
+	double tripleTime, refineTime;
+	int timed = 0;
+
+	srand(34);
+	sight(30, 50, 20, 0, 1.5, 3, -1, angles, sightings);
+	start = clock();
+	for (timed = 0; timed < 200000; timed++)
+	{
+		float x, y, theta;
+		triple(angles, timed % NUM_BEACONS, &x, &y, &theta);
+		sink = x + y + theta;
+	}
+	tripleTime = (double) (clock() - start) / CLOCKS_PER_SEC;
+	start = clock();
+	for (timed = 0; timed < 200000; timed++)
+	{
+		float x, y, theta;
+		triple(angles, timed % NUM_BEACONS, &x, &y, &theta);
+		sink = Triangulate_Refine(0xf, angles, sightings, FloatBeaconX, FloatBeaconY, &x, &y, &theta) + x + y + theta;
+	}
+	refineTime = (double) (clock() - start) / CLOCKS_PER_SEC;
+	(void) sink;
+	printf("cost: triple %.0f ns, triple and refine %.0f ns per fix (host)\n", tripleTime * 1e9 / timed, refineTime * 1e9 / timed);
+}
+
+int main(void)
+{
+	testKernel();
+	testGrid();
+	testNoisy("standing", 0, 0);
+	testNoisy("driving", 1.5, 3);
+	testLatency();
+	testRefineCost();
+	return TEST_RESULT();
+}
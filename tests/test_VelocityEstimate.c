@@ -0,0 +1,126 @@
+/****************************************************************************
+ Host test of VelocityEstimate.c against a synthetic encoder: a drive wheel
+ with five unevenly spaced magnets, a 40 MHz capture timer and the drive's
+ 2 ms control loop and estimator settings (DriveTrainControl_Service.c).
+****************************************************************************/
+#include <math.h>
+#include "VelocityEstimate.h"
+#include "test.h"
+
+#define TICKS_PER_SEC 40000000.0
+#define CONTROL_PERIOD 0.002
+#define STEP 1e-6
+
+// As in DriveTrainControl_Service.c
+#define GEAR_RATIO 50
+#define PULSES_PER_REV 5
+#define RPM_NUMERATOR 9600000ul
+#define RPM_HEADROOM 8
+#define WINDOW_TICKS (12 * 40000ul)
+#define STALE_TICKS (100 * 40000ul)
+
+// Each magnet's share of the mean angle between them (+/-5%)
+static const double Spacing[PULSES_PER_REV] = {1.04, 0.97, 1.02, 0.95, 1.02};
+
+typedef struct {
+	double rms;				// RMS error while the wheel turns at a constant speed
+	double stopTime;	// seconds after the wheel stops until we read under 10% of the speed
+} Result;
+
+// Runs the wheel at rpm for half a second, then stops it dead. maxIntervals 1
+// is the old estimate from the last two edges. start offsets the capture timer
+static Result run(double rpm, uint8_t maxIntervals, uint32_t start)
+{
+	VelocityEstimate estimate;
+	Result result = {0, -1};
+	double pulses = 0;
+	double nextEdge = Spacing[0];
+	double nextControl = 0;
+	double squares = 0;
+	int samples = 0;
+	int edges = 0;
+	double t;
+
+	VelocityEstimate_Init(&estimate, RPM_NUMERATOR, RPM_HEADROOM, maxIntervals, WINDOW_TICKS, STALE_TICKS);
+	for (t = 0; t < 1.0; t += STEP)
+	{
+		double speed = (t < 0.5) ? rpm : 0;
+		uint32_t now = start + (uint32_t) (t * TICKS_PER_SEC);
+
+		pulses += speed / 60 * GEAR_RATIO * PULSES_PER_REV * STEP;
+		if (pulses >= nextEdge)
+		{
+			VelocityEstimate_Edge(&estimate, now);
+			edges++;
+			nextEdge += Spacing[edges % PULSES_PER_REV];
+		}
+		if (t >= nextControl)
+		{
+			double reading = Q16_TO_FLOAT(VelocityEstimate_RPM(&estimate, now));
+
+			nextControl += CONTROL_PERIOD;
+			if ((t > 0.1) && (t < 0.5))
+			{
+				squares += (reading - rpm) * (reading - rpm);
+				samples++;
+			}
+			if ((t >= 0.5) && (result.stopTime < 0) && (reading < 0.1 * rpm))
+			{
+				result.stopTime = t - 0.5;
+			}
+		}
+	}
+	result.rms = sqrt(squares / samples);
+	return result;
+}
+
+static void testSteadySpeed(void)
+{
+	Result twoEdge = run(100, 1, 0);
+	Result ring = run(100, PULSES_PER_REV, 0);
+
+	printf("100 RPM: rms %.2f RPM from two edges, %.2f from the ring\n", twoEdge.rms, ring.rms);
+	CHECK(twoEdge.rms > 2.0, "uneven magnets should make two-edge timing noisy (rms %g)", twoEdge.rms);
+	CHECK(ring.rms < 0.5, "a turn's worth of edges should cancel the magnet spacing (rms %g)", ring.rms);
+}
+
+static void testStop(void)
+{
+	Result fast = run(100, PULSES_PER_REV, 0);
+	Result slow = run(30, PULSES_PER_REV, 0);
+
+	printf("stopped reads under 10%% after %.1f ms from 100 RPM, %.1f ms from 30 RPM\n", fast.stopTime * 1000, slow.stopTime * 1000);
+	CHECK((fast.stopTime >= 0) && (fast.stopTime < 0.03), "stopping from 100 RPM took %g s to read", fast.stopTime);
+	CHECK((slow.stopTime >= 0) && (slow.stopTime < 0.1), "stopping from 30 RPM took %g s to read", slow.stopTime);
+}
+
+// The capture timer wraps every 107 s; start just before it does
+static void testTimerWrap(void)
+{
+	Result wrapped = run(100, PULSES_PER_REV, 0xffffffff - (uint32_t) (0.3 * TICKS_PER_SEC));
+
+	CHECK(wrapped.rms < 0.5, "the estimate should ride through the capture timer wrapping (rms %g)", wrapped.rms);
+}
+
+static void testTooFewEdges(void)
+{
+	VelocityEstimate estimate;
+
+	VelocityEstimate_Init(&estimate, RPM_NUMERATOR, RPM_HEADROOM, PULSES_PER_REV, WINDOW_TICKS, STALE_TICKS);
+	CHECK(VelocityEstimate_RPM(&estimate, 1000) == 0, "no edges should read zero");
+	VelocityEstimate_Edge(&estimate, 1000);
+	CHECK(VelocityEstimate_RPM(&estimate, 2000) == 0, "one edge should read zero");
+	VelocityEstimate_Edge(&estimate, 97000);
+	CHECK(fabs(Q16_TO_FLOAT(VelocityEstimate_RPM(&estimate, 97000)) - 100) < 0.01, "two edges 2.4 ms apart should read 100 RPM");
+	VelocityEstimate_Reset(&estimate);
+	CHECK(VelocityEstimate_RPM(&estimate, 97000) == 0, "a reset should read zero");
+}
+
+int main(void)
+{
+	testSteadySpeed();
+	testStop();
+	testTimerWrap();
+	testTooFewEdges();
+	return TEST_RESULT();
+}